@@ -36,14 +36,15 @@
 #define LIO_IO_ALISTIO          00010   /* single stride async listio */
 #define LIO_IO_SYNCV            00020   /* single-buffer readv/writev */
 #define LIO_IO_SYNCP            00040   /* pread/pwrite */
+#define LIO_IO_URING            00100   /* io_uring readv/writev */
 
 #ifdef sgi
 #define LIO_IO_ATYPES           00077   /* all io types */
 #define LIO_IO_TYPES            00061   /* all io types, non-async */
 #endif /* sgi */
 #if defined(__linux__) && !defined(__UCLIBC__)
-#define LIO_IO_TYPES            00061   /* all io types */
-#define LIO_IO_ATYPES           00077   /* all io types */
+#define LIO_IO_TYPES            00161   /* all io types */
+#define LIO_IO_ATYPES           00177   /* all io types */
 #endif
 #if defined(__sun) || defined(__hpux) || defined(_AIX) || defined(__UCLIBC__)
 #define LIO_IO_TYPES            00021   /* all io types except pread/pwrite */
@@ -64,7 +65,8 @@
 #if defined(sgi) || defined(__linux__)
 #define LIO_WAIT_CBSUSPEND      00400000 /* aio_suspend waiting for callback */
 #define LIO_WAIT_SIGSUSPEND     01000000 /* aio_suspend waiting for signal */
-#define LIO_WAIT_ATYPES         01760000 /* all async wait types, except nowait */
+#define LIO_WAIT_EVENTFD        02000000 /* read(2) an eventfd registered with io_uring */
+#define LIO_WAIT_ATYPES         03760000 /* all async wait types, except nowait */
 #define LIO_WAIT_TYPES          00020000 /* all sync wait types (sorta) */
 #endif /* sgi */
 #if defined(__sun) || defined(__hpux) || defined(_AIX)
@@ -130,6 +132,24 @@ int  lio_write_buffer(int fd, int method, char *buffer, int size,
 
 int  lio_read_buffer(int fd, int method, char *buffer, int size,
 		     int sig, char **errmsg, long wrd);
+
+/*
+ * One entry of a lio_write_buffers()/lio_read_buffers() batch.
+ * An offset of -1 means "right after the previous entry" (the current
+ * file offset for the first one).  ret is set to the number of bytes
+ * transferred for the entry or to -errno if it failed.
+ */
+struct lio_buf {
+    char  *buffer;
+    off_t offset;
+    int   size;
+    int   ret;
+};
+
+int  lio_write_buffers(int fd, int method, struct lio_buf *bufs, int nbufs,
+		       int sig, char **errmsg, long wrd);
+int  lio_read_buffers(int fd, int method, struct lio_buf *bufs, int nbufs,
+		      int sig, char **errmsg, long wrd);
 int  lio_random_methods(long mask);
 
 #if CRAY
@@ -50,7 +50,9 @@
  *    DESCRIPTION
  * 	TEST(SCALL) - calls a system call
  *	TEST_VOID(SCALL) - same as TEST() but for syscalls with no return value.
- *	TEST_CLEANUP - print the log of errno return counts if STD_ERRNO_LOG
+ *	TEST_CLEANUP - print the per call latency summary if STD_TIMING_ON,
+ *		       the per copy and aggregate summary of -c copies
+ *		       and the log of errno return counts if STD_ERRNO_LOG
  *		       is set.
  *	TEST_PAUSEF(HAND) - Pause for SIGUSR1 if the pause flag is set.
  *		      Use "hand" as the interrupt handling function
@@ -91,6 +93,7 @@
 #endif
 
 #include <sys/param.h>
+#include <stdint.h>
 
 /*
  * Ensure that PATH_MAX is defined
@@ -198,19 +201,35 @@ extern void STD_go();
 extern int (*_TMP_FUNC)(void);
 extern void STD_opts_help();
 
+/*
+ * Per call timing used by TEST()/TEST_VOID() when STD_TIMING_ON is set,
+ * see parse_opts.c.
+ */
+extern uint64_t usc_timing_start(void);
+extern void usc_timing_record(uint64_t start);
+extern void usc_cleanup_hook(void);
+
 
 /***********************************************************************
  * TEST: calls a system call
  *
+ * If STD_TIMING_ON is set the time spent in SCALL is added to the
+ * per call latency histogram reported by TEST_CLEANUP.
+ *
  * parameters:
  *	SCALL = system call and parameters to execute
  *
  ***********************************************************************/
 #define TEST(SCALL) \
 	do { \
+		uint64_t _usc_start = 0; \
+		if (STD_TIMING_ON) \
+			_usc_start = usc_timing_start(); \
 		errno = 0; \
 		TEST_RETURN = SCALL; \
 		TEST_ERRNO = errno; \
+		if (STD_TIMING_ON) \
+			usc_timing_record(_usc_start); \
 	} while (0)
 
 /***********************************************************************
@@ -225,11 +244,23 @@ extern void STD_opts_help();
  * errors.
  *
  ***********************************************************************/
-#define TEST_VOID(SCALL) do { errno = 0; SCALL; TEST_ERRNO = errno; } while (0)
+#define TEST_VOID(SCALL) \
+	do { \
+		uint64_t _usc_start = 0; \
+		if (STD_TIMING_ON) \
+			_usc_start = usc_timing_start(); \
+		errno = 0; \
+		SCALL; \
+		TEST_ERRNO = errno; \
+		if (STD_TIMING_ON) \
+			usc_timing_record(_usc_start); \
+	} while (0)
 
 /***********************************************************************
  * TEST_CLEANUP: print system call timing stats and errno log entries
  * to stdout if STD_TIMING_ON and STD_ERRNO_LOG are set, respectively.
+ * With -c the parent waits for the other copies and prints their
+ * iteration counts, throughput and fairness.
  * Do NOT print ANY information if no system calls logged.
  *
  * parameters:
@@ -239,6 +270,7 @@ extern void STD_opts_help();
 #define TEST_CLEANUP \
 do { \
 	int i; \
+	usc_cleanup_hook(); \
 	if (!STD_ERRNO_LOG) \
 		break; \
 	for (i = 0; i < USC_MAX_ERRNO; ++i) { \
@@ -60,14 +60,16 @@
  *      associated with the options.  It uses getopt to do the actual cmd line
  *      parsing.  uhf() is a function to print user define help
  *
- *      This module contains the functions usc_global_setup_hook and
- *      usc_test_looping, which are called by marcos defined in usctest.h.
+ *      This module contains the functions usc_global_setup_hook,
+ *      usc_test_looping and the usc_timing_* functions, which are called
+ *      by marcos defined in usctest.h.
  *
  *    RETURN VALUE
  * 	parse_opts returns a pointer to an error message if an error occurs.
  *	This pointer is (char *)NULL if parsing is successful.
  *
  *#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#*#**/
+#define _GNU_SOURCE
 #include "config.h"
 #include <errno.h>
 #include <stdlib.h>
@@ -77,11 +79,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <stdint.h>
-
-#if UNIT_TEST
 #include <time.h>
-#endif /* UNIT_TEST */
+#include <sched.h>
 
 #include "test.h"
 #define _USC_LIB_   1		/* indicates we are the library to the usctest.h include */
@@ -91,6 +93,18 @@
 #define USC_COPIES   "USC_COPIES"
 #endif
 
+#ifndef USC_TIMING
+#define USC_TIMING   "USC_TIMING"
+#endif
+
+#ifndef USC_PIN
+#define USC_PIN      "USC_PIN"
+#endif
+
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW	4
+#endif
+
 #ifndef UNIT_TEST
 #define UNIT_TEST	0
 #endif
@@ -99,9 +113,60 @@
 #define DEBUG	0
 #endif
 
-/* The timing information block. */
+/* The timing information block, in nanoseconds. */
 struct tblock tblock = { 0, ((long)-1) >> 1, 0, 0 };
 
+/*
+ * Per call latency histogram filled by TEST()/TEST_VOID() when
+ * STD_TIMING_ON is set.  The buckets are log-linear with
+ * USC_HIST_SUB_BITS sub buckets per power of two, so any latency is
+ * accounted with about 6% resolution.  Values are in clock ticks,
+ * nanoseconds unless the TSC is used.
+ */
+#define USC_HIST_SUB_BITS	4
+#define USC_HIST_BUCKETS	1024
+
+struct usc_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[USC_HIST_BUCKETS];
+};
+
+static struct usc_hist STD_hist;
+static int STD_timing_tsc = 0;	/* USC_TIMING=tsc: time with rdtsc */
+static uint64_t STD_tsc_base, STD_ns_base;	/* TSC calibration start */
+
+/*
+ * With -c the copies share this region.  The parent (copy 0) forks the
+ * others, which pin themselves if USC_PIN is set and wait until the
+ * parent releases them all at once.  Every copy publishes its
+ * iteration count and latency histogram in its slot, the parent
+ * collects them in TEST_CLEANUP.
+ */
+struct usc_copy {
+	pid_t pid;
+	int cpu;		/* cpu the copy is pinned to, -1 if none */
+	int iterations;		/* TEST_LOOPING iterations done */
+	uint64_t stop;		/* ns when TEST_LOOPING ended, 0 if running */
+	struct usc_hist hist;
+};
+
+struct usc_copies {
+	int ncopies;		/* copies actually forked, parent included */
+	volatile int arrived;	/* copies waiting at the start barrier */
+	volatile int go;	/* set by the parent to release them */
+	uint64_t start;		/* ns when the copies were released */
+	struct usc_copy copy[];
+};
+
+static struct usc_copies *STD_copies_shm = NULL;
+static int STD_copy = 0;	/* index of this copy, 0 is the parent */
+static int STD_pin = 0;		/* USC_PIN: pin copy n to the n-th cpu */
+
+static uint64_t usc_ns_now(void);
+
 #ifdef GARRETT_IS_A_PEDANTIC_BASTARD
 extern pid_t spawned_program_pid;
 #endif
@@ -149,7 +214,8 @@ struct std_option_t {
 	char **arg;
 } std_options[] = {
 	{
-	"c:", "  -c n    Run n copies concurrently\n", NULL, NULL}, {
+	"c:", "  -c n    Run n copies concurrently, released together "
+		    "(USC_PIN=1 pins them to cpus)\n", NULL, NULL}, {
 	"e", "  -e      Turn on errno logging\n", NULL, NULL}, {
 	"f", "  -f      Turn off functional testing\n", NULL, NULL}, {
 	"h", "  -h      Show this help screen\n", NULL, NULL}, {
@@ -158,7 +224,8 @@ struct std_option_t {
 	"p", "  -p      Pause for SIGUSR1 before starting\n", NULL, NULL}, {
 	"P:", "  -P x    Pause for x seconds between iterations\n", NULL, NULL},
 	{
-	"t", "  -t      Turn on syscall timing\n", NULL, NULL},
+	"t", "  -t      Turn on syscall timing (per call latency histogram)\n",
+		    NULL, NULL},
 #ifdef UCLINUX
 	{
 	"C:",
@@ -200,6 +267,7 @@ static void usc_recressive_func();
 #define  OPT_duration		04
 #define  OPT_delay		010
 #define  OPT_copies		020
+#define  OPT_timing		040
 
 #ifdef UCLINUX
 /* Allocated and used in self_exec.c: */
@@ -305,11 +373,12 @@ char *parse_opts(int ac, char **av, const option_t * user_optarr,
 			fprintf(stderr,
 				"WARNING * WARNING * WARNING * WARNING * "
 				"WARNING * WARNING * WARNING * WARNING\n\n"
-				"The -c option is broken by desing. See:\n\n"
+				"The copies share the test setup (temporary "
+				"directory, files, ipc keys). See:\n\n"
 				"http://www.mail-archive.com/"
 				"ltp-list@lists.sourceforge.net/msg13418.html\n"
-				"\nIn short don't use it in runtest files "
-				"as the option will be removed.\n\n"
+				"\nIn short use it for scalability runs of "
+				"tests that tolerate it, not in runtest files.\n\n"
 				"WARNING * WARNING * WARNING * WARNING * "
 				"WARNING * WARNING * WARNING * WARNING\n\n");
 			options |= OPT_copies;
@@ -322,6 +391,7 @@ char *parse_opts(int ac, char **av, const option_t * user_optarr,
 			STD_PAUSE = 1;
 			break;
 		case 't':	/* syscall timing */
+			options |= OPT_timing;
 			STD_TIMING_ON = 1;
 			break;
 		case 'e':	/* errno loggin */
@@ -486,6 +556,35 @@ char *parse_opts(int ac, char **av, const option_t * user_optarr,
 		}
 	}
 
+	/*
+	 * If the USC_TIMING environmental variable is set, turn on syscall
+	 * timing (same as -t option).  A value of "tsc" times the calls
+	 * with the time stamp counter instead of CLOCK_MONOTONIC_RAW.
+	 */
+	if ((ptr = getenv(USC_TIMING)) != NULL) {
+		if (!(options & OPT_timing))
+			STD_TIMING_ON = strcmp(ptr, "0") != 0;
+#if defined(__i386__) || defined(__x86_64__)
+		STD_timing_tsc = strcmp(ptr, "tsc") == 0;
+#endif
+		if (Debug)
+			printf("Using env %s, set STD_TIMING_ON to %d%s\n",
+			       USC_TIMING, STD_TIMING_ON,
+			       STD_timing_tsc ? " (tsc)" : "");
+	}
+
+	/*
+	 * If the USC_PIN environmental variable is set, each of the -c
+	 * copies is pinned to its own cpu (wrapping around the allowed
+	 * cpus if there are more copies than cpus).
+	 */
+	if ((ptr = getenv(USC_PIN)) != NULL) {
+		STD_pin = strcmp(ptr, "0") != 0;
+		if (Debug)
+			printf("Using env %s, set STD_pin to %d\n", USC_PIN,
+			       STD_pin);
+	}
+
 	/*
 	 * The following are special system testing envs to turn on special
 	 * hooks in the code.
@@ -637,38 +736,145 @@ void STD_go(int sig)
 	return;
 }
 
-/***********************************************************************
- * This function will do desired end of global setup test
- * hooks.
- * Currently it will only do a pause waiting for sigusr1 if
- * STD_PAUSE is set.
- *
- ***********************************************************************/
-int usc_global_setup_hook()
-{
 #ifndef UCLINUX
-	int cnt;
-	/* temp variable to store old signal action to be restored after pause */
-	int (*_TMP_FUNC) (void);
+/*
+ * Pin this copy to the STD_copy-th cpu of the allowed set.
+ */
+static int usc_pin_copy(const cpu_set_t * allowed)
+{
+	cpu_set_t set;
+	int cpu, n = 0, want;
+
+	want = STD_copy % CPU_COUNT(allowed);
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, allowed))
+			continue;
+		if (n++ == want)
+			break;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+		fprintf(stderr, "%s: sched_setaffinity(cpu %d) failed: %d - %s\n",
+			__FILE__, cpu, errno, strerror(errno));
+		return -1;
+	}
+
+	return cpu;
+}
+
+/*
+ * Fork STD_COPIES-1 copies sharing STD_copies_shm and release them
+ * together once they all reached the barrier.
+ */
+static void usc_fork_copies(void)
+{
+	struct usc_copies *shm;
+	cpu_set_t allowed;
+	size_t size;
+	pid_t pid;
+	int cnt, forked = 0, spin, status;
+
+	size = sizeof(*shm) + STD_COPIES * sizeof(struct usc_copy);
+	shm = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shm == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap of %zu bytes failed: %d - %s\n",
+			__FILE__, size, errno, strerror(errno));
+		shm = NULL;
+	} else {
+		memset(shm, 0, size);
+	}
+
+	if (STD_pin && sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+		fprintf(stderr, "%s: sched_getaffinity failed: %d - %s\n",
+			__FILE__, errno, strerror(errno));
+		STD_pin = 0;
+	}
 
 	/*
-	 * Fork STD_COPIES-1 copies.
+	 * The copies spin at the barrier, but give the cpu away if there
+	 * are more of them than cpus.
 	 */
+	spin = STD_COPIES <= sysconf(_SC_NPROCESSORS_ONLN);
+
 	for (cnt = 1; cnt < STD_COPIES; cnt++) {
-		switch (fork()) {
+		switch (pid = fork()) {
 		case -1:
 			fprintf(stderr, "%s: fork failed: %d - %s\n",
 				__FILE__, errno, strerror(errno));
 			break;
 		case 0:	/* child */
-			cnt = STD_COPIES;	/* to stop the forking */
-			break;
+			STD_copy = forked + 1;
+			STD_copies_shm = shm;
+			if (shm == NULL)
+				return;
+			shm->copy[STD_copy].pid = getpid();
+			shm->copy[STD_copy].cpu =
+			    STD_pin ? usc_pin_copy(&allowed) : -1;
+			__sync_fetch_and_add(&shm->arrived, 1);
+			while (!shm->go) {
+				if (!spin)
+					sched_yield();
+			}
+			return;
 
 		default:	/* parent */
+			forked++;
+			if (shm != NULL)
+				shm->copy[forked].pid = pid;
 			break;
 		}
 	}
 
+	if (shm == NULL)
+		return;
+
+	STD_copies_shm = shm;
+	shm->ncopies = forked + 1;
+	shm->copy[0].pid = getpid();
+	shm->copy[0].cpu = STD_pin ? usc_pin_copy(&allowed) : -1;
+
+	/* a copy dying before the barrier would keep us here forever */
+	while (shm->arrived < forked) {
+		pid = waitpid(-1, &status, WNOHANG);
+		if (pid > 0) {
+			for (cnt = 1; cnt <= forked; cnt++)
+				kill(shm->copy[cnt].pid, SIGKILL);
+			while (wait(NULL) > 0 || errno == EINTR) ;
+			tst_brkm(TBROK, NULL, "COPIES: copy pid %d exited "
+				 "before the start barrier", pid);
+		}
+		sched_yield();
+	}
+
+	shm->start = usc_ns_now();
+	__sync_synchronize();
+	shm->go = 1;
+}
+#endif
+
+/***********************************************************************
+ * This function will do desired end of global setup test
+ * hooks.
+ * It forks the -c copies, which are released together by a shared
+ * memory barrier, and does a pause waiting for sigusr1 if STD_PAUSE
+ * is set.
+ *
+ ***********************************************************************/
+int usc_global_setup_hook()
+{
+#ifndef UCLINUX
+	/* temp variable to store old signal action to be restored after pause */
+	int (*_TMP_FUNC) (void);
+
+	/*
+	 * Fork STD_COPIES-1 copies.
+	 */
+	if (STD_COPIES > 1)
+		usc_fork_copies();
+
 	/*
 	 * pause waiting for sigusr1.
 	 */
@@ -696,15 +902,287 @@ int usc_global_setup_hook()
 #define USECS_PER_SEC	1000000	/* microseconds per second */
 
 /***********************************************************************
- * Returns current time in microseconds since 1970.
+ * Returns current time in microseconds, from a clock that is not
+ * stepped by settimeofday() or NTP so that -I and -P are exact.
  ***********************************************************************/
 static uint64_t get_current_time(void)
 {
-	struct timeval curtime;
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+		struct timeval curtime;
+
+		gettimeofday(&curtime, NULL);
+		return (((uint64_t) curtime.tv_sec) * USECS_PER_SEC) +
+		    curtime.tv_usec;
+	}
+
+	return (((uint64_t) ts.tv_sec) * USECS_PER_SEC) + ts.tv_nsec / 1000;
+}
+
+static uint64_t usc_ns_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC_RAW, &ts) == -1)
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+static inline uint64_t usc_rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	__asm__ __volatile__("rdtsc":"=a"(lo), "=d"(hi));
+	return ((uint64_t) hi << 32) | lo;
+}
+#else
+#define usc_rdtsc()	usc_ns_now()
+#endif
+
+static unsigned int usc_hist_bucket(uint64_t v)
+{
+	unsigned int msb, b;
+
+	if (v < (1 << USC_HIST_SUB_BITS))
+		return v;
+
+	msb = 63 - __builtin_clzll(v);
+	b = ((msb - USC_HIST_SUB_BITS + 1) << USC_HIST_SUB_BITS) +
+	    ((v >> (msb - USC_HIST_SUB_BITS)) & ((1 << USC_HIST_SUB_BITS) - 1));
+
+	return b < USC_HIST_BUCKETS ? b : USC_HIST_BUCKETS - 1;
+}
+
+/* Lower bound of the values accounted in bucket b */
+static uint64_t usc_hist_value(unsigned int b)
+{
+	unsigned int msb;
 
-	gettimeofday(&curtime, NULL);
+	if (b < (1 << USC_HIST_SUB_BITS))
+		return b;
 
-	return (((uint64_t) curtime.tv_sec) * USECS_PER_SEC) + curtime.tv_usec;
+	msb = (b >> USC_HIST_SUB_BITS) - 1 + USC_HIST_SUB_BITS;
+	return (uint64_t)((b & ((1 << USC_HIST_SUB_BITS) - 1)) |
+			  (1 << USC_HIST_SUB_BITS)) << (msb - USC_HIST_SUB_BITS);
+}
+
+static uint64_t usc_hist_percentile(const struct usc_hist *h, double pct)
+{
+	uint64_t target, seen = 0, v;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+
+	target = (uint64_t)(h->count * pct / 100.0);
+	if (target == 0)
+		target = 1;
+
+	for (i = 0; i < USC_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= target) {
+			v = usc_hist_value(i);
+			if (v < h->min)
+				v = h->min;
+			return v > h->max ? h->max : v;
+		}
+	}
+
+	return h->max;
+}
+
+/***********************************************************************
+ * usc_timing_start() returns the current tick count, and
+ * usc_timing_record() accounts the ticks since start in the per call
+ * latency histogram.  Both are called by TEST()/TEST_VOID() around the
+ * call when STD_TIMING_ON is set.
+ ***********************************************************************/
+uint64_t usc_timing_start(void)
+{
+	if (STD_timing_tsc) {
+		if (STD_tsc_base == 0) {
+			STD_ns_base = usc_ns_now();
+			STD_tsc_base = usc_rdtsc();
+		}
+		return usc_rdtsc();
+	}
+
+	return usc_ns_now();
+}
+
+void usc_timing_record(uint64_t start)
+{
+	uint64_t d = (STD_timing_tsc ? usc_rdtsc() : usc_ns_now()) - start;
+
+	if (!STD_hist.count || d < STD_hist.min)
+		STD_hist.min = d;
+	if (d > STD_hist.max)
+		STD_hist.max = d;
+	STD_hist.count++;
+	STD_hist.sum += d;
+	STD_hist.buckets[usc_hist_bucket(d)]++;
+}
+
+static void usc_hist_merge(struct usc_hist *dst, const struct usc_hist *src)
+{
+	unsigned int i;
+
+	if (!src->count)
+		return;
+
+	if (!dst->count || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (i = 0; i < USC_HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+/* nanoseconds per histogram tick */
+static double usc_timing_scale(void)
+{
+	uint64_t ns, ticks;
+
+	if (!STD_timing_tsc)
+		return 1.0;
+
+	ns = usc_ns_now() - STD_ns_base;
+	ticks = usc_rdtsc() - STD_tsc_base;
+
+	return ticks ? (double)ns / ticks : 1.0;
+}
+
+static void usc_timing_print(const char *what, const struct usc_hist *h,
+			     double scale)
+{
+	tst_resm(TINFO,
+		 "%s: %llu calls, usec min %.3f p50 %.3f p99 %.3f "
+		 "max %.3f avg %.3f, %.0f calls/sec (%s)", what,
+		 (unsigned long long)h->count,
+		 h->min * scale / 1000.0,
+		 usc_hist_percentile(h, 50) * scale / 1000.0,
+		 usc_hist_percentile(h, 99) * scale / 1000.0,
+		 h->max * scale / 1000.0,
+		 (double)h->sum * scale / h->count / 1000.0,
+		 h->sum ? 1e9 * h->count / ((double)h->sum * scale) : 0.0,
+		 STD_timing_tsc ? "tsc" : "CLOCK_MONOTONIC_RAW");
+}
+
+/*
+ * Wait for the other copies and print what each of them did, the
+ * aggregate throughput and Jain's fairness index of the iteration
+ * counts (1.0 when all copies did the same amount of work).
+ * The TSC scale of the parent is used for all copies, it is the same
+ * clock on every cpu where rdtsc is usable for timing at all.
+ */
+static void usc_copies_report(double scale)
+{
+	struct usc_copies *shm = STD_copies_shm;
+	struct usc_copy *c;
+	struct usc_hist all;
+	uint64_t end = 0, total = 0;
+	double sq = 0.0, secs;
+	int i, n = 0, min = -1, max = 0;
+
+	for (i = 1; i < shm->ncopies; i++) {
+		while (waitpid(shm->copy[i].pid, NULL, 0) == -1 &&
+		       errno == EINTR) ;
+	}
+
+	memset(&all, 0, sizeof(all));
+	for (i = 0; i < shm->ncopies; i++) {
+		c = &shm->copy[i];
+		usc_hist_merge(&all, &c->hist);
+		if (c->stop == 0) {
+			tst_resm(TINFO, "COPIES: copy %d pid %d cpu %d: "
+				 "did not finish TEST_LOOPING", i, c->pid,
+				 c->cpu);
+			continue;
+		}
+
+		secs = (c->stop - shm->start) / 1e9;
+		if (c->hist.count)
+			tst_resm(TINFO, "COPIES: copy %d pid %d cpu %d: "
+				 "%d iterations in %.3f sec, %.0f/sec, "
+				 "usec p50 %.3f p99 %.3f", i, c->pid, c->cpu,
+				 c->iterations, secs,
+				 secs > 0 ? c->iterations / secs : 0.0,
+				 usc_hist_percentile(&c->hist, 50) * scale /
+				 1000.0,
+				 usc_hist_percentile(&c->hist, 99) * scale /
+				 1000.0);
+		else
+			tst_resm(TINFO, "COPIES: copy %d pid %d cpu %d: "
+				 "%d iterations in %.3f sec, %.0f/sec", i,
+				 c->pid, c->cpu, c->iterations, secs,
+				 secs > 0 ? c->iterations / secs : 0.0);
+
+		if (c->stop > end)
+			end = c->stop;
+		if (min == -1 || c->iterations < min)
+			min = c->iterations;
+		if (c->iterations > max)
+			max = c->iterations;
+		total += c->iterations;
+		sq += (double)c->iterations * c->iterations;
+		n++;
+	}
+
+	if (n) {
+		secs = (end - shm->start) / 1e9;
+		tst_resm(TINFO, "COPIES: %d copies, %llu iterations in %.3f sec, "
+			 "%.0f/sec, per copy min %d max %d, fairness %.3f",
+			 n, (unsigned long long)total, secs,
+			 secs > 0 ? total / secs : 0.0, min, max,
+			 sq > 0 ? (double)total * total / (n * sq) : 1.0);
+	}
+
+	if (all.count) {
+		tblock.tb_count = all.count;
+		tblock.tb_total = all.sum * scale;
+		tblock.tb_min = all.min * scale;
+		tblock.tb_max = all.max * scale;
+		usc_timing_print("TIMING all copies", &all, scale);
+	}
+}
+
+/***********************************************************************
+ * This function will do the end of test hooks, called by TEST_CLEANUP.
+ * It prints the per call latency summary collected since the last
+ * call, if any call was timed, and updates the tblock accumulator
+ * with the same figures in nanoseconds.
+ * With -c the copies only publish their figures and the parent
+ * prints the per copy and aggregate summary once they all exited.
+ ***********************************************************************/
+void usc_cleanup_hook(void)
+{
+	double scale = usc_timing_scale();
+
+	if (STD_copies_shm != NULL) {
+		usc_hist_merge(&STD_copies_shm->copy[STD_copy].hist, &STD_hist);
+		memset(&STD_hist, 0, sizeof(STD_hist));
+		if (STD_copy == 0 && getpid() == STD_copies_shm->copy[0].pid)
+			usc_copies_report(scale);
+		STD_copies_shm = NULL;
+		return;
+	}
+
+	if (!STD_TIMING_ON || !STD_hist.count)
+		return;
+
+	tblock.tb_count = STD_hist.count;
+	tblock.tb_total = STD_hist.sum * scale;
+	tblock.tb_min = STD_hist.min * scale;
+	tblock.tb_max = STD_hist.max * scale;
+
+	usc_timing_print("TIMING", &STD_hist, scale);
+
+	memset(&STD_hist, 0, sizeof(STD_hist));
 }
 
 /***********************************************************************
@@ -789,8 +1267,14 @@ int usc_test_looping(int counter)
 	if (STD_LOOP_DURATION != 0.0 && get_current_time() < stop_time)
 		keepgoing++;
 
-	if (keepgoing == 0)
+	if (keepgoing == 0) {
+		if (STD_copies_shm != NULL &&
+		    STD_copies_shm->copy[STD_copy].stop == 0) {
+			STD_copies_shm->copy[STD_copy].iterations = counter;
+			STD_copies_shm->copy[STD_copy].stop = usc_ns_now();
+		}
 		return 0;
+	}
 
 	/*
 	 * The following code allows special system testing hooks.
@@ -52,6 +52,10 @@
  *						char **errmsg, long wrd);
  *  int  lio_read_buffer(int fd, int method, char *buffer, int size,
  *						char **errmsg, long wrd);
+ *  int  lio_write_buffers(int fd, int method, struct lio_buf *bufs,
+ *			int nbufs, int sig, char **errmsg, long wrd);
+ *  int  lio_read_buffers(int fd, int method, struct lio_buf *bufs,
+ *			int nbufs, int sig, char **errmsg, long wrd);
  *
  *  #ifdef CRAY
  *  int  lio_wait4asyncio(int method, int fd, struct iosw **statptr)
@@ -113,6 +117,16 @@
 #endif
 #endif
 #include <stdlib.h>		/* atoi, abs */
+#include <limits.h>		/* IOV_MAX */
+#if defined(__linux__) && !defined(__UCLIBC__) && defined(HAVE_LINUX_IO_URING_H)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+#ifdef __NR_io_uring_setup
+#define LIO_HAVE_URING	1
+#endif
+#endif
 
 #include "tlibio.h"		/* defines LIO* marcos */
 #include "random_range.h"
@@ -166,6 +180,12 @@ struct lio_info_type Lio_info1[] = {
 	 "single stride async listio using pause"},
 	{"v", LIO_IO_SYNCV, "single buffer sync readv/writev"},
 	{"P", LIO_IO_SYNCP, "sync pread/pwrite"},
+	{"u", LIO_IO_URING | LIO_WAIT_RECALL,
+	 "io_uring waiting in io_uring_enter"},
+	{"U", LIO_IO_URING | LIO_WAIT_ACTIVE,
+	 "io_uring busy polling the completion queue"},
+	{"E", LIO_IO_URING | LIO_WAIT_EVENTFD,
+	 "io_uring waiting on an eventfd"},
 };
 
 /*
@@ -178,9 +198,12 @@ struct lio_info_type Lio_info2[] = {
 	{"alistio", LIO_IO_ALISTIO, "single stride async listio"},
 	{"syncv", LIO_IO_SYNCV, "single buffer sync readv/writev"},
 	{"syncp", LIO_IO_SYNCP, "pread/pwrite"},
+	{"uring", LIO_IO_URING, "io_uring readv/writev"},
 	{"active", LIO_WAIT_ACTIVE, "spin on status/control values"},
 	{"recall", LIO_WAIT_RECALL,
-	 "use recall(2)/aio_suspend(3) to wait for i/o to complete"},
+	 "use recall(2)/aio_suspend(3)/io_uring_enter(2) to wait for i/o to complete"},
+	{"eventfd", LIO_WAIT_EVENTFD,
+	 "read(2) an eventfd notified by io_uring"},
 	{"sigactive", LIO_WAIT_SIGACTIVE, "spin waiting for signal"},
 	{"sigpause", LIO_WAIT_SIGPAUSE, "call pause(2) to wait for signal"},
 /* nowait is a touchy thing, it's an accident that this implementation worked at all.  6/27/97 roehrich */
@@ -499,10 +522,322 @@ static void wait4sync_io(int fd, int read)
 	select(fd + 1, read ? &s : NULL, read ? NULL : &s, NULL, NULL);
 }
 
+#if LIO_HAVE_URING
+/*
+ * io_uring is driven with the raw system calls so no extra library is
+ * needed.  One ring is set up lazily and kept for the life of the
+ * process; a child that inherited it from its parent sets up its own,
+ * since two processes must not share a submission queue.
+ */
+static struct lio_uring {
+	int fd;			/* ring fd, -1 if not set up */
+	int efd;		/* eventfd registered with the ring, or -1 */
+	pid_t pid;		/* process that set up the ring */
+	unsigned entries;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len, sqes_len;
+} Lio_uring = {.fd = -1,.efd = -1 };
+
+#define LIO_URING_ENTRIES	128
+
+static void lio_uring_exit(void)
+{
+	if (Lio_uring.sqes != NULL)
+		munmap(Lio_uring.sqes, Lio_uring.sqes_len);
+	if (Lio_uring.cq_ptr != NULL && Lio_uring.cq_ptr != Lio_uring.sq_ptr)
+		munmap(Lio_uring.cq_ptr, Lio_uring.cq_len);
+	if (Lio_uring.sq_ptr != NULL)
+		munmap(Lio_uring.sq_ptr, Lio_uring.sq_len);
+	if (Lio_uring.efd != -1)
+		close(Lio_uring.efd);
+	if (Lio_uring.fd != -1)
+		close(Lio_uring.fd);
+	memset(&Lio_uring, 0, sizeof(Lio_uring));
+	Lio_uring.fd = -1;
+	Lio_uring.efd = -1;
+}
+
+static int lio_uring_init(void)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	if (Lio_uring.fd != -1) {
+		if (Lio_uring.pid == getpid())
+			return 0;
+		lio_uring_exit();
+	}
+
+	memset(&p, 0, sizeof(p));
+	Lio_uring.fd = syscall(__NR_io_uring_setup, LIO_URING_ENTRIES, &p);
+	if (Lio_uring.fd == -1) {
+		sprintf(Errormsg,
+			"%s/%d io_uring_setup(%d, &p) failed, errno=%d %s",
+			__FILE__, __LINE__, LIO_URING_ENTRIES, errno,
+			strerror(errno));
+		return -errno;
+	}
+	Lio_uring.pid = getpid();
+	Lio_uring.entries = p.sq_entries;
+
+	Lio_uring.sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	Lio_uring.cq_len =
+	    p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (Lio_uring.cq_len > Lio_uring.sq_len)
+			Lio_uring.sq_len = Lio_uring.cq_len;
+		Lio_uring.cq_len = Lio_uring.sq_len;
+	}
+	Lio_uring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	sq = mmap(NULL, Lio_uring.sq_len, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, Lio_uring.fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto mmap_failed;
+	Lio_uring.sq_ptr = sq;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, Lio_uring.cq_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, Lio_uring.fd,
+			  IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto mmap_failed;
+	}
+	Lio_uring.cq_ptr = cq;
+
+	Lio_uring.sqes = mmap(NULL, Lio_uring.sqes_len, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, Lio_uring.fd,
+			      IORING_OFF_SQES);
+	if (Lio_uring.sqes == MAP_FAILED) {
+		Lio_uring.sqes = NULL;
+		goto mmap_failed;
+	}
+
+	Lio_uring.sq_head = (unsigned *)(sq + p.sq_off.head);
+	Lio_uring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	Lio_uring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	Lio_uring.sq_array = (unsigned *)(sq + p.sq_off.array);
+	Lio_uring.cq_head = (unsigned *)(cq + p.cq_off.head);
+	Lio_uring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	Lio_uring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	Lio_uring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	if (Debug_level > 1)
+		printf("DEBUG %s/%d: io_uring set up, fd %d, %u entries\n",
+		       __FILE__, __LINE__, Lio_uring.fd, Lio_uring.entries);
+	return 0;
+
+mmap_failed:
+	sprintf(Errormsg, "%s/%d mmap of io_uring rings failed, errno=%d %s",
+		__FILE__, __LINE__, errno, strerror(errno));
+	lio_uring_exit();
+	return -ENOMEM;
+}
+
+static int lio_uring_eventfd(void)
+{
+	int efd;
+
+	if (Lio_uring.efd != -1)
+		return 0;
+
+	if ((efd = eventfd(0, 0)) == -1) {
+		sprintf(Errormsg, "%s/%d eventfd(0, 0) failed, errno=%d %s",
+			__FILE__, __LINE__, errno, strerror(errno));
+		return -errno;
+	}
+	if (syscall(__NR_io_uring_register, Lio_uring.fd,
+		    IORING_REGISTER_EVENTFD, &efd, 1) == -1) {
+		sprintf(Errormsg,
+			"%s/%d io_uring_register(%d, IORING_REGISTER_EVENTFD) failed, errno=%d %s",
+			__FILE__, __LINE__, Lio_uring.fd, errno,
+			strerror(errno));
+		close(efd);
+		return -errno;
+	}
+	Lio_uring.efd = efd;
+
+	return 0;
+}
+
+/* Reap whatever is in the completion queue, return the number reaped. */
+static int lio_uring_reap(struct lio_buf *bufs)
+{
+	unsigned head, tail;
+	struct io_uring_cqe *cqe;
+	int cnt = 0;
+
+	head = *Lio_uring.cq_head;
+	tail = *Lio_uring.cq_tail;
+	__sync_synchronize();
+	while (head != tail) {
+		cqe = &Lio_uring.cqes[head & *Lio_uring.cq_mask];
+		bufs[cqe->user_data].ret = cqe->res;
+		head++;
+		cnt++;
+	}
+	__sync_synchronize();
+	*Lio_uring.cq_head = head;
+
+	return cnt;
+}
+
+/***********************************************************************
+ * Transfer nbufs entries through the io_uring, at most the ring size
+ * at a time.  iov[i] and pos[i] describe entry i, its result (bytes or
+ * -errno) is stored in bufs[i].ret.  If link is set the entries are
+ * chained with IOSQE_IO_LINK so they run in order, which is needed
+ * on fifos where the offsets mean nothing.
+ *
+ * The wait method bits select how completions are waited for:
+ *   LIO_WAIT_ACTIVE  - submit only, then spin on the completion queue.
+ *   LIO_WAIT_EVENTFD - submit only, then block in read(2) on an eventfd
+ *                      registered with the ring.
+ *   otherwise        - io_uring_enter(2) with IORING_ENTER_GETEVENTS
+ *                      submits and waits for all of them at once.
+ *
+ * Return Value
+ *   0 if the ring worked (per entry errors are only in bufs[].ret),
+ *   otherwise -errno with Errormsg updated.
+ ***********************************************************************/
+static int lio_uring_rw(int fd, int method, struct iovec *iov, off_t *pos,
+			struct lio_buf *bufs, int nbufs, int rd, int link)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+	int i, n, done, submit, ret;
+	eventfd_t cnt;
+
+	if ((ret = lio_uring_init()) < 0)
+		return ret;
+	if ((method & LIO_WAIT_EVENTFD) && (ret = lio_uring_eventfd()) < 0)
+		return ret;
+
+	for (i = 0; i < nbufs; i += n) {
+		n = nbufs - i;
+		if (n > (int)Lio_uring.entries)
+			n = Lio_uring.entries;
+
+		tail = *Lio_uring.sq_tail;
+		for (idx = 0; idx < (unsigned)n; idx++, tail++) {
+			sqe = &Lio_uring.sqes[tail & *Lio_uring.sq_mask];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = rd ? IORING_OP_READV : IORING_OP_WRITEV;
+			sqe->fd = fd;
+			sqe->addr = (unsigned long)&iov[i + idx];
+			sqe->len = 1;
+			sqe->off = pos[i + idx];
+			sqe->user_data = i + idx;
+			if (link && idx != (unsigned)n - 1)
+				sqe->flags |= IOSQE_IO_LINK;
+			Lio_uring.sq_array[tail & *Lio_uring.sq_mask] =
+			    tail & *Lio_uring.sq_mask;
+		}
+		__sync_synchronize();
+		*Lio_uring.sq_tail = tail;
+		__sync_synchronize();
+
+		if (Debug_level > 2)
+			printf("DEBUG %s/%d: io_uring_enter(%d, %d, ...) %s\n",
+			       __FILE__, __LINE__, Lio_uring.fd, n,
+			       (method & LIO_WAIT_ACTIVE) ? "busy poll" :
+			       (method & LIO_WAIT_EVENTFD) ? "eventfd" :
+			       "wait");
+
+		/*
+		 * The kernel only waits for completions once everything
+		 * asked for was submitted, so waiting for n - done can not
+		 * hang on a partial submit.
+		 */
+		submit = n;
+		done = 0;
+		while (done < n) {
+			if (submit || !(method & (LIO_WAIT_ACTIVE |
+						  LIO_WAIT_EVENTFD))) {
+				ret = syscall(__NR_io_uring_enter,
+					      Lio_uring.fd, submit,
+					      (method & (LIO_WAIT_ACTIVE |
+							 LIO_WAIT_EVENTFD)) ?
+					      0 : n - done,
+					      (method & (LIO_WAIT_ACTIVE |
+							 LIO_WAIT_EVENTFD)) ?
+					      0 : IORING_ENTER_GETEVENTS,
+					      NULL, 0);
+				if (ret == -1 && errno != EINTR &&
+				    errno != EAGAIN && errno != EBUSY)
+					goto enter_failed;
+				if (ret > 0)
+					submit -= ret;
+			}
+
+			if ((method & LIO_WAIT_EVENTFD) && !submit &&
+			    *Lio_uring.cq_head == *Lio_uring.cq_tail &&
+			    eventfd_read(Lio_uring.efd, &cnt) == -1 &&
+			    errno != EINTR) {
+				sprintf(Errormsg,
+					"%s/%d read of io_uring eventfd %d failed, errno=%d %s",
+					__FILE__, __LINE__, Lio_uring.efd,
+					errno, strerror(errno));
+				ret = -errno;
+				lio_uring_exit();
+				return ret;
+			}
+
+			done += lio_uring_reap(bufs);
+		}
+	}
+
+	return 0;
+
+enter_failed:
+	ret = -errno;
+	sprintf(Errormsg, "%s/%d io_uring_enter(%d, %d, ...) failed, errno=%d %s",
+		__FILE__, __LINE__, Lio_uring.fd, n, errno, strerror(errno));
+	/* unsubmitted entries would be picked up by the next call */
+	lio_uring_exit();
+	return ret;
+}
+#else
+static int lio_uring_init(void)
+{
+	sprintf(Errormsg, "%s/%d io_uring support was not compiled in",
+		__FILE__, __LINE__);
+	return -ENOSYS;
+}
+
+static int lio_uring_rw(int fd, int method, struct iovec *iov, off_t *pos,
+			struct lio_buf *bufs, int nbufs, int rd, int link)
+{
+	return lio_uring_init();
+}
+#endif
+
+#if defined(__linux__) && !defined(__UCLIBC__)
+/*
+ * io_uring leaves the file offset alone, so move it to pos like read(2)
+ * or write(2) would have.  On an O_APPEND fd the writes went to the end
+ * of the file, wherever pos pointed.
+ */
+static off_t lio_uring_seek(int fd, off_t pos, int rd)
+{
+	int flags;
+
+	if (!rd && (flags = fcntl(fd, F_GETFL)) != -1 && (flags & O_APPEND))
+		return lseek(fd, 0, SEEK_END);
+	return lseek(fd, pos, SEEK_SET);
+}
+#endif
+
 /***********************************************************************
  * Generic write function
  * This function can be used to do a write using write(2), writea(2),
- * aio_write(3), writev(2), pwrite(2),
+ * aio_write(3), writev(2), pwrite(2), an io_uring IORING_OP_WRITEV,
  * or single stride listio(2)/lio_listio(3).
  * By setting the desired bits in the method
  * bitmask, the caller can control the type of write and the wait method
@@ -659,6 +994,24 @@ long wrd;			/* to allow future features, use zero for now */
 
 #endif
 
+#if defined(__linux__) && !defined(__UCLIBC__)
+	/*
+	 * A randomly chosen io_uring falls back to sync i/o on kernels
+	 * that do not have it (or have it disabled).
+	 */
+	if ((method & LIO_IO_URING) && (ret = lio_uring_init()) < 0) {
+		if (omethod & LIO_RANDOM) {
+			method &= ~LIO_IO_URING;
+			method |= LIO_IO_SYNC;
+			if (Debug_level > 2)
+				printf
+				    ("DEBUG %s/%d: random chosen method switched to %#o, no io_uring\n",
+				     __FILE__, __LINE__, method);
+		} else
+			return ret;
+	}
+#endif
+
 	/*
 	 * If the LIO_USE_SIGNAL bit is not set, only use the signal
 	 * if the LIO_WAIT_SIGPAUSE or the LIO_WAIT_SIGACTIVE bits are bit.
@@ -1020,6 +1373,62 @@ long wrd;			/* to allow future features, use zero for now */
 	}			/* LIO_IO_SYNCP */
 #endif
 
+#if defined(__linux__) && !defined(__UCLIBC__)
+	else if (method & LIO_IO_URING) {
+		struct lio_buf lbuf;
+		off_t pos = poffset;
+
+		io_type = "io_uring writev";
+
+		sprintf(Lio_SysCall,
+			"io_uring IORING_OP_WRITEV(%d, &iov, 1, %lld) nbyte:%d",
+			fd, (long long)poffset, size);
+
+		if (Debug_level) {
+			printf("DEBUG %s/%d: %s\n", __FILE__, __LINE__,
+			       Lio_SysCall);
+		}
+
+		lbuf.buffer = buffer;
+		lbuf.offset = poffset;
+		lbuf.size = size;
+		lbuf.ret = 0;
+		if ((ret = lio_uring_rw(fd, method, &iov, &pos, &lbuf, 1,
+					0, 0)) < 0)
+			return ret;
+
+		if ((ret = lbuf.ret) < 0) {
+			sprintf(Errormsg,
+				"%s/%d %s ret:%d, errno=%d %s",
+				__FILE__, __LINE__, Lio_SysCall, ret, -ret,
+				strerror(-ret));
+			return ret;
+		}
+
+		/* move the file offset like write(2) would */
+		if (lio_uring_seek(fd, poffset + ret, 0) == -1
+		    && errno != ESPIPE) {
+			sprintf(Errormsg,
+				"%s/%d lseek(fd=%d,%lld,SEEK_SET) failed, errno=%d  %s",
+				__FILE__, __LINE__, fd,
+				(long long)(poffset + ret), errno,
+				strerror(errno));
+			return -errno;
+		}
+
+		if (ret != size) {
+			sprintf(Errormsg,
+				"%s/%d %s returned=%d",
+				__FILE__, __LINE__, Lio_SysCall, ret);
+		} else if (Debug_level > 1)
+			printf
+			    ("DEBUG %s/%d: io_uring write completed without error (ret %d)\n",
+			     __FILE__, __LINE__, ret);
+
+		return ret;
+	}			/* LIO_IO_URING */
+#endif
+
 	else {
 		printf("DEBUG %s/%d: No I/O method chosen\n", __FILE__,
 		       __LINE__);
@@ -1073,7 +1482,7 @@ long wrd;			/* to allow future features, use zero for now */
 /***********************************************************************
  * Generic read function
  * This function can be used to do a read using read(2), reada(2),
- * aio_read(3), readv(2), pread(2),
+ * aio_read(3), readv(2), pread(2), an io_uring IORING_OP_READV,
  * or single stride listio(2)/lio_listio(3).
  * By setting the desired bits in the method
  * bitmask, the caller can control the type of read and the wait method
@@ -1231,6 +1640,24 @@ long wrd;			/* to allow future features, use zero for now */
 
 #endif
 
+#if defined(__linux__) && !defined(__UCLIBC__)
+	/*
+	 * A randomly chosen io_uring falls back to sync i/o on kernels
+	 * that do not have it (or have it disabled).
+	 */
+	if ((method & LIO_IO_URING) && (ret = lio_uring_init()) < 0) {
+		if (omethod & LIO_RANDOM) {
+			method &= ~LIO_IO_URING;
+			method |= LIO_IO_SYNC;
+			if (Debug_level > 2)
+				printf
+				    ("DEBUG %s/%d: random chosen method switched to %#o, no io_uring\n",
+				     __FILE__, __LINE__, method);
+		} else
+			return ret;
+	}
+#endif
+
 	/*
 	 * If the LIO_USE_SIGNAL bit is not set, only use the signal
 	 * if the LIO_WAIT_SIGPAUSE or the LIO_WAIT_SIGACTIVE bits are set.
@@ -1594,6 +2021,62 @@ long wrd;			/* to allow future features, use zero for now */
 	}			/* LIO_IO_SYNCP */
 #endif
 
+#if defined(__linux__) && !defined(__UCLIBC__)
+	else if (method & LIO_IO_URING) {
+		struct lio_buf lbuf;
+		off_t pos = poffset;
+
+		io_type = "io_uring readv";
+
+		sprintf(Lio_SysCall,
+			"io_uring IORING_OP_READV(%d, &iov, 1, %lld) nbyte:%d",
+			fd, (long long)poffset, size);
+
+		if (Debug_level) {
+			printf("DEBUG %s/%d: %s\n", __FILE__, __LINE__,
+			       Lio_SysCall);
+		}
+
+		lbuf.buffer = buffer;
+		lbuf.offset = poffset;
+		lbuf.size = size;
+		lbuf.ret = 0;
+		if ((ret = lio_uring_rw(fd, method, &iov, &pos, &lbuf, 1,
+					1, 0)) < 0)
+			return ret;
+
+		if ((ret = lbuf.ret) < 0) {
+			sprintf(Errormsg,
+				"%s/%d %s ret:%d, errno=%d %s",
+				__FILE__, __LINE__, Lio_SysCall, ret, -ret,
+				strerror(-ret));
+			return ret;
+		}
+
+		/* move the file offset like read(2) would */
+		if (lio_uring_seek(fd, poffset + ret, 1) == -1
+		    && errno != ESPIPE) {
+			sprintf(Errormsg,
+				"%s/%d lseek(fd=%d,%lld,SEEK_SET) failed, errno=%d  %s",
+				__FILE__, __LINE__, fd,
+				(long long)(poffset + ret), errno,
+				strerror(errno));
+			return -errno;
+		}
+
+		if (ret != size) {
+			sprintf(Errormsg,
+				"%s/%d %s returned=%d",
+				__FILE__, __LINE__, Lio_SysCall, ret);
+		} else if (Debug_level > 1)
+			printf
+			    ("DEBUG %s/%d: io_uring read completed without error (ret %d)\n",
+			     __FILE__, __LINE__, ret);
+
+		return ret;
+	}			/* LIO_IO_URING */
+#endif
+
 	else {
 		printf("DEBUG %s/%d: No I/O method chosen\n", __FILE__,
 		       __LINE__);
@@ -1795,6 +2278,7 @@ int lio_wait4asyncio(int method, int fd, struct aiocb *aiocbp)
 #if defined(sgi) || (defined(__linux__)&& !defined(__UCLIBC__))
 	    || (method & LIO_WAIT_CBSUSPEND)
 	    || (method & LIO_WAIT_SIGSUSPEND)
+	    || (method & LIO_WAIT_EVENTFD)
 #endif
 	    || ((method & LIO_WAIT_TYPES) == 0)) {
 		/*
@@ -1964,6 +2448,513 @@ int lio_wait4asyncio(int method, int fd, struct aiocb *aiocbp)
 #endif /* ifndef linux */
 #endif
 
+/***********************************************************************
+ * Generic batched write/read functions
+ * These functions move an array of (buffer, offset, size) entries
+ * with as few system calls as the method allows:
+ *
+ *   LIO_IO_SYNCV     - one writev(2)/readv(2) per run of contiguous
+ *                      entries (at most IOV_MAX entries per call).
+ *   LIO_IO_SYNCP     - one pwritev(2)/preadv(2) per run of contiguous
+ *                      entries.  The file offset is not changed.
+ *   LIO_IO_ASYNC     - one aio_write(3)/aio_read(3) per entry, then all
+ *                      entries are reaped together.
+ *   LIO_IO_SLISTIO   - one lio_listio(LIO_WAIT) for the whole batch.
+ *   LIO_IO_ALISTIO   - one lio_listio(LIO_NOWAIT) for the whole batch,
+ *                      then all entries are reaped together.
+ *   LIO_IO_URING     - the whole batch is queued on the io_uring and
+ *                      reaped together, see lio_uring_rw().
+ *   LIO_IO_SYNC      - one write(2)/read(2) per entry (default).
+ *
+ * Async batches wait with aio_suspend(3) on all outstanding entries,
+ * or spin on aio_error(3) if LIO_WAIT_ACTIVE is set.  Per entry
+ * signals and callbacks would coalesce, so the signal and callback
+ * wait methods fall back to aio_suspend(3) and sig is not used.
+ * Except for LIO_IO_SYNCP, the file offset is left at the end of the
+ * last entry, as if the entries had been written/read one by one.
+ *
+ * Return Value
+ *   The ret field of every entry is set to the amount of data
+ *   transferred for it, or to -errno if it failed.
+ *   If any entry failed, the -errno of the first failed entry is
+ *   returned and errmsg describes that failure.
+ *   Otherwise the total amount of data transferred is returned.
+ *	If an entry transferred less than its size, errmsg is updated
+ *	for this condition but the total is still returned.
+ ***********************************************************************/
+#if defined(__linux__) && !defined(__UCLIBC__)
+static int lio_batch_error(struct lio_buf *bufs, int nbufs, int *first)
+{
+	int i;
+
+	for (i = 0; i < nbufs; i++) {
+		if (bufs[i].ret < 0) {
+			*first = i;
+			return bufs[i].ret;
+		}
+	}
+
+	return 0;
+}
+
+static int lio_rw_buffers(int fd, int method, struct lio_buf *bufs,
+			  int nbufs, char **errmsg, int rd)
+{
+	int ret;
+	int i, j, cnt;
+	int omethod = method;
+	int seekable = 1;
+	int total = 0;
+	int first = -1;
+	char *io_type;
+	off_t cur, end;
+	off_t *pos = NULL;
+	struct iovec *iov = NULL;
+	struct aiocb *aio = NULL;
+	const struct aiocb **aiolist = NULL;
+
+	if (method & LIO_RANDOM) {
+		method = lio_random_methods(method);
+		if (Debug_level > 2)
+			printf("DEBUG %s/%d: random chosen method %#o\n",
+			       __FILE__, __LINE__, method);
+	}
+
+	if (errmsg != NULL)
+		*errmsg = Errormsg;
+
+	if (nbufs <= 0)
+		return 0;
+
+	if ((cur = lseek(fd, 0, SEEK_CUR)) == -1) {
+		if (errno != ESPIPE) {
+			sprintf(Errormsg,
+				"%s/%d lseek(fd=%d,0,SEEK_CUR) failed, errno=%d  %s",
+				__FILE__, __LINE__, fd, errno, strerror(errno));
+			return -errno;
+		}
+		/*
+		 * Offsets are meaningless on a fifo, so the whole batch
+		 * is one stream.  A randomly chosen pwritev/preadv is
+		 * switched to writev/readv.
+		 */
+		seekable = 0;
+		cur = 0;
+		if ((method & LIO_IO_SYNCP) && (omethod & LIO_RANDOM)) {
+			method &= ~LIO_IO_SYNCP;
+			method |= LIO_IO_SYNCV;
+			if (Debug_level > 2)
+				printf
+				    ("DEBUG %s/%d: random chosen method switched to %#o for fifo\n",
+				     __FILE__, __LINE__, method);
+		}
+	}
+
+	if ((method & LIO_IO_URING) && (ret = lio_uring_init()) < 0) {
+		if (!(omethod & LIO_RANDOM))
+			return ret;
+		method &= ~LIO_IO_URING;
+		method |= LIO_IO_SYNC;
+		if (Debug_level > 2)
+			printf
+			    ("DEBUG %s/%d: random chosen method switched to %#o, no io_uring\n",
+			     __FILE__, __LINE__, method);
+	}
+
+	pos = malloc(nbufs * sizeof(*pos));
+	iov = malloc(nbufs * sizeof(*iov));
+	if (method & LIO_IO_ASYNC_TYPES) {
+		aio = calloc(nbufs, sizeof(*aio));
+		aiolist = malloc(nbufs * sizeof(*aiolist));
+	}
+	if (pos == NULL || iov == NULL ||
+	    ((method & LIO_IO_ASYNC_TYPES) && (aio == NULL || aiolist == NULL))) {
+		sprintf(Errormsg, "%s/%d malloc of %d entry batch failed",
+			__FILE__, __LINE__, nbufs);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	end = cur;
+	for (i = 0; i < nbufs; i++) {
+		if (seekable && bufs[i].offset >= 0)
+			end = bufs[i].offset;
+		pos[i] = seekable ? end : 0;
+		end += bufs[i].size;
+		iov[i].iov_base = bufs[i].buffer;
+		iov[i].iov_len = bufs[i].size;
+		bufs[i].ret = 0;
+	}
+
+	if (method & LIO_IO_ASYNC_TYPES) {
+		for (i = 0; i < nbufs; i++) {
+			aio[i].aio_fildes = fd;
+			aio[i].aio_buf = bufs[i].buffer;
+			aio[i].aio_nbytes = bufs[i].size;
+			aio[i].aio_offset = pos[i];
+			aio[i].aio_lio_opcode = rd ? LIO_READ : LIO_WRITE;
+			aio[i].aio_sigevent.sigev_notify = SIGEV_NONE;
+			aiolist[i] = &aio[i];
+		}
+
+		if (method & LIO_IO_ASYNC) {
+			io_type = rd ? "aio_read" : "aio_write";
+			sprintf(Lio_SysCall, "%s(fildes=%d, buf, nbytes) x %d",
+				io_type, fd, nbufs);
+			if (Debug_level)
+				printf("DEBUG %s/%d: %s\n", __FILE__, __LINE__,
+				       Lio_SysCall);
+
+			for (i = 0; i < nbufs; i++) {
+				ret = rd ? aio_read(&aio[i]) : aio_write(&aio[i]);
+				if (ret == -1) {
+					bufs[i].ret = -errno;
+					sprintf(Errormsg,
+						"%s/%d %s(fildes=%d, buf, nbytes=%d) entry %d ret:-1, errno=%d %s",
+						__FILE__, __LINE__, io_type, fd,
+						bufs[i].size, i, errno,
+						strerror(errno));
+					aiolist[i] = NULL;
+				}
+			}
+		} else {
+			int listio_cmd;
+
+			listio_cmd =
+			    (method & LIO_IO_SLISTIO) ? LIO_WAIT : LIO_NOWAIT;
+			io_type = (method & LIO_IO_SLISTIO) ?
+			    (rd ? "lio_listio(3) sync read" :
+			     "lio_listio(3) sync write") :
+			    (rd ? "lio_listio(3) async read" :
+			     "lio_listio(3) async write");
+			sprintf(Lio_SysCall,
+				"lio_listio(%s, aiolist, %d, NULL) %s, fd:%d",
+				listio_cmd == LIO_WAIT ? "LIO_WAIT" :
+				"LIO_NOWAIT", nbufs,
+				rd ? "LIO_READ" : "LIO_WRITE", fd);
+			if (Debug_level)
+				printf("DEBUG %s/%d: %s\n", __FILE__, __LINE__,
+				       Lio_SysCall);
+
+			/*
+			 * EIO only says that some entry failed, aio_error()
+			 * below tells which one.
+			 */
+			if (lio_listio(listio_cmd, (struct aiocb **)aiolist,
+				       nbufs, NULL) == -1 && errno != EIO) {
+				ret = -errno;
+				sprintf(Errormsg,
+					"%s/%d %s failed, errno=%d %s",
+					__FILE__, __LINE__, Lio_SysCall,
+					errno, strerror(errno));
+				for (i = 0; i < nbufs; i++)
+					bufs[i].ret = ret;
+			}
+		}
+
+		/* reap all the entries together */
+		for (j = nbufs;;) {
+			for (i = 0, cnt = 0; i < j; i++) {
+				if (aiolist[i] != NULL &&
+				    aio_error(aiolist[i]) == EINPROGRESS)
+					aiolist[cnt++] = aiolist[i];
+			}
+			if ((j = cnt) == 0)
+				break;
+			if (method & LIO_WAIT_ACTIVE)
+				continue;
+			if (aio_suspend(aiolist, cnt, NULL) == -1 &&
+			    errno != EINTR) {
+				sprintf(Errormsg,
+					"%s/%d aio_suspend(fildes=%d, aiolist, %d, NULL) failed, errno:%d %s",
+					__FILE__, __LINE__, fd, cnt, errno,
+					strerror(errno));
+				ret = -errno;
+				goto out;
+			}
+		}
+
+		for (i = 0; i < nbufs; i++) {
+			if (bufs[i].ret < 0)
+				continue;
+			if ((ret = aio_error(&aio[i])) != 0) {
+				bufs[i].ret = -ret;
+				sprintf(Errormsg,
+					"%s/%d %s, entry %d, aio_error = %d %s; method %#o",
+					__FILE__, __LINE__, io_type, i,
+					ret, strerror(ret), method);
+				continue;
+			}
+			bufs[i].ret = aio_return(&aio[i]);
+		}
+
+		if (seekable && lseek(fd, end, SEEK_SET) == -1) {
+			sprintf(Errormsg,
+				"%s/%d lseek(fd=%d,%lld,SEEK_SET) failed, errno=%d  %s",
+				__FILE__, __LINE__, fd, (long long)end, errno,
+				strerror(errno));
+			ret = -errno;
+			goto out;
+		}
+	} else if (method & LIO_IO_URING) {
+		io_type = rd ? "io_uring readv" : "io_uring writev";
+		sprintf(Lio_SysCall, "io_uring IORING_OP_%s x %d, fd:%d",
+			rd ? "READV" : "WRITEV", nbufs, fd);
+		if (Debug_level)
+			printf("DEBUG %s/%d: %s\n", __FILE__, __LINE__,
+			       Lio_SysCall);
+
+		/* a fifo has no offsets, keep the entries in order */
+		if ((ret = lio_uring_rw(fd, method, iov, pos, bufs, nbufs, rd,
+					!seekable)) < 0)
+			goto out;
+
+		for (i = 0; i < nbufs; i++) {
+			if (bufs[i].ret < 0 && first == -1) {
+				first = i;
+				sprintf(Errormsg,
+					"%s/%d %s, entry %d failed, errno=%d %s",
+					__FILE__, __LINE__, io_type, i,
+					-bufs[i].ret, strerror(-bufs[i].ret));
+			}
+		}
+
+		if (seekable && lio_uring_seek(fd, end, rd) == -1) {
+			sprintf(Errormsg,
+				"%s/%d lseek(fd=%d,%lld,SEEK_SET) failed, errno=%d  %s",
+				__FILE__, __LINE__, fd, (long long)end, errno,
+				strerror(errno));
+			ret = -errno;
+			goto out;
+		}
+	} else if (method & (LIO_IO_SYNCV | LIO_IO_SYNCP)) {
+		int syncp = !(method & LIO_IO_SYNCV);
+
+		io_type = syncp ? (rd ? "preadv(2)" : "pwritev(2)") :
+		    (rd ? "readv(2)" : "writev(2)");
+
+		if (syncp && !seekable) {
+			sprintf(Errormsg,
+				"%s/%d %s on fd %d which is not seekable",
+				__FILE__, __LINE__, io_type, fd);
+			ret = -ESPIPE;
+			goto out;
+		}
+
+		for (i = 0; i < nbufs; i = j) {
+			int want, got;
+
+			/* gather the run of contiguous entries starting at i */
+			want = bufs[i].size;
+			for (j = i + 1; j < nbufs && j - i < IOV_MAX; j++) {
+				if (seekable && pos[j] != pos[j - 1] + bufs[j - 1].size)
+					break;
+				want += bufs[j].size;
+			}
+
+			if (syncp)
+				sprintf(Lio_SysCall,
+					"%s(%d, iov, %d, %lld) nbyte:%d",
+					rd ? "preadv" : "pwritev", fd, j - i,
+					(long long)pos[i], want);
+			else
+				sprintf(Lio_SysCall, "%s(%d, iov, %d) nbyte:%d",
+					rd ? "readv" : "writev", fd, j - i,
+					want);
+			if (Debug_level)
+				printf("DEBUG %s/%d: %s\n", __FILE__, __LINE__,
+				       Lio_SysCall);
+
+			if (!syncp && seekable && pos[i] != cur &&
+			    lseek(fd, pos[i], SEEK_SET) == -1) {
+				ret = -errno;
+				sprintf(Errormsg,
+					"%s/%d lseek(fd=%d,%lld,SEEK_SET) failed, errno=%d  %s",
+					__FILE__, __LINE__, fd,
+					(long long)pos[i], errno,
+					strerror(errno));
+				for (cnt = i; cnt < j; cnt++)
+					bufs[cnt].ret = ret;
+				continue;
+			}
+
+			while (1) {
+				if (syncp)
+					got = rd ?
+					    preadv(fd, &iov[i], j - i, pos[i]) :
+					    pwritev(fd, &iov[i], j - i, pos[i]);
+				else
+					got = rd ? readv(fd, &iov[i], j - i) :
+					    writev(fd, &iov[i], j - i);
+				if (got != -1 ||
+				    (errno != EAGAIN && errno != EINTR))
+					break;
+				wait4sync_io(fd, rd);
+			}
+
+			if (got == -1) {
+				ret = -errno;
+				sprintf(Errormsg,
+					"%s/%d %s ret:-1, errno=%d %s",
+					__FILE__, __LINE__, Lio_SysCall,
+					errno, strerror(errno));
+				for (cnt = i; cnt < j; cnt++)
+					bufs[cnt].ret = ret;
+				continue;
+			}
+
+			/* the file offset moved by what was transferred */
+			cur = pos[i] + got;
+
+			/* hand the transferred bytes out to the entries */
+			for (cnt = i; cnt < j; cnt++) {
+				bufs[cnt].ret = got < bufs[cnt].size ?
+				    got : bufs[cnt].size;
+				got -= bufs[cnt].ret;
+			}
+		}
+	} else {
+		/*
+		 * write(2)/read(2) is used if LIO_IO_SYNC bit is set or
+		 * none of the LIO_IO_TYPES bits are set (default).
+		 */
+		io_type = rd ? "read" : "write";
+
+		for (i = 0; i < nbufs; i++) {
+			char *buffer = bufs[i].buffer;
+			int size = bufs[i].size;
+
+			sprintf(Lio_SysCall, "%s(%d, buf, %d)", io_type, fd,
+				size);
+			if (Debug_level)
+				printf("DEBUG %s/%d: %s\n", __FILE__, __LINE__,
+				       Lio_SysCall);
+
+			if (seekable && pos[i] != cur &&
+			    lseek(fd, pos[i], SEEK_SET) == -1) {
+				bufs[i].ret = -errno;
+				sprintf(Errormsg,
+					"%s/%d lseek(fd=%d,%lld,SEEK_SET) failed, errno=%d  %s",
+					__FILE__, __LINE__, fd,
+					(long long)pos[i], errno,
+					strerror(errno));
+				continue;
+			}
+			cur = pos[i];
+
+			while (size > 0) {
+				ret = rd ? read(fd, buffer, size) :
+				    write(fd, buffer, size);
+				if (ret == -1) {
+					if (errno == EAGAIN || errno == EINTR) {
+						wait4sync_io(fd, rd);
+						continue;
+					}
+					bufs[i].ret = -errno;
+					sprintf(Errormsg,
+						"%s/%d %s ret:-1, errno=%d %s",
+						__FILE__, __LINE__,
+						Lio_SysCall, errno,
+						strerror(errno));
+					break;
+				}
+				if (ret == 0)
+					break;
+				bufs[i].ret += ret;
+				buffer += ret;
+				size -= ret;
+			}
+			if (bufs[i].ret > 0)
+				cur += bufs[i].ret;
+		}
+	}
+
+	for (i = 0; i < nbufs; i++) {
+		if (bufs[i].ret < 0)
+			continue;
+		total += bufs[i].ret;
+		if (bufs[i].ret != bufs[i].size)
+			sprintf(Errormsg,
+				"%s/%d %s, entry %d not as expected(%d), but actual:%d",
+				__FILE__, __LINE__, io_type, i, bufs[i].size,
+				bufs[i].ret);
+	}
+
+	if ((ret = lio_batch_error(bufs, nbufs, &first)) < 0) {
+		if (Debug_level > 1)
+			printf("DEBUG %s/%d: %s, entry %d of %d failed (%d)\n",
+			       __FILE__, __LINE__, io_type, first, nbufs, ret);
+	} else {
+		ret = total;
+		if (Debug_level > 1)
+			printf
+			    ("DEBUG %s/%d: %s batch of %d completed (ret %d)\n",
+			     __FILE__, __LINE__, io_type, nbufs, ret);
+	}
+
+out:
+	free(aiolist);
+	free(aio);
+	free(iov);
+	free(pos);
+	return ret;
+}
+#endif
+
+int lio_write_buffers(int fd, int method, struct lio_buf *bufs, int nbufs,
+		      int sig, char **errmsg, long wrd)
+{
+#if defined(__linux__) && !defined(__UCLIBC__)
+	return lio_rw_buffers(fd, method, bufs, nbufs, errmsg, 0);
+#else
+	int i, total = 0, err = 0;
+
+	for (i = 0; i < nbufs; i++) {
+		if (bufs[i].offset >= 0 &&
+		    lseek(fd, bufs[i].offset, SEEK_SET) == -1) {
+			bufs[i].ret = -errno;
+		} else {
+			bufs[i].ret = lio_write_buffer(fd, method,
+						       bufs[i].buffer,
+						       bufs[i].size, sig,
+						       errmsg, wrd);
+		}
+		if (bufs[i].ret < 0 && err == 0)
+			err = bufs[i].ret;
+		else if (bufs[i].ret > 0)
+			total += bufs[i].ret;
+	}
+	return err ? err : total;
+#endif
+}				/* end of lio_write_buffers */
+
+int lio_read_buffers(int fd, int method, struct lio_buf *bufs, int nbufs,
+		     int sig, char **errmsg, long wrd)
+{
+#if defined(__linux__) && !defined(__UCLIBC__)
+	return lio_rw_buffers(fd, method, bufs, nbufs, errmsg, 1);
+#else
+	int i, total = 0, err = 0;
+
+	for (i = 0; i < nbufs; i++) {
+		if (bufs[i].offset >= 0 &&
+		    lseek(fd, bufs[i].offset, SEEK_SET) == -1) {
+			bufs[i].ret = -errno;
+		} else {
+			bufs[i].ret = lio_read_buffer(fd, method,
+						      bufs[i].buffer,
+						      bufs[i].size, sig,
+						      errmsg, wrd);
+		}
+		if (bufs[i].ret < 0 && err == 0)
+			err = bufs[i].ret;
+		else if (bufs[i].ret > 0)
+			total += bufs[i].ret;
+	}
+	return err ? err : total;
+#endif
+}				/* end of lio_read_buffers */
+
 #if UNIT_TEST
 /***********************************************************************
  * The following code is provided as unit test.
@@ -2016,6 +3007,7 @@ char **argv;
 	int i;
 	char *symbols = NULL;
 	int die_on_err = 0;
+	struct lio_buf bufs[4];
 
 	while ((c = getopt(argc, argv, "s:di:")) != -1) {
 		switch (c) {
@@ -2159,6 +3151,48 @@ char **argv;
 			}
 		}
 
+		printf("\n********* batch write/read %s ***************\n",
+		       Unit_info[ind].str);
+		memset(buffer, 'C', 4096);
+		for (i = 0; i < 4; i++) {
+			bufs[i].buffer = buffer + (3 - i) * 1024;
+			bufs[i].offset = (3 - i) * 1024;
+			bufs[i].size = 1024;
+		}
+		if ((ret = lio_write_buffers(fd, Unit_info[ind].method, bufs,
+					     4, Unit_info[ind].sig, &err,
+					     0)) != size) {
+			printf(">>>>> lio_write_buffers returned %d, err = %s\n",
+			       ret, err);
+			++exit_status;
+			if (die_on_err)
+				exit(exit_status);
+		}
+		memset(buffer, 'B', 4096);
+		for (i = 0; i < 4; i++)
+			bufs[i].buffer = buffer + i * 1024;
+		bufs[0].offset = 0;
+		for (i = 1; i < 4; i++)
+			bufs[i].offset = -1;
+		if ((ret = lio_read_buffers(fd, Unit_info[ind].method, bufs,
+					    4, Unit_info[ind].sig, &err,
+					    0)) != size) {
+			printf(">>>>> lio_read_buffers returned %d, err = %s\n",
+			       ret, err);
+			++exit_status;
+			if (die_on_err)
+				exit(exit_status);
+		}
+		for (i = 0; i < 4096; ++i) {
+			if (buffer[i] != 'C') {
+				printf("  buffer[%d] = %d\n", i, buffer[i]);
+				++exit_status;
+				if (die_on_err)
+					exit(exit_status);
+				break;
+			}
+		}
+
 		fflush(stdout);
 		fflush(stderr);
 		sleep(1);
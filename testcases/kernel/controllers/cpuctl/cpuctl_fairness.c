@@ -0,0 +1,671 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2013 Linux Test Project                                      */
+/*                                                                            */
+/* This program is free software;  you can redistribute it and/or modify      */
+/* it under the terms of the GNU General Public License as published by       */
+/* the Free Software Foundation; either version 2 of the License, or          */
+/* (at your option) any later version.                                        */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY;  without even the implied warranty of            */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See                  */
+/* the GNU General Public License for more details.                           */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License          */
+/* along with this program;  if not, write to the Free Software               */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA    */
+/*                                                                            */
+/******************************************************************************/
+/*
+ * cpu controller fairness sampler.
+ *
+ * Creates N cpu cgroups with the given shares and runs CPU hogs in each of
+ * them, all pinned to one CPU by default, plus optionally one task per group
+ * which wakes up periodically. Instead of waiting for coarse per task CPU
+ * times like cpuctl_test0* do, the parent keeps /proc/<pid>/schedstat of
+ * every task and cpu.stat of every group open and samples them with pread()
+ * every few hundred microseconds.
+ *
+ * From the samples it computes, per group:
+ *  - the error of the CPU time it actually got against the share it should
+ *    get (shares / sum of shares), over the whole run,
+ *  - the time after which that error stayed within the tolerance
+ *    (convergence time),
+ *  - the mean run queue wait per timeslice from schedstat and, with -W,
+ *    the wakeup latency distribution of the periodic task.
+ *
+ * The test passes if every group is within the tolerance at the end.
+ *
+ * Works with the cgroup v1 cpu controller (mounted at /dev/cpuctl like
+ * parameters.sh does, unless -m points at an existing mount) as well as
+ * with a cgroup v2 hierarchy passed with -m, where the shares are converted
+ * to cpu.weight.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "usctest.h"
+#include "../libcontrollers/libcontrollers.h"
+
+char *TCID = "cpuctl_fairness";
+int TST_TOTAL = 1;
+
+#define CPUCTL_MNT		"/dev/cpuctl"
+#define GROUP_PREFIX		"ltp_fairness"
+#define MAX_GROUPS		64
+#define HIST_BUCKETS		32	/* log2(ns), up to ~4 seconds */
+
+/* cpu.stat keys, whichever the kernel has */
+static const char *stat_keys[] = { "usage_usec", "nr_throttled" };
+#define NR_STAT_KEYS	(sizeof(stat_keys) / sizeof(stat_keys[0]))
+enum { USAGE_USEC, NR_THROTTLED };
+
+struct group_lat {
+	unsigned long wakeups;
+	unsigned long max_ns;
+	unsigned long hist[HIST_BUCKETS];
+};
+
+struct shared {
+	volatile int go;
+	volatile int stop;
+	int ready;
+	struct group_lat group[MAX_GROUPS];
+};
+
+struct task {
+	pid_t pid;
+	int group;
+	int fd;			/* /proc/<pid>/schedstat */
+	unsigned long long run, wait, slices;
+	unsigned long long run0, wait0, slices0;
+};
+
+struct group {
+	unsigned int shares;
+	int stat_fd;		/* cpu.stat */
+	unsigned long long stat[NR_STAT_KEYS];
+	unsigned long long stat0[NR_STAT_KEYS];
+	int have_usage;
+	double expected;	/* share of the CPU time, 0..1 */
+	double err;		/* last relative error, % */
+	unsigned long conv_us;	/* end of the last sample out of tolerance */
+};
+
+static int opt_groups, opt_tasks, opt_shares, opt_time, opt_interval;
+static int opt_tol, opt_cpu, opt_wake, opt_mnt, opt_verbose;
+static char *groups_str, *tasks_str, *shares_str, *time_str, *interval_str;
+static char *tol_str, *cpu_str, *wake_str, *mnt_str;
+
+static option_t options[] = {
+	{"g:", &opt_groups, &groups_str},
+	{"n:", &opt_tasks, &tasks_str},
+	{"S:", &opt_shares, &shares_str},
+	{"T:", &opt_time, &time_str},
+	{"s:", &opt_interval, &interval_str},
+	{"E:", &opt_tol, &tol_str},
+	{"a:", &opt_cpu, &cpu_str},
+	{"W:", &opt_wake, &wake_str},
+	{"m:", &opt_mnt, &mnt_str},
+	{"v", &opt_verbose, NULL},
+	{NULL, NULL, NULL}
+};
+
+static int ngroups = 2;
+static int ntasks = 1;
+static int runtime = 5;
+static long interval_us = 500;
+static double tolerance = 5;
+static int cpu;			/* -1 for none, default the first allowed */
+static long wake_us;
+
+static char *mnt = CPUCTL_MNT;
+static struct cgroup_tree cg;
+
+static struct group groups[MAX_GROUPS];
+static struct task *tasks;
+static int ntask_slots;
+
+static struct shared *shm;
+static pid_t *pids;
+static int npids;
+
+static void setup(void);
+static void cleanup(void);
+static void help(void);
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* Tasks */
+
+static void join_group(int group)
+{
+	char path[PATH_MAX], buf[32];
+	cpu_set_t set;
+
+	if (cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+			perror("sched_setaffinity");
+			exit(1);
+		}
+	}
+
+	cgroup_path(&cg, path, group, cg.cgroup2 ? "cgroup.procs" : "tasks");
+	snprintf(buf, sizeof(buf), "%d", getpid());
+	if (write_str_to_file(path, buf) == -1) {
+		perror(path);
+		exit(1);
+	}
+
+	__sync_fetch_and_add(&shm->ready, 1);
+	while (!shm->go && !shm->stop)
+		usleep(1000);
+}
+
+static void hog(int group)
+{
+	join_group(group);
+	while (!shm->stop)
+		;
+	exit(0);
+}
+
+/*
+ * Sleeps until absolute deadlines wake_us apart and records how late it
+ * woke up. Deadlines which were missed altogether are skipped, so one long
+ * delay is counted once rather than as a burst of late wakeups after it.
+ */
+static void waker(int group)
+{
+	struct group_lat *gl = &shm->group[group];
+	struct timespec next, now;
+	unsigned long lat;
+	int b;
+
+	join_group(group);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!shm->stop) {
+		next.tv_nsec += wake_us * 1000;
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+				       NULL) == EINTR)
+			;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		lat = (now.tv_sec - next.tv_sec) * 1000000000L +
+		      now.tv_nsec - next.tv_nsec;
+		if ((long)lat < 0)
+			lat = 0;
+
+		for (b = 0; b < HIST_BUCKETS - 1 && (2UL << b) <= lat; b++)
+			;
+		gl->hist[b]++;
+		gl->wakeups++;
+		if (lat > gl->max_ns)
+			gl->max_ns = lat;
+		if (lat > wake_us * 1000UL)
+			next = now;
+	}
+	exit(0);
+}
+
+/* Parent */
+
+/* cpu.shares to cpu.weight, the way the kernel maps them for cgroup v2 */
+static unsigned int shares_to_weight(unsigned int shares)
+{
+	unsigned long w = 1 + ((unsigned long)(shares - 2) * 9999) / 262142;
+
+	return w < 1 ? 1 : w > 10000 ? 10000 : w;
+}
+
+static void make_groups(void)
+{
+	char path[PATH_MAX], buf[32];
+	unsigned long total = 0;
+	int g;
+
+	cgroup_make_groups(&cg, GROUP_PREFIX, "cpu", ngroups, cleanup);
+
+	for (g = 0; g < ngroups; g++) {
+		if (cg.cgroup2) {
+			cgroup_path(&cg, path, g, "cpu.weight");
+			snprintf(buf, sizeof(buf), "%u",
+				 shares_to_weight(groups[g].shares));
+		} else {
+			cgroup_path(&cg, path, g, "cpu.shares");
+			snprintf(buf, sizeof(buf), "%u", groups[g].shares);
+		}
+		if (write_str_to_file(path, buf) == -1)
+			tst_brkm(TBROK | TERRNO, cleanup, "write %s", path);
+
+		cgroup_path(&cg, path, g, "cpu.stat");
+		groups[g].stat_fd = open(path, O_RDONLY);
+		total += groups[g].shares;
+	}
+
+	for (g = 0; g < ngroups; g++)
+		groups[g].expected = (double)groups[g].shares / total;
+}
+
+static void open_schedstat(struct task *t)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "/proc/%d/schedstat", t->pid);
+	t->fd = open(path, O_RDONLY);
+	if (t->fd == -1)
+		tst_brkm(TBROK | TERRNO, cleanup, "open %s", path);
+}
+
+/*
+ * Reads every task and every group once. Returns the CPU time of every
+ * group since the baseline in ns in usage[].
+ */
+static void read_all(unsigned long long *usage)
+{
+	struct task *t;
+	struct group *gr;
+	int i, g;
+
+	for (g = 0; g < ngroups; g++)
+		usage[g] = 0;
+
+	for (i = 0; i < ntask_slots; i++) {
+		t = &tasks[i];
+		if (read_schedstat(t->fd, &t->run, &t->wait, &t->slices) == 0)
+			usage[t->group] += t->run - t->run0;
+	}
+
+	for (g = 0; g < ngroups; g++) {
+		gr = &groups[g];
+		if (gr->stat_fd == -1)
+			continue;
+		read_stat_values(gr->stat_fd, stat_keys, gr->stat,
+				 NR_STAT_KEYS);
+		/* cgroup v2 accounts for the group as a whole, use that */
+		if (gr->have_usage)
+			usage[g] = (gr->stat[USAGE_USEC] -
+				    gr->stat0[USAGE_USEC]) * 1000;
+	}
+}
+
+static void baseline(void)
+{
+	unsigned long long usage[MAX_GROUPS];
+	struct group *gr;
+	int i, g;
+
+	for (i = 0; i < ntask_slots; i++)
+		open_schedstat(&tasks[i]);
+
+	for (g = 0; g < ngroups; g++) {
+		gr = &groups[g];
+		if (gr->stat_fd == -1)
+			continue;
+		gr->stat[USAGE_USEC] = ULLONG_MAX;
+		read_stat_values(gr->stat_fd, stat_keys, gr->stat,
+				 NR_STAT_KEYS);
+		gr->have_usage = gr->stat[USAGE_USEC] != ULLONG_MAX;
+		if (!gr->have_usage)
+			gr->stat[USAGE_USEC] = 0;
+	}
+
+	read_all(usage);
+
+	for (i = 0; i < ntask_slots; i++) {
+		tasks[i].run0 = tasks[i].run;
+		tasks[i].wait0 = tasks[i].wait;
+		tasks[i].slices0 = tasks[i].slices;
+	}
+	for (g = 0; g < ngroups; g++)
+		memcpy(groups[g].stat0, groups[g].stat,
+		       sizeof(groups[g].stat0));
+}
+
+/* Returns the largest error of all of the groups */
+static double update_errors(const unsigned long long *usage,
+			    unsigned long elapsed_us)
+{
+	unsigned long long total = 0;
+	double actual, max_err = 0;
+	int g;
+
+	for (g = 0; g < ngroups; g++)
+		total += usage[g];
+	if (total == 0)
+		return 100;
+
+	for (g = 0; g < ngroups; g++) {
+		actual = (double)usage[g] / total;
+		groups[g].err = 100 * (actual - groups[g].expected) /
+				groups[g].expected;
+		if (groups[g].err > tolerance || groups[g].err < -tolerance)
+			groups[g].conv_us = elapsed_us;
+		if (groups[g].err > max_err)
+			max_err = groups[g].err;
+		else if (-groups[g].err > max_err)
+			max_err = -groups[g].err;
+	}
+	return max_err;
+}
+
+static void spawn(int group, int slot, void (*fn)(int))
+{
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == -1)
+		tst_brkm(TBROK | TERRNO, cleanup, "fork");
+	if (pid == 0)
+		fn(group);
+	pids[npids++] = pid;
+	tasks[slot].pid = pid;
+	tasks[slot].group = group;
+}
+
+static void report(unsigned long long *usage, unsigned long elapsed_us,
+		   unsigned long samples, unsigned long overruns,
+		   unsigned long sample_ns, unsigned long sample_max_ns)
+{
+	unsigned long long total = 0, wait[MAX_GROUPS], slices[MAX_GROUPS];
+	struct group_lat *gl;
+	struct group *gr;
+	struct task *t;
+	char lat[128];
+	int i, g, failed = 0;
+
+	memset(wait, 0, sizeof(wait));
+	memset(slices, 0, sizeof(slices));
+	for (i = 0; i < ntask_slots; i++) {
+		t = &tasks[i];
+		wait[t->group] += t->wait - t->wait0;
+		slices[t->group] += t->slices - t->slices0;
+	}
+	for (g = 0; g < ngroups; g++)
+		total += usage[g];
+
+	tst_resm(TINFO, "%lu samples in %lums, %luus per sample (max %luus), "
+		 "%lu overruns", samples, elapsed_us / 1000,
+		 samples ? sample_ns / samples / 1000 : 0,
+		 sample_max_ns / 1000, overruns);
+
+	for (g = 0; g < ngroups; g++) {
+		gr = &groups[g];
+		gl = &shm->group[g];
+
+		lat[0] = 0;
+		if (wake_us)
+			snprintf(lat, sizeof(lat), ", wakeup p50 %luus "
+				 "p99 %luus max %luus (%lu)",
+				 hist_pct(gl->hist, HIST_BUCKETS, 50) / 1000,
+				 hist_pct(gl->hist, HIST_BUCKETS, 99) / 1000,
+				 gl->max_ns / 1000, gl->wakeups);
+
+		tst_resm(TINFO, "group %d: shares %u, exp %.2f%% got %.2f%% "
+			 "err %+.2f%%, within %.1f%% after %lums, "
+			 "wait/slice %lluus, throttled %llu%s", g, gr->shares,
+			 100 * gr->expected,
+			 total ? 100.0 * usage[g] / total : 0.0, gr->err,
+			 tolerance, gr->conv_us / 1000,
+			 slices[g] ? wait[g] / slices[g] / 1000 : 0,
+			 gr->stat[NR_THROTTLED] - gr->stat0[NR_THROTTLED],
+			 lat);
+
+		if (gr->err > tolerance || gr->err < -tolerance)
+			failed++;
+	}
+
+	if (failed)
+		tst_resm(TFAIL, "%d of %d groups are off their share by more "
+			 "than %.1f%%", failed, ngroups, tolerance);
+	else
+		tst_resm(TPASS, "all %d groups got their share within %.1f%%",
+			 ngroups, tolerance);
+}
+
+static void run(void)
+{
+	unsigned long long usage[MAX_GROUPS];
+	unsigned long start, end, t, elapsed_us = 0, samples = 0;
+	unsigned long overruns = 0, sample_ns = 0, sample_max_ns = 0;
+	struct timespec next;
+	double max_err;
+	int g, i, slot = 0, status;
+	pid_t pid;
+
+	ntask_slots = ngroups * (ntasks + (wake_us ? 1 : 0));
+	pids = calloc(ntask_slots, sizeof(*pids));
+	tasks = calloc(ntask_slots, sizeof(*tasks));
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (pids == NULL || tasks == NULL || shm == MAP_FAILED)
+		tst_brkm(TBROK | TERRNO, cleanup, "allocating shared state");
+	for (i = 0; i < ntask_slots; i++)
+		tasks[i].fd = -1;
+
+	make_groups();
+
+	tst_resm(TINFO, "%d groups x %d hogs%s on %s, sampling every %ldus "
+		 "for %ds", ngroups, ntasks, wake_us ? " + 1 waker" : "",
+		 cpu >= 0 ? "one cpu" : "all cpus", interval_us, runtime);
+
+	for (g = 0; g < ngroups; g++) {
+		for (i = 0; i < ntasks; i++)
+			spawn(g, slot++, hog);
+		if (wake_us)
+			spawn(g, slot++, waker);
+	}
+
+	while (shm->ready < npids) {
+		pid = waitpid(-1, &status, WNOHANG);
+		if (pid > 0)
+			tst_brkm(TBROK, cleanup, "task %d died during setup",
+				 pid);
+		usleep(1000);
+	}
+
+	baseline();
+	shm->go = 1;
+
+	start = now_ns();
+	end = start + runtime * 1000000000UL;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (;;) {
+		next.tv_nsec += interval_us * 1000;
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+				       NULL) == EINTR)
+			;
+
+		t = now_ns();
+		/* Missed the next deadline altogether, don't try to catch up */
+		if (t > next.tv_sec * 1000000000UL + next.tv_nsec +
+		    interval_us * 1000) {
+			overruns++;
+			next.tv_sec = t / 1000000000UL;
+			next.tv_nsec = t % 1000000000UL;
+		}
+
+		read_all(usage);
+		elapsed_us = (now_ns() - start) / 1000;
+		sample_ns += now_ns() - t;
+		if (now_ns() - t > sample_max_ns)
+			sample_max_ns = now_ns() - t;
+		samples++;
+
+		max_err = update_errors(usage, elapsed_us);
+		if (opt_verbose && samples % (100000 / interval_us + 1) == 0)
+			tst_resm(TINFO, "t=%lums max err %.2f%%",
+				 elapsed_us / 1000, max_err);
+
+		if (t >= end)
+			break;
+	}
+
+	shm->stop = 1;
+	while (wait(&status) > 0)
+		;
+	npids = 0;
+
+	report(usage, elapsed_us, samples, overruns, sample_ns, sample_max_ns);
+}
+
+static void parse_shares(void)
+{
+	char *str = shares_str, *tok;
+	int g = 0;
+
+	if (!opt_shares) {
+		for (g = 0; g < ngroups; g++)
+			groups[g].shares = 1024 * (g + 1);
+		return;
+	}
+
+	/* The last value repeats for the groups not listed */
+	for (tok = strtok(str, ","); tok && g < ngroups;
+	     tok = strtok(NULL, ","), g++)
+		groups[g].shares = parse_num(tok, "shares", 2, 262144);
+	if (g == 0)
+		tst_brkm(TBROK, NULL, "invalid shares '%s'", shares_str);
+	for (; g < ngroups; g++)
+		groups[g].shares = groups[g - 1].shares;
+}
+
+int main(int argc, char *argv[])
+{
+	char *msg;
+
+	msg = parse_opts(argc, argv, options, help);
+	if (msg != NULL)
+		tst_brkm(TBROK, NULL, "OPTION PARSING ERROR - %s", msg);
+
+	if (opt_groups)
+		ngroups = parse_num(groups_str, "groups", 1, MAX_GROUPS);
+	if (opt_tasks)
+		ntasks = parse_num(tasks_str, "tasks", 1, 1000);
+	if (opt_time)
+		runtime = parse_num(time_str, "runtime", 1, INT_MAX);
+	if (opt_interval)
+		interval_us = parse_num(interval_str, "interval", 10, 10000000);
+	if (opt_cpu)
+		cpu = parse_num(cpu_str, "cpu", -1, CPU_SETSIZE - 1);
+	if (opt_wake)
+		wake_us = parse_num(wake_str, "wakeup period", 0, 10000000);
+	if (opt_mnt)
+		mnt = mnt_str;
+	if (opt_tol) {
+		tolerance = atof(tol_str);
+		if (tolerance <= 0)
+			tst_brkm(TBROK, NULL, "invalid tolerance '%s'",
+				 tol_str);
+	}
+	parse_shares();
+
+	setup();
+	run();
+	cleanup();
+	tst_exit();
+}
+
+static void setup(void)
+{
+	cpu_set_t allowed;
+	int g;
+
+	tst_require_root(NULL);
+
+	if (access("/proc/self/schedstat", R_OK) == -1)
+		tst_brkm(TCONF, NULL, "/proc/<pid>/schedstat is missing "
+			 "(CONFIG_SCHED_INFO)");
+
+	/* The tasks can only be pinned to a cpu of our cpuset */
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "sched_getaffinity");
+	if (!opt_cpu) {
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &allowed))
+				break;
+	} else if (cpu >= 0 && !CPU_ISSET(cpu, &allowed)) {
+		tst_brkm(TCONF, NULL, "cpu %d is not in the allowed cpu set",
+			 cpu);
+	}
+
+	for (g = 0; g < MAX_GROUPS; g++)
+		groups[g].stat_fd = -1;
+
+	cgroup_setup(&cg, mnt, !opt_mnt, "cpu", "cpu.shares", cleanup);
+
+	TEST_PAUSE;
+}
+
+static void cleanup(void)
+{
+	int i;
+
+	TEST_CLEANUP;
+
+	if (shm != NULL && shm != MAP_FAILED)
+		shm->stop = 1;
+	for (i = 0; i < npids; i++)
+		if (pids[i] > 0)
+			kill(pids[i], SIGKILL);
+	while (wait(NULL) > 0)
+		;
+
+	for (i = 0; tasks != NULL && i < ntask_slots; i++)
+		if (tasks[i].fd != -1)
+			close(tasks[i].fd);
+	for (i = 0; i < cg.groups_made; i++)
+		if (groups[i].stat_fd != -1)
+			close(groups[i].stat_fd);
+	cgroup_cleanup(&cg);
+}
+
+static void help(void)
+{
+	printf("  -g n    number of cpu cgroups (default 2)\n");
+	printf("  -n n    CPU hogs per group (default 1)\n");
+	printf("  -S s,.. shares of the groups, the last one repeats\n");
+	printf("          (default 1024, 2048, 3072...)\n");
+	printf("  -T sec  run time (default 5)\n");
+	printf("  -s us   sampling interval (default 500)\n");
+	printf("  -E pct  allowed error of the CPU time share (default 5)\n");
+	printf("  -a cpu  cpu to pin all tasks to, -1 for none\n");
+	printf("          (default the first one we may run on)\n");
+	printf("  -W us   add a task per group waking up every us and\n");
+	printf("          report its wakeup latency (default off)\n");
+	printf("  -m dir  existing cpu cgroup (v1 or v2) mount\n");
+	printf("  -v      print the largest error every 100ms\n");
+}
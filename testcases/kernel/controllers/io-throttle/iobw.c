@@ -28,13 +28,17 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <limits.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/wait.h>
 
+#include "tlibio.h"
+
 #ifndef PAGE_SIZE
 #define PAGE_SIZE sysconf(_SC_PAGE_SIZE)
 #endif
@@ -43,10 +47,18 @@
 #define __align_mask(x,mask)	(((x)+(mask))&~(mask))
 #define kb(x)			((x) >> 10)
 
-const char usage[] = "Usage: iobw [-direct] threads chunk_size data_size\n";
+/* A rate counts as converged once every later sample is this close */
+#define CONVERGE_PCT		10
+
+const char usage[] =
+    "Usage: iobw [-direct] [-m seq|rand|mixed] [-r read_pct] [-q depth]\n"
+    "            [-i interval_ms] [-T secs] [-g cgroup[,cgroup...]]\n"
+    "            [-L limit_KiB/s] threads chunk_size data_size\n";
 const char child_fmt[] = "(%s) task %3d: time %4lu.%03lu bw %7lu KiB/s (%s)\n";
 const char parent_fmt[] =
     "(%s) parent %d: time %4lu.%03lu bw %7lu KiB/s (%s)\n";
+const char sample_fmt[] =
+    "(%s) sample %d: time %4lu.%03lu bw %7lu KiB/s (%s)\n";
 
 static int directio = 0;
 static size_t data_size = 0;
@@ -55,45 +67,232 @@ static size_t chunk_size = 0;
 typedef enum {
 	OP_WRITE,
 	OP_READ,
+	OP_MIXED,
 	NUM_IOPS,
 } iops_t;
 
 static const char *iops[] = {
 	"WRITE",
 	"READ ",
+	"MIXED",
 	"TOTAL",
 };
 
+typedef enum {
+	MODE_SEQ,
+	MODE_RAND,
+	MODE_MIXED,
+} iomode_t;
+
+static iomode_t mode = MODE_SEQ;
+static int read_pct = 50;
+static int qdepth = 1;
+static int interval_ms;
+static int runtime;
+static unsigned long limit_kbs;
+
 static int threads;
 pid_t *children;
 
 char *mygroup;
 
+/* -g: the workers are spread over these cgroups round robin */
+static char **groups;
+static char **group_names;
+static int ngroups;
+
+/* Bytes moved by each worker so far, sampled by the parent */
+static volatile unsigned long *progress;
+
+static void now(struct timeval *tv)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	tv->tv_sec = ts.tv_sec;
+	tv->tv_usec = ts.tv_nsec / 1000;
+}
+
+static unsigned long kbps(size_t bytes, struct timeval *diff)
+{
+	unsigned long long usec = diff->tv_sec * 1000000ULL + diff->tv_usec;
+
+	if (usec == 0)
+		usec = 1;
+	return bytes * 1000000ULL / usec / 1024;
+}
+
 static void print_results(int id, iops_t op, size_t bytes, struct timeval *diff)
 {
+	const char *group = mygroup;
+
+	if (id && ngroups)
+		group = group_names[(id - 1) % ngroups];
 	fprintf(stdout, id ? child_fmt : parent_fmt,
-		mygroup, id, diff->tv_sec, diff->tv_usec / 1000,
-		(bytes / (diff->tv_sec * 1000000L + diff->tv_usec))
-		* 1000000L / 1024, iops[op]);
+		group, id, diff->tv_sec, diff->tv_usec / 1000,
+		kbps(bytes, diff), iops[op]);
+}
+
+static void join_cgroup(int id, const char *dir)
+{
+	char path[PATH_MAX], buf[32];
+	int fd, len;
+
+	snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		snprintf(path, sizeof(path), "%s/tasks", dir);
+		fd = open(path, O_WRONLY);
+	}
+	len = snprintf(buf, sizeof(buf), "%d", getpid());
+	if (fd < 0 || write(fd, buf, len) != len) {
+		fprintf(stderr, "ERROR: task %d couldn't join %s (%s)\n",
+			id, dir, strerror(errno));
+		exit(1);
+	}
+	close(fd);
+}
+
+/*
+ * One phase of a worker: op is OP_WRITE/OP_READ for the passes of the
+ * seq and rand modes, or OP_MIXED.  Runs for data_size bytes, or for
+ * runtime seconds when -T was given.  With -q the I/O is submitted
+ * through lio_{write,read}_buffers() a queue depth at a time.
+ */
+static int do_phase(int id, int fd, iops_t op, struct lio_buf *bufs,
+		    unsigned short *xsubi, size_t *moved)
+{
+	struct timeval start, t;
+	size_t n = 0, nchunks = data_size / chunk_size;
+	off_t off;
+	char *errmsg;
+	int i, k, ret, rd, nrd, nwr;
+	int method = LIO_IO_URING;
+	struct lio_buf *rbufs = bufs + qdepth, *wbufs = bufs + 2 * qdepth;
+
+	now(&start);
+	for (;;) {
+		if (runtime) {
+			now(&t);
+			timersub(&t, &start, &t);
+			if (t.tv_sec >= runtime)
+				break;
+		} else if (n >= data_size) {
+			break;
+		}
+
+		nrd = nwr = 0;
+		for (k = 0; k < qdepth; k++) {
+			if (mode == MODE_SEQ)
+				off = (n + k * chunk_size) % data_size;
+			else
+				off = (nrand48(xsubi) % nchunks) * chunk_size;
+
+			if (op == OP_MIXED)
+				rd = (int)(nrand48(xsubi) % 100) < read_pct;
+			else
+				rd = op == OP_READ;
+
+			if (qdepth == 1) {
+				if (rd)
+					ret = pread(fd, bufs[0].buffer,
+						    chunk_size, off);
+				else
+					ret = pwrite(fd, bufs[0].buffer,
+						     chunk_size, off);
+				if (ret < 0) {
+					fprintf(stderr, "ERROR: task %d %s "
+						"(%s)\n", id,
+						rd ? "reading" : "writing",
+						strerror(errno));
+					return 1;
+				}
+				n += ret;
+				__sync_fetch_and_add(&progress[id], ret);
+				continue;
+			}
+
+			if (rd) {
+				rbufs[nrd] = bufs[k];
+				rbufs[nrd++].offset = off;
+			} else {
+				wbufs[nwr] = bufs[k];
+				wbufs[nwr++].offset = off;
+			}
+		}
+		if (qdepth == 1)
+			continue;
+
+		/* Reads and writes of a mixed batch go out as two batches */
+		for (i = 0; i < 2; i++) {
+			if ((i ? nrd : nwr) == 0)
+				continue;
+again:
+			if (i)
+				ret = lio_read_buffers(fd, method, rbufs, nrd,
+						       0, &errmsg, 0);
+			else
+				ret = lio_write_buffers(fd, method, wbufs, nwr,
+							0, &errmsg, 0);
+			if ((ret == -ENOSYS || ret == -EPERM) &&
+			    method == LIO_IO_URING) {
+				/* no io_uring, fall back to POSIX aio */
+				method = LIO_IO_ASYNC | LIO_WAIT_RECALL;
+				goto again;
+			}
+			if (ret < 0) {
+				fprintf(stderr, "ERROR: task %d %s\n", id,
+					errmsg);
+				return 1;
+			}
+			n += ret;
+			__sync_fetch_and_add(&progress[id], ret);
+		}
+	}
+
+	now(&t);
+	timersub(&t, &start, &t);
+	print_results(id + 1, op, n, &t);
+	*moved += n;
+
+	return 0;
 }
 
 static void thread(int id)
 {
-	struct timeval start, stop, diff;
-	int fd, i, ret;
-	size_t n;
+	int fd, k, ret = 0;
+	struct lio_buf *bufs;
 	void *buf;
 	int flags = O_CREAT | O_RDWR | O_LARGEFILE;
 	char filename[32];
+	unsigned short xsubi[3];
+	size_t moved = 0;
 
-	ret = posix_memalign(&buf, PAGE_SIZE, chunk_size);
-	if (ret < 0) {
-		fprintf(stderr,
-			"ERROR: task %d couldn't allocate %zu bytes (%s)\n",
-			id, chunk_size, strerror(errno));
+	if (ngroups)
+		join_cgroup(id, groups[id % ngroups]);
+
+	xsubi[0] = getpid();
+	xsubi[1] = id;
+	xsubi[2] = time(NULL);
+
+	/* qdepth buffers, plus room to sort a batch into reads and writes */
+	bufs = calloc(3 * qdepth, sizeof(*bufs));
+	if (!bufs) {
+		fprintf(stderr, "ERROR: task %d out of memory\n", id);
 		exit(1);
 	}
-	memset(buf, 0xaa, chunk_size);
+	for (k = 0; k < qdepth; k++) {
+		ret = posix_memalign(&buf, PAGE_SIZE, chunk_size);
+		if (ret) {
+			fprintf(stderr,
+				"ERROR: task %d couldn't allocate %zu bytes (%s)\n",
+				id, chunk_size, strerror(ret));
+			exit(1);
+		}
+		memset(buf, 0xaa, chunk_size);
+		bufs[k].buffer = buf;
+		bufs[k].size = chunk_size;
+	}
 
 	snprintf(filename, sizeof(filename), "%s-%d-iobw.tmp", mygroup, id);
 	if (directio)
@@ -102,49 +301,30 @@ static void thread(int id)
 	if (fd < 0) {
 		fprintf(stderr, "ERROR: task %d couldn't open %s (%s)\n",
 			id, filename, strerror(errno));
-		free(buf);
 		exit(1);
 	}
 
-	/* Write */
-	lseek(fd, 0, SEEK_SET);
-	n = 0;
-	gettimeofday(&start, NULL);
-	while (n < data_size) {
-		i = write(fd, buf, chunk_size);
-		if (i < 0) {
-			fprintf(stderr, "ERROR: task %d writing to %s (%s)\n",
-				id, filename, strerror(errno));
-			ret = 1;
-			goto out;
-		}
-		n += i;
-	}
-	gettimeofday(&stop, NULL);
-	timersub(&stop, &start, &diff);
-	print_results(id + 1, OP_WRITE, data_size, &diff);
-
-	/* Read */
-	lseek(fd, 0, SEEK_SET);
-	n = 0;
-	gettimeofday(&start, NULL);
-	while (n < data_size) {
-		i = read(fd, buf, chunk_size);
-		if (i < 0) {
-			fprintf(stderr, "ERROR: task %d reading to %s (%s)\n",
+	if (mode == MODE_MIXED) {
+		/* Reads must not all land on holes */
+		if (posix_fallocate(fd, 0, data_size) != 0 &&
+		    ftruncate(fd, data_size) < 0) {
+			fprintf(stderr, "ERROR: task %d sizing %s (%s)\n",
 				id, filename, strerror(errno));
 			ret = 1;
 			goto out;
 		}
-		n += i;
+		ret = do_phase(id, fd, OP_MIXED, bufs, xsubi, &moved);
+	} else {
+		ret = do_phase(id, fd, OP_WRITE, bufs, xsubi, &moved);
+		if (!ret)
+			ret = do_phase(id, fd, OP_READ, bufs, xsubi, &moved);
 	}
-	gettimeofday(&stop, NULL);
-	timersub(&stop, &start, &diff);
-	print_results(id + 1, OP_READ, data_size, &diff);
 out:
 	close(fd);
 	unlink(filename);
-	free(buf);
+	for (k = 0; k < qdepth; k++)
+		free(bufs[k].buffer);
+	free(bufs);
 	exit(ret);
 }
 
@@ -208,18 +388,172 @@ unsigned long long memparse(char *ptr, char **retptr)
 	return ret;
 }
 
+/* Per group bandwidth samples, for the convergence report */
+static unsigned long **samples;
+static int nsamples, samples_cap;
+
+static int group_count(void)
+{
+	return ngroups ? ngroups : 1;
+}
+
+static const char *group_name(int g)
+{
+	return ngroups ? group_names[g] : mygroup;
+}
+
+static void sample(struct timeval *start, struct timeval *last,
+		   unsigned long *last_bytes)
+{
+	struct timeval t, diff, step;
+	unsigned long bytes;
+	int g, i;
+
+	now(&t);
+	timersub(&t, start, &diff);
+	timersub(&t, last, &step);
+	*last = t;
+
+	if (nsamples == samples_cap) {
+		samples_cap = samples_cap ? samples_cap * 2 : 64;
+		for (g = 0; g < group_count(); g++)
+			samples[g] = realloc(samples[g], samples_cap *
+					     sizeof(**samples));
+	}
+
+	for (g = 0; g < group_count(); g++) {
+		bytes = 0;
+		for (i = g; i < threads; i += group_count())
+			bytes += progress[i];
+		samples[g][nsamples] = kbps(bytes - last_bytes[g], &step);
+		last_bytes[g] = bytes;
+		fprintf(stdout, sample_fmt, group_name(g), nsamples,
+			diff.tv_sec, diff.tv_usec / 1000,
+			samples[g][nsamples], "IO   ");
+	}
+	fflush(stdout);
+	nsamples++;
+}
+
+/*
+ * With -L, report how long each group took to settle within
+ * CONVERGE_PCT of the limit and how far off it was from then on.
+ */
+static void report_convergence(void)
+{
+	unsigned long lo = limit_kbs * (100 - CONVERGE_PCT) / 100;
+	unsigned long hi = limit_kbs * (100 + CONVERGE_PCT) / 100;
+	unsigned long long sum;
+	unsigned long ms;
+	int g, i, first;
+
+	for (g = 0; g < group_count(); g++) {
+		/* The last sample usually covers a partial interval */
+		first = nsamples - 1;
+		while (first > 0 && samples[g][first - 1] >= lo &&
+		       samples[g][first - 1] <= hi)
+			first--;
+		if (nsamples < 2 || first == nsamples - 1) {
+			fprintf(stdout, "(%s) limit %lu KiB/s: did not "
+				"converge\n", group_name(g), limit_kbs);
+			continue;
+		}
+		sum = 0;
+		for (i = first; i < nsamples - 1; i++)
+			sum += samples[g][i];
+		sum /= nsamples - 1 - first;
+		ms = (unsigned long)first * interval_ms;
+		fprintf(stdout, "(%s) limit %lu KiB/s: converged after "
+			"%lu.%03lus, mean %llu KiB/s, err %+lld%%\n",
+			group_name(g), limit_kbs, ms / 1000, ms % 1000, sum,
+			((long long)sum - (long long)limit_kbs) * 100 /
+			(long long)limit_kbs);
+	}
+}
+
+static void parse_groups(char *list)
+{
+	char *tok, *base;
+
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+		groups = realloc(groups, (ngroups + 1) * sizeof(*groups));
+		group_names = realloc(group_names,
+				      (ngroups + 1) * sizeof(*group_names));
+		if (!groups || !group_names) {
+			fprintf(stderr, "ERROR: not enough memory\n");
+			exit(1);
+		}
+		base = strrchr(tok, '/');
+		groups[ngroups] = tok;
+		group_names[ngroups++] = base && base[1] ? base + 1 : tok;
+	}
+}
+
 int main(int argc, char *argv[])
 {
-	struct timeval start, stop, diff;
+	struct timeval start, stop, diff, last;
+	unsigned long *last_bytes;
+	size_t total = 0;
 	char *end;
-	int i;
+	int c, i, status, done;
+	pid_t pid;
 
-	if (argv[1] && strcmp(argv[1], "-direct") == 0) {
-		directio = 1;
-		argc--;
-		argv++;
+	/* "-direct" predates the other options and can't go to getopt */
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-direct") == 0) {
+			directio = 1;
+			memmove(&argv[i], &argv[i + 1],
+				(argc - i) * sizeof(*argv));
+			argc--;
+			break;
+		}
+		/* skip the argument of an option */
+		if (!argv[i][2] && strchr("mrqiTgL", argv[i][1]))
+			i++;
+	}
+
+	while ((c = getopt(argc, argv, "+m:r:q:i:T:g:L:")) != -1) {
+		switch (c) {
+		case 'm':
+			if (strcmp(optarg, "seq") == 0)
+				mode = MODE_SEQ;
+			else if (strcmp(optarg, "rand") == 0)
+				mode = MODE_RAND;
+			else if (strcmp(optarg, "mixed") == 0)
+				mode = MODE_MIXED;
+			else {
+				fprintf(stderr, usage);
+				exit(1);
+			}
+			break;
+		case 'r':
+			read_pct = atoi(optarg);
+			break;
+		case 'q':
+			qdepth = atoi(optarg);
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		case 'T':
+			runtime = atoi(optarg);
+			break;
+		case 'g':
+			parse_groups(optarg);
+			break;
+		case 'L':
+			limit_kbs = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, usage);
+			exit(1);
+		}
 	}
-	if (argc != 4) {
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	if (argc != 4 || qdepth < 1 || read_pct < 0 || read_pct > 100 ||
+	    interval_ms < 0 || runtime < 0 || (limit_kbs && !interval_ms)) {
 		fprintf(stderr, usage);
 		exit(1);
 	}
@@ -233,21 +567,30 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 	data_size = align(memparse(argv[3], &end), PAGE_SIZE);
-	if (*end) {
+	if (*end || data_size < chunk_size) {
 		fprintf(stderr, usage);
 		exit(1);
 	}
+	/* Whole chunks only, so random offsets stay chunk aligned */
+	data_size -= data_size % chunk_size;
 
 	/* retrieve group name */
 	mygroup = getenv("MYGROUP");
+	if (!mygroup && ngroups)
+		mygroup = group_names[0];
 	if (!mygroup) {
 		fprintf(stderr,
 			"ERROR: undefined environment variable MYGROUP\n");
 		exit(1);
 	}
 
-	children = malloc(sizeof(pid_t) * threads);
-	if (!children) {
+	children = calloc(threads, sizeof(pid_t));
+	progress = mmap(NULL, threads * sizeof(*progress),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+			-1, 0);
+	samples = calloc(group_count(), sizeof(*samples));
+	last_bytes = calloc(group_count(), sizeof(*last_bytes));
+	if (!children || progress == MAP_FAILED || !samples || !last_bytes) {
 		fprintf(stderr, "ERROR: not enough memory\n");
 		exit(1);
 	}
@@ -261,19 +604,44 @@ int main(int argc, char *argv[])
 		kb(chunk_size), kb(data_size));
 	fflush(stdout);
 
-	gettimeofday(&start, NULL);
+	now(&start);
+	last = start;
 	for (i = 0; i < threads; i++)
 		spawn(i);
-	for (i = 0; i < threads; i++) {
-		int status;
-		wait(&status);
-		if (!WIFEXITED(status))
-			exit(1);
+	for (done = 0; done < threads; ) {
+		if (interval_ms) {
+			/* Look for exited workers every 10ms between samples */
+			usleep(10000);
+			now(&stop);
+			timersub(&stop, &last, &diff);
+			if (diff.tv_sec * 1000 + diff.tv_usec / 1000 >=
+			    interval_ms)
+				sample(&start, &last, last_bytes);
+			pid = waitpid(-1, &status, WNOHANG);
+			if (pid == 0)
+				continue;
+		} else {
+			pid = wait(&status);
+		}
+		do {
+			if (pid < 0 || !WIFEXITED(status) ||
+			    WEXITSTATUS(status))
+				exit(1);
+			done++;
+		} while (done < threads &&
+			 (pid = waitpid(-1, &status, WNOHANG)) > 0);
 	}
-	gettimeofday(&stop, NULL);
+	now(&stop);
+	timersub(&stop, &last, &diff);
+	if (interval_ms && (diff.tv_sec || diff.tv_usec >= 1000))
+		sample(&start, &last, last_bytes);
 
+	for (i = 0; i < threads; i++)
+		total += progress[i];
 	timersub(&stop, &start, &diff);
-	print_results(0, NUM_IOPS, data_size * threads * NUM_IOPS, &diff);
+	print_results(0, NUM_IOPS, total, &diff);
+	if (limit_kbs)
+		report_convergence();
 	fflush(stdout);
 	free(children);
 
@@ -0,0 +1,223 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2013 Linux Test Project                                      */
+/*                                                                            */
+/* This program is free software;  you can redistribute it and/or modify      */
+/* it under the terms of the GNU General Public License as published by       */
+/* the Free Software Foundation; either version 2 of the License, or          */
+/* (at your option) any later version.                                        */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY;  without even the implied warranty of            */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See                  */
+/* the GNU General Public License for more details.                           */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License          */
+/* along with this program;  if not, write to the Free Software               */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA    */
+/*                                                                            */
+/******************************************************************************/
+
+/******************************************************************************/
+/*                                                                            */
+/* File:        cgroup_tree.c                                                 */
+/*                                                                            */
+/* Description: Helpers for the tests which create their own numbered         */
+/*              cgroups under <mnt>/<prefix>.<pid>, on a cgroup v1            */
+/*              controller mount or a cgroup v2 hierarchy. They report        */
+/*              errors through tst_brkm(), so unlike the rest of the          */
+/*              library they need -lltp after -lcontrollers.                  */
+/*                                                                            */
+/******************************************************************************/
+
+#include <sys/mount.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "test.h"
+#include "libcontrollers.h"
+
+/*
+ * Function: cgroup_setup()
+ * Mounts the v1 controller at mnt when mount_it is set, else uses the
+ * existing mount there, and tells cgroup v2 from v1. A v1 mount must have
+ * v1_file. The mount point is limited to CGROUP_MNT_MAX so that all of the
+ * paths built from it fit a tst_res message.
+ */
+
+void cgroup_setup(struct cgroup_tree *cg, const char *mnt, int mount_it,
+		  const char *controller, const char *v1_file,
+		  void (*cleanup_fn)(void))
+{
+	char path[PATH_MAX];
+
+	memset(cg, 0, sizeof(*cg));
+	if (strlen(mnt) > CGROUP_MNT_MAX)
+		tst_brkm(TBROK, NULL, "mount point is longer than %d bytes",
+			 CGROUP_MNT_MAX);
+	cg->mnt = mnt;
+
+	if (mount_it) {
+		if (mkdir(mnt, 0755) == -1 && errno != EEXIST)
+			tst_brkm(TBROK | TERRNO, NULL, "mkdir %s", mnt);
+		if (mount(controller, mnt, "cgroup", 0, controller) == -1) {
+			rmdir(mnt);
+			tst_brkm(TCONF | TERRNO, NULL, "can't mount the %s "
+				 "controller, pass a cgroup mount with -m",
+				 controller);
+		}
+		cg->mounted = 1;
+	}
+
+	snprintf(path, sizeof(path), "%s/cgroup.controllers", mnt);
+	cg->cgroup2 = access(path, F_OK) == 0;
+	snprintf(path, sizeof(path), "%s/%s", mnt, v1_file);
+	if (!cg->cgroup2 && access(path, F_OK) == -1)
+		tst_brkm(TCONF, cleanup_fn, "%s is not a %s cgroup mount",
+			 mnt, controller);
+}
+
+/*
+ * Function: cgroup_make_groups()
+ * Creates <mnt>/<prefix>.<pid> and the groups 0 to ngroups - 1 in it,
+ * enabling the controller for them on cgroup v2.
+ */
+
+void cgroup_make_groups(struct cgroup_tree *cg, const char *prefix,
+			const char *controller, int ngroups,
+			void (*cleanup_fn)(void))
+{
+	char path[PATH_MAX], buf[64];
+	int g;
+
+	snprintf(cg->basedir, sizeof(cg->basedir), "%s/%.31s.%d", cg->mnt,
+		 prefix, getpid());
+	if (mkdir(cg->basedir, 0755) == -1) {
+		snprintf(path, sizeof(path), "%s", cg->basedir);
+		cg->basedir[0] = '\0';
+		tst_brkm(TBROK | TERRNO, cleanup_fn, "mkdir %s", path);
+	}
+
+	if (cg->cgroup2) {
+		snprintf(buf, sizeof(buf), "+%s", controller);
+		snprintf(path, sizeof(path), "%s/cgroup.subtree_control",
+			 cg->mnt);
+		write_str_to_file(path, buf);
+		snprintf(path, sizeof(path), "%s/cgroup.subtree_control",
+			 cg->basedir);
+		if (write_str_to_file(path, buf) == -1)
+			tst_brkm(TCONF | TERRNO, cleanup_fn, "can't enable the "
+				 "%s controller in %s", controller,
+				 cg->basedir);
+	}
+
+	for (g = 0; g < ngroups; g++) {
+		cgroup_path(cg, path, g, NULL);
+		if (mkdir(path, 0755) == -1)
+			tst_brkm(TBROK | TERRNO, cleanup_fn, "mkdir %s", path);
+		cg->groups_made++;
+	}
+}
+
+/*
+ * Function: cgroup_path()
+ * Puts the path of the group, or of the file in it, into buf, which must
+ * hold PATH_MAX bytes.
+ */
+
+void cgroup_path(const struct cgroup_tree *cg, char *buf, int group,
+		 const char *file)
+{
+	if (file)
+		snprintf(buf, PATH_MAX, "%s/%d/%s", cg->basedir, group, file);
+	else
+		snprintf(buf, PATH_MAX, "%s/%d", cg->basedir, group);
+}
+
+/*
+ * Function: cgroup_cleanup()
+ * Removes the groups, which must be empty by now, and unmounts what
+ * cgroup_setup() mounted. Safe to call at any point of the setup.
+ */
+
+void cgroup_cleanup(struct cgroup_tree *cg)
+{
+	char path[PATH_MAX];
+	int g;
+
+	for (g = 0; g < cg->groups_made; g++) {
+		cgroup_path(cg, path, g, NULL);
+		if (rmdir(path) == -1)
+			tst_resm(TWARN | TERRNO, "rmdir %s", path);
+	}
+	cg->groups_made = 0;
+	if (cg->basedir[0] && rmdir(cg->basedir) == -1)
+		tst_resm(TWARN | TERRNO, "rmdir %s", cg->basedir);
+	cg->basedir[0] = '\0';
+
+	if (cg->mounted) {
+		if (umount(cg->mnt) == -1)
+			tst_resm(TWARN | TERRNO, "umount %s", cg->mnt);
+		rmdir(cg->mnt);
+		cg->mounted = 0;
+	}
+}
+
+/*
+ * Function: write_str_to_file()
+ * Writes str to the file at path in a single write(), as the cgroup files
+ * want it. Returns 0 if success
+ */
+
+int write_str_to_file(const char *path, const char *str)
+{
+	int fd, ret = 0;
+
+	fd = open(path, O_WRONLY);
+	if (fd == -1)
+		return -1;
+	if (write(fd, str, strlen(str)) != (ssize_t)strlen(str))
+		ret = -1;
+	close(fd);
+	return ret;
+}
+
+/*
+ * Function: hist_pct()
+ * Returns the upper bound of the bucket of a log2 histogram (bucket i
+ * counts values below 2^(i + 1)) which holds the pct percentile.
+ */
+
+unsigned long hist_pct(const unsigned long *hist, int nbuckets, double pct)
+{
+	unsigned long total = 0, sum = 0;
+	int i;
+
+	for (i = 0; i < nbuckets; i++)
+		total += hist[i];
+	if (total == 0)
+		return 0;
+	for (i = 0; i < nbuckets; i++) {
+		sum += hist[i];
+		if (sum >= total * pct / 100)
+			break;
+	}
+	return 2UL << (i < nbuckets ? i : nbuckets - 1);
+}
+
+/*
+ * Function: parse_num()
+ * Parses a decimal option value, TBROKs if it is not within min and max.
+ */
+
+long parse_num(const char *str, const char *what, long min, long max)
+{
+	char *end;
+	long val;
+
+	val = strtol(str, &end, 10);
+	if (*end != '\0' || val < min || val > max)
+		tst_brkm(TBROK, NULL, "invalid %s '%.64s' (%ld-%ld)", what, str,
+			 min, max);
+	return val;
+}
@@ -188,6 +188,66 @@ int write_to_file(char *file, const char *mode, unsigned int value)
 	return 0;
 }
 
+/* Function: read_schedstat()
+ * Reads the run time, the run queue wait time (both in ns) and the number
+ * of timeslices from an open /proc/<pid>/schedstat fd. The fd is read with
+ * pread() so that it can be kept open and sampled often. Returns 0 if success
+ */
+
+int read_schedstat(int fd, unsigned long long *run, unsigned long long *wait,
+		   unsigned long long *slices)
+{
+	char buf[128];
+	ssize_t len;
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return -1;
+	buf[len] = 0;
+	if (sscanf(buf, "%llu %llu %llu", run, wait, slices) != 3)
+		return -1;
+	return 0;
+}
+
+/* Function: read_stat_values()
+ * Looks up nkeys keys in an open "key value" per line file (cpu.stat etc.)
+ * with a single pread(). Keys which are not found leave their value alone.
+ * Returns the number of keys found or -1 if the file can not be read
+ */
+
+int read_stat_values(int fd, const char **keys, unsigned long long *values,
+		     int nkeys)
+{
+	char buf[4096], *line, *next, *val;
+	ssize_t len;
+	int i, found = 0;
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len < 0)
+		return -1;
+	buf[len] = 0;
+
+	for (line = buf; *line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = 0;
+		else
+			next = line + strlen(line);
+		val = strchr(line, ' ');
+		if (val == NULL)
+			continue;
+		*val++ = 0;
+		for (i = 0; i < nkeys; i++) {
+			if (strcmp(line, keys[i]) == 0) {
+				values[i] = strtoull(val, NULL, 10);
+				found++;
+				break;
+			}
+		}
+	}
+	return found;
+}
+
 /* Function: signal_handler_alarm()
  * signal handler for the new action
  */
@@ -80,6 +80,42 @@ int scan_shares_files(unsigned int *shares_pointer);
 
 int write_to_file (char * file, const char* mode, unsigned int value);
 
+int read_schedstat(int fd, unsigned long long *run, unsigned long long *wait,
+		   unsigned long long *slices);
+
+int read_stat_values(int fd, const char **keys, unsigned long long *values,
+		     int nkeys);
+
+/* Numbered test groups under <mnt>/<prefix>.<pid>, see cgroup_tree.c */
+#define CGROUP_MNT_MAX	1024	/* paths built from it fit a tst_res message */
+
+struct cgroup_tree {
+	const char *mnt;
+	char basedir[CGROUP_MNT_MAX + 64];
+	int mounted;
+	int cgroup2;
+	int groups_made;
+};
+
+void cgroup_setup(struct cgroup_tree *cg, const char *mnt, int mount_it,
+		  const char *controller, const char *v1_file,
+		  void (*cleanup_fn)(void));
+
+void cgroup_make_groups(struct cgroup_tree *cg, const char *prefix,
+			const char *controller, int ngroups,
+			void (*cleanup_fn)(void));
+
+void cgroup_path(const struct cgroup_tree *cg, char *buf, int group,
+		 const char *file);
+
+void cgroup_cleanup(struct cgroup_tree *cg);
+
+int write_str_to_file(const char *path, const char *str);
+
+unsigned long hist_pct(const unsigned long *hist, int nbuckets, double pct);
+
+long parse_num(const char *str, const char *what, long min, long max);
+
 void signal_handler_alarm (int signal );
 
 void signal_handler_sigusr2 (int signal);
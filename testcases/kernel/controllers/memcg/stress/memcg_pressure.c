@@ -0,0 +1,635 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2013 Linux Test Project                                      */
+/*                                                                            */
+/* This program is free software;  you can redistribute it and/or modify      */
+/* it under the terms of the GNU General Public License as published by       */
+/* the Free Software Foundation; either version 2 of the License, or          */
+/* (at your option) any later version.                                        */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY;  without even the implied warranty of            */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See                  */
+/* the GNU General Public License for more details.                           */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License          */
+/* along with this program;  if not, write to the Free Software               */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA    */
+/*                                                                            */
+/******************************************************************************/
+/*
+ * Multi-tenant memcg pressure generator.
+ *
+ * Creates N memory cgroups and runs P worker processes in each.  Every
+ * worker owns a working set made of a file backed part (page cache, read)
+ * and an anonymous part (written), and keeps accessing it with a uniform,
+ * zipf or sequential page distribution.  A configurable share of the
+ * accesses first drop the page (MADV_DONTNEED, plus POSIX_FADV_DONTNEED
+ * for file pages) so that it has to be faulted in again.
+ *
+ * Every access is timed into a per group log2 latency histogram, and the
+ * parent samples memory.stat of all of the groups at a fixed interval,
+ * printing the totals, the latency percentiles and how long reading
+ * memory.stat of all of the groups took.
+ *
+ * Works with the cgroup v1 memory controller (mounted at /dev/memcg like
+ * memcg_stress_test.sh does, unless -m points at an existing mount) as
+ * well as with a cgroup v2 hierarchy passed with -m.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "usctest.h"
+#include "safe_macros.h"
+#include "libcontrollers.h"
+
+char *TCID = "memcg_pressure";
+int TST_TOTAL = 1;
+
+#define MEMCG_MNT		"/dev/memcg"
+#define GROUP_PREFIX		"ltp_pressure"
+#define HIST_BUCKETS		40	/* log2(ns), up to ~18 minutes */
+#define BATCH			4096	/* accesses between histogram merges */
+
+enum dist { DIST_UNIFORM, DIST_ZIPF, DIST_SEQ };
+
+static const char *dist_names[] = { "uniform", "zipf", "seq" };
+
+/* Summed over all groups at every sample; missing keys are skipped */
+static const char *stat_keys[] = {
+	"rss", "cache", "anon", "file", "pgfault", "pgmajfault",
+	"workingset_refault", "workingset_refault_anon",
+	"workingset_refault_file", "pgscan", "pgsteal",
+};
+#define NR_STAT_KEYS	(sizeof(stat_keys) / sizeof(stat_keys[0]))
+
+struct group_stats {
+	unsigned long accesses;
+	unsigned long dropped;
+	unsigned long minflt;
+	unsigned long majflt;
+	unsigned long max_ns;
+	unsigned long hist[HIST_BUCKETS];
+};
+
+struct shared {
+	volatile int go;
+	volatile int stop;
+	int ready;
+	struct group_stats group[];
+};
+
+static int opt_groups, opt_wset, opt_limit, opt_dist, opt_file;
+static int opt_refault, opt_procs, opt_time, opt_interval, opt_mnt;
+static int opt_zipf, opt_verbose;
+static char *groups_str, *wset_str, *limit_str, *dist_str, *file_str;
+static char *refault_str, *procs_str, *time_str, *interval_str, *mnt_str;
+static char *zipf_str;
+
+static option_t options[] = {
+	{"g:", &opt_groups, &groups_str},
+	{"w:", &opt_wset, &wset_str},
+	{"l:", &opt_limit, &limit_str},
+	{"d:", &opt_dist, &dist_str},
+	{"F:", &opt_file, &file_str},
+	{"r:", &opt_refault, &refault_str},
+	{"n:", &opt_procs, &procs_str},
+	{"T:", &opt_time, &time_str},
+	{"s:", &opt_interval, &interval_str},
+	{"m:", &opt_mnt, &mnt_str},
+	{"z:", &opt_zipf, &zipf_str},
+	{"v", &opt_verbose, NULL},
+	{NULL, NULL, NULL}
+};
+
+static int ngroups = 8;
+static int nprocs = 1;
+static long wset_mb = 64;
+static long limit_mb;
+static enum dist dist = DIST_UNIFORM;
+static int file_pct = 50;
+static int refault_pct;
+static int runtime = 60;
+static int interval = 5;
+static double zipf_s = 1.0;
+
+static char *mnt = MEMCG_MNT;
+static struct cgroup_tree cg;
+static int tmpdir_made;
+
+static struct shared *shm;
+static size_t shm_size;
+static pid_t *pids;
+static int npids;
+
+static long pagesize;
+
+static void setup(void);
+static void cleanup(void);
+static void help(void);
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* Worker */
+
+static unsigned long rnd_state;
+
+static unsigned long rnd(void)
+{
+	/* xorshift64* */
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return rnd_state * 2685821657736338717UL;
+}
+
+static double *zipf_build(long npages)
+{
+	double *cdf, sum = 0;
+	long i;
+
+	cdf = malloc(npages * sizeof(*cdf));
+	if (cdf == NULL)
+		return NULL;
+	for (i = 0; i < npages; i++) {
+		sum += 1.0 / pow(i + 1, zipf_s);
+		cdf[i] = sum;
+	}
+	for (i = 0; i < npages; i++)
+		cdf[i] /= sum;
+	return cdf;
+}
+
+static long zipf_rank(const double *cdf, long npages)
+{
+	double u = (rnd() >> 11) * (1.0 / 9007199254740992.0);
+	long lo = 0, hi = npages - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static long gcd(long a, long b)
+{
+	while (b) {
+		long t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static void merge_stats(struct group_stats *gs, unsigned long *hist,
+			unsigned long accesses, unsigned long dropped,
+			unsigned long max_ns)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (hist[i])
+			__sync_fetch_and_add(&gs->hist[i], hist[i]);
+		hist[i] = 0;
+	}
+	__sync_fetch_and_add(&gs->accesses, accesses);
+	__sync_fetch_and_add(&gs->dropped, dropped);
+	while (max_ns > gs->max_ns)
+		__sync_val_compare_and_swap(&gs->max_ns, gs->max_ns, max_ns);
+}
+
+static void worker(int group, int proc)
+{
+	struct group_stats *gs = &shm->group[group];
+	unsigned long hist[HIST_BUCKETS] = { 0 };
+	unsigned long t, dropped = 0, max_ns = 0;
+	unsigned long seq = 0;
+	long npages, nfile, page, rank, stride, i;
+	char path[PATH_MAX], buf[32], *file_map = NULL, *anon_map = NULL;
+	char *p;
+	double *cdf = NULL;
+	volatile char sink;
+	struct rusage ru;
+	int fd = -1, k, b;
+
+	/* Join the group before touching anything so it all gets charged */
+	cgroup_path(&cg, path, group, "cgroup.procs");
+	snprintf(buf, sizeof(buf), "%d", getpid());
+	if (write_str_to_file(path, buf) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "write %s", path);
+
+	rnd_state = (now_ns() ^ ((unsigned long)getpid() << 32)) | 1;
+
+	npages = wset_mb * (1024 * 1024 / pagesize) / nprocs;
+	if (npages < 1)
+		npages = 1;
+	nfile = npages * file_pct / 100;
+
+	if (nfile) {
+		snprintf(path, sizeof(path), "pressure.%d.%d", group, proc);
+		fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (fd == -1)
+			tst_brkm(TBROK | TERRNO, NULL, "open %s", path);
+		unlink(path);
+		p = malloc(pagesize);
+		if (p == NULL)
+			tst_brkm(TBROK | TERRNO, NULL, "malloc");
+		memset(p, 'f', pagesize);
+		for (i = 0; i < nfile; i++)
+			if (write(fd, p, pagesize) != pagesize)
+				tst_brkm(TBROK | TERRNO, NULL, "write %s",
+					 path);
+		free(p);
+		file_map = mmap(NULL, nfile * pagesize, PROT_READ, MAP_SHARED,
+				fd, 0);
+		if (file_map == MAP_FAILED)
+			tst_brkm(TBROK | TERRNO, NULL, "mmap file");
+	}
+	if (npages > nfile) {
+		anon_map = mmap(NULL, (npages - nfile) * pagesize,
+				PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (anon_map == MAP_FAILED)
+			tst_brkm(TBROK | TERRNO, NULL, "mmap anon");
+		memset(anon_map, 'a', (npages - nfile) * pagesize);
+	}
+
+	if (dist == DIST_ZIPF) {
+		cdf = zipf_build(npages);
+		if (cdf == NULL)
+			tst_brkm(TBROK | TERRNO, NULL, "malloc");
+	}
+	/* Scatter zipf ranks over both parts instead of making the file hot */
+	stride = (long)(npages * 0.618) | 1;
+	while (npages > 1 && gcd(stride, npages) != 1)
+		stride += 2;
+
+	__sync_fetch_and_add(&shm->ready, 1);
+	while (!shm->go && !shm->stop)
+		usleep(1000);
+
+	while (!shm->stop) {
+		for (k = 0; k < BATCH; k++) {
+			switch (dist) {
+			case DIST_SEQ:
+				page = seq++ % npages;
+				break;
+			case DIST_ZIPF:
+				rank = zipf_rank(cdf, npages);
+				page = (rank * stride) % npages;
+				break;
+			default:
+				page = rnd() % npages;
+			}
+
+			if (page < nfile)
+				p = file_map + page * pagesize;
+			else
+				p = anon_map + (page - nfile) * pagesize;
+
+			if (refault_pct && (int)(rnd() % 100) < refault_pct) {
+				madvise(p, pagesize, MADV_DONTNEED);
+				if (page < nfile)
+					posix_fadvise(fd, page * pagesize,
+						      pagesize,
+						      POSIX_FADV_DONTNEED);
+				dropped++;
+			}
+
+			t = now_ns();
+			if (page < nfile)
+				sink = *p;
+			else
+				*p = (char)k;
+			t = now_ns() - t;
+
+			for (b = 0; b < HIST_BUCKETS - 1 && (t >> (b + 1)); b++)
+				;
+			hist[b]++;
+			if (t > max_ns)
+				max_ns = t;
+		}
+		merge_stats(gs, hist, BATCH, dropped, max_ns);
+		dropped = 0;
+	}
+	(void)sink;
+
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+		__sync_fetch_and_add(&gs->minflt, ru.ru_minflt);
+		__sync_fetch_and_add(&gs->majflt, ru.ru_majflt);
+	}
+
+	exit(0);
+}
+
+/* Parent */
+
+static void hist_add(unsigned long *dst, const struct group_stats *gs)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst[i] += gs->hist[i];
+}
+
+/* Upper bound of the bucket holding the pct percentile, in ns */
+#define PCT(hist, pct)	hist_pct(hist, HIST_BUCKETS, pct)
+
+static int read_memory_stat(int group, unsigned long long *vals, int *found)
+{
+	char path[PATH_MAX], key[64];
+	unsigned long long val;
+	unsigned int i;
+	FILE *fp;
+
+	cgroup_path(&cg, path, group, "memory.stat");
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	while (fscanf(fp, "%63s %llu", key, &val) == 2) {
+		for (i = 0; i < NR_STAT_KEYS; i++) {
+			if (strcmp(key, stat_keys[i]) == 0) {
+				vals[i] += val;
+				found[i] = 1;
+				break;
+			}
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+static void sample(int elapsed, int step, unsigned long *last_accesses)
+{
+	unsigned long long vals[NR_STAT_KEYS] = { 0 };
+	int found[NR_STAT_KEYS] = { 0 };
+	unsigned long hist[HIST_BUCKETS] = { 0 };
+	unsigned long accesses = 0, t;
+	char line[BUFSIZ];
+	size_t len;
+	unsigned int i;
+	int g;
+
+	t = now_ns();
+	for (g = 0; g < ngroups; g++)
+		read_memory_stat(g, vals, found);
+	t = now_ns() - t;
+
+	for (g = 0; g < ngroups; g++) {
+		accesses += shm->group[g].accesses;
+		hist_add(hist, &shm->group[g]);
+	}
+
+	len = snprintf(line, sizeof(line), "t=%ds %lu acc/s p50 %luns "
+		       "p99 %luns p99.9 %luns", elapsed,
+		       (accesses - *last_accesses) / step,
+		       PCT(hist, 50), PCT(hist, 99),
+		       PCT(hist, 99.9));
+	for (i = 0; i < NR_STAT_KEYS && len < sizeof(line); i++)
+		if (found[i])
+			len += snprintf(line + len, sizeof(line) - len,
+					" %s=%llu", stat_keys[i], vals[i]);
+	if (len < sizeof(line))
+		snprintf(line + len, sizeof(line) - len,
+			 " (memory.stat x%d in %luus)", ngroups, t / 1000);
+	tst_resm(TINFO, "%s", line);
+
+	*last_accesses = accesses;
+}
+
+static void make_groups(void)
+{
+	char path[PATH_MAX], buf[64];
+	const char *limit_file;
+	int g;
+
+	cgroup_make_groups(&cg, GROUP_PREFIX, "memory", ngroups, cleanup);
+	if (!limit_mb)
+		return;
+
+	limit_file = cg.cgroup2 ? "memory.max" : "memory.limit_in_bytes";
+	snprintf(buf, sizeof(buf), "%ld", limit_mb << 20);
+	for (g = 0; g < ngroups; g++) {
+		cgroup_path(&cg, path, g, limit_file);
+		if (write_str_to_file(path, buf) == -1)
+			tst_brkm(TBROK | TERRNO, cleanup, "write %s", path);
+	}
+}
+
+static void run(void)
+{
+	unsigned long last_accesses = 0, hist[HIST_BUCKETS];
+	unsigned long accesses = 0, dropped = 0, minflt = 0, majflt = 0;
+	unsigned long max_ns = 0;
+	struct group_stats *gs;
+	int g, p, status, elapsed, step, failed = 0;
+	pid_t pid;
+
+	npids = ngroups * nprocs;
+	pids = calloc(npids, sizeof(*pids));
+	shm_size = sizeof(*shm) + ngroups * sizeof(struct group_stats);
+	shm = mmap(NULL, shm_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (pids == NULL || shm == MAP_FAILED)
+		tst_brkm(TBROK | TERRNO, cleanup, "allocating shared state");
+
+	make_groups();
+
+	tst_resm(TINFO, "%d groups x %d procs, %ld MB working set per group "
+		 "(%d%% page cache), limit %ld MB, %s access, %d%% dropped",
+		 ngroups, nprocs, wset_mb, file_pct, limit_mb,
+		 dist_names[dist], refault_pct);
+
+	for (g = 0; g < ngroups; g++) {
+		for (p = 0; p < nprocs; p++) {
+			fflush(stdout);
+			pid = fork();
+			if (pid == -1)
+				tst_brkm(TBROK | TERRNO, cleanup, "fork");
+			if (pid == 0)
+				worker(g, p);
+			pids[g * nprocs + p] = pid;
+		}
+	}
+
+	/* Every worker has its working set faulted in before the clock runs */
+	while (shm->ready < npids) {
+		pid = waitpid(-1, &status, WNOHANG);
+		if (pid > 0)
+			tst_brkm(TBROK, cleanup, "worker %d died during setup",
+				 pid);
+		usleep(10000);
+	}
+	shm->go = 1;
+
+	for (elapsed = 0; elapsed < runtime; elapsed += step) {
+		step = interval < runtime - elapsed ? interval :
+		       runtime - elapsed;
+		sleep(step);
+		sample(elapsed + step, step, &last_accesses);
+	}
+
+	shm->stop = 1;
+	while ((pid = wait(&status)) > 0)
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			tst_resm(TINFO, "worker %d: status %d", pid, status);
+			failed++;
+		}
+	npids = 0;
+
+	memset(hist, 0, sizeof(hist));
+	for (g = 0; g < ngroups; g++) {
+		gs = &shm->group[g];
+		hist_add(hist, gs);
+		accesses += gs->accesses;
+		dropped += gs->dropped;
+		minflt += gs->minflt;
+		majflt += gs->majflt;
+		if (gs->max_ns > max_ns)
+			max_ns = gs->max_ns;
+		if (opt_verbose)
+			tst_resm(TINFO, "group %d: %lu accesses, %lu dropped, "
+				 "%lu minflt, %lu majflt, p50 %luns p99 %luns "
+				 "max %luns", g, gs->accesses, gs->dropped,
+				 gs->minflt, gs->majflt,
+				 PCT(gs->hist, 50), PCT(gs->hist, 99),
+				 gs->max_ns);
+	}
+
+	tst_resm(TINFO, "total: %lu accesses, %lu dropped, %lu minflt, "
+		 "%lu majflt, p50 %luns p99 %luns p99.9 %luns max %luns",
+		 accesses, dropped, minflt, majflt, PCT(hist, 50),
+		 PCT(hist, 99), PCT(hist, 99.9), max_ns);
+
+	if (failed)
+		tst_resm(TFAIL, "%d of %d workers were killed or failed",
+			 failed, ngroups * nprocs);
+	else
+		tst_resm(TPASS, "%d groups ran for %ds", ngroups, runtime);
+}
+
+int main(int argc, char *argv[])
+{
+	char *msg;
+	int i;
+
+	msg = parse_opts(argc, argv, options, help);
+	if (msg != NULL)
+		tst_brkm(TBROK, NULL, "OPTION PARSING ERROR - %s", msg);
+
+	if (opt_groups)
+		ngroups = parse_num(groups_str, "groups", 1, 100000);
+	if (opt_procs)
+		nprocs = parse_num(procs_str, "procs", 1, 10000);
+	if (opt_wset)
+		wset_mb = parse_num(wset_str, "working set", 1, 1 << 20);
+	if (opt_limit)
+		limit_mb = parse_num(limit_str, "limit", 0, 1 << 20);
+	if (opt_file)
+		file_pct = parse_num(file_str, "page cache share", 0, 100);
+	if (opt_refault)
+		refault_pct = parse_num(refault_str, "refault rate", 0, 100);
+	if (opt_time)
+		runtime = parse_num(time_str, "runtime", 1, INT_MAX);
+	if (opt_interval)
+		interval = parse_num(interval_str, "interval", 1, INT_MAX);
+	if (opt_mnt)
+		mnt = mnt_str;
+	if (opt_zipf) {
+		zipf_s = atof(zipf_str);
+		if (zipf_s <= 0)
+			tst_brkm(TBROK, NULL, "invalid zipf exponent '%s'",
+				 zipf_str);
+	}
+	if (opt_dist) {
+		for (i = 0; i < 3; i++)
+			if (strcmp(dist_str, dist_names[i]) == 0)
+				break;
+		if (i == 3)
+			tst_brkm(TBROK, NULL, "invalid distribution '%s'",
+				 dist_str);
+		dist = i;
+	}
+
+	setup();
+	run();
+	cleanup();
+	tst_exit();
+}
+
+static void setup(void)
+{
+	tst_require_root(NULL);
+
+	pagesize = sysconf(_SC_PAGESIZE);
+
+	cgroup_setup(&cg, mnt, !opt_mnt, "memory", "memory.stat", cleanup);
+
+	/* The workers create their page cache files here */
+	tst_tmpdir();
+	tmpdir_made = 1;
+
+	TEST_PAUSE;
+}
+
+static void cleanup(void)
+{
+	int i;
+
+	TEST_CLEANUP;
+
+	if (shm != NULL && shm != MAP_FAILED)
+		shm->stop = 1;
+	for (i = 0; i < npids; i++)
+		if (pids[i] > 0)
+			kill(pids[i], SIGKILL);
+	while (wait(NULL) > 0)
+		;
+
+	/* The workers are gone, so the groups are empty and can go too */
+	cgroup_cleanup(&cg);
+
+	if (tmpdir_made)
+		tst_rmdir();
+}
+
+static void help(void)
+{
+	printf("  -g n    number of memory cgroups (default 8)\n");
+	printf("  -n n    worker processes per group (default 1)\n");
+	printf("  -w MB   working set per group (default 64)\n");
+	printf("  -l MB   memory limit per group, 0 for none (default 0)\n");
+	printf("  -F pct  page cache share of the working set (default 50)\n");
+	printf("  -d dist access distribution: uniform, zipf or seq\n");
+	printf("  -z s    zipf exponent (default 1.0)\n");
+	printf("  -r pct  accesses that drop the page first (default 0)\n");
+	printf("  -T sec  run time (default 60)\n");
+	printf("  -s sec  memory.stat sampling interval (default 5)\n");
+	printf("  -m dir  existing memory cgroup (v1 or v2) mount\n");
+	printf("  -v      print per group results\n");
+}
@@ -110,6 +110,9 @@ int shrinkfile(int fd, char *filename, int trunc_incr,
 	       int trunc_inter, int just_trunc);
 int check_write(int fd, int cf_inter, char *filename, int mode);
 int check_file(int fd, int cf_inter, char *filename, int no_file_check);
+int check_file_incr(int fd, char *filename, int fsize);
+void chk_invalidate(off_t offset);
+void chk_report(void);
 int file_size(int fd);
 int lkfile(int fd, int operation, int lklevel);
 
@@ -144,6 +147,8 @@ void myexit(int x)
 			/* only tlibio.c functions will be used */
 #else
 #include "tlibio.h"
+static int read_chunks(int fd, char *buf, int offset, int left,
+		       char **errmsg);
 #endif
 
 #ifndef PATH_MAX
@@ -168,6 +173,7 @@ int open_flags = O_RDWR | O_CREAT;	/* open flags */
 #endif
 
 #define MAX_FC_READ	196608	/* 4096 * 48 - 48 blocks */
+#define FC_BATCH	4	/* MAX_FC_READ chunks per lio_read_buffers() */
 
 #define PATTERN_ASCII	1	/* repeating alphabet letter pattern */
 				/* allows multiple writers and to be checked */
@@ -243,6 +249,34 @@ int Sync_with_others = 0;	/* Flag indicating to stop other if we stop before DON
 int Iter_cnt = 0;		/* contains current iteration count value */
 char TagName[40];		/* name of this growfiles (see Monster)     */
 
+/*
+ * Incremental file check (-K).  Every file has an index with a checksum
+ * of each IDX_BLKSZ block verified so far.  A file check then verifies
+ * only the blocks written or truncated since the last one, plus a random
+ * sample of the older blocks, whose checksums are compared to the index.
+ */
+#define IDX_BLKSZ	65536	/* MAX_FC_READ must be a multiple */
+
+struct chk_index {
+	uint32_t *cksum;	/* checksum of every indexed block */
+	int nblks;		/* entries allocated in cksum */
+	off_t valid;		/* bytes of the file the index is good for */
+};
+
+int Chk_incr = 0;		/* set by -K */
+struct chk_index *Chk_index = NULL;	/* one per file */
+struct chk_index *Chk_cur = NULL;	/* index of the file being worked on */
+int Chk_sample = 0;		/* old blocks sampled every file check */
+int Chk_full_inter = 0;		/* every Nth file check reads everything */
+int Chk_checks = 0;		/* file checks done */
+int Chk_full_checks = 0;	/* of which full scans */
+long long Chk_bytes_read = 0;	/* read by file checks */
+long long Chk_bytes_file = 0;	/* file size summed over the file checks */
+long long Chk_usecs = 0;	/* spent in file checks */
+long long Chk_new_blks = 0;	/* blocks verified because they changed */
+long long Chk_old_blks = 0;	/* unchanged blocks, summed over checks */
+long long Chk_sampled_blks = 0;	/* unchanged blocks re-verified */
+
 struct fileinfo_t {
 	char *filename;
 	int fd;
@@ -409,7 +443,7 @@ int main(int argc, char **argv)
 	 * Process options
 	 */
 	while ((ind = getopt(argc, argv,
-			     "hB:C:c:bd:D:e:Ef:g:H:I:i:lL:n:N:O:o:pP:q:wt:r:R:s:S:T:uU:W:xy"))
+			     "hB:C:c:bd:D:e:Ef:g:H:I:i:K:lL:n:N:O:o:pP:q:wt:r:R:s:S:T:uU:W:xy"))
 	       != EOF) {
 		switch (ind) {
 
@@ -591,6 +625,19 @@ int main(int argc, char **argv)
 #endif
 			break;
 
+		case 'K':
+			if (sscanf(optarg, "%i:%i", &Chk_sample,
+				   &Chk_full_inter) < 1 || Chk_sample < 0
+			    || Chk_full_inter < 0) {
+				fprintf(stderr,
+					"%s%s: --K option arg invalid\n",
+					Progname, TagName);
+				usage();
+				exit(1);
+			}
+			Chk_incr = 1;
+			break;
+
 		case 'l':
 			lockfile++;
 			if (lockfile > 2)
@@ -1290,6 +1337,17 @@ no whole file checking will be performed!\n", Progname, TagName,
 
 /**** end filename stuff ****/
 
+	if (Chk_incr) {
+		Chk_index = (struct chk_index *)calloc(num_files,
+						       sizeof(struct chk_index));
+		if (Chk_index == NULL) {
+			fprintf(stderr, "%s%s: %d %s/%d: calloc(%d) failed: %s\n",
+				Progname, TagName, Pid, __FILE__, __LINE__,
+				num_files, strerror(errno));
+			exit(1);
+		}
+	}
+
 	if (time_iterval > 0) {
 		struct timeval ts;
 		gettimeofday(&ts, NULL);
@@ -1403,6 +1461,8 @@ no whole file checking will be performed!\n", Progname, TagName,
 			filename = (char *)filenames + (ind * PATH_MAX);
 			Fileinfo.filename =
 			    (char *)filenames + (ind * PATH_MAX);
+			if (Chk_index != NULL)
+				Chk_cur = &Chk_index[ind];
 
 			if (open_flags == RANDOM_OPEN) {
 				ret =
@@ -1494,6 +1554,7 @@ no whole file checking will be performed!\n", Progname, TagName,
 				close(fd);
 				continue;
 			}
+			chk_invalidate(Woffset);
 
 			/*
 			 * check if last write is not corrupted
@@ -1542,6 +1603,7 @@ no whole file checking will be performed!\n", Progname, TagName,
 					     Iter_cnt, filename);
 
 				unlink(filename);
+				chk_invalidate(0);
 			}
 
 			/*
@@ -1584,6 +1646,9 @@ no whole file checking will be performed!\n", Progname, TagName,
 
 	}			/* end iteration for loop */
 
+	if (Chk_index != NULL)
+		chk_report();
+
 	if (Debug) {
 		printf("%s%s: %d %s/%d: DONE %d iterations to %d files. %s\n",
 		       Progname, TagName, Pid, __FILE__, __LINE__, Iter_cnt,
@@ -1802,7 +1867,7 @@ void usage(void)
 	fprintf(stderr,
 		"[-s seed][-S seq_auto_files][-p][-P PANIC][-I io_type][-o open_flags][-B maxbytes]\n");
 	fprintf(stderr,
-		"[-r iosizes][-R lseeks][-U unlk_inter][-W tagname] [files]\n");
+		"[-r iosizes][-R lseeks][-U unlk_inter][-W tagname][-K sample[:full]] [files]\n");
 
 	return;
 
@@ -1835,6 +1900,11 @@ void help(void)
   -I io_type Specifies io type: s - sync, p - polled async, a - async (def s)\n\
 		 l - listio sync, L - listio async, r - random\n\
   -i iteration   Specfied to grow each file num times. 0 means forever (default 1)\n\
+  -K sample[:full] Make the whole file check (-c) incremental: verify only\n\
+                 what was written or truncated since the last check plus\n\
+                 sample random older blocks against a checksum index, and\n\
+                 every full-th check the whole file (default 0 = never).\n\
+                 Reports the read rate and the verify coverage at exit\n\
   -l             Specfied to do file locking around write/read/trunc\n\
 		 If specified twice, file locking after open to just before close\n\
   -L time        Specfied to exit after time secs, must be used with -i.\n\
@@ -1920,7 +1990,13 @@ void prt_examples(FILE * stream)
 	fprintf(stream,
 		"# run forever: 5 copies of random iosize, random lseek to beyond eof,\n\
 # random open flags, rand io types doing a trunc every 10 iterations.\n\
-%s -i0 -r 1-50000 -R 0--2 -o random -I r -C0 -l -T 20 -uU100-200 -n 5 gf_rand1 gf_rand2\n",
+%s -i0 -r 1-50000 -R 0--2 -o random -I r -C0 -l -T 20 -uU100-200 -n 5 gf_rand1 gf_rand2\n\n",
+		Progname);
+
+	fprintf(stream,
+		"# run 60 secs: grow by 64k, check the whole file every iteration but\n\
+# only read what changed plus 8 older blocks, full check every 100 checks.\n\
+%s -g 65536 -i 0 -L 60 -T 50 -t 1048576 -c 1 -K 8:100 -u gf_incr\n",
 		Progname);
 
 	return;
@@ -2438,6 +2514,8 @@ shrinkfile(int fd, char *filename, int trunc_incr, int trunc_inter,
 	ret = trunc(fd);
 #else
 	ret = ftruncate(fd, new_offset);
+	if (ret == 0)
+		chk_invalidate(new_offset);
 	if (ret == 0 && Debug > 3) {
 		printf
 		    ("%s: %d DEBUG4 %s/%d: ftruncated to offset %d, %d bytes from end\n",
@@ -2687,6 +2765,7 @@ int check_file(int fd, int cf_inter, char *filename, int no_file_check)
 	int ret_val = 0;
 	int rd_cnt;
 	int rd_size;
+	char *chunk;
 	char *errmsg;
 
 	cf_count++;
@@ -2737,15 +2816,22 @@ int check_file(int fd, int cf_inter, char *filename, int no_file_check)
 		printf("%s: %d DEBUG3 %s/%d: about to do file validation\n",
 		       Progname, Pid, __FILE__, __LINE__);
 
+	if (Chk_cur != NULL) {
+		ret_val = check_file_incr(fd, filename, fsize);
+		lkfile(fd, LOCK_UN, LKLVL0);
+		return ret_val;
+	}
+
 	if (fsize > MAX_FC_READ) {
 		/*
-		 * read the file in MAX_FC_READ chuncks.
+		 * read the file in MAX_FC_READ chuncks, FC_BATCH of them
+		 * with each lio_read_buffers() call.
 		 */
 
-		if ((buf = (char *)malloc(MAX_FC_READ)) == NULL) {
+		if ((buf = (char *)malloc(FC_BATCH * MAX_FC_READ)) == NULL) {
 			fprintf(stderr, "%s%s: %s/%d: malloc(%d) failed: %s\n",
 				Progname, TagName, __FILE__, __LINE__,
-				MAX_FC_READ, strerror(errno));
+				FC_BATCH * MAX_FC_READ, strerror(errno));
 			lkfile(fd, LOCK_UN, LKLVL0);
 			return -1;
 		}
@@ -2762,9 +2848,17 @@ int check_file(int fd, int cf_inter, char *filename, int no_file_check)
 				rd_size = fsize - rd_cnt;
 
 #if NEWIO
-			ret = lio_read_buffer(fd, io_type, buf, rd_size,
-					      SIGUSR1, &errmsg, 0);
+			chunk = buf + rd_cnt / MAX_FC_READ % FC_BATCH *
+			    MAX_FC_READ;
+			if (chunk != buf)
+				ret = rd_size;	/* read with the first one */
+			else if (read_chunks(fd, buf, rd_cnt, fsize - rd_cnt,
+					     &errmsg))
+				ret = -1;
+			else
+				ret = rd_size;
 #else
+			chunk = buf;
 			ret =
 			    read_buffer(fd, io_type, buf, rd_size, 0, &errmsg);
 #endif
@@ -2783,40 +2877,40 @@ int check_file(int fd, int cf_inter, char *filename, int no_file_check)
 
 			if (Pattern == PATTERN_OFFSET)
 				ret =
-				    datapidchk(STATIC_NUM, buf, rd_size, rd_cnt,
+				    datapidchk(STATIC_NUM, chunk, rd_size, rd_cnt,
 					       &errmsg);
 			else if (Pattern == PATTERN_PID)
 				ret =
-				    datapidchk(Pid, buf, rd_size, rd_cnt,
+				    datapidchk(Pid, chunk, rd_size, rd_cnt,
 					       &errmsg);
 			else if (Pattern == PATTERN_ASCII)
 				ret =
-				    dataasciichk(NULL, buf, rd_size, rd_cnt,
+				    dataasciichk(NULL, chunk, rd_size, rd_cnt,
 						 &errmsg);
 			else if (Pattern == PATTERN_RANDOM) ;	/* no checks for random */
 			else if (Pattern == PATTERN_ALT)
 				ret =
-				    databinchk('a', buf, rd_size, rd_cnt,
+				    databinchk('a', chunk, rd_size, rd_cnt,
 					       &errmsg);
 			else if (Pattern == PATTERN_CHKER)
 				ret =
-				    databinchk('c', buf, rd_size, rd_cnt,
+				    databinchk('c', chunk, rd_size, rd_cnt,
 					       &errmsg);
 			else if (Pattern == PATTERN_CNTING)
 				ret =
-				    databinchk('C', buf, rd_size, rd_cnt,
+				    databinchk('C', chunk, rd_size, rd_cnt,
 					       &errmsg);
 			else if (Pattern == PATTERN_ZEROS)
 				ret =
-				    databinchk('z', buf, rd_size, rd_cnt,
+				    databinchk('z', chunk, rd_size, rd_cnt,
 					       &errmsg);
 			else if (Pattern == PATTERN_ONES)
 				ret =
-				    databinchk('o', buf, rd_size, rd_cnt,
+				    databinchk('o', chunk, rd_size, rd_cnt,
 					       &errmsg);
 			else
 				ret =
-				    dataasciichk(NULL, buf, rd_size, rd_cnt,
+				    dataasciichk(NULL, chunk, rd_size, rd_cnt,
 						 &errmsg);
 
 			if (ret >= 0) {
@@ -2910,6 +3004,270 @@ int check_file(int fd, int cf_inter, char *filename, int no_file_check)
 
 }				/* end of check_file */
 
+#if NEWIO
+/***********************************************************************
+ * Read FC_BATCH (or fewer, at the end of the file) MAX_FC_READ chunks
+ * from offset into buf with a single lio_read_buffers() call.  The
+ * offsets are explicit since pread/preadv leave the file offset alone.
+ * Returns 0 if all of them were read in full.
+ ***********************************************************************/
+static int read_chunks(int fd, char *buf, int offset, int left,
+		       char **errmsg)
+{
+	struct lio_buf bufs[FC_BATCH];
+	int nbufs, want = 0;
+
+	for (nbufs = 0; nbufs < FC_BATCH && left > 0; nbufs++) {
+		bufs[nbufs].buffer = buf + nbufs * MAX_FC_READ;
+		bufs[nbufs].offset = offset + nbufs * MAX_FC_READ;
+		bufs[nbufs].size = left > MAX_FC_READ ? MAX_FC_READ : left;
+		want += bufs[nbufs].size;
+		left -= bufs[nbufs].size;
+	}
+
+	return lio_read_buffers(fd, io_type, bufs, nbufs, SIGUSR1, errmsg,
+				0) != want;
+}
+#endif
+
+/***********************************************************************
+ * Check buf, read from offset of the file, against the pattern.
+ * Returns -1 if it matches, else the offset of the first mismatch
+ * with *errmsg describing it.
+ ***********************************************************************/
+static int chk_pattern(char *buf, int size, int offset, char **errmsg)
+{
+	switch (Pattern) {
+	case PATTERN_OFFSET:
+		return datapidchk(STATIC_NUM, buf, size, offset, errmsg);
+	case PATTERN_PID:
+		return datapidchk(Pid, buf, size, offset, errmsg);
+	case PATTERN_ALT:
+		return databinchk('a', buf, size, offset, errmsg);
+	case PATTERN_CHKER:
+		return databinchk('c', buf, size, offset, errmsg);
+	case PATTERN_CNTING:
+		return databinchk('C', buf, size, offset, errmsg);
+	case PATTERN_ZEROS:
+		return databinchk('z', buf, size, offset, errmsg);
+	case PATTERN_ONES:
+		return databinchk('o', buf, size, offset, errmsg);
+	default:
+		return dataasciichk(NULL, buf, size, offset, errmsg);
+	}
+}
+
+/***********************************************************************
+ * FNV-1a checksum of a block
+ ***********************************************************************/
+static uint32_t chk_cksum(char *buf, int size)
+{
+	uint32_t sum = 2166136261U;
+	int ind;
+
+	for (ind = 0; ind < size; ind++) {
+		sum ^= (unsigned char)buf[ind];
+		sum *= 16777619U;
+	}
+	return sum;
+}
+
+/***********************************************************************
+ * Read size bytes at offset for the incremental file check
+ ***********************************************************************/
+static int chk_read(int fd, char *buf, int size, int offset, char **errmsg)
+{
+	int ret;
+
+	lseek(fd, offset, SEEK_SET);
+#if NEWIO
+	ret = lio_read_buffer(fd, io_type, buf, size, SIGUSR1, errmsg, 0);
+#else
+	ret = read_buffer(fd, io_type, buf, size, 0, errmsg);
+#endif
+	if (ret > 0)
+		Chk_bytes_read += ret;
+
+	return ret != size;
+}
+
+/***********************************************************************
+ * Incremental version of check_file(), called with the file locked.
+ * Blocks past the part of the file covered by the index (the ones
+ * written or truncated since the last check) are read, checked against
+ * the pattern and their checksums stored.  Chk_sample of the unchanged
+ * blocks are re-read and compared with the index; a block whose
+ * checksum changed is checked against the pattern to tell corruption
+ * from a rewrite by another copy.  Every Chk_full_inter-th check reads
+ * the whole file.
+ ***********************************************************************/
+int check_file_incr(int fd, char *filename, int fsize)
+{
+	struct chk_index *idx = Chk_cur;
+	struct timeval t1, t2;
+	char *buf;
+	char *errmsg;
+	uint32_t *cksum;
+	uint32_t sum;
+	int nblks;		/* blocks in the file */
+	int vblks;		/* whole blocks covered by the index */
+	int rd_cnt, rd_size;
+	int off, size, blk;
+	int ind, ret;
+	int ret_val = 0;
+
+	gettimeofday(&t1, NULL);
+
+	Chk_checks++;
+	Chk_bytes_file += fsize;
+
+	/* the file may have been truncated by another copy */
+	if (idx->valid > fsize)
+		idx->valid = fsize;
+
+	nblks = (fsize + IDX_BLKSZ - 1) / IDX_BLKSZ;
+	if (nblks > idx->nblks) {
+		ind = idx->nblks * 2 > nblks ? idx->nblks * 2 : nblks;
+		cksum = (uint32_t *)realloc(idx->cksum, ind * sizeof(uint32_t));
+		if (cksum == NULL) {
+			fprintf(stderr, "%s%s: %s/%d: realloc(%d) failed: %s\n",
+				Progname, TagName, __FILE__, __LINE__,
+				(int)(ind * sizeof(uint32_t)), strerror(errno));
+			return -1;
+		}
+		idx->cksum = cksum;
+		idx->nblks = ind;
+	}
+
+	if (Chk_full_inter && Chk_checks % Chk_full_inter == 0) {
+		Chk_full_checks++;
+		vblks = 0;
+	} else {
+		vblks = idx->valid / IDX_BLKSZ;
+	}
+
+	if ((buf = (char *)malloc(MAX_FC_READ)) == NULL) {
+		fprintf(stderr, "%s%s: %s/%d: malloc(%d) failed: %s\n",
+			Progname, TagName, __FILE__, __LINE__,
+			MAX_FC_READ, strerror(errno));
+		return -1;
+	}
+
+	/*
+	 * verify the changed blocks and index them
+	 */
+	for (rd_cnt = vblks * IDX_BLKSZ; rd_cnt < fsize; rd_cnt += rd_size) {
+		if (fsize - rd_cnt > MAX_FC_READ)
+			rd_size = MAX_FC_READ;
+		else
+			rd_size = fsize - rd_cnt;
+
+		if (chk_read(fd, buf, rd_size, rd_cnt, &errmsg)) {
+			fprintf(stderr, "%s%s: %d %s/%d: %d CFa %s\n",
+				Progname, TagName, Pid, __FILE__, __LINE__,
+				Iter_cnt, errmsg);
+			ret_val = -1;
+			goto out;
+		}
+
+		if ((ret = chk_pattern(buf, rd_size, rd_cnt, &errmsg)) >= 0) {
+			fprintf(stderr,
+				"%s%s: %d %s/%d: %d CFp %s in file %s\n",
+				Progname, TagName, Pid, __FILE__, __LINE__,
+				Iter_cnt, errmsg, filename);
+			fflush(stderr);
+			ret_val = 1;
+			goto out;
+		}
+
+		for (off = 0; off < rd_size; off += IDX_BLKSZ) {
+			size = rd_size - off;
+			if (size > IDX_BLKSZ)
+				size = IDX_BLKSZ;
+			idx->cksum[(rd_cnt + off) / IDX_BLKSZ] =
+			    chk_cksum(buf + off, size);
+		}
+	}
+	Chk_new_blks += nblks - vblks;
+	Chk_old_blks += vblks;
+
+	/*
+	 * re-verify a random sample of the unchanged blocks
+	 */
+	for (ind = 0; ind < Chk_sample && vblks > 0; ind++) {
+		blk = random_range(0, vblks - 1, 1, NULL);
+		off = blk * IDX_BLKSZ;
+
+		if (chk_read(fd, buf, IDX_BLKSZ, off, &errmsg)) {
+			fprintf(stderr, "%s%s: %d %s/%d: %d CFa %s\n",
+				Progname, TagName, Pid, __FILE__, __LINE__,
+				Iter_cnt, errmsg);
+			ret_val = -1;
+			goto out;
+		}
+		Chk_sampled_blks++;
+
+		if ((sum = chk_cksum(buf, IDX_BLKSZ)) == idx->cksum[blk])
+			continue;
+
+		if ((ret = chk_pattern(buf, IDX_BLKSZ, off, &errmsg)) >= 0) {
+			fprintf(stderr,
+				"%s%s: %d %s/%d: %d CFs %s in file %s (block %d)\n",
+				Progname, TagName, Pid, __FILE__, __LINE__,
+				Iter_cnt, errmsg, filename, blk);
+			fflush(stderr);
+			ret_val = 1;
+			goto out;
+		}
+		if (Debug > 2)
+			printf("%s: %d DEBUG3 %s/%d: block %d of %s rewritten\n",
+			       Progname, Pid, __FILE__, __LINE__, blk,
+			       filename);
+		idx->cksum[blk] = sum;
+	}
+
+	idx->valid = fsize;
+
+out:
+	free(buf);
+	gettimeofday(&t2, NULL);
+	Chk_usecs += (t2.tv_sec - t1.tv_sec) * (long long)USECS_PER_SEC +
+	    (t2.tv_usec - t1.tv_usec);
+
+	return ret_val;
+}
+
+/***********************************************************************
+ * The current file was written or truncated from offset on, the
+ * incremental file check must not trust its index past it.
+ ***********************************************************************/
+void chk_invalidate(off_t offset)
+{
+	if (Chk_cur != NULL && offset < Chk_cur->valid)
+		Chk_cur->valid = offset;
+}
+
+/***********************************************************************
+ * Print what the incremental file check read and how much of the
+ * unchanged data it covered.
+ ***********************************************************************/
+void chk_report(void)
+{
+	double secs = Chk_usecs / (double)USECS_PER_SEC;
+
+	printf("%s%s: %d file check: %d checks (%d full), read %lld bytes "
+	       "(%.1f%% of a full check each time) at %.1f MB/s, "
+	       "%lld changed blocks, %lld of %lld unchanged blocks "
+	       "re-verified (%.2f%%)\n",
+	       Progname, TagName, Pid, Chk_checks, Chk_full_checks,
+	       Chk_bytes_read,
+	       Chk_bytes_file ? 100.0 * Chk_bytes_read / Chk_bytes_file : 0.0,
+	       secs > 0 ? Chk_bytes_read / secs / 1000000 : 0.0,
+	       Chk_new_blks, Chk_sampled_blks, Chk_old_blks,
+	       Chk_old_blks ? 100.0 * Chk_sampled_blks / Chk_old_blks : 0.0);
+	fflush(stdout);
+}
+
 /***********************************************************************
  *
  ***********************************************************************/
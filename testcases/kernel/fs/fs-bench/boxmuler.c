@@ -26,3 +26,26 @@ int box_muler(int min, int max)
 	}
 	return (-1);
 }
+
+/* same as box_muler() but drawing from the caller's erand48() state */
+int box_muler_r(int min, int max, unsigned short *xsubi)
+{
+	double u1, u2, z;
+	int i;
+	int ave;
+	int ZZ;
+	if (min >= max) {
+		return (-1);
+	}
+	ave = (max - min) / 2;
+	for (i = 0; i < 10; i++) {
+		u1 = 1.0 - erand48(xsubi);
+		u2 = erand48(xsubi);
+		z = sqrt(-2.0 * log(u1)) * cos(M_2PI * u2);
+		ZZ = min + (ave + (z * (ave / 4)));
+		if (ZZ >= min && ZZ < max) {
+			return (ZZ);
+		}
+	}
+	return (-1);
+}
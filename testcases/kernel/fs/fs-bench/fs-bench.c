@@ -0,0 +1,475 @@
+/* fs-bench.c (GPL)*/
+/*
+ * Multi-threaded small file benchmark.
+ *
+ * Every thread works in its own directory tree below the target
+ * directory, with at most -w files per leaf directory, and runs the
+ * phases one after the other in lockstep with the others:
+ *
+ *   create  openat(O_CREAT|O_EXCL), write the whole file, close
+ *   stat    fstatat() every file in random order
+ *   read    openat(O_RDONLY), read to EOF, close, in random order
+ *   delete  unlinkat() every file in random order
+ *
+ * All the file operations are relative to an open directory fd, so the
+ * numbers are not dominated by path walks from the top. The file sizes
+ * follow the Box-Muler curve of create-files, a uniform or a lognormal
+ * distribution, drawn from a per thread state seeded with seed + thread
+ * number, so the same -S gives the same set of files.
+ *
+ * For every phase the wall time of the slowest thread gives the files/s
+ * and MB/s, and the latency of each single operation gives the
+ * percentiles.
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#define MAXFSIZE (192*1024)
+#define BUFS 8192
+
+#define DIST_BOX	0
+#define DIST_UNIFORM	1
+#define DIST_LOGNORMAL	2
+
+#define PH_CREATE	0
+#define PH_STAT		1
+#define PH_READ		2
+#define PH_DELETE	3
+#define PH_MAX		4
+
+char *dist_names[] = { "box", "uniform", "lognormal" };
+char *phase_names[] = { "create", "stat", "read", "delete" };
+
+struct worker {
+	pthread_t tid;
+	int num;
+	unsigned short xsubi[3];
+	int rootfd;
+	int *dirfds;
+	int ndirs;
+	int *order;		/* file numbers in random order */
+	int *sizes;
+	unsigned long long bytes[PH_MAX];
+	unsigned long *lat[PH_MAX];	/* ns per file */
+	int errors[PH_MAX];
+};
+
+extern int box_muler_r(int, int, unsigned short *);
+
+int nthreads = 1;
+int nfiles = 1000;
+int perdir = 256;
+int minsize = 0;
+int maxsize = MAXFSIZE;
+int dist = DIST_BOX;
+char *phases = "csrd";
+unsigned long seed;
+int keep = 0;
+int rootfd;
+pthread_barrier_t barrier;
+
+void usage(char *prog)
+{
+	printf("usage: %s [-t threads] [-n files] [-w files_per_dir]\n"
+	       "\t[-s min:max] [-D box|uniform|lognormal] [-S seed]\n"
+	       "\t[-p phases] [-k] [dir]\n", prog);
+	printf("  -t threads   worker threads (default 1)\n");
+	printf("  -n files     files per thread (default 1000)\n");
+	printf("  -w files     files per leaf directory (default 256)\n");
+	printf("  -s min:max   file size range in bytes (default 0:%d)\n",
+	       MAXFSIZE);
+	printf("  -D dist      file size distribution (default box)\n");
+	printf("  -S seed      random seed (default time based, printed)\n");
+	printf("  -p phases    any of c(reate) s(tat) r(ead) d(elete), "
+	       "default csrd\n");
+	printf("  -k           keep the files\n");
+	exit(1);
+}
+
+unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+int file_size(struct worker *w)
+{
+	double z, median;
+	int i, s;
+
+	switch (dist) {
+	case DIST_UNIFORM:
+		return minsize + erand48(w->xsubi) * (maxsize - minsize);
+	case DIST_LOGNORMAL:
+		/* sigma 1, median at a quarter of the range */
+		median = (maxsize - minsize) / 4.0;
+		for (i = 0; i < 10; i++) {
+			z = sqrt(-2.0 * log(1.0 - erand48(w->xsubi))) *
+			    cos(2 * M_PI * erand48(w->xsubi));
+			s = minsize + median * exp(z);
+			if (s >= minsize && s < maxsize)
+				return s;
+		}
+		return maxsize;
+	default:
+		if ((s = box_muler_r(minsize, maxsize, w->xsubi)) < 0)
+			s = maxsize;
+		return s;
+	}
+}
+
+int file_dir(struct worker *w, int f)
+{
+	return w->dirfds[f / perdir];
+}
+
+void file_name(char *buf, int f)
+{
+	sprintf(buf, "%8.8x", f);
+}
+
+/* the errors column counts them, print only the first one */
+void create_error(struct worker *w, char *name)
+{
+	if (w->errors[PH_CREATE]++ == 0)
+		fprintf(stderr, "thread %d: %s: %s\n", w->num, name,
+			strerror(errno));
+}
+
+void do_create(struct worker *w, int f, char *buf)
+{
+	char name[16];
+	int fd, n, left;
+
+	file_name(name, f);
+	fd = openat(file_dir(w, f), name, O_CREAT | O_EXCL | O_WRONLY, 0600);
+	if (fd < 0) {
+		create_error(w, name);
+		return;
+	}
+	for (left = w->sizes[f]; left > 0; left -= n) {
+		n = write(fd, buf, left > BUFS ? BUFS : left);
+		if (n <= 0) {
+			create_error(w, name);
+			break;
+		}
+		w->bytes[PH_CREATE] += n;
+	}
+	close(fd);
+}
+
+void do_stat(struct worker *w, int f)
+{
+	char name[16];
+	struct stat st;
+
+	file_name(name, f);
+	if (fstatat(file_dir(w, f), name, &st, 0) < 0 ||
+	    st.st_size != w->sizes[f])
+		w->errors[PH_STAT]++;
+}
+
+void do_read(struct worker *w, int f, char *buf)
+{
+	char name[16];
+	int fd, n;
+
+	file_name(name, f);
+	fd = openat(file_dir(w, f), name, O_RDONLY);
+	if (fd < 0) {
+		w->errors[PH_READ]++;
+		return;
+	}
+	while ((n = read(fd, buf, BUFS)) > 0)
+		w->bytes[PH_READ] += n;
+	if (n < 0)
+		w->errors[PH_READ]++;
+	close(fd);
+}
+
+void do_delete(struct worker *w, int f)
+{
+	char name[16];
+
+	file_name(name, f);
+	if (unlinkat(file_dir(w, f), name, 0) < 0)
+		w->errors[PH_DELETE]++;
+}
+
+void shuffle(struct worker *w)
+{
+	int i, j, t;
+
+	for (i = nfiles - 1; i > 0; i--) {
+		j = nrand48(w->xsubi) % (i + 1);
+		t = w->order[i];
+		w->order[i] = w->order[j];
+		w->order[j] = t;
+	}
+}
+
+/* creates and opens the directories of a worker: tNN/DDDD */
+void setup_dirs(struct worker *w)
+{
+	char name[16];
+	int i, tfd;
+
+	sprintf(name, "t%2.2x", w->num);
+	if (mkdirat(rootfd, name, 0700) < 0 && errno != EEXIST) {
+		perror(name);
+		exit(1);
+	}
+	if ((tfd = openat(rootfd, name, O_RDONLY | O_DIRECTORY)) < 0) {
+		perror(name);
+		exit(1);
+	}
+	w->rootfd = tfd;
+	w->ndirs = (nfiles + perdir - 1) / perdir;
+	w->dirfds = malloc(w->ndirs * sizeof(int));
+	for (i = 0; i < w->ndirs; i++) {
+		sprintf(name, "%4.4x", i);
+		if (mkdirat(tfd, name, 0700) < 0 && errno != EEXIST) {
+			perror(name);
+			exit(1);
+		}
+		w->dirfds[i] = openat(tfd, name, O_RDONLY | O_DIRECTORY);
+		if (w->dirfds[i] < 0) {
+			perror(name);
+			exit(1);
+		}
+	}
+}
+
+void cleanup_dirs(struct worker *w)
+{
+	char name[16];
+	int i;
+
+	for (i = 0; i < w->ndirs; i++) {
+		close(w->dirfds[i]);
+		sprintf(name, "%4.4x", i);
+		unlinkat(w->rootfd, name, AT_REMOVEDIR);
+	}
+	close(w->rootfd);
+	sprintf(name, "t%2.2x", w->num);
+	unlinkat(rootfd, name, AT_REMOVEDIR);
+}
+
+void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	char buf[BUFS];
+	unsigned long t;
+	char *p;
+	int i, f, ph;
+
+	memset(buf, 0x5a, sizeof(buf));
+	for (p = phases; *p; p++) {
+		ph = strchr("csrd", *p) - "csrd";
+		if (ph != PH_CREATE)
+			shuffle(w);
+		pthread_barrier_wait(&barrier);
+		for (i = 0; i < nfiles; i++) {
+			f = ph == PH_CREATE ? i : w->order[i];
+			t = now_ns();
+			switch (ph) {
+			case PH_CREATE:
+				do_create(w, f, buf);
+				break;
+			case PH_STAT:
+				do_stat(w, f);
+				break;
+			case PH_READ:
+				do_read(w, f, buf);
+				break;
+			case PH_DELETE:
+				do_delete(w, f);
+				break;
+			}
+			w->lat[ph][i] = now_ns() - t;
+		}
+		pthread_barrier_wait(&barrier);
+	}
+	return NULL;
+}
+
+int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(unsigned long *)a, y = *(unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+void report(struct worker *workers, int ph, unsigned long ns)
+{
+	unsigned long *all;
+	unsigned long long bytes = 0, sum = 0;
+	int errors = 0;
+	long n = (long)nthreads * nfiles;
+	double secs = ns / 1e9;
+	int i;
+
+	all = malloc(n * sizeof(*all));
+	if (all == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < nthreads; i++) {
+		memcpy(all + (long)i * nfiles, workers[i].lat[ph],
+		       nfiles * sizeof(*all));
+		bytes += workers[i].bytes[ph];
+		errors += workers[i].errors[ph];
+	}
+	for (i = 0; i < n; i++)
+		sum += all[i];
+	qsort(all, n, sizeof(*all), cmp_ulong);
+
+	printf("%-7s %9ld %10.1f %8.1f %8.1f %8.1f %8.1f %8.1f %9.1f %6d\n",
+	       phase_names[ph], n, n / secs, bytes / secs / (1 << 20),
+	       sum / 1000.0 / n, all[n / 2] / 1000.0,
+	       all[n * 90 / 100] / 1000.0, all[n * 99 / 100] / 1000.0,
+	       all[n - 1] / 1000.0, errors);
+	free(all);
+}
+
+int main(int ac, char **av)
+{
+	struct worker *workers;
+	struct timeval tv;
+	unsigned long t;
+	char *dir = ".";
+	char *p;
+	int errors = 0;
+	int c, i, ph;
+
+	gettimeofday(&tv, NULL);
+	seed = tv.tv_sec ^ tv.tv_usec ^ getpid();
+
+	while ((c = getopt(ac, av, "t:n:w:s:D:S:p:kh")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'n':
+			nfiles = atoi(optarg);
+			break;
+		case 'w':
+			perdir = atoi(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%d:%d", &minsize, &maxsize) != 2) {
+				fprintf(stderr, "bad size range %s\n", optarg);
+				usage(av[0]);
+			}
+			break;
+		case 'D':
+			for (dist = 0; dist <= DIST_LOGNORMAL; dist++)
+				if (!strcmp(optarg, dist_names[dist]))
+					break;
+			if (dist > DIST_LOGNORMAL) {
+				fprintf(stderr, "unknown distribution %s\n",
+					optarg);
+				usage(av[0]);
+			}
+			break;
+		case 'S':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			phases = optarg;
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		default:
+			usage(av[0]);
+		}
+	}
+	if (optind < ac)
+		dir = av[optind];
+	if (nthreads < 1 || nfiles < 1 || perdir < 1 || minsize < 0 ||
+	    maxsize <= minsize)
+		usage(av[0]);
+	for (p = phases; *p; p++) {
+		if (!strchr("csrd", *p)) {
+			fprintf(stderr, "unknown phase %c\n", *p);
+			usage(av[0]);
+		}
+	}
+
+	if ((rootfd = open(dir, O_RDONLY | O_DIRECTORY)) < 0) {
+		perror(dir);
+		exit(1);
+	}
+
+	workers = calloc(nthreads, sizeof(*workers));
+	for (i = 0; i < nthreads; i++) {
+		struct worker *w = &workers[i];
+
+		w->num = i;
+		w->xsubi[0] = 0x330e;
+		w->xsubi[1] = (seed + i) & 0xffff;
+		w->xsubi[2] = ((seed + i) >> 16) & 0xffff;
+		w->order = malloc(nfiles * sizeof(int));
+		w->sizes = malloc(nfiles * sizeof(int));
+		for (ph = 0; ph < PH_MAX; ph++)
+			w->lat[ph] = calloc(nfiles, sizeof(unsigned long));
+		for (c = 0; c < nfiles; c++) {
+			w->order[c] = c;
+			w->sizes[c] = file_size(w);
+		}
+		setup_dirs(w);
+	}
+
+	printf("%d threads, %d files each in %s, %s sizes %d-%d, seed %lu\n",
+	       nthreads, nfiles, dir, dist_names[dist], minsize, maxsize, seed);
+	printf("%-7s %9s %10s %8s %8s %8s %8s %8s %9s %6s\n", "phase",
+	       "files", "files/s", "MB/s", "avg us", "p50 us", "p90 us",
+	       "p99 us", "max us", "errors");
+
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&workers[i].tid, NULL, worker_main,
+				   &workers[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (p = phases; *p; p++) {
+		ph = strchr("csrd", *p) - "csrd";
+		pthread_barrier_wait(&barrier);
+		t = now_ns();
+		pthread_barrier_wait(&barrier);
+		report(workers, ph, now_ns() - t);
+		for (i = 0; i < nthreads; i++) {
+			errors += workers[i].errors[ph];
+			/* a phase may be given more than once */
+			workers[i].errors[ph] = 0;
+			workers[i].bytes[ph] = 0;
+		}
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].tid, NULL);
+
+	if (!keep) {
+		for (i = 0; i < nthreads; i++) {
+			for (c = 0; c < nfiles; c++)
+				do_delete(&workers[i], c);
+			cleanup_dirs(&workers[i]);
+		}
+	}
+	close(rootfd);
+	return errors ? 1 : 0;
+}
@@ -102,6 +102,26 @@ typedef struct pathname {
 	char *path;
 } pathname_t;
 
+/*
+ * Latency of one op type in one process or thread: bucket b counts the
+ * calls that took less than 2^b microseconds (and at least 2^(b-1)).
+ */
+#define	LAT_BUCKETS	32
+
+typedef struct opstat {
+	unsigned long count;
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+	unsigned long hist[LAT_BUCKETS];
+} opstat_t;
+
+typedef struct profile {
+	char *name;
+	char *desc;
+	char *freqs;		/* op_name=freq list for process_freq() */
+	off64_t fsize;		/* caps the file offsets, 0 for no cap */
+} profile_t;
+
 #define	FT_DIR	0
 #define	FT_DIRm	(1 << FT_DIR)
 #define	FT_REG	1
@@ -120,9 +140,26 @@ typedef struct pathname {
 #define	FLIST_SLOT_INCR	16
 #define	NDCACHE	64
 
+#define	SHARE_PRIVATE	0	/* threads work in their own subtree */
+#define	SHARE_DIR	1	/* threads share one tree and its flist */
+#define	SHARE_FILES	2	/* threads share a fixed set of files */
+#define	SHARED_FILES	16	/* files created up front for SHARE_FILES */
+
 #define	MAXFSIZE	((1ULL << 63) - 1ULL)
 #define	MAXFSIZE32	((1ULL << 40) - 1ULL)
 
+profile_t profiles[] = {
+	{"metadata", "namespace and inode operations, no data",
+	 "chown=2,creat=4,getdents=3,link=2,mkdir=3,mknod=1,readlink=1,"
+	 "rename=4,rmdir=2,stat=6,symlink=2,unlink=4", 0},
+	{"fsync", "small writes, most of them flushed at once",
+	 "creat=1,fdatasync=4,fsync=4,read=1,truncate=1,write=8", 0},
+	{"mailserver", "small files created, synced, read and removed",
+	 "creat=4,fsync=3,getdents=1,read=4,rename=2,stat=2,unlink=3,"
+	 "write=4", 64 * 1024},
+	{NULL, NULL, NULL, 0}
+};
+
 void allocsp_f(int, long);
 void attr_remove_f(int, long);
 void attr_set_f(int, long);
@@ -191,7 +228,7 @@ opdesc_t ops[] = {
 	{OP_WRITE, "write", write_f, 4, 1},
 }, *ops_end;
 
-flist_t flist[FT_nft] = {
+flist_t main_flist[FT_nft] = {
 	{0, 0, 'd', NULL},
 	{0, 0, 'f', NULL},
 	{0, 0, 'l', NULL},
@@ -199,7 +236,14 @@ flist_t flist[FT_nft] = {
 	{0, 0, 'r', NULL},
 };
 
-int dcache[NDCACHE];
+int main_dcache[NDCACHE];
+
+/*
+ * With -t every thread has its own flist and dcache in SHARE_PRIVATE mode,
+ * else all of them use the main ones under flist_mutex.
+ */
+__thread flist_t *flist = main_flist;
+__thread int *dcache = main_dcache;
 int errrange;
 int errtag;
 opty_t *freq_table;
@@ -207,7 +251,7 @@ int freq_table_size;
 #ifndef NO_XFS
 xfs_fsop_geom_t geom;
 #endif
-char *homedir;
+__thread char *homedir;
 int *ilist;
 int ilistlen;
 off64_t maxfsize;
@@ -217,11 +261,18 @@ int nameseq;
 int nops;
 int nproc = 1;
 int operations = 1;
-int procid;
+__thread int procid;
 int rtpct;
 unsigned long seed = 0;
-ino_t top_ino;
+__thread ino_t top_ino;
 int verbose = 0;
+int nthreads = 0;
+int share_mode = SHARE_PRIVATE;
+int shared_flist = 0;
+pthread_mutex_t flist_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+opstat_t *op_stats;		/* nops entries per thread or process */
+int show_lat = 0;
+profile_t *profile;
 #ifndef NO_XFS
 int no_xfs = 0;
 #else
@@ -242,10 +293,14 @@ void dcache_init(void);
 fent_t *dcache_lookup(int);
 void dcache_purge(int);
 void del_from_flist(int, int);
+void del_id_from_flist(int, int);
 int dirid_to_name(char *, int);
+fent_t *dirid_to_fent(int);
 void doproc(void);
 void fent_to_name(pathname_t *, flist_t *, fent_t *);
 void fix_parent(int, int);
+void flist_lock(void);
+void flist_unlock(void);
 void free_pathname(pathname_t *);
 int generate_fname(fent_t *, int, pathname_t *, int *, int *);
 int get_fname(int, long, pathname_t *, flist_t **, fent_t **, int *);
@@ -254,6 +309,7 @@ int lchown_path(pathname_t *, uid_t, gid_t);
 int link_path(pathname_t *, pathname_t *);
 int lstat64_path(pathname_t *, struct stat64 *);
 void make_freq_table(void);
+void ns_freq(void);
 int mkdir_path(pathname_t *, mode_t);
 int mknod_path(pathname_t *, mode_t, dev_t);
 void namerandpad(int, char *, int);
@@ -264,7 +320,11 @@ int readlink_path(pathname_t *, char *, size_t);
 int rename_path(pathname_t *, pathname_t *);
 int rmdir_path(pathname_t *);
 void separate_pathname(pathname_t *, char *, pathname_t *);
+void *thread_proc(void *);
+unsigned long lat_pct(opstat_t *, int);
 void show_ops(int, char *);
+void set_profile(char *);
+void show_op_stats(double);
 int stat64_path(pathname_t *, struct stat64 *);
 int symlink_path(const char *, pathname_t *);
 int truncate64_path(pathname_t *, off64_t);
@@ -294,6 +354,10 @@ int main(int argc, char **argv)
 	ptrdiff_t srval;
 #endif
 	int nousage = 0;
+	int mflag = 0;
+	pthread_t *threads = NULL;
+	struct timeval t0;
+	size_t stats_size;
 #ifndef NO_XFS
 	xfs_error_injection_t err_inj;
 #endif
@@ -303,7 +367,7 @@ int main(int argc, char **argv)
 	nops = sizeof(ops) / sizeof(ops[0]);
 	ops_end = &ops[nops];
 	myprog = argv[0];
-	while ((c = getopt(argc, argv, "cd:e:f:i:l:n:p:rs:vwzHSX")) != -1) {
+	while ((c = getopt(argc, argv, "cd:e:f:i:l:m:n:p:rs:t:vwzHLP:SX")) != -1) {
 		switch (c) {
 		case 'c':
 			/*Don't cleanup */
@@ -329,6 +393,12 @@ int main(int argc, char **argv)
 		case 'f':
 			process_freq(optarg);
 			break;
+		case 'L':
+			show_lat = 1;
+			break;
+		case 'P':
+			set_profile(optarg);
+			break;
 		case 'i':
 			ilist = realloc(ilist, ++ilistlen * sizeof(*ilist));
 			ilist[ilistlen - 1] = strtol(optarg, &p, 16);
@@ -336,6 +406,20 @@ int main(int argc, char **argv)
 		case 'l':
 			loops = atoi(optarg);
 			break;
+		case 'm':
+			mflag = 1;
+			if (strcmp(optarg, "private") == 0)
+				share_mode = SHARE_PRIVATE;
+			else if (strcmp(optarg, "dir") == 0)
+				share_mode = SHARE_DIR;
+			else if (strcmp(optarg, "files") == 0)
+				share_mode = SHARE_FILES;
+			else {
+				fprintf(stderr, "%s: unknown sharing mode %s\n",
+					myprog, optarg);
+				exit(1);
+			}
+			break;
 		case 'n':
 			operations = atoi(optarg);
 			break;
@@ -348,6 +432,9 @@ int main(int argc, char **argv)
 		case 's':
 			seed = strtoul(optarg, NULL, 0);
 			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
 		case 'v':
 			verbose = 1;
 			break;
@@ -387,6 +474,31 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (nthreads && nproc > 1) {
+		fprintf(stderr, "%s: -t and -p are mutually exclusive\n",
+			myprog);
+		exit(1);
+	}
+	if (nthreads) {
+		threads = calloc(nthreads, sizeof(*threads));
+		if (threads == NULL) {
+			perror("calloc");
+			exit(1);
+		}
+		shared_flist = (share_mode != SHARE_PRIVATE);
+	} else if (mflag) {
+		fprintf(stderr, "%s: -m is only valid with -t\n", myprog);
+		exit(1);
+	}
+	/* shared, so the parent sees what the forked processes counted */
+	stats_size = (nthreads ? nthreads : nproc) * nops * sizeof(opstat_t);
+	op_stats = mmap(NULL, stats_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (op_stats == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
 	make_freq_table();
 
 	while ((loopcntr <= loops) || (loops == 0)) {
@@ -408,6 +520,8 @@ int main(int argc, char **argv)
 			maxfsize = (off64_t) MAXFSIZE32;
 		else
 			maxfsize = (off64_t) MAXFSIZE;
+		if (profile && profile->fsize && maxfsize > profile->fsize)
+			maxfsize = profile->fsize;
 		dcache_init();
 		setlinebuf(stdout);
 		if (!seed) {
@@ -465,19 +579,73 @@ int main(int argc, char **argv)
 #endif
 			close(fd);
 		unlink(buf);
-		if (nproc == 1) {
-			procid = 0;
-			doproc();
+		if (nthreads) {
+			/* same name padding in every thread */
+			srandom(seed);
+			if (namerand)
+				namerand = random();
+			if (share_mode == SHARE_FILES) {
+				/*
+				 * create the files, then leave the
+				 * namespace alone
+				 */
+				(void)mkdir("shared", 0777);
+				if (chdir("shared") < 0) {
+					perror("shared");
+					exit(1);
+				}
+				for (i = 0; i < SHARED_FILES; i++)
+					creat_f(i, random());
+				if (chdir("..") < 0) {
+					perror("..");
+					exit(1);
+				}
+				ns_freq();
+				free(freq_table);
+				make_freq_table();
+				if (freq_table_size == 0) {
+					fprintf(stderr, "%s: no operations left "
+						"for -m files\n", myprog);
+					exit(1);
+				}
+			}
+			memset(op_stats, 0, stats_size);
+			gettimeofday(&t0, NULL);
+			for (i = 0; i < nthreads; i++) {
+				if (pthread_create(&threads[i], NULL,
+						   thread_proc,
+						   (void *)(long)i)) {
+					perror("pthread_create");
+					exit(1);
+				}
+			}
+			for (i = 0; i < nthreads; i++)
+				pthread_join(threads[i], NULL);
+			gettimeofday(&t, NULL);
+			show_op_stats(t.tv_sec - t0.tv_sec +
+				      (t.tv_usec - t0.tv_usec) / 1000000.0);
 		} else {
-			for (i = 0; i < nproc; i++) {
-				if (fork() == 0) {
-					procid = i;
-					doproc();
-					return 0;
+			memset(op_stats, 0, stats_size);
+			gettimeofday(&t0, NULL);
+			if (nproc == 1) {
+				procid = 0;
+				doproc();
+			} else {
+				for (i = 0; i < nproc; i++) {
+					if (fork() == 0) {
+						procid = i;
+						doproc();
+						return 0;
+					}
 				}
+				while (wait(&stat) > 0)
+					continue;
 			}
-			while (wait(&stat) > 0)
-				continue;
+			gettimeofday(&t, NULL);
+			if (show_lat)
+				show_op_stats(t.tv_sec - t0.tv_sec +
+					      (t.tv_usec - t0.tv_usec) /
+					      1000000.0);
 		}
 #ifndef NO_XFS
 		if (errtag != 0) {
@@ -517,6 +685,12 @@ void add_to_flist(int ft, int id, int parent)
 	fent_t *fep;
 	flist_t *ftp;
 
+	flist_lock();
+	/* another thread may have removed the parent meanwhile */
+	if (shared_flist && parent != -1 && dirid_to_fent(parent) == NULL) {
+		flist_unlock();
+		return;
+	}
 	ftp = &flist[ft];
 	if (ftp->nfiles == ftp->nslots) {
 		ftp->nslots += FLIST_SLOT_INCR;
@@ -525,6 +699,7 @@ void add_to_flist(int ft, int id, int parent)
 	fep = &ftp->fents[ftp->nfiles++];
 	fep->id = id;
 	fep->parent = parent;
+	flist_unlock();
 }
 
 void append_pathname(pathname_t * name, char *str)
@@ -687,6 +862,26 @@ void del_from_flist(int ft, int slot)
 		ftp->nfiles--;
 }
 
+/*
+ * Remove the entry by id; with a shared flist its slot may have moved
+ * (or it may be gone) since it was looked up.
+ */
+void del_id_from_flist(int ft, int id)
+{
+	flist_t *ftp;
+	int slot;
+
+	flist_lock();
+	ftp = &flist[ft];
+	for (slot = 0; slot < ftp->nfiles; slot++) {
+		if (ftp->fents[slot].id == id) {
+			del_from_flist(ft, slot);
+			break;
+		}
+	}
+	flist_unlock();
+}
+
 fent_t *dirid_to_fent(int dirid)
 {
 	fent_t *efep;
@@ -712,8 +907,15 @@ void doproc(void)
 	int opno;
 	int rval;
 	opdesc_t *p;
+	opstat_t *stats;
+	struct timespec ts0, ts1;
+	unsigned long long ns;
+	int b;
 
-	sprintf(buf, "p%x", procid);
+	if (nthreads && share_mode != SHARE_PRIVATE)
+		strcpy(buf, "shared");
+	else
+		sprintf(buf, "p%x", procid);
 	(void)mkdir(buf, 0777);
 	if (chdir(buf) < 0 || stat64(".", &statbuf) < 0) {
 		perror(buf);
@@ -721,16 +923,28 @@ void doproc(void)
 	}
 	top_ino = statbuf.st_ino;
 	homedir = getcwd(NULL, -1);
-	seed += procid;
-	srandom(seed);
-	if (namerand)
-		namerand = random();
+	if (!nthreads) {
+		srandom(seed + procid);
+		if (namerand)
+			namerand = random();
+	}
+	stats = &op_stats[procid * nops];
 	for (opno = 0; opno < operations; opno++) {
 		p = &ops[freq_table[random() % freq_table_size]];
 		if ((unsigned long)p->func < 4096)
 			abort();
 
+		clock_gettime(CLOCK_MONOTONIC, &ts0);
 		p->func(opno, random());
+		clock_gettime(CLOCK_MONOTONIC, &ts1);
+		ns = (ts1.tv_sec - ts0.tv_sec) * 1000000000ULL +
+		    ts1.tv_nsec - ts0.tv_nsec;
+		for (b = 0; b < LAT_BUCKETS - 1 && (ns / 1000) >> b; b++) ;
+		stats[p - ops].count++;
+		stats[p - ops].total_ns += ns;
+		if (ns > stats[p - ops].max_ns)
+			stats[p - ops].max_ns = ns;
+		stats[p - ops].hist[b]++;
 		/*
 		 * test for forced shutdown by stat'ing the test
 		 * directory.  If this stat returns EIO, assume
@@ -754,8 +968,8 @@ void fent_to_name(pathname_t * name, flist_t * flp, fent_t * fep)
 
 	if (fep == NULL)
 		return;
-	if (fep->parent != -1) {
-		pfep = dirid_to_fent(fep->parent);
+	/* an entry orphaned by a racing thread resolves to the top */
+	if (fep->parent != -1 && (pfep = dirid_to_fent(fep->parent))) {
 		fent_to_name(name, &flist[FT_DIR], pfep);
 		append_pathname(name, "/");
 	}
@@ -764,6 +978,18 @@ void fent_to_name(pathname_t * name, flist_t * flp, fent_t * fep)
 	append_pathname(name, buf);
 }
 
+void flist_lock(void)
+{
+	if (shared_flist)
+		pthread_mutex_lock(&flist_mutex);
+}
+
+void flist_unlock(void)
+{
+	if (shared_flist)
+		pthread_mutex_unlock(&flist_mutex);
+}
+
 void fix_parent(int oldid, int newid)
 {
 	fent_t *fep;
@@ -797,7 +1023,8 @@ int generate_fname(fent_t * fep, int ft, pathname_t * name, int *idp, int *v)
 	int len;
 
 	flp = &flist[ft];
-	len = sprintf(buf, "%c%x", flp->tag, id = nameseq++);
+	len = sprintf(buf, "%c%x", flp->tag, id =
+		      __sync_fetch_and_add(&nameseq, 1));
 	namerandpad(id, buf, len);
 	if (fep) {
 		fent_to_name(name, &flist[FT_DIR], fep);
@@ -826,6 +1053,7 @@ get_fname(int which, long r, pathname_t * name, flist_t ** flpp, fent_t ** fepp,
 	int j;
 	int x;
 
+	flist_lock();
 	for (i = 0, c = 0, flp = flist; i < FT_nft; i++, flp++) {
 		if (which & (1 << i))
 			c += flp->nfiles;
@@ -836,6 +1064,7 @@ get_fname(int which, long r, pathname_t * name, flist_t ** flpp, fent_t ** fepp,
 		if (fepp)
 			*fepp = NULL;
 		*v = verbose;
+		flist_unlock();
 		return 0;
 	}
 	x = (int)(r % c);
@@ -856,11 +1085,13 @@ get_fname(int which, long r, pathname_t * name, flist_t ** flpp, fent_t ** fepp,
 						break;
 					}
 				}
+				flist_unlock();
 				return 1;
 			}
 			c += flp->nfiles;
 		}
 	}
+	flist_unlock();
 #ifdef DEBUG
 	fprintf(stderr, "fsstress: get_fname failure\n");
 	abort();
@@ -1202,6 +1433,26 @@ void separate_pathname(pathname_t * name, char *buf, pathname_t * newname)
 
 #define WIDTH 80
 
+void set_profile(char *name)
+{
+	char *freqs, *f;
+
+	for (profile = profiles; profile->name; profile++) {
+		if (strcmp(name, profile->name) == 0)
+			break;
+	}
+	if (profile->name == NULL) {
+		fprintf(stderr, "unknown profile %s for -P\n", name);
+		exit(1);
+	}
+	/* process_freq() writes into its argument */
+	freqs = strdup(profile->freqs);
+	zero_freq();
+	for (f = strtok(freqs, ","); f; f = strtok(NULL, ","))
+		process_freq(f);
+	free(freqs);
+}
+
 void show_ops(int flag, char *lead_str)
 {
 	opdesc_t *p;
@@ -1317,11 +1568,14 @@ int unlink_path(pathname_t * name)
 
 void usage(void)
 {
+	profile_t *pr;
+
 	printf("Usage: %s -H   or\n", myprog);
 	printf
 	    ("       %s [-c][-d dir][-e errtg][-f op_name=freq][-l loops][-n nops]\n",
 	     myprog);
-	printf("          [-p nproc][-r len][-s seed][-v][-w][-z][-S]\n");
+	printf("          [-p nproc][-r len][-s seed][-t nthreads [-m mode]][-v][-w][-z]\n");
+	printf("          [-L][-P profile][-S]\n");
 	printf("where\n");
 	printf
 	    ("   -c               specifies not to remove files(cleanup) after execution\n");
@@ -1340,12 +1594,28 @@ void usage(void)
 	printf
 	    ("   -p nproc         specifies the no. of processes (default 1)\n");
 	printf("   -r               specifies random name padding\n");
+	printf
+	    ("   -t nthreads      specifies the no. of threads instead of processes\n");
+	printf
+	    ("   -m mode          how the threads share the filesystem (default private)\n");
+	printf("                     private: every thread in its own subtree\n");
+	printf("                     dir: one tree, racing on the same names\n");
+	printf
+	    ("                     files: %d files, no namespace operations\n",
+	     SHARED_FILES);
 	printf
 	    ("   -s seed          specifies the seed for the random generator (default random)\n");
 	printf("   -v               specifies verbose mode\n");
 	printf
 	    ("   -w               zeros frequencies of non-write operations\n");
 	printf("   -z               zeros frequencies of all operations\n");
+	printf
+	    ("   -L               prints ops/s and per op latency histograms at the end\n");
+	printf("                     of every loop (the summary is always on with -t)\n");
+	printf
+	    ("   -P profile       sets the frequencies of a workload, -f can adjust them\n");
+	for (pr = profiles; pr->name; pr++)
+		printf("                     %-11s %s\n", pr->name, pr->desc);
 	printf
 	    ("   -S               prints the table of operations (omitting zero frequency)\n");
 	printf("   -H               prints usage and exits\n");
@@ -1371,6 +1641,137 @@ void zero_freq(void)
 		p->freq = 0;
 }
 
+/* zeros frequencies of the operations changing the namespace */
+void ns_freq(void)
+{
+	opdesc_t *p;
+
+	for (p = ops; p < ops_end; p++) {
+		switch (p->op) {
+		case OP_CREAT:
+		case OP_LINK:
+		case OP_MKDIR:
+		case OP_MKNOD:
+		case OP_RENAME:
+		case OP_RMDIR:
+		case OP_SYMLINK:
+		case OP_UNLINK:
+			p->freq = 0;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* upper bound in microseconds of the bucket holding the pct percentile */
+unsigned long lat_pct(opstat_t * st, int pct)
+{
+	unsigned long n = 0;
+	int b;
+
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		n += st->hist[b];
+		if (n * 100 >= st->count * pct)
+			break;
+	}
+	return 1UL << b;
+}
+
+void show_op_stats(double secs)
+{
+	static char *modes[] = { "private", "dir", "files" };
+	opstat_t sum, all;
+	opstat_t *st;
+	opdesc_t *p;
+	int nworkers = nthreads ? nthreads : nproc;
+	int b;
+	int i;
+
+	if (nthreads)
+		printf("%d threads, %s sharing", nthreads, modes[share_mode]);
+	else
+		printf("%d processes", nproc);
+	printf(", %.2f seconds%s%s\n", secs, profile ? ", profile " : "",
+	       profile ? profile->name : "");
+	printf("%-12s %10s %12s %10s %8s %8s %8s %10s\n", "op", "count",
+	       "ops/s", "avg us", "p50<", "p90<", "p99<", "max us");
+	memset(&all, 0, sizeof(all));
+	for (p = ops; p < ops_end; p++) {
+		/* merge what every thread or process counted for this op */
+		memset(&sum, 0, sizeof(sum));
+		for (i = 0; i < nworkers; i++) {
+			st = &op_stats[i * nops + (p - ops)];
+			sum.count += st->count;
+			sum.total_ns += st->total_ns;
+			sum.max_ns = MAX(sum.max_ns, st->max_ns);
+			for (b = 0; b < LAT_BUCKETS; b++)
+				sum.hist[b] += st->hist[b];
+		}
+		if (sum.count == 0)
+			continue;
+		printf("%-12s %10lu %12.1f %10.1f %8lu %8lu %8lu %10.1f\n",
+		       p->name, sum.count, sum.count / secs,
+		       sum.total_ns / 1000.0 / sum.count, lat_pct(&sum, 50),
+		       lat_pct(&sum, 90), lat_pct(&sum, 99),
+		       sum.max_ns / 1000.0);
+		if (show_lat) {
+			for (b = 0; b < LAT_BUCKETS; b++) {
+				if (sum.hist[b])
+					printf("%16s<%-10lu %10lu\n", "",
+					       1UL << b, sum.hist[b]);
+			}
+		}
+		all.count += sum.count;
+		all.total_ns += sum.total_ns;
+		all.max_ns = MAX(all.max_ns, sum.max_ns);
+		for (b = 0; b < LAT_BUCKETS; b++)
+			all.hist[b] += sum.hist[b];
+	}
+	if (all.count == 0)
+		return;
+	printf("%-12s %10lu %12.1f %10.1f %8lu %8lu %8lu %10.1f\n", "total",
+	       all.count, all.count / secs, all.total_ns / 1000.0 / all.count,
+	       lat_pct(&all, 50), lat_pct(&all, 90), lat_pct(&all, 99),
+	       all.max_ns / 1000.0);
+}
+
+void *thread_proc(void *arg)
+{
+	int i;
+
+	procid = (long)arg;
+
+	/* doproc() and the *_path() helpers chdir() */
+	if (unshare(CLONE_FS) < 0) {
+		perror("unshare(CLONE_FS)");
+		exit(1);
+	}
+
+	if (share_mode == SHARE_PRIVATE) {
+		flist = calloc(FT_nft, sizeof(flist_t));
+		dcache = malloc(NDCACHE * sizeof(int));
+		if (flist == NULL || dcache == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		for (i = 0; i < FT_nft; i++)
+			flist[i].tag = main_flist[i].tag;
+		dcache_init();
+	}
+
+	doproc();
+
+	if (share_mode == SHARE_PRIVATE) {
+		for (i = 0; i < FT_nft; i++)
+			free(flist[i].fents);
+		free(flist);
+		free(dcache);
+	}
+	free(homedir);
+	return NULL;
+}
+
 #ifndef NO_XFS
 
 void allocsp_f(int opno, long r)
@@ -1648,6 +2049,7 @@ void creat_f(int opno, long r)
 	int v1;
 	int esz = 0;
 
+	flist_lock();
 	if (!get_fname(FT_DIRm, r, NULL, NULL, &fep, &v1))
 		parid = -1;
 	else
@@ -1666,9 +2068,11 @@ void creat_f(int opno, long r)
 			printf("%d/%d: creat - no filename from %s\n",
 			       procid, opno, f.path);
 		}
+		flist_unlock();
 		free_pathname(&f);
 		return;
 	}
+	flist_unlock();
 	fd = creat_path(&f, 0666);
 	e = fd < 0 ? errno : 0;
 	e1 = 0;
@@ -2071,9 +2475,11 @@ void link_f(int opno, long r)
 	int v1;
 
 	init_pathname(&f);
+	flist_lock();
 	if (!get_fname(FT_NOTDIR, r, &f, &flp, NULL, &v1)) {
 		if (v1)
 			printf("%d/%d: link - no file\n", procid, opno);
+		flist_unlock();
 		free_pathname(&f);
 		return;
 	}
@@ -2091,10 +2497,12 @@ void link_f(int opno, long r)
 			printf("%d/%d: link - no filename from %s\n",
 			       procid, opno, l.path);
 		}
+		flist_unlock();
 		free_pathname(&l);
 		free_pathname(&f);
 		return;
 	}
+	flist_unlock();
 	e = link_path(&f, &l) < 0 ? errno : 0;
 	check_cwd();
 	if (e == 0)
@@ -2116,6 +2524,7 @@ void mkdir_f(int opno, long r)
 	int v;
 	int v1;
 
+	flist_lock();
 	if (!get_fname(FT_DIRm, r, NULL, NULL, &fep, &v))
 		parid = -1;
 	else
@@ -2129,9 +2538,11 @@ void mkdir_f(int opno, long r)
 			printf("%d/%d: mkdir - no filename from %s\n",
 			       procid, opno, f.path);
 		}
+		flist_unlock();
 		free_pathname(&f);
 		return;
 	}
+	flist_unlock();
 	e = mkdir_path(&f, 0777) < 0 ? errno : 0;
 	check_cwd();
 	if (e == 0)
@@ -2151,6 +2562,7 @@ void mknod_f(int opno, long r)
 	int v;
 	int v1;
 
+	flist_lock();
 	if (!get_fname(FT_DIRm, r, NULL, NULL, &fep, &v))
 		parid = -1;
 	else
@@ -2164,9 +2576,11 @@ void mknod_f(int opno, long r)
 			printf("%d/%d: mknod - no filename from %s\n",
 			       procid, opno, f.path);
 		}
+		flist_unlock();
 		free_pathname(&f);
 		return;
 	}
+	flist_unlock();
 	e = mknod_path(&f, S_IFCHR | 0444, 0) < 0 ? errno : 0;
 	check_cwd();
 	if (e == 0)
@@ -2271,12 +2685,15 @@ void rename_f(int opno, long r)
 	int v1;
 
 	init_pathname(&f);
+	flist_lock();
 	if (!get_fname(FT_ANYm, r, &f, &flp, &fep, &v1)) {
 		if (v1)
 			printf("%d/%d: rename - no filename\n", procid, opno);
+		flist_unlock();
 		free_pathname(&f);
 		return;
 	}
+	oldid = fep->id;
 	if (!get_fname(FT_DIRm, random(), NULL, NULL, &dfep, &v))
 		parid = -1;
 	else
@@ -2291,19 +2708,21 @@ void rename_f(int opno, long r)
 			printf("%d/%d: rename - no filename from %s\n",
 			       procid, opno, f.path);
 		}
+		flist_unlock();
 		free_pathname(&newf);
 		free_pathname(&f);
 		return;
 	}
+	flist_unlock();
 	e = rename_path(&f, &newf) < 0 ? errno : 0;
 	check_cwd();
 	if (e == 0) {
-		if (flp - flist == FT_DIR) {
-			oldid = fep->id;
+		flist_lock();
+		if (flp - flist == FT_DIR)
 			fix_parent(oldid, id);
-		}
-		del_from_flist(flp - flist, fep - flp->fents);
+		del_id_from_flist(flp - flist, oldid);
 		add_to_flist(flp - flist, id, parid);
+		flist_unlock();
 	}
 	if (v)
 		printf("%d/%d: rename %s to %s %d\n", procid, opno, f.path,
@@ -2371,19 +2790,24 @@ void rmdir_f(int opno, long r)
 	int e;
 	pathname_t f;
 	fent_t *fep;
+	int id;
 	int v;
 
 	init_pathname(&f);
+	flist_lock();
 	if (!get_fname(FT_DIRm, r, &f, NULL, &fep, &v)) {
 		if (v)
 			printf("%d/%d: rmdir - no directory\n", procid, opno);
+		flist_unlock();
 		free_pathname(&f);
 		return;
 	}
+	id = fep->id;
+	flist_unlock();
 	e = rmdir_path(&f) < 0 ? errno : 0;
 	check_cwd();
 	if (e == 0)
-		del_from_flist(FT_DIR, fep - flist[FT_DIR].fents);
+		del_id_from_flist(FT_DIR, id);
 	if (v)
 		printf("%d/%d: rmdir %s %d\n", procid, opno, f.path, e);
 	free_pathname(&f);
@@ -2423,6 +2847,7 @@ void symlink_f(int opno, long r)
 	int v1;
 	char *val;
 
+	flist_lock();
 	if (!get_fname(FT_DIRm, r, NULL, NULL, &fep, &v))
 		parid = -1;
 	else
@@ -2436,9 +2861,11 @@ void symlink_f(int opno, long r)
 			printf("%d/%d: symlink - no filename from %s\n",
 			       procid, opno, f.path);
 		}
+		flist_unlock();
 		free_pathname(&f);
 		return;
 	}
+	flist_unlock();
 	len = (int)(random() % PATH_MAX);
 	val = malloc(len + 1);
 	if (len)
@@ -2506,19 +2933,24 @@ void unlink_f(int opno, long r)
 	pathname_t f;
 	fent_t *fep;
 	flist_t *flp;
+	int id;
 	int v;
 
 	init_pathname(&f);
+	flist_lock();
 	if (!get_fname(FT_NOTDIR, r, &f, &flp, &fep, &v)) {
 		if (v)
 			printf("%d/%d: unlink - no file\n", procid, opno);
+		flist_unlock();
 		free_pathname(&f);
 		return;
 	}
+	id = fep->id;
+	flist_unlock();
 	e = unlink_path(&f) < 0 ? errno : 0;
 	check_cwd();
 	if (e == 0)
-		del_from_flist(flp - flist, fep - flp->fents);
+		del_id_from_flist(flp - flist, id);
 	if (v)
 		printf("%d/%d: unlink %s %d\n", procid, opno, f.path, e);
 	free_pathname(&f);
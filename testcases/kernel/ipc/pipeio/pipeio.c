@@ -35,6 +35,7 @@
  *  This tool can be used to beat on system or named pipes.
  *  See the help() function below for user information.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -48,6 +49,8 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include <sys/sem.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 
 #include "tlibio.h"
 
@@ -96,6 +99,17 @@ void sig_child();
 int count = 0;
 int Nchildcomplete = 0;
 
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ	1031
+#endif
+#ifndef F_GETPIPE_SZ
+#define F_GETPIPE_SZ	1032
+#endif
+
+static int perf_mode_parse(const char *arg);
+static int perf_pipe(int mode, int unpipe, char *pname, int num_wrters,
+		     int num_readers, int num_writes, int size, int pipe_sz);
+
 /*
  * Ensure PATH_MAX is define
  */
@@ -158,6 +172,10 @@ char *av[];
 	} u;
 	unsigned int uwait_iter = 1000;
 	unsigned int uwait_total = 5000000;
+	int perf_mode = -1;	/* performance mode transfer method */
+	int num_readers = 1;	/* number of readers in performance mode */
+	int readers_set = 0;	/* -r was given */
+	int pipe_sz = 0;	/* F_SETPIPE_SZ size, 0 keeps the default */
 
 	u.val = 0;
 	format = HEX;
@@ -173,7 +191,7 @@ char *av[];
 
 	while ((c =
 		getopt(ac, av,
-		       "T:BbCc:D:d:he:Ef:i:I:ln:p:qs:uvW:w:P:")) != EOF) {
+		       "T:BbCc:D:d:he:Ef:i:I:lm:n:p:qr:S:s:uvW:w:P:")) != EOF) {
 		switch (c) {
 		case 'T':
 			TCID = optarg;
@@ -296,6 +314,38 @@ char *av[];
 			++loop;
 			break;
 
+		case 'm':	/* performance mode */
+			if ((perf_mode = perf_mode_parse(optarg)) == -1) {
+				fprintf(stderr,
+					"%s: --m arg is invalid, must be rw, vmsplice or splice.\n",
+					TCID);
+				exit(1);
+			}
+			break;
+
+		case 'r':	/* number of readers */
+			if (sscanf(optarg, "%d", &num_readers) != 1 ||
+			    num_readers <= 0) {
+				fprintf(stderr,
+					"%s: --r option must be greater than zero.\n",
+					TCID);
+				usage();
+				exit(1);
+			}
+			readers_set = 1;
+			break;
+
+		case 'S':	/* pipe size */
+			if (sscanf(optarg, "%d", &pipe_sz) != 1 ||
+			    pipe_sz <= 0) {
+				fprintf(stderr,
+					"%s: --S option must be greater than zero.\n",
+					TCID);
+				usage();
+				exit(1);
+			}
+			break;
+
 		case 'i':
 		case 'n':	/* number writes per child */
 			if (sscanf(optarg, "%d", &num_writes) != 1) {
@@ -422,7 +472,20 @@ char *av[];
 	 *      bytes will be written.)  This is the same as:
 	 *      pipeio -s 4096 -n 13 -c 5
 	 */
-	if (size > PIPE_BUF && num_wrters > 1) {
+	if (perf_mode == -1 && (readers_set || pipe_sz)) {
+		fprintf(stderr,
+			"%s: --r and --S are only valid with --m.\n", TCID);
+		exit(1);
+	}
+
+	if (perf_mode != -1 && loop) {
+		fprintf(stderr,
+			"%s: --m needs a finite number of writes.\n", TCID);
+		exit(1);
+	}
+
+	/* Several readers can only keep chunks apart if writes are atomic */
+	if (size > PIPE_BUF && (num_wrters > 1 || num_readers > 1)) {
 		if (!loop) {
 			/* we must set num_writes s.t. num_writes*num_wrters doesn't overflow later */
 			num_writes =
@@ -438,6 +501,15 @@ char *av[];
 
 	}
 
+	if (perf_mode != -1) {
+		if (strlen(dir) && !unpipe && chdir(dir) == -1) {
+			tst_resm(TFAIL | TERRNO, "chdir(%s) failed", dir);
+			exit(1);
+		}
+		return perf_pipe(perf_mode, unpipe, pname, num_wrters,
+				 num_readers, num_writes, size, pipe_sz);
+	}
+
 	if ((writebuf = (char *)malloc(size)) == NULL ||
 	    (readbuf = (char *)malloc(size)) == NULL) {
 		tst_resm(TFAIL | TERRNO, "malloc() failed");
@@ -773,10 +845,379 @@ output:
 	return (error);
 }
 
+/*
+ * Performance mode.
+ *
+ * Writers stamp every chunk with a header carrying their id, a sequence
+ * number and the send time instead of relying on the buffer contents, so
+ * readers only need to look at the header.  Per reader monotonic sequence
+ * numbers plus per writer chunk counts and sequence sums, merged in a
+ * shared mapping at exit, catch lost, duplicated and reordered chunks.
+ */
+#define PERF_MAGIC	0x50495045
+#define PERF_HIST	32
+
+#define PERF_RW		0
+#define PERF_VMSPLICE	1
+#define PERF_SPLICE	2
+
+static const char *perf_names[] = { "rw", "vmsplice", "splice" };
+
+struct perf_hdr {
+	unsigned int magic;
+	unsigned int writer;
+	unsigned long long seq;
+	unsigned long long stamp;
+};
+
+struct perf_shared {
+	long long errors;
+	long long bytes;
+	long long hist[PERF_HIST];	/* log2 usec buckets */
+	long long counts[];		/* chunks, then seq sums per writer */
+};
+
+static unsigned long long perf_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int perf_mode_parse(const char *arg)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(perf_names) / sizeof(perf_names[0]); i++)
+		if (!strcmp(arg, perf_names[i]))
+			return i;
+
+	return -1;
+}
+
+static void perf_write_full(int fd, int mode, char *buf, int size)
+{
+	struct iovec iov = {.iov_base = buf,.iov_len = size };
+	ssize_t n;
+
+	while (iov.iov_len) {
+		if (mode == PERF_RW)
+			n = write(fd, iov.iov_base, iov.iov_len);
+		else
+			n = vmsplice(fd, &iov, 1, 0);
+		if (n < 0)
+			tst_brkm(TBROK | TERRNO, NULL, "%s to pipe failed",
+				 mode == PERF_RW ? "write" : "vmsplice");
+		iov.iov_base = (char *)iov.iov_base + n;
+		iov.iov_len -= n;
+	}
+}
+
+static void perf_splice_full(int in, int out, int size)
+{
+	ssize_t n;
+
+	while (size) {
+		n = splice(in, NULL, out, NULL, size, SPLICE_F_MOVE);
+		if (n <= 0)
+			tst_brkm(TBROK | TERRNO, NULL, "splice failed");
+		size -= n;
+	}
+}
+
+static void perf_writer(int fd, int id, int mode, int size, int num_writes,
+			int pipe_sz)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	int stride = (size + page - 1) / page * page;
+	int entries = 1, stage[2];
+	struct perf_hdr *hdr;
+	char *ring;
+	int seq;
+
+	/* A chunk is vmsplice()d whole before it is spliced on */
+	if (mode == PERF_SPLICE) {
+		if (pipe(stage) == -1)
+			tst_brkm(TBROK | TERRNO, NULL,
+				 "pipe() for staging failed");
+		if (fcntl(stage[1], F_SETPIPE_SZ, size) == -1 &&
+		    fcntl(stage[1], F_GETPIPE_SZ) < size)
+			tst_brkm(TBROK | TERRNO, NULL,
+				 "staging pipe too small for %d bytes", size);
+	}
+
+	/*
+	 * The pipes keep references to vmsplice()d pages, so a chunk may only
+	 * be reused after more chunks than both pipes can hold were written.
+	 */
+	if (mode != PERF_RW) {
+		int slots = pipe_sz / page;
+
+		if (mode == PERF_SPLICE)
+			slots += fcntl(stage[1], F_GETPIPE_SZ) / page;
+		entries = 2 * slots / (stride / page) + 2;
+	}
+
+	if (posix_memalign((void **)&ring, page, (size_t)entries * stride))
+		tst_brkm(TBROK, NULL, "posix_memalign() failed");
+	memset(ring, 'Z', (size_t)entries * stride);
+
+	for (seq = 0; seq < num_writes; seq++) {
+		char *buf = ring + (size_t)(seq % entries) * stride;
+
+		hdr = (struct perf_hdr *)buf;
+		hdr->magic = PERF_MAGIC;
+		hdr->writer = id;
+		hdr->seq = seq;
+		hdr->stamp = perf_now();
+
+		if (mode == PERF_SPLICE) {
+			perf_write_full(stage[1], PERF_VMSPLICE, buf, size);
+			perf_splice_full(stage[0], fd, size);
+		} else {
+			perf_write_full(fd, mode, buf, size);
+		}
+	}
+}
+
+/* Returns the number of bytes read, less than size only at EOF */
+static int perf_read_chunk(int fd, int mode, char *buf, int size,
+			   int stage[2], int null_fd)
+{
+	int done = 0;
+	ssize_t n;
+
+	while (done < size) {
+		if (mode == PERF_SPLICE)
+			n = splice(fd, NULL, stage[1], NULL, size - done,
+				   SPLICE_F_MOVE);
+		else
+			n = read(fd, buf + done, size - done);
+		if (n < 0)
+			tst_brkm(TBROK | TERRNO, NULL, "reading pipe failed");
+		if (n == 0)
+			break;
+		done += n;
+	}
+
+	/* Copy out just the header, the payload goes to /dev/null */
+	if (mode == PERF_SPLICE && done) {
+		n = MIN((int)sizeof(struct perf_hdr), done);
+		if (read(stage[0], buf, n) != n)
+			tst_brkm(TBROK | TERRNO, NULL,
+				 "reading staging pipe failed");
+		if (done > n)
+			perf_splice_full(stage[0], null_fd, done - n);
+	}
+
+	return done;
+}
+
+static void perf_reader(int fd, int mode, int size, int num_wrters,
+			int num_writes, struct perf_shared *sh)
+{
+	long long *counts, *seqsums, *last, hist[PERF_HIST];
+	long long errors = 0, bytes = 0, lat;
+	struct perf_hdr *hdr;
+	int stage[2], null_fd = -1, b, n;
+	char *buf;
+
+	if (mode == PERF_SPLICE) {
+		if (pipe(stage) == -1)
+			tst_brkm(TBROK | TERRNO, NULL,
+				 "pipe() for staging failed");
+		if (fcntl(stage[1], F_SETPIPE_SZ, size) == -1 &&
+		    fcntl(stage[1], F_GETPIPE_SZ) < size)
+			tst_brkm(TBROK | TERRNO, NULL,
+				 "staging pipe too small for %d bytes", size);
+		if ((null_fd = open("/dev/null", O_WRONLY)) == -1)
+			tst_brkm(TBROK | TERRNO, NULL,
+				 "open(/dev/null) failed");
+	}
+
+	buf = malloc(size);
+	counts = calloc(3 * num_wrters, sizeof(long long));
+	if (buf == NULL || counts == NULL)
+		tst_brkm(TBROK | TERRNO, NULL, "malloc() failed");
+	seqsums = counts + num_wrters;
+	last = seqsums + num_wrters;
+	memset(hist, 0, sizeof(hist));
+
+	while ((n = perf_read_chunk(fd, mode, buf, size, stage, null_fd))) {
+		hdr = (struct perf_hdr *)buf;
+		lat = (perf_now() - hdr->stamp) / 1000;
+		bytes += n;
+
+		if (n < size || hdr->magic != PERF_MAGIC ||
+		    hdr->writer >= (unsigned int)num_wrters ||
+		    hdr->seq >= (unsigned long long)num_writes ||
+		    (long long)hdr->seq < last[hdr->writer]) {
+			if (!errors++)
+				tst_resm(TFAIL, "bad chunk: %d bytes, magic "
+					 "%#x, writer %u, seq %llu", n,
+					 hdr->magic, hdr->writer, hdr->seq);
+			continue;
+		}
+
+		last[hdr->writer] = hdr->seq + 1;
+		counts[hdr->writer]++;
+		seqsums[hdr->writer] += hdr->seq;
+
+		for (b = 0; b < PERF_HIST - 1 && lat >> b; b++) ;
+		hist[b]++;
+	}
+
+	__sync_fetch_and_add(&sh->errors, errors);
+	__sync_fetch_and_add(&sh->bytes, bytes);
+	for (b = 0; b < PERF_HIST; b++)
+		__sync_fetch_and_add(&sh->hist[b], hist[b]);
+	for (n = 0; n < 2 * num_wrters; n++)
+		__sync_fetch_and_add(&sh->counts[n], counts[n]);
+}
+
+static long long perf_percentile(long long *hist, long long total, int pct)
+{
+	long long seen = 0, target = (total * pct + 99) / 100;
+	int b;
+
+	for (b = 0; b < PERF_HIST; b++) {
+		seen += hist[b];
+		if (seen >= target)
+			break;
+	}
+
+	return b ? 1LL << b : 1;
+}
+
+static int perf_pipe(int mode, int unpipe, char *pname, int num_wrters,
+		     int num_readers, int num_writes, int size, int pipe_sz)
+{
+	struct perf_shared *sh;
+	size_t sh_size;
+	unsigned long long start, end;
+	long long chunks, expected, total = 0;
+	int fds[2], go[2], i, c, status, error = 0;
+	char dummy;
+	double secs;
+
+	if ((size_t)size < sizeof(struct perf_hdr))
+		tst_brkm(TBROK, NULL, "size must be at least %zu bytes",
+			 sizeof(struct perf_hdr));
+
+	if (unpipe) {
+		if (pipe(fds) == -1)
+			tst_brkm(TBROK | TERRNO, NULL, "pipe() failed");
+	} else {
+		if (mkfifo(pname, 0777) == -1 && errno != EEXIST)
+			tst_brkm(TBROK | TERRNO, NULL,
+				 "mkfifo(%s,0777) failed", pname);
+		/* A non-blocking reader lets the writer open without a peer */
+		if ((fds[0] = open(pname, O_RDONLY | O_NONBLOCK)) == -1 ||
+		    (fds[1] = open(pname, O_WRONLY)) == -1 ||
+		    fcntl(fds[0], F_SETFL, 0) == -1)
+			tst_brkm(TBROK | TERRNO, NULL, "open(%s) failed",
+				 pname);
+	}
+
+	if (pipe_sz && fcntl(fds[0], F_SETPIPE_SZ, pipe_sz) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "F_SETPIPE_SZ to %d failed",
+			 pipe_sz);
+	pipe_sz = fcntl(fds[0], F_GETPIPE_SZ);
+
+	sh_size = sizeof(*sh) + 2 * num_wrters * sizeof(long long);
+	sh = mmap(NULL, sh_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sh == MAP_FAILED)
+		tst_brkm(TBROK | TERRNO, NULL, "mmap() failed");
+
+	/* Children block on go until the parent closes its write end */
+	if (pipe(go) == -1)
+		tst_brkm(TBROK | TERRNO, NULL, "pipe() failed");
+
+	for (i = 0; i < num_wrters + num_readers; i++) {
+		if ((c = fork()) == -1)
+			tst_brkm(TBROK | TERRNO, NULL, "fork() failed");
+		if (c)
+			continue;
+
+		close(go[1]);
+		if (read(go[0], &dummy, 1) == -1)
+			tst_brkm(TBROK | TERRNO, NULL, "read(go) failed");
+
+		if (i < num_wrters) {
+			close(fds[0]);
+			perf_writer(fds[1], i, mode, size, num_writes,
+				    pipe_sz);
+		} else {
+			close(fds[1]);
+			perf_reader(fds[0], mode, size, num_wrters,
+				    num_writes, sh);
+		}
+		_exit(0);
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+	close(go[0]);
+
+	start = perf_now();
+	close(go[1]);
+
+	for (i = 0; i < num_wrters + num_readers; i++) {
+		if (wait(&status) == -1)
+			tst_brkm(TBROK | TERRNO, NULL, "wait() failed");
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			tst_resm(TFAIL, "child exited abnormally (%#x)",
+				 status);
+			error++;
+		}
+	}
+	end = perf_now();
+
+	if (!unpipe)
+		unlink(pname);
+
+	expected = num_writes;
+	for (i = 0; i < num_wrters; i++) {
+		chunks = sh->counts[i];
+		if (chunks != expected || sh->counts[num_wrters + i] !=
+		    expected * (expected - 1) / 2) {
+			tst_resm(TFAIL, "writer %d: received %lld chunks, "
+				 "expected %lld", i, chunks, expected);
+			error++;
+		}
+		total += chunks;
+	}
+	error += sh->errors;
+
+	secs = (end - start) / 1e9;
+	tst_resm(TINFO, "%s %s: %d writers, %d readers, %d byte chunks, "
+		 "pipe size %d: %.1f MB/s, %.0f chunks/s", perf_names[mode],
+		 unpipe ? "sys pipe" : "named pipe", num_wrters, num_readers,
+		 size, pipe_sz, sh->bytes / secs / 1048576, total / secs);
+	if (total)
+		tst_resm(TINFO, "chunk latency (usec): p50 < %lld, p90 < %lld,"
+			 " p99 < %lld, max < %lld",
+			 perf_percentile(sh->hist, total, 50),
+			 perf_percentile(sh->hist, total, 90),
+			 perf_percentile(sh->hist, total, 99),
+			 perf_percentile(sh->hist, total, 100));
+
+	if (error)
+		tst_resm(TFAIL, "%d errors in %lld chunks", error, total);
+	else
+		tst_resm(TPASS, "%lld chunks transferred", total);
+
+	munmap(sh, sh_size);
+
+	return error;
+}
+
 void usage()
 {
 	fprintf(stderr,
-		"Usage: %s [-BbCEv][-c #writers][-D pname][-d dir][-h][-e exit_num][-f fmt][-l][-i #writes][-n #writes][-p num_rpt]\n\t[-s size][-W max_wait][-w max_wait][-u]\n",
+		"Usage: %s [-BbCEv][-c #writers][-D pname][-d dir][-h][-e exit_num][-f fmt][-l][-i #writes][-n #writes][-p num_rpt]\n\t[-s size][-W max_wait][-w max_wait][-u][-m mode][-r #readers][-S pipe_size]\n",
 		TCID);
 	fflush(stderr);
 
@@ -802,9 +1243,16 @@ void help()
   -I io_type   - Specifies io type: s - sync, p - polled async, a - async (def s)\n\
                  l - listio sync, L - listio async, r - random\n\
   -l           - loop forever (implied by -n 0).\n\
+  -m mode      - performance mode, transfer with rw (read/write), vmsplice\n\
+                 (vmsplice writers) or splice (vmsplice+splice writers,\n\
+                 splicing readers). Chunks carry sequence headers instead\n\
+                 of verified contents, I/O is blocking and MB/s and chunk\n\
+                 latency are reported.\n\
   -n #writes   - same as -i (for compatability).\n\
   -p num_rpt   - number of reads before a report\n\
   -q           - quiet mode, no PASS results are printed\n\
+  -r #readers  - number of readers in performance mode (def 1)\n\
+  -S pipe_size - resize the pipe with F_SETPIPE_SZ in performance mode\n\
   -s size      - size of read and write (def 327)\n\
                  if size >= 4096, i/o will be in 4096 chuncks\n\
   -w max_wait  - max time (seconds) for sleep between writes.\n\
@@ -913,6 +1361,8 @@ void prt_examples()
 	printf("%s -c 5 -i 0 -s 4090 -b\n", TCID);
 	printf("%s -c 5 -i 0 -s 4090 -b -u \n", TCID);
 	printf("%s -c 5 -i 0 -s 4090 -b -W 3 -w 3 \n", TCID);
+	printf("%s -c 4 -r 4 -i 100000 -s 4096 -u -m splice -S 1048576\n",
+	       TCID);
 
 }
 
@@ -8,6 +8,9 @@ static void _test_alloc(int testcase, int lite);
 
 /* KSM */
 static void _check(char *path, long int value);
+static long _read_ksm(char *name);
+static void _read_ksm_pages(long *pages);
+static void _wait_ksmd_done(void);
 static void _group_check(int run, int pages_shared, int pages_sharing,
 		int pages_volatile, int pages_unshared,
 		int sleep_millisecs, int pages_to_scan);
@@ -18,5 +21,8 @@ static void _verify(char **memory, char value, int proc, int start, int end,
 static void _gather_cpus(char *cpus, long nd);
 
 /* shared */
+static long _verify_range(char *addr, size_t len, char value);
+static long _fill_verify_mem(char *addr, size_t len, char value, int flags,
+		int verify);
 
 #endif /* __INTERNAL_H */
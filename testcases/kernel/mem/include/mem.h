@@ -31,6 +31,10 @@ void testoom(int mempolicy, int lite, int numa);
 /* KSM */
 
 #define PATH_KSM		"/sys/kernel/mm/ksm/"
+/* ksmd is polled this often until it settles, for at most the timeout */
+#define KSM_POLL_MSECS		100
+#define KSM_WAIT_TIMEOUT	600
+#define KSM_MIN_SCANS		3
 
 /* HUGETLB */
 
@@ -74,4 +78,13 @@ void setup(void);
 
 void update_shm_size(size_t *shm_size);
 
+/* parallel fill/verify */
+#define FILL_CHUNK		(2 * MB)
+#define FILL_MAX_THREADS	64
+#define FILL_HUGEPAGE		0x1	/* madvise(MADV_HUGEPAGE) first */
+#define FILL_POPULATE		0x2	/* prefault with MADV_POPULATE_WRITE */
+
+void fill_mem(void *addr, size_t len, char value, int flags);
+long verify_mem(void *addr, size_t len, char value);
+
 #endif
@@ -6,6 +6,7 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #if HAVE_NUMA_H
 #include <numa.h>
 #endif
@@ -15,6 +16,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "test.h"
@@ -45,7 +47,7 @@ static int _alloc_mem(long int length, int testcase)
 	if (testcase == KSM && madvise(s, length, MADV_MERGEABLE) == -1)
 		tst_brkm(TBROK | TERRNO, cleanup, "madvise");
 #endif
-	memset(s, '\a', length);
+	fill_mem(s, length, '\a', 0);
 
 	return 0;
 }
@@ -142,45 +144,72 @@ static void _check(char *path, long int value)
 		tst_resm(TFAIL, "%s is not %ld.", path, value);
 }
 
+static long _read_ksm(char *name)
+{
+	char buf[BUFSIZ], path[BUFSIZ];
+
+	snprintf(path, BUFSIZ, "%s%s", PATH_KSM, name);
+	memset(buf, 0, BUFSIZ);
+	read_file(path, buf);
+	return SAFE_STRTOL(cleanup, buf, 0, LONG_MAX);
+}
+
+static void _read_ksm_pages(long *pages)
+{
+	pages[0] = _read_ksm("pages_shared");
+	pages[1] = _read_ksm("pages_sharing");
+	pages[2] = _read_ksm("pages_volatile");
+	pages[3] = _read_ksm("pages_unshared");
+}
+
+/*
+ * ksmd only merges a page once it has seen it unchanged over a scan, so
+ * with run=1 wait for the counters to stay put over a whole scan, and
+ * for at least KSM_MIN_SCANS scans that all started after the children
+ * stopped writing.  With run=0/2 the counters change synchronously and
+ * only need to be stable between two polls.
+ */
 static void _wait_ksmd_done(void)
 {
-	char buf[BUFSIZ];
-	long pages_shared, pages_sharing, pages_volatile, pages_unshared;
-	long old_pages_shared = 0, old_pages_sharing = 0;
-	long old_pages_volatile = 0, old_pages_unshared = 0;
-	int changing = 1, count = 0;
-
-	while (changing) {
-		sleep(10);
-		count++;
-
-		read_file(PATH_KSM "pages_shared", buf);
-		pages_shared = SAFE_STRTOL(cleanup, buf, 0, LONG_MAX);
-
-		read_file(PATH_KSM "pages_sharing", buf);
-		pages_sharing = SAFE_STRTOL(cleanup, buf, 0, LONG_MAX);
-
-		read_file(PATH_KSM "pages_volatile", buf);
-		pages_volatile = SAFE_STRTOL(cleanup, buf, 0, LONG_MAX);
-
-		read_file(PATH_KSM "pages_unshared", buf);
-		pages_unshared = SAFE_STRTOL(cleanup, buf, 0, LONG_MAX);
-
-		if (pages_shared != old_pages_shared ||
-		    pages_sharing != old_pages_sharing ||
-		    pages_volatile != old_pages_volatile ||
-		    pages_unshared != old_pages_unshared) {
-			old_pages_shared = pages_shared;
-			old_pages_sharing = pages_sharing;
-			old_pages_volatile = pages_volatile;
-			old_pages_unshared = pages_unshared;
-		} else {
-			changing = 0;
+	long run, full_scans, last_scans = 0, scans = 0;
+	long pages[4], old_pages[4];
+	struct timespec start, now;
+	long msecs = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	run = _read_ksm("run");
+	if (run == 1)
+		last_scans = _read_ksm("full_scans");
+	_read_ksm_pages(old_pages);
+
+	for (;;) {
+		usleep(KSM_POLL_MSECS * 1000);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		msecs = (now.tv_sec - start.tv_sec) * 1000 +
+			(now.tv_nsec - start.tv_nsec) / 1000000;
+		if (msecs > KSM_WAIT_TIMEOUT * 1000)
+			tst_brkm(TBROK, cleanup, "ksm daemon did not settle "
+				 "within %ds", KSM_WAIT_TIMEOUT);
+
+		if (run == 1) {
+			full_scans = _read_ksm("full_scans");
+			if (full_scans == last_scans)
+				continue;
+			scans += full_scans - last_scans;
+			last_scans = full_scans;
 		}
+
+		_read_ksm_pages(pages);
+		if (memcmp(pages, old_pages, sizeof(pages)) == 0 &&
+		    (run != 1 || scans >= KSM_MIN_SCANS))
+			break;
+		memcpy(old_pages, pages, sizeof(pages));
 	}
 
-	tst_resm(TINFO, "ksm daemon takes %ds to scan all mergeable pages",
-		 count * 10);
+	tst_resm(TINFO, "ksm daemon takes %ld.%03lds and %ld full scans to "
+		 "scan all mergeable pages", msecs / 1000, msecs % 1000, scans);
 }
 
 static void _group_check(int run, int pages_shared, int pages_sharing,
@@ -203,25 +232,17 @@ static void _group_check(int run, int pages_shared, int pages_sharing,
 static void _verify(char **memory, char value, int proc,
 		    int start, int end, int start2, int end2)
 {
-	int i, j;
-	void *s = NULL;
-
-	s = malloc((end - start) * (end2 - start2));
-	if (s == NULL)
-		tst_brkm(TBROK | TERRNO, tst_exit, "malloc");
+	int j;
+	long i;
 
 	tst_resm(TINFO, "child %d verifies memory content.", proc);
-	memset(s, value, (end - start) * (end2 - start2));
-	if (memcmp(memory[start], s, (end - start) * (end2 - start2))
-	    != 0)
-		for (j = start; j < end; j++)
-			for (i = start2; i < end2; i++)
-				if (memory[j][i] != value)
-					tst_resm(TFAIL, "child %d has %c at "
-						 "%d,%d,%d.",
-						 proc, memory[j][i], proc,
-						 j, i);
-	free(s);
+	for (j = start; j < end; j++) {
+		i = verify_mem(memory[j] + start2, end2 - start2, value);
+		if (i != -1)
+			tst_resm(TFAIL, "child %d has %c at %d,%d,%ld.",
+				 proc, memory[j][start2 + i], proc,
+				 j, start2 + i);
+	}
 }
 
 void write_memcg(void)
@@ -243,7 +264,7 @@ static struct ksm_merge_data {
 static void ksm_child_memset(int child_num, int size, int total_unit,
 		 struct ksm_merge_data ksm_merge_data, char **memory)
 {
-	int i, j;
+	int j;
 	int unit = size / total_unit;
 
 	tst_resm(TINFO, "child %d continues...", child_num);
@@ -258,16 +279,14 @@ static void ksm_child_memset(int child_num, int size, int total_unit,
 				child_num, size, ksm_merge_data.data);
 	}
 
-	for (j = 0; j < total_unit; j++) {
-		for (i = 0; i < unit * MB; i++)
-			memory[j][i] = ksm_merge_data.data;
-	}
+	for (j = 0; j < total_unit; j++)
+		fill_mem(memory[j], unit * MB, ksm_merge_data.data, 0);
 
 	/* if it contains unshared page, then set 'e' char
 	 * at the end of the last page
 	 */
 	if (ksm_merge_data.mergeable_size < size * MB)
-		memory[j-1][i-1] = 'e';
+		memory[total_unit - 1][unit * MB - 1] = 'e';
 }
 
 static void create_ksm_child(int child_num, int size, int unit,
@@ -414,22 +433,25 @@ void create_same_memory(int size, int num, int unit)
 	write_file(PATH_KSM "pages_to_scan", buf);
 	write_file(PATH_KSM "sleep_millisecs", "0");
 
+	/*
+	 * The children stop again once they have filled their memory, so
+	 * ksmd is only checked when nothing is being written any more.
+	 */
 	resume_ksm_children(child, num);
+	stop_ksm_children(child, num);
 	_group_check(1, 2, size * num * pages - 2, 0, 0, 0, size * pages * num);
 
-	stop_ksm_children(child, num);
 	resume_ksm_children(child, num);
+	stop_ksm_children(child, num);
 	_group_check(1, 3, size * num * pages - 3, 0, 0, 0, size * pages * num);
 
-	stop_ksm_children(child, num);
 	resume_ksm_children(child, num);
+	stop_ksm_children(child, num);
 	_group_check(1, 1, size * num * pages - 1, 0, 0, 0, size * pages * num);
 
-	stop_ksm_children(child, num);
 	resume_ksm_children(child, num);
-	_group_check(1, 1, size * num * pages - 2, 0, 1, 0, size * pages * num);
-
 	stop_ksm_children(child, num);
+	_group_check(1, 1, size * num * pages - 2, 0, 1, 0, size * pages * num);
 
 	tst_resm(TINFO, "KSM unmerging...");
 	write_file(PATH_KSM "run", "2");
@@ -625,6 +647,143 @@ void mount_mem(char *name, char *fs, char *options, char *path, char *path_new)
 
 /* shared */
 
+struct fill_arg {
+	char *addr;
+	size_t len;
+	char value;
+	int flags;
+	int verify;
+	int started;
+	long bad;
+};
+
+/* Returns the offset of the first byte that isn't value, or -1. */
+static long _verify_range(char *addr, size_t len, char value)
+{
+	unsigned long pattern, diff, *p;
+	size_t i = 0;
+	int k;
+
+	memset(&pattern, value, sizeof(pattern));
+
+	while (i < len && ((unsigned long)(addr + i) % sizeof(long)) != 0) {
+		if (addr[i] != value)
+			return i;
+		i++;
+	}
+	/* Compare a cache line worth of words at a time */
+	for (; i + 8 * sizeof(long) <= len; i += 8 * sizeof(long)) {
+		p = (unsigned long *)(addr + i);
+		diff = 0;
+		for (k = 0; k < 8; k++)
+			diff |= p[k] ^ pattern;
+		if (diff)
+			break;
+	}
+	for (; i < len; i++)
+		if (addr[i] != value)
+			return i;
+
+	return -1;
+}
+
+static void *_fill_thread(void *data)
+{
+	struct fill_arg *arg = data;
+
+	if (arg->verify) {
+		arg->bad = _verify_range(arg->addr, arg->len, arg->value);
+		return NULL;
+	}
+#ifdef MADV_POPULATE_WRITE
+	/* Fault the whole range in with one call instead of page by page */
+	if (arg->flags & FILL_POPULATE)
+		madvise(arg->addr, arg->len, MADV_POPULATE_WRITE);
+#endif
+	memset(arg->addr, arg->value, arg->len);
+
+	return NULL;
+}
+
+/*
+ * Splits [addr, addr + len) into FILL_CHUNK aligned pieces spread over
+ * one thread per online CPU and fills or verifies them in parallel.
+ */
+static long _fill_verify_mem(char *addr, size_t len, char value, int flags,
+			     int verify)
+{
+	struct fill_arg *args;
+	pthread_t *threads;
+	size_t chunks, per_thread;
+	long ncpus, bad = -1;
+	int i, nthreads;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	chunks = (len + FILL_CHUNK - 1) / FILL_CHUNK;
+	nthreads = ncpus < 1 ? 1 : (ncpus > FILL_MAX_THREADS ?
+				    FILL_MAX_THREADS : ncpus);
+	if (chunks < (size_t)nthreads)
+		nthreads = chunks ? chunks : 1;
+	per_thread = (chunks + nthreads - 1) / nthreads * FILL_CHUNK;
+	/* Rounding up may leave the last threads with nothing to do */
+	if (per_thread)
+		nthreads = (len + per_thread - 1) / per_thread;
+
+#ifdef MADV_HUGEPAGE
+	if (!verify && (flags & FILL_HUGEPAGE) &&
+	    madvise(addr, len, MADV_HUGEPAGE) == -1)
+		tst_resm(TINFO | TERRNO, "madvise MADV_HUGEPAGE");
+#endif
+
+	args = calloc(nthreads, sizeof(*args));
+	threads = calloc(nthreads, sizeof(*threads));
+	if (args == NULL || threads == NULL)
+		tst_brkm(TBROK | TERRNO, NULL, "calloc");
+
+	for (i = 0; i < nthreads; i++) {
+		args[i].addr = addr + i * per_thread;
+		args[i].len = i == nthreads - 1 ? len - i * per_thread :
+						  per_thread;
+		args[i].value = value;
+		args[i].flags = flags;
+		args[i].verify = verify;
+		args[i].bad = -1;
+	}
+
+	/* The caller's thread does the first piece itself */
+	for (i = 1; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, _fill_thread, &args[i]))
+			_fill_thread(&args[i]);
+		else
+			args[i].started = 1;
+	}
+	_fill_thread(&args[0]);
+	for (i = 1; i < nthreads; i++)
+		if (args[i].started)
+			pthread_join(threads[i], NULL);
+
+	for (i = 0; i < nthreads; i++)
+		if (args[i].bad != -1) {
+			bad = args[i].bad + i * per_thread;
+			break;
+		}
+
+	free(args);
+	free(threads);
+
+	return bad;
+}
+
+void fill_mem(void *addr, size_t len, char value, int flags)
+{
+	_fill_verify_mem(addr, len, value, flags, 0);
+}
+
+long verify_mem(void *addr, size_t len, char value)
+{
+	return _fill_verify_mem(addr, len, value, 0, 1);
+}
+
 /* Warning: *DO NOT* use this function in child */
 unsigned int get_a_numa_node(void (*cleanup_fn) (void))
 {
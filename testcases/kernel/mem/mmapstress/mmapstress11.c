@@ -0,0 +1,710 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2013 Linux Test Project                                      */
+/*                                                                            */
+/* This program is free software;  you can redistribute it and/or modify      */
+/* it under the terms of the GNU General Public License as published by       */
+/* the Free Software Foundation; either version 2 of the License, or          */
+/* (at your option) any later version.                                        */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY;  without even the implied warranty of            */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See                  */
+/* the GNU General Public License for more details.                           */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License          */
+/* along with this program;  if not, write to the Free Software               */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA    */
+/*                                                                            */
+/******************************************************************************/
+/*
+ * Multi-threaded page fault stress engine.
+ *
+ * N threads fault in a mapping page by page in sequential, random or
+ * strided order, then drop it again (MADV_DONTNEED, or munmap + mmap
+ * with -r) so that every pass takes a fault per page.  The mapping is
+ * anonymous, file backed, hugetlbfs or THP backed, private or shared,
+ * and either one per thread or, with -g, a single one all of the
+ * threads fault concurrently.  Optional churn threads keep doing
+ * mmap/mprotect/madvise/munmap of small areas next to it, which all take
+ * mmap_lock, to see how well faults scale against them.
+ *
+ * Every page touch (a fault, unless THP mapped the page already) and
+ * every mapping operation is timed into a log2 latency histogram.  At
+ * the end faults/s (from the rusage minflt/majflt counts of the faulting
+ * threads), the spread between the slowest and the fastest thread, and
+ * the context switches taken while faulting are reported along with the
+ * per operation latencies; the last two and the latency tails of the
+ * churn operations are the mmap_lock contention proxies.  With write
+ * faults, the page stamps are checked after each pass, and SIGSEGV or
+ * SIGBUS fail the test like in mtest06/mmap1.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "usctest.h"
+#include "safe_macros.h"
+
+char *TCID = "mmapstress11";
+int TST_TOTAL = 1;
+
+#define HIST_BUCKETS		40	/* log2(ns), up to ~18 minutes */
+#define CHURN_PAGES		16	/* max size of a churn area */
+
+enum backing { BACK_ANON, BACK_FILE, BACK_HUGETLB, BACK_THP };
+enum access { ACC_SEQ, ACC_RAND, ACC_STRIDE };
+enum op { OP_TOUCH, OP_ZAP, OP_MMAP, OP_MPROTECT, OP_MADVISE, OP_MUNMAP,
+	  NR_OPS };
+
+static const char *backing_names[] = { "anon", "file", "hugetlb", "thp" };
+static const char *access_names[] = { "seq", "rand", "stride" };
+static const char *op_names[] = { "touch", "zap", "mmap", "mprotect",
+	"madvise", "munmap" };
+
+struct op_stats {
+	unsigned long count;
+	unsigned long total_ns;
+	unsigned long max_ns;
+	unsigned long hist[HIST_BUCKETS];
+};
+
+struct thread_data {
+	pthread_t tid;
+	int id;
+	int churn;
+	char *slice;		/* the part this thread drops after a pass */
+	size_t slice_len;
+	off_t slice_off;	/* file offset of the slice */
+	char *map;		/* what this thread faults */
+	long npages;
+	long *order;
+	unsigned long rnd_state;
+	unsigned long passes;
+	unsigned long mismatches;
+	struct rusage ru;
+	struct op_stats ops[NR_OPS];
+};
+
+static int opt_threads, opt_size, opt_backing, opt_shared, opt_access;
+static int opt_stride, opt_read, opt_global, opt_remap, opt_churn;
+static int opt_time, opt_verbose;
+static char *threads_str, *size_str, *backing_str, *access_str;
+static char *stride_str, *churn_str, *time_str;
+
+static option_t options[] = {
+	{"n:", &opt_threads, &threads_str},
+	{"s:", &opt_size, &size_str},
+	{"b:", &opt_backing, &backing_str},
+	{"S", &opt_shared, NULL},
+	{"a:", &opt_access, &access_str},
+	{"k:", &opt_stride, &stride_str},
+	{"R", &opt_read, NULL},
+	{"g", &opt_global, NULL},
+	{"r", &opt_remap, NULL},
+	{"x:", &opt_churn, &churn_str},
+	{"T:", &opt_time, &time_str},
+	{"v", &opt_verbose, NULL},
+	{NULL, NULL, NULL}
+};
+
+static int nthreads;
+static int nchurn;
+static long size_mb = 64;
+static enum backing backing = BACK_ANON;
+static enum access access_mode = ACC_SEQ;
+static long stride = 16;
+static int runtime = 10;
+
+static long pagesize;
+static long step;		/* distance between two faults */
+static int map_flags;
+static int fd = -1;
+static int tmpdir_made;
+static char *common_map;
+static size_t common_len;
+static struct thread_data *td;
+static pthread_barrier_t barrier;
+static volatile int stop;
+
+static void setup(void);
+static void cleanup(void);
+static void help(void);
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static unsigned long rnd(struct thread_data *t)
+{
+	/* xorshift64* */
+	t->rnd_state ^= t->rnd_state >> 12;
+	t->rnd_state ^= t->rnd_state << 25;
+	t->rnd_state ^= t->rnd_state >> 27;
+	return t->rnd_state * 2685821657736338717UL;
+}
+
+static void record(struct op_stats *os, unsigned long ns)
+{
+	int b = 0;
+
+	while (b < HIST_BUCKETS - 1 && (2UL << b) <= ns)
+		b++;
+	os->hist[b]++;
+	os->count++;
+	os->total_ns += ns;
+	if (ns > os->max_ns)
+		os->max_ns = ns;
+}
+
+/*
+ * Upper bound of the bucket holding the pct percentile, in ns, but no
+ * more than the slowest op actually seen
+ */
+static unsigned long op_pct(const struct op_stats *os, double pct)
+{
+	unsigned long total = 0, sum = 0, ns;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		total += os->hist[i];
+	if (total == 0)
+		return 0;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		sum += os->hist[i];
+		if (sum >= total * pct / 100)
+			break;
+	}
+	ns = 2UL << (i < HIST_BUCKETS ? i : HIST_BUCKETS - 1);
+	return ns < os->max_ns ? ns : os->max_ns;
+}
+
+static void sig_handler(int sig, siginfo_t *info, void *uc)
+{
+	tst_resm(TFAIL, "unexpected %s at %p", sig == SIGBUS ? "SIGBUS" :
+		 "SIGSEGV", info->si_addr);
+	_exit(TFAIL);
+}
+
+static void *map_area(void *addr, size_t len, off_t off)
+{
+	int flags = map_flags;
+
+	if (addr != NULL)
+		flags |= MAP_FIXED;
+	if (backing == BACK_FILE)
+		return mmap(addr, len, PROT_READ | PROT_WRITE, flags, fd, off);
+	return mmap(addr, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+}
+
+/* Page visiting order of one pass */
+static void build_order(struct thread_data *t)
+{
+	long i, j, k, tmp;
+
+	t->order = malloc(t->npages * sizeof(*t->order));
+	if (t->order == NULL)
+		tst_brkm(TBROK | TERRNO, cleanup, "malloc");
+
+	switch (access_mode) {
+	case ACC_SEQ:
+		for (i = 0; i < t->npages; i++)
+			t->order[i] = i;
+		break;
+	case ACC_RAND:
+		for (i = 0; i < t->npages; i++)
+			t->order[i] = i;
+		for (i = t->npages - 1; i > 0; i--) {
+			j = rnd(t) % (i + 1);
+			tmp = t->order[i];
+			t->order[i] = t->order[j];
+			t->order[j] = tmp;
+		}
+		break;
+	case ACC_STRIDE:
+		i = 0;
+		for (k = 0; k < stride && k < t->npages; k++)
+			for (j = k; j < t->npages; j += stride)
+				t->order[i++] = j;
+		break;
+	}
+}
+
+static unsigned long stamp(struct thread_data *t, long page)
+{
+	return ((unsigned long)t->id << 48) ^ (t->passes << 24) ^ page;
+}
+
+/* Drops the pages of the slice so that the next pass faults them again */
+static void zap(struct thread_data *t)
+{
+	unsigned long start = now_ns();
+
+	if (opt_remap) {
+		if (map_area(t->slice, t->slice_len, t->slice_off) ==
+		    MAP_FAILED)
+			tst_brkm(TBROK | TERRNO, NULL, "mmap MAP_FIXED");
+#ifdef MADV_HUGEPAGE
+		/* the new mapping does not inherit the advice */
+		if (backing == BACK_THP &&
+		    madvise(t->slice, t->slice_len, MADV_HUGEPAGE) == -1)
+			tst_brkm(TBROK | TERRNO, NULL,
+				 "madvise MADV_HUGEPAGE");
+#endif
+	} else if (madvise(t->slice, t->slice_len, MADV_DONTNEED) == -1) {
+		tst_brkm(TBROK | TERRNO, NULL, "madvise MADV_DONTNEED, "
+			 "try -r");
+	}
+	record(&t->ops[OP_ZAP], now_ns() - start);
+}
+
+static void fault_pass(struct thread_data *t)
+{
+	struct op_stats *os = &t->ops[OP_TOUCH];
+	unsigned long start;
+	volatile char sink;
+	long i, page;
+	char *p;
+
+	for (i = 0; i < t->npages && !stop; i++) {
+		page = t->order[i];
+		p = t->map + page * step;
+		start = now_ns();
+		if (opt_read)
+			sink = *(volatile char *)p;
+		else
+			*(volatile unsigned long *)p = stamp(t, page);
+		record(os, now_ns() - start);
+	}
+	(void)sink;
+
+	/* With -g the other threads write the same pages */
+	if (!opt_read && !opt_global) {
+		for (i = 0; i < t->npages && !stop; i++) {
+			p = t->map + i * step;
+			if (*(unsigned long *)p != stamp(t, i) &&
+			    t->mismatches++ == 0)
+				tst_resm(TINFO, "thread %d pass %lu: page %ld "
+					 "holds %#lx, expected %#lx", t->id,
+					 t->passes, i, *(unsigned long *)p,
+					 stamp(t, i));
+		}
+	}
+}
+
+static void *fault_thread(void *arg)
+{
+	struct thread_data *t = arg;
+
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		fault_pass(t);
+		if (stop)
+			break;
+		zap(t);
+		t->passes++;
+	}
+	getrusage(RUSAGE_THREAD, &t->ru);
+	return NULL;
+}
+
+/* Keeps mmap_lock busy with small mappings of its own */
+static void *churn_thread(void *arg)
+{
+	struct thread_data *t = arg;
+	unsigned long start;
+	size_t len;
+	char *p;
+
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		len = (1 + rnd(t) % CHURN_PAGES) * pagesize;
+
+		start = now_ns();
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		record(&t->ops[OP_MMAP], now_ns() - start);
+		if (p == MAP_FAILED)
+			tst_brkm(TBROK | TERRNO, NULL, "mmap");
+		p[0] = 1;
+
+		start = now_ns();
+		if (mprotect(p, len, PROT_READ) == -1)
+			tst_brkm(TBROK | TERRNO, NULL, "mprotect");
+		record(&t->ops[OP_MPROTECT], now_ns() - start);
+
+		start = now_ns();
+		if (madvise(p, len, MADV_DONTNEED) == -1)
+			tst_brkm(TBROK | TERRNO, NULL, "madvise");
+		record(&t->ops[OP_MADVISE], now_ns() - start);
+
+		start = now_ns();
+		if (munmap(p, len) == -1)
+			tst_brkm(TBROK | TERRNO, NULL, "munmap");
+		record(&t->ops[OP_MUNMAP], now_ns() - start);
+	}
+	getrusage(RUSAGE_THREAD, &t->ru);
+	return NULL;
+}
+
+static long hugepage_size(void)
+{
+	char line[BUFSIZ];
+	long kb = 0;
+	FILE *f;
+
+	f = fopen("/proc/meminfo", "r");
+	if (f == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), f) != NULL)
+		if (sscanf(line, "Hugepagesize: %ld kB", &kb) == 1)
+			break;
+	fclose(f);
+	return kb * 1024;
+}
+
+static void *map_region(size_t len, off_t off)
+{
+	void *p;
+
+	p = map_area(NULL, len, off);
+	if (p == MAP_FAILED) {
+		if (backing == BACK_HUGETLB && errno == ENOMEM)
+			tst_brkm(TCONF, cleanup, "not enough huge pages "
+				 "reserved, see /proc/sys/vm/nr_hugepages");
+		tst_brkm(TBROK | TERRNO, cleanup, "mmap");
+	}
+#ifdef MADV_HUGEPAGE
+	if (backing == BACK_THP && madvise(p, len, MADV_HUGEPAGE) == -1)
+		tst_brkm(TCONF | TERRNO, cleanup, "madvise MADV_HUGEPAGE");
+#endif
+	return p;
+}
+
+static void setup_threads(void)
+{
+	struct thread_data *t;
+	size_t len;
+	long npages;
+	int i;
+
+	len = (size_t)size_mb << 20;
+	npages = len / step;
+	if (npages < 1)
+		tst_brkm(TBROK, cleanup, "-s is smaller than a page");
+	len = npages * step;
+	if (opt_global && npages < nthreads)
+		tst_brkm(TBROK, cleanup, "-g needs a page per thread");
+
+	if (backing == BACK_FILE) {
+		fd = open("mmapstress11.data", O_RDWR | O_CREAT | O_TRUNC,
+			  0600);
+		if (fd == -1)
+			tst_brkm(TBROK | TERRNO, cleanup, "open");
+		if (ftruncate(fd, opt_global ? len : len * nthreads) == -1)
+			tst_brkm(TBROK | TERRNO, cleanup, "ftruncate");
+	}
+	if (opt_global) {
+		common_len = len;
+		common_map = map_region(len, 0);
+	}
+
+	td = calloc(nthreads + nchurn, sizeof(*td));
+	if (td == NULL)
+		tst_brkm(TBROK | TERRNO, cleanup, "calloc");
+
+	for (i = 0; i < nthreads + nchurn; i++) {
+		t = &td[i];
+		t->id = i;
+		t->churn = i >= nthreads;
+		t->rnd_state = (now_ns() ^ ((unsigned long)i << 32)) | 1;
+		if (t->churn)
+			continue;
+
+		if (opt_global) {
+			/* everybody faults everything, drops its own part */
+			t->map = common_map;
+			t->npages = npages;
+			t->slice_off = (npages / nthreads) * i * step;
+			t->slice = common_map + t->slice_off;
+			t->slice_len = (npages / nthreads) * step;
+			if (i == nthreads - 1)
+				t->slice_len = len - t->slice_off;
+		} else {
+			t->slice_off = (off_t)len * i;
+			t->map = t->slice = map_region(len, t->slice_off);
+			t->npages = npages;
+			t->slice_len = len;
+		}
+		build_order(t);
+	}
+}
+
+static void report(double secs)
+{
+	struct op_stats total[NR_OPS];
+	unsigned long minflt = 0, majflt = 0, nvcsw = 0, nivcsw = 0;
+	unsigned long passes = 0, mismatches = 0, flt;
+	double rate, min_rate = 0, max_rate = 0;
+	struct thread_data *t;
+	int i, o, b;
+
+	memset(total, 0, sizeof(total));
+	for (i = 0; i < nthreads + nchurn; i++) {
+		t = &td[i];
+		for (o = 0; o < NR_OPS; o++) {
+			total[o].count += t->ops[o].count;
+			total[o].total_ns += t->ops[o].total_ns;
+			if (t->ops[o].max_ns > total[o].max_ns)
+				total[o].max_ns = t->ops[o].max_ns;
+			for (b = 0; b < HIST_BUCKETS; b++)
+				total[o].hist[b] += t->ops[o].hist[b];
+		}
+		if (t->churn)
+			continue;
+
+		flt = t->ru.ru_minflt + t->ru.ru_majflt;
+		rate = flt / secs;
+		if (i == 0 || rate < min_rate)
+			min_rate = rate;
+		if (i == 0 || rate > max_rate)
+			max_rate = rate;
+		minflt += t->ru.ru_minflt;
+		majflt += t->ru.ru_majflt;
+		nvcsw += t->ru.ru_nvcsw;
+		nivcsw += t->ru.ru_nivcsw;
+		passes += t->passes;
+		mismatches += t->mismatches;
+
+		if (opt_verbose)
+			tst_resm(TINFO, "thread %d: %lu passes, %lu faults "
+				 "(%.0f/s), %ld/%ld csw, touch p50 %luns "
+				 "p99 %luns max %luns", i, t->passes, flt,
+				 rate, t->ru.ru_nvcsw, t->ru.ru_nivcsw,
+				 op_pct(&t->ops[OP_TOUCH], 50),
+				 op_pct(&t->ops[OP_TOUCH], 99),
+				 t->ops[OP_TOUCH].max_ns);
+	}
+
+	for (o = 0; o < NR_OPS; o++) {
+		if (total[o].count == 0)
+			continue;
+		tst_resm(TINFO, "%-8s %10lu ops %10.0f ops/s avg %6luns "
+			 "p50 %luns p90 %luns p99 %luns max %luns",
+			 op_names[o], total[o].count, total[o].count / secs,
+			 total[o].total_ns / total[o].count,
+			 op_pct(&total[o], 50),
+			 op_pct(&total[o], 90),
+			 op_pct(&total[o], 99), total[o].max_ns);
+	}
+
+	tst_resm(TINFO, "%lu passes, %lu minflt + %lu majflt in %.2fs: "
+		 "%.0f faults/s, per thread %.0f - %.0f faults/s", passes,
+		 minflt, majflt, secs, (minflt + majflt) / secs, min_rate,
+		 max_rate);
+	tst_resm(TINFO, "faulting threads: %lu voluntary, %lu involuntary "
+		 "context switches, touch p99/p50 %.1f", nvcsw, nivcsw,
+		 op_pct(&total[OP_TOUCH], 50) ?
+		 (double)op_pct(&total[OP_TOUCH], 99) /
+		 op_pct(&total[OP_TOUCH], 50) : 0);
+
+	if (mismatches)
+		tst_resm(TFAIL, "%lu pages lost their contents", mismatches);
+	else
+		tst_resm(TPASS, "%d threads faulted for %.0fs", nthreads,
+			 secs);
+}
+
+static void run(void)
+{
+	unsigned long start;
+	int i;
+
+	tst_resm(TINFO, "%d threads, %s %s mapping%s, %ld MB%s, %s access, "
+		 "%s faults, %s, %d churn threads", nthreads,
+		 opt_shared ? "shared" : "private", backing_names[backing],
+		 opt_global ? " common to all" : "", size_mb,
+		 opt_global ? "" : " per thread", access_names[access_mode],
+		 opt_read ? "read" : "write",
+		 opt_remap ? "munmap+mmap" : "MADV_DONTNEED", nchurn);
+
+	setup_threads();
+
+	if (pthread_barrier_init(&barrier, NULL, nthreads + nchurn + 1))
+		tst_brkm(TBROK, cleanup, "pthread_barrier_init");
+	for (i = 0; i < nthreads + nchurn; i++) {
+		errno = pthread_create(&td[i].tid, NULL, td[i].churn ?
+				       churn_thread : fault_thread, &td[i]);
+		if (errno)
+			tst_brkm(TBROK | TERRNO, cleanup, "pthread_create");
+	}
+
+	pthread_barrier_wait(&barrier);
+	start = now_ns();
+	sleep(runtime);
+	stop = 1;
+	for (i = 0; i < nthreads + nchurn; i++)
+		pthread_join(td[i].tid, NULL);
+
+	report((now_ns() - start) / 1e9);
+}
+
+static long parse_num(const char *str, const char *what, long min, long max)
+{
+	char *end;
+	long val;
+
+	val = strtol(str, &end, 10);
+	if (*end != '\0' || val < min || val > max)
+		tst_brkm(TBROK, NULL, "invalid %s '%s' (%ld-%ld)", what, str,
+			 min, max);
+	return val;
+}
+
+static int parse_name(const char *str, const char *what,
+		      const char **names, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (strcmp(str, names[i]) == 0)
+			return i;
+	tst_brkm(TBROK, NULL, "invalid %s '%s'", what, str);
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	char *msg;
+
+	msg = parse_opts(argc, argv, options, help);
+	if (msg != NULL)
+		tst_brkm(TBROK, NULL, "OPTION PARSING ERROR - %s", msg);
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
+	if (opt_threads)
+		nthreads = parse_num(threads_str, "threads", 1, 4096);
+	if (opt_size)
+		size_mb = parse_num(size_str, "size", 1, 1 << 20);
+	if (opt_churn)
+		nchurn = parse_num(churn_str, "churn threads", 0, 4096);
+	if (opt_stride)
+		stride = parse_num(stride_str, "stride", 1, LONG_MAX);
+	if (opt_time)
+		runtime = parse_num(time_str, "runtime", 1, INT_MAX);
+	if (opt_backing)
+		backing = parse_name(backing_str, "backing", backing_names, 4);
+	if (opt_access)
+		access_mode = parse_name(access_str, "access pattern",
+					 access_names, 3);
+
+	setup();
+	run();
+	cleanup();
+	tst_exit();
+}
+
+static void setup(void)
+{
+	struct sigaction sa;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	step = pagesize;
+	map_flags = opt_shared ? MAP_SHARED : MAP_PRIVATE;
+
+	switch (backing) {
+	case BACK_ANON:
+		map_flags |= MAP_ANONYMOUS;
+		break;
+	case BACK_FILE:
+		/* The file is created in setup_threads() */
+		tst_tmpdir();
+		tmpdir_made = 1;
+		break;
+	case BACK_HUGETLB:
+#ifdef MAP_HUGETLB
+		step = hugepage_size();
+		if (step == 0)
+			tst_brkm(TCONF, NULL, "no hugetlbfs support");
+		map_flags |= MAP_ANONYMOUS | MAP_HUGETLB;
+#else
+		tst_brkm(TCONF, NULL, "MAP_HUGETLB is not defined");
+#endif
+		break;
+	case BACK_THP:
+#ifndef MADV_HUGEPAGE
+		tst_brkm(TCONF, NULL, "MADV_HUGEPAGE is not defined");
+#endif
+		if (opt_shared)
+			tst_brkm(TCONF, NULL, "thp is for private mappings");
+		map_flags |= MAP_ANONYMOUS;
+		break;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = sig_handler;
+	sa.sa_flags = SA_SIGINFO;
+	sigaction(SIGSEGV, &sa, NULL);
+	sigaction(SIGBUS, &sa, NULL);
+
+	TEST_PAUSE;
+}
+
+static void cleanup(void)
+{
+	int i;
+
+	TEST_CLEANUP;
+
+	if (td != NULL) {
+		for (i = 0; i < nthreads; i++)
+			if (!opt_global && td[i].map != NULL)
+				munmap(td[i].map, td[i].slice_len);
+	}
+	if (common_map != NULL)
+		munmap(common_map, common_len);
+	if (fd != -1)
+		close(fd);
+	if (tmpdir_made)
+		tst_rmdir();
+}
+
+static void help(void)
+{
+	printf("  -n n    faulting threads (default: online CPUs)\n");
+	printf("  -s MB   mapping size per thread, or in all with -g "
+	       "(default 64)\n");
+	printf("  -b type anon, file, hugetlb or thp (default anon)\n");
+	printf("  -S      MAP_SHARED instead of MAP_PRIVATE\n");
+	printf("  -g      one mapping faulted by all of the threads\n");
+	printf("  -a acc  page order: seq, rand or stride (default seq)\n");
+	printf("  -k n    stride in pages for -a stride (default 16)\n");
+	printf("  -R      read faults instead of write faults\n");
+	printf("  -r      drop the pages with munmap + mmap, not "
+	       "MADV_DONTNEED\n");
+	printf("  -x n    mmap/mprotect/madvise/munmap churn threads "
+	       "(default 0)\n");
+	printf("  -T sec  run time (default 10)\n");
+	printf("  -v      print per thread results\n");
+}
@@ -29,6 +29,13 @@
 /* Description: hackbench tests the Linux scheduler. Test groups of 20        */
 /*              processes spraying to 20 receivers                            */
 /*                                                                            */
+/*              The transport between senders and receivers is selectable:   */
+/*              AF_UNIX sockets (default), pipes, eventfd (pure wakeups),     */
+/*              vmsplice()d pipes, sendmmsg()/recvmmsg() batches or a shared  */
+/*              memory ring with futex wakeups. Every message carries a       */
+/*              CLOCK_MONOTONIC send stamp so that per-message latency        */
+/*              percentiles are reported together with the total time.       */
+/*                                                                            */
 /* Total Tests: 1                                                             */
 /*                                                                            */
 /* Test Name:   hackbench01 and hackbench02                                   */
@@ -46,23 +53,57 @@
 /*                  - June 26 2008 - Subrata Modak<subrata@linux.vnet.ibm.com>*/
 /*                                                                            */
 /******************************************************************************/
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/poll.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <limits.h>
 
+#ifndef F_GETPIPE_SZ
+#define F_GETPIPE_SZ	1032
+#endif
+
 #define SAFE_FREE(p) { if (p) { free(p); (p)=NULL; } }
 #define DATASIZE 100
+#define MAX_BATCH 64
+#define RING_SLOTS 64
+#define SPLICE_SLOT 128
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS 1024
+
+enum transport {
+	TR_SOCKET,
+	TR_PIPE,
+	TR_EVENTFD,
+	TR_VMSPLICE,
+	TR_MMSG,
+	TR_SHM,
+	TR_MAX
+};
+
+static const char *transport_names[TR_MAX] = {
+	"socket", "pipe", "eventfd", "vmsplice", "mmsg", "shm"
+};
+
 static struct sender_context **snd_ctx_tab;	/*Table for sender context pointers. */
 static struct receiver_context **rev_ctx_tab;	/*Table for receiver context pointers. */
+static struct receiver_shared *shared_tab;	/*Per receiver state shared by all tasks. */
 static int gr_num = 0;		/*For group calculation */
 static unsigned int loops = 100;
 /*
@@ -71,11 +112,51 @@ static unsigned int loops = 100;
 static unsigned int process_mode = 1;
 
 static int use_pipes = 0;
+static enum transport transport = TR_SOCKET;
+static unsigned int batch = 16;
+
+/*
+ * Log-linear latency histogram in nanoseconds, 16 sub buckets per power
+ * of two, so percentiles are accurate to ~6% over the whole range.
+ */
+struct lat_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+/*
+ * Bounded multi producer / single consumer ring. Producers reserve a slot
+ * with head, publish it through the slot sequence and only issue a futex
+ * wake when the consumer has announced it is about to sleep (and vice
+ * versa for producers waiting for free slots).
+ */
+struct shm_ring {
+	unsigned int head;
+	unsigned int tail;
+	int data_seq;
+	int rx_waiting;
+	int space_seq;
+	int tx_waiting;
+	struct {
+		unsigned int seq;
+		char data[DATASIZE];
+	} slot[RING_SLOTS];
+};
+
+struct receiver_shared {
+	struct lat_hist hist;
+	uint64_t stamp;		/* last eventfd send stamp */
+	struct shm_ring ring;
+};
 
 struct sender_context {
 	unsigned int num_fds;
 	int ready_out;
 	int wakefd;
+	struct receiver_shared *out_shared;
 	int out_fds[0];
 };
 
@@ -84,6 +165,14 @@ struct receiver_context {
 	int in_fds[2];
 	int ready_out;
 	int wakefd;
+	struct receiver_shared *shared;
+};
+
+/* Buffers for one sendmmsg()/recvmmsg() batch */
+struct mmsg_batch {
+	struct mmsghdr msgs[MAX_BATCH];
+	struct iovec iov[MAX_BATCH];
+	char data[MAX_BATCH][DATASIZE];
 };
 
 static void barf(const char *msg)
@@ -94,12 +183,173 @@ static void barf(const char *msg)
 
 static void print_usage_exit()
 {
-	printf
-	    ("Usage: hackbench [-pipe] <num groups> [process|thread] [loops]\n");
+	printf("Usage: hackbench [-pipe] "
+	       "[-mode socket|pipe|eventfd|vmsplice|mmsg|shm] [-batch n] "
+	       "<num groups> [process|thread] [loops]\n");
 	exit(1);
 }
 
-static void fdpair(int fds[2])
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int hist_bucket(uint64_t v)
+{
+	unsigned int msb, b;
+
+	if (v < (1 << HIST_SUB_BITS))
+		return v;
+
+	msb = 63 - __builtin_clzll(v);
+	b = ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+	    ((v >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+
+	return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+/* Lower bound of the values accounted in bucket b */
+static uint64_t hist_value(unsigned int b)
+{
+	unsigned int msb;
+
+	if (b < (1 << HIST_SUB_BITS))
+		return b;
+
+	msb = (b >> HIST_SUB_BITS) - 1 + HIST_SUB_BITS;
+	return (uint64_t)((b & ((1 << HIST_SUB_BITS) - 1)) |
+			  (1 << HIST_SUB_BITS)) << (msb - HIST_SUB_BITS);
+}
+
+static void hist_add(struct lat_hist *h, uint64_t v)
+{
+	if (!h->count || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->count++;
+	h->sum += v;
+	h->buckets[hist_bucket(v)]++;
+}
+
+static void hist_merge(struct lat_hist *dst, const struct lat_hist *src)
+{
+	unsigned int i;
+
+	if (!src->count)
+		return;
+
+	if (!dst->count || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+static double hist_percentile(const struct lat_hist *h, double pct)
+{
+	uint64_t target, seen = 0;
+	unsigned int i;
+
+	target = (uint64_t)(h->count * pct / 100.0);
+	if (target == 0)
+		target = 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= target) {
+			uint64_t v = hist_value(i);
+
+			return (v > h->max ? h->max : v) / 1000.0;
+		}
+	}
+
+	return h->max / 1000.0;
+}
+
+static void stamp_msg(char *data)
+{
+	uint64_t t = now_ns();
+
+	memcpy(data, &t, sizeof(t));
+}
+
+static void record_msg(struct receiver_context *ctx, const char *data,
+		       uint64_t now)
+{
+	uint64_t t;
+
+	memcpy(&t, data, sizeof(t));
+	hist_add(&ctx->shared->hist, now - t);
+}
+
+static int futex_wait(int *uaddr, int val)
+{
+	return syscall(SYS_futex, uaddr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static int futex_wake(int *uaddr, int nr)
+{
+	return syscall(SYS_futex, uaddr, FUTEX_WAKE, nr, NULL, NULL, 0);
+}
+
+static void ring_put(struct shm_ring *r, const char *data)
+{
+	unsigned int pos = __sync_fetch_and_add(&r->head, 1);
+	volatile unsigned int *tail = &r->tail;
+	int seq;
+
+	while (pos - *tail >= RING_SLOTS) {
+		seq = *(volatile int *)&r->space_seq;
+		__sync_fetch_and_or(&r->tx_waiting, 1);
+		if (pos - *tail < RING_SLOTS)
+			break;
+		futex_wait(&r->space_seq, seq);
+	}
+
+	memcpy(r->slot[pos % RING_SLOTS].data, data, DATASIZE);
+	__sync_synchronize();
+	*(volatile unsigned int *)&r->slot[pos % RING_SLOTS].seq = pos + 1;
+
+	__sync_fetch_and_add(&r->data_seq, 1);
+	if (*(volatile int *)&r->rx_waiting &&
+	    __sync_lock_test_and_set(&r->rx_waiting, 0))
+		futex_wake(&r->data_seq, 1);
+}
+
+static void ring_get(struct shm_ring *r, char *data)
+{
+	unsigned int pos = r->tail;
+	volatile unsigned int *slot_seq = &r->slot[pos % RING_SLOTS].seq;
+	int seq;
+
+	while (*slot_seq != pos + 1) {
+		seq = *(volatile int *)&r->data_seq;
+		__sync_fetch_and_or(&r->rx_waiting, 1);
+		if (*slot_seq == pos + 1)
+			break;
+		futex_wait(&r->data_seq, seq);
+	}
+
+	__sync_synchronize();
+	memcpy(data, r->slot[pos % RING_SLOTS].data, DATASIZE);
+	__sync_synchronize();
+	*(volatile unsigned int *)&r->tail = pos + 1;
+
+	__sync_fetch_and_add(&r->space_seq, 1);
+	if (*(volatile int *)&r->tx_waiting &&
+	    __sync_lock_test_and_set(&r->tx_waiting, 0))
+		futex_wake(&r->space_seq, INT_MAX);
+}
+
+/* Control channel used for the ready/go handshake */
+static void ctl_fdpair(int fds[2])
 {
 	if (use_pipes) {
 		if (pipe(fds) == 0)
@@ -111,6 +361,40 @@ static void fdpair(int fds[2])
 	barf("Creating fdpair");
 }
 
+/* Data channel between one receiver and the senders of its group */
+static void fdpair(int fds[2])
+{
+	switch (transport) {
+	case TR_PIPE:
+	case TR_VMSPLICE:
+		if (pipe(fds) == 0)
+			return;
+		break;
+	case TR_MMSG:
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == 0)
+			return;
+		break;
+	case TR_EVENTFD:
+		/*
+		 * Both ends refer to the same counter, dup() it so that the
+		 * process mode can close its unused end as usual.
+		 */
+		fds[0] = eventfd(0, 0);
+		if (fds[0] >= 0 && (fds[1] = dup(fds[0])) >= 0)
+			return;
+		break;
+	case TR_SHM:
+		/* The ring lives in shared_tab, no descriptors needed */
+		fds[0] = fds[1] = -1;
+		return;
+	default:
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0)
+			return;
+		break;
+	}
+	barf("Creating fdpair");
+}
+
 /* Block until we're ready to go */
 static void ready(int ready_out, int wakefd)
 {
@@ -126,59 +410,295 @@ static void ready(int ready_out, int wakefd)
 		barf("poll");
 }
 
-/* Sender sprays loops messages down each file descriptor */
-static void *sender(struct sender_context *ctx)
+static void write_msg(int fd, const char *data)
+{
+	int ret, done = 0;
+
+again:
+	ret = write(fd, data + done, DATASIZE - done);
+	if (ret < 0)
+		barf("SENDER: write");
+	done += ret;
+	if (done < DATASIZE)
+		goto again;
+}
+
+static void read_msg(int fd, char *data)
+{
+	int ret, done = 0;
+
+again:
+	ret = read(fd, data + done, DATASIZE - done);
+	if (ret < 0)
+		barf("SERVER: read");
+	done += ret;
+	if (done < DATASIZE)
+		goto again;
+}
+
+static void send_stream(struct sender_context *ctx)
 {
 	char data[DATASIZE];
 	unsigned int i, j;
 
-	ready(ctx->ready_out, ctx->wakefd);
+	memset(data, 0, sizeof(data));
 
-	/* Now pump to every receiver. */
 	for (i = 0; i < loops; i++) {
 		for (j = 0; j < ctx->num_fds; j++) {
-			int ret, done = 0;
+			stamp_msg(data);
+			write_msg(ctx->out_fds[j], data);
+		}
+	}
+}
 
-again:
-			ret =
-			    write(ctx->out_fds[j], data + done,
-				  sizeof(data) - done);
-			if (ret < 0)
-				barf("SENDER: write");
-			done += ret;
-			if (done < sizeof(data))
-				goto again;
+/*
+ * The pipe keeps references to the vmsplice()d pages, so a message slot
+ * may only be reused once the pipe cannot hold it anymore. Each fd gets
+ * twice as many slots as the pipe has buffers.
+ */
+static void send_vmsplice(struct sender_context *ctx, char *slots,
+			  unsigned int nslots)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < ctx->num_fds; j++) {
+			struct iovec iov;
+			char *msg = slots + ((size_t)j * nslots + i % nslots)
+			    * SPLICE_SLOT;
+
+			stamp_msg(msg);
+			iov.iov_base = msg;
+			iov.iov_len = DATASIZE;
+			while (iov.iov_len) {
+				ssize_t ret = vmsplice(ctx->out_fds[j], &iov,
+						       1, 0);
+				if (ret < 0)
+					barf("SENDER: vmsplice");
+				iov.iov_base = (char *)iov.iov_base + ret;
+				iov.iov_len -= ret;
+			}
 		}
 	}
+}
+
+static void send_eventfd(struct sender_context *ctx)
+{
+	uint64_t one = 1;
+	unsigned int i, j;
+
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < ctx->num_fds; j++) {
+			*(volatile uint64_t *)&ctx->out_shared[j].stamp =
+			    now_ns();
+			if (write(ctx->out_fds[j], &one, sizeof(one)) !=
+			    sizeof(one))
+				barf("SENDER: eventfd write");
+		}
+	}
+}
+
+static void mmsg_batch_init(struct mmsg_batch *b)
+{
+	unsigned int k;
+
+	memset(b, 0, sizeof(*b));
+	for (k = 0; k < MAX_BATCH; k++) {
+		b->iov[k].iov_base = b->data[k];
+		b->iov[k].iov_len = DATASIZE;
+		b->msgs[k].msg_hdr.msg_iov = &b->iov[k];
+		b->msgs[k].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+static void send_mmsg(struct sender_context *ctx, struct mmsg_batch *b)
+{
+	unsigned int i, j, k, n, done;
+	int ret;
+
+	for (i = 0; i < loops; i += n) {
+		n = loops - i < batch ? loops - i : batch;
+		for (j = 0; j < ctx->num_fds; j++) {
+			for (k = 0; k < n; k++)
+				stamp_msg(b->data[k]);
+			for (done = 0; done < n; done += ret) {
+				ret = sendmmsg(ctx->out_fds[j], b->msgs + done,
+					       n - done, 0);
+				if (ret < 0)
+					barf("SENDER: sendmmsg");
+			}
+		}
+	}
+}
+
+static void send_shm(struct sender_context *ctx)
+{
+	char data[DATASIZE];
+	unsigned int i, j;
+
+	memset(data, 0, sizeof(data));
+
+	for (i = 0; i < loops; i++) {
+		for (j = 0; j < ctx->num_fds; j++) {
+			stamp_msg(data);
+			ring_put(&ctx->out_shared[j].ring, data);
+		}
+	}
+}
+
+/* Sender sprays loops messages down each file descriptor */
+static void *sender(struct sender_context *ctx)
+{
+	struct mmsg_batch *b = NULL;
+	char *slots = NULL;
+	unsigned int nslots = 0;
+
+	/* Set up the per transport buffers before the clock starts */
+	if (transport == TR_MMSG) {
+		b = malloc(sizeof(*b));
+		if (!b)
+			barf("SENDER: malloc()");
+		mmsg_batch_init(b);
+	} else if (transport == TR_VMSPLICE) {
+		int sz = fcntl(ctx->out_fds[0], F_GETPIPE_SZ);
+		long page = sysconf(_SC_PAGESIZE);
+
+		nslots = sz > 0 ? 2 * (sz / page) : 32;
+		if (posix_memalign((void **)&slots, page,
+				   (size_t)ctx->num_fds * nslots *
+				   SPLICE_SLOT))
+			barf("SENDER: posix_memalign()");
+		memset(slots, 0, (size_t)ctx->num_fds * nslots * SPLICE_SLOT);
+	}
+
+	ready(ctx->ready_out, ctx->wakefd);
+
+	/* Now pump to every receiver. */
+	switch (transport) {
+	case TR_EVENTFD:
+		send_eventfd(ctx);
+		break;
+	case TR_VMSPLICE:
+		send_vmsplice(ctx, slots, nslots);
+		break;
+	case TR_MMSG:
+		send_mmsg(ctx, b);
+		break;
+	case TR_SHM:
+		send_shm(ctx);
+		break;
+	default:
+		send_stream(ctx);
+		break;
+	}
+
+	/*
+	 * slots is not freed, receivers may still hold the vmsplice()d pages
+	 * in their pipes and must not see them reused.
+	 */
+	SAFE_FREE(b);
 
 	return NULL;
 }
 
+static void recv_stream(struct receiver_context *ctx)
+{
+	char data[DATASIZE];
+	unsigned int i;
+
+	for (i = 0; i < ctx->num_packets; i++) {
+		read_msg(ctx->in_fds[0], data);
+		record_msg(ctx, data, now_ns());
+	}
+}
+
+static void recv_eventfd(struct receiver_context *ctx)
+{
+	struct receiver_shared *sh = ctx->shared;
+	uint64_t cnt, stamp, got = 0;
+
+	/* Writes coalesce, so every wakeup accounts for one sample */
+	while (got < ctx->num_packets) {
+		if (read(ctx->in_fds[0], &cnt, sizeof(cnt)) != sizeof(cnt))
+			barf("SERVER: eventfd read");
+		stamp = *(volatile uint64_t *)&sh->stamp;
+		hist_add(&sh->hist, now_ns() - stamp);
+		got += cnt;
+	}
+}
+
+static void recv_mmsg(struct receiver_context *ctx, struct mmsg_batch *b)
+{
+	unsigned int got, k, n;
+	uint64_t now;
+	int ret;
+
+	for (got = 0; got < ctx->num_packets; got += ret) {
+		n = ctx->num_packets - got;
+		if (n > batch)
+			n = batch;
+		ret = recvmmsg(ctx->in_fds[0], b->msgs, n, MSG_WAITFORONE,
+			       NULL);
+		if (ret < 0)
+			barf("SERVER: recvmmsg");
+		now = now_ns();
+		for (k = 0; k < (unsigned int)ret; k++) {
+			if (b->msgs[k].msg_len != DATASIZE) {
+				errno = EMSGSIZE;
+				barf("SERVER: recvmmsg short datagram");
+			}
+			record_msg(ctx, b->data[k], now);
+		}
+	}
+}
+
+static void recv_shm(struct receiver_context *ctx)
+{
+	char data[DATASIZE];
+	unsigned int i;
+
+	for (i = 0; i < ctx->num_packets; i++) {
+		ring_get(&ctx->shared->ring, data);
+		record_msg(ctx, data, now_ns());
+	}
+}
+
 /* One receiver per fd */
 static void *receiver(struct receiver_context *ctx)
 {
-	unsigned int i;
+	struct mmsg_batch *b = NULL;
 
 	if (process_mode)
 		close(ctx->in_fds[1]);
 
+	if (transport == TR_MMSG) {
+		b = malloc(sizeof(*b));
+		if (!b)
+			barf("SERVER: malloc()");
+		mmsg_batch_init(b);
+	}
+
 	/* Wait for start... */
 	ready(ctx->ready_out, ctx->wakefd);
 
 	/* Receive them all */
-	for (i = 0; i < ctx->num_packets; i++) {
-		char data[DATASIZE];
-		int ret, done = 0;
-
-again:
-		ret = read(ctx->in_fds[0], data + done, DATASIZE - done);
-		if (ret < 0)
-			barf("SERVER: read");
-		done += ret;
-		if (done < DATASIZE)
-			goto again;
+	switch (transport) {
+	case TR_EVENTFD:
+		recv_eventfd(ctx);
+		break;
+	case TR_MMSG:
+		recv_mmsg(ctx, b);
+		break;
+	case TR_SHM:
+		recv_shm(ctx);
+		break;
+	default:
+		recv_stream(ctx);
+		break;
 	}
 
+	SAFE_FREE(b);
+
 	return NULL;
 }
 
@@ -263,6 +783,7 @@ static unsigned int group(pthread_t * pth,
 		ctx->in_fds[1] = fds[1];
 		ctx->ready_out = ready_out;
 		ctx->wakefd = wakefd;
+		ctx->shared = shared_tab + gr_num * num_fds + i;
 
 		pth[i] = create_worker(ctx, (void *)(void *)receiver);
 
@@ -276,6 +797,7 @@ static unsigned int group(pthread_t * pth,
 		snd_ctx->ready_out = ready_out;
 		snd_ctx->wakefd = wakefd;
 		snd_ctx->num_fds = num_fds;
+		snd_ctx->out_shared = shared_tab + gr_num * num_fds;
 
 		pth[num_fds + i] =
 		    create_worker(snd_ctx, (void *)(void *)sender);
@@ -299,18 +821,41 @@ int main(int argc, char *argv[])
 	int readyfds[2], wakefds[2];
 	char dummy;
 	pthread_t *pth_tab;
-
-	if (argv[1] && strcmp(argv[1], "-pipe") == 0) {
-		use_pipes = 1;
+	struct lat_hist lat;
+	size_t shared_size;
+
+	while (argc > 1 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-pipe") == 0) {
+			transport = TR_PIPE;
+		} else if (strcmp(argv[1], "-mode") == 0 && argc > 2) {
+			for (i = 0; i < TR_MAX; i++)
+				if (!strcmp(argv[2], transport_names[i]))
+					break;
+			if (i == TR_MAX)
+				print_usage_exit();
+			transport = i;
+			argc--;
+			argv++;
+		} else if (strcmp(argv[1], "-batch") == 0 && argc > 2) {
+			batch = atoi(argv[2]);
+			if (batch == 0 || batch > MAX_BATCH)
+				print_usage_exit();
+			argc--;
+			argv++;
+		} else {
+			print_usage_exit();
+		}
 		argc--;
 		argv++;
 	}
 
+	use_pipes = (transport == TR_PIPE || transport == TR_VMSPLICE);
+
 	if (argc >= 2 && (num_groups = atoi(argv[1])) == 0)
 		print_usage_exit();
 
-	printf("Running with %d*40 (== %d) tasks.\n",
-	       num_groups, num_groups * 40);
+	printf("Running with %d*40 (== %d) tasks, %s transport.\n",
+	       num_groups, num_groups * 40, transport_names[transport]);
 
 	fflush(NULL);
 
@@ -332,8 +877,14 @@ int main(int argc, char *argv[])
 	if (!pth_tab || !snd_ctx_tab || !rev_ctx_tab)
 		barf("main:malloc()");
 
-	fdpair(readyfds);
-	fdpair(wakefds);
+	shared_size = num_groups * num_fds * sizeof(struct receiver_shared);
+	shared_tab = mmap(NULL, shared_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared_tab == MAP_FAILED)
+		barf("main:mmap()");
+
+	ctl_fdpair(readyfds);
+	ctl_fdpair(wakefds);
 
 	total_children = 0;
 	for (i = 0; i < num_groups; i++)
@@ -362,6 +913,20 @@ int main(int argc, char *argv[])
 	timersub(&stop, &start, &diff);
 	printf("Time: %lu.%03lu\n", diff.tv_sec, diff.tv_usec / 1000);
 
+	/* ...and the message latencies collected by the receivers */
+	memset(&lat, 0, sizeof(lat));
+	for (i = 0; i < num_groups * num_fds; i++)
+		hist_merge(&lat, &shared_tab[i].hist);
+
+	if (lat.count) {
+		printf("Latency (usec): min %.1f avg %.1f p50 %.1f p90 %.1f "
+		       "p99 %.1f p99.9 %.1f max %.1f (%llu samples)\n",
+		       lat.min / 1000.0, lat.sum / 1000.0 / lat.count,
+		       hist_percentile(&lat, 50), hist_percentile(&lat, 90),
+		       hist_percentile(&lat, 99), hist_percentile(&lat, 99.9),
+		       lat.max / 1000.0, (unsigned long long)lat.count);
+	}
+
 	/* free the memory */
 	for (i = 0; i < num_groups; i++) {
 		for (j = 0; j < num_fds; j++) {
@@ -372,5 +937,6 @@ int main(int argc, char *argv[])
 	SAFE_FREE(pth_tab);
 	SAFE_FREE(snd_ctx_tab);
 	SAFE_FREE(rev_ctx_tab);
+	munmap(shared_tab, shared_size);
 	exit(0);
 }
@@ -0,0 +1,1024 @@
+/******************************************************************************/
+/*                                                                            */
+/* Copyright (c) 2013 Linux Test Project                                      */
+/*                                                                            */
+/* This program is free software;  you can redistribute it and/or modify      */
+/* it under the terms of the GNU General Public License as published by       */
+/* the Free Software Foundation; either version 2 of the License, or          */
+/* (at your option) any later version.                                        */
+/*                                                                            */
+/* This program is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY;  without even the implied warranty of            */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See                  */
+/* the GNU General Public License for more details.                           */
+/*                                                                            */
+/* You should have received a copy of the GNU General Public License          */
+/* along with this program;  if not, write to the Free Software               */
+/* Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA    */
+/*                                                                            */
+/******************************************************************************/
+/*
+ * Native ftrace stress driver.
+ *
+ * Does what the shell loops in ftrace_stress/ of ftrace_stress_test.sh do,
+ * without forking a process for every echo and cat: each knob (tracer,
+ * clock, buffer size, events, options, stack tracer, ...) is opened once
+ * and then flipped through its values with pwrite() by one or more
+ * threads, as fast as they can go.  The read only files are read with
+ * pread() the same way, except for "trace", which is reopened for every
+ * read, like cat does, since keeping it open pauses the tracing on newer
+ * kernels.
+ *
+ * At the same time one thread per CPU drains per_cpu/cpuN/trace_pipe_raw
+ * with splice() into a pipe and from there into /dev/null, and the main
+ * thread samples per_cpu/cpuN/stats for the events the ring buffer lost.
+ *
+ * At the end the ops/s and the errors of each knob, the drained bytes/s
+ * and the lost event counts are reported.  The test fails if the kernel
+ * got tainted by a warning, an oops or a BUG during the run.  Note that
+ * buffer_size_kb and current_tracer can't be changed while trace_pipe_raw
+ * is open on newer kernels (EBUSY); run with -D to stress them without
+ * the drain.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "usctest.h"
+#include "safe_macros.h"
+
+char *TCID = "ftrace_knob_stress";
+int TST_TOTAL = 1;
+
+#define DRAIN_PAGES		16	/* pages moved per splice() */
+#define DRAIN_IDLE_US		1000	/* sleep when the buffer is empty */
+#define SAMPLE_US		100000	/* stats sampling period */
+#define READ_BUF		65536
+#define TAINT_BAD		(1 << 7 | 1 << 9)	/* TAINT_DIE, TAINT_WARN */
+#define DIR_MAX			1024	/* so that the paths printed fit tst_res */
+
+enum knob_kind {
+	K_NUM,		/* a number, restored as read */
+	K_WORD,		/* one of a list, the current one in [] */
+	K_LIST,		/* a list, cleared by O_TRUNC */
+	K_OPTS,		/* trace_options: foo / nofoo */
+	K_READ,		/* read only, kept open */
+	K_CAT,		/* read only, reopened for each read */
+	K_TRUNC,	/* cleared by an O_TRUNC open */
+};
+
+struct knob {
+	const char *name;
+	const char *path;	/* relative to the tracing dir unless absolute */
+	enum knob_kind kind;
+	void (*fill)(struct knob *);
+	const char *src;	/* where fill() takes the values from */
+	char *fullpath;
+	char **vals;		/* NULL means clear it with O_TRUNC */
+	int nvals;
+	int fd;
+	int no_pwrite;		/* a seq_file, written with write() */
+	int used;
+	char *saved;
+	unsigned long ops;
+	unsigned long errs;
+	int err;
+};
+
+struct knob_thread {
+	pthread_t tid;
+	struct knob *knob;
+	unsigned long idx;
+	unsigned long ops;
+	unsigned long errs;
+	int err;
+};
+
+enum lost_stat { L_OVERRUN, L_COMMIT, L_DROPPED, NR_LOST };
+
+static const char *lost_names[] = { "overrun", "commit overrun",
+	"dropped events" };
+
+struct cpu_data {
+	pthread_t tid;
+	int cpu;
+	int raw_fd;
+	int stats_fd;
+	int pipe_fd[2];
+	int use_read;
+	unsigned long long bytes;
+	unsigned long long splices;
+	unsigned long errs;
+	int err;
+	unsigned long long last[NR_LOST];
+	unsigned long long lost[NR_LOST];
+};
+
+static void fill_onoff(struct knob *k);
+static void fill_buffer(struct knob *k);
+static void fill_latency(struct knob *k);
+static void fill_stack_size(struct knob *k);
+static void fill_words(struct knob *k);
+static void fill_options(struct knob *k);
+static void fill_events(struct knob *k);
+static void fill_pid(struct knob *k);
+
+/*
+ * The knobs the ftrace_stress/ scripts toggle, in restore order:
+ * events/enable goes before set_event, which puts back the single events.
+ */
+static struct knob knobs[] = {
+	{"buffer_size", "buffer_size_kb", K_NUM, fill_buffer, NULL},
+	{"current_tracer", "current_tracer", K_WORD, fill_words,
+	 "available_tracers"},
+	{"trace_clock", "trace_clock", K_WORD, fill_words, "trace_clock"},
+	{"trace_options", "trace_options", K_OPTS, fill_options, NULL},
+	{"tracing_on", "tracing_on", K_NUM, fill_onoff, NULL},
+	{"tracing_enabled", "tracing_enabled", K_NUM, fill_onoff, NULL},
+	{"events_enable", "events/enable", K_NUM, fill_onoff, NULL},
+	{"set_event", "set_event", K_LIST, fill_events, NULL},
+	{"set_ftrace_pid", "set_ftrace_pid", K_LIST, fill_pid, NULL},
+	{"max_latency", "tracing_max_latency", K_NUM, fill_latency, NULL},
+	{"stack_max_size", "stack_max_size", K_NUM, fill_stack_size, NULL},
+	{"stack_tracer", "/proc/sys/kernel/stack_tracer_enabled", K_NUM,
+	 fill_onoff, NULL},
+	{"ftrace_enabled", "/proc/sys/kernel/ftrace_enabled", K_NUM,
+	 fill_onoff, NULL},
+	{"profile_enabled", "function_profile_enabled", K_NUM, fill_onoff,
+	 NULL},
+	{"stack_trace", "stack_trace", K_READ, NULL, NULL},
+	{"trace_stat", "trace_stat/function0", K_READ, NULL, NULL},
+	{"trace", "trace", K_CAT, NULL, NULL},
+	{"trace_reset", "trace", K_TRUNC, NULL, NULL},
+};
+
+#define NR_KNOBS	(sizeof(knobs) / sizeof(knobs[0]))
+
+static int opt_dir, opt_knobs, opt_threads, opt_time, opt_bufmax;
+static int opt_nodrain, opt_verbose;
+static char *dir_str, *knobs_str, *threads_str, *time_str, *bufmax_str;
+
+static option_t options[] = {
+	{"d:", &opt_dir, &dir_str},
+	{"k:", &opt_knobs, &knobs_str},
+	{"n:", &opt_threads, &threads_str},
+	{"T:", &opt_time, &time_str},
+	{"B:", &opt_bufmax, &bufmax_str},
+	{"D", &opt_nodrain, NULL},
+	{"v", &opt_verbose, NULL},
+	{NULL, NULL, NULL}
+};
+
+static int threads_per_knob = 1;
+static int runtime = 30;
+static long buffer_max_kb = 4096;
+
+/* mount_dir leaves room for "/tracing" in tracing_dir */
+static char tracing_dir[DIR_MAX];
+static char mount_dir[DIR_MAX - 64];
+static int tmpdir_made;
+static long pagesize;
+static unsigned long taint_before;
+
+static struct knob_thread *kt;
+static int nkt;
+static struct cpu_data *cpus;
+static int ncpus;
+static int null_fd = -1;
+
+static volatile int stop;
+
+static void setup(void);
+static void cleanup(void);
+static void help(void);
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* reads a whole (possibly large and unseekable) file, NULL on failure */
+static char *read_file(const char *path)
+{
+	size_t size = 4096, len = 0;
+	char *buf, *tmp;
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	buf = malloc(size);
+	while (buf != NULL) {
+		if (len + 1 == size) {
+			size *= 2;
+			tmp = realloc(buf, size);
+			if (tmp == NULL) {
+				free(buf);
+				buf = NULL;
+				break;
+			}
+			buf = tmp;
+		}
+		n = read(fd, buf + len, size - len - 1);
+		if (n <= 0) {
+			if (n == -1 && errno == EINTR)
+				continue;
+			buf[len] = '\0';
+			break;
+		}
+		len += n;
+	}
+	close(fd);
+	return buf;
+}
+
+static void trace_path(char *buf, const char *name)
+{
+	if (name[0] == '/')
+		snprintf(buf, PATH_MAX, "%s", name);
+	else
+		snprintf(buf, PATH_MAX, "%s/%s", tracing_dir, name);
+}
+
+static void add_val(struct knob *k, const char *fmt, ...)
+	__attribute__ ((format(printf, 2, 3)));
+
+static void add_val(struct knob *k, const char *fmt, ...)
+{
+	va_list ap;
+
+	k->vals = realloc(k->vals, (k->nvals + 1) * sizeof(*k->vals));
+	if (k->vals == NULL)
+		tst_brkm(TBROK | TERRNO, cleanup, "realloc");
+	va_start(ap, fmt);
+	if (vasprintf(&k->vals[k->nvals], fmt, ap) == -1)
+		tst_brkm(TBROK | TERRNO, cleanup, "vasprintf");
+	va_end(ap);
+	k->nvals++;
+}
+
+static void fill_onoff(struct knob *k)
+{
+	add_val(k, "0");
+	add_val(k, "1");
+}
+
+static void fill_buffer(struct knob *k)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		add_val(k, "%ld", 1 + i * (buffer_max_kb - 1) / 15);
+}
+
+static void fill_latency(struct knob *k)
+{
+	int i;
+
+	for (i = 0; i < 100000; i += 400)
+		add_val(k, "%d", i);
+}
+
+static void fill_stack_size(struct knob *k)
+{
+	int i;
+
+	for (i = 0; i < 8192; i += 70)
+		add_val(k, "%d", i);
+}
+
+/* the words of k->src, without the [] around the current one */
+static void fill_words(struct knob *k)
+{
+	char path[PATH_MAX];
+	char *buf, *tok, *save;
+
+	trace_path(path, k->src);
+	buf = read_file(path);
+	if (buf == NULL)
+		return;
+	for (tok = strtok_r(buf, " \t\n[]", &save); tok != NULL;
+	     tok = strtok_r(NULL, " \t\n[]", &save)) {
+		/* mmiotrace needs a special setup, see ftrace_current_tracer.sh */
+		if (strcmp(tok, "mmiotrace") != 0)
+			add_val(k, "%s", tok);
+	}
+	free(buf);
+}
+
+static void fill_options(struct knob *k)
+{
+	char *buf, *tok, *save;
+
+	buf = read_file(k->fullpath);
+	if (buf == NULL)
+		return;
+	for (tok = strtok_r(buf, " \t\n", &save); tok != NULL;
+	     tok = strtok_r(NULL, " \t\n", &save)) {
+		if (strncmp(tok, "no", 2) == 0)
+			tok += 2;
+		add_val(k, "%s", tok);
+		add_val(k, "no%s", tok);
+	}
+	free(buf);
+}
+
+/*
+ * All events enabled in turn, then all disabled in turn, so that each
+ * one stays on for half of the round.
+ */
+static void fill_events(struct knob *k)
+{
+	char path[PATH_MAX];
+	char *buf, *tok, *save;
+	int i, n;
+
+	trace_path(path, "available_events");
+	buf = read_file(path);
+	if (buf == NULL)
+		return;
+	for (tok = strtok_r(buf, "\n", &save); tok != NULL;
+	     tok = strtok_r(NULL, "\n", &save))
+		add_val(k, "%s", tok);
+	free(buf);
+
+	n = k->nvals;
+	for (i = 0; i < n; i++)
+		add_val(k, "!%s", k->vals[i]);
+}
+
+static void fill_pid(struct knob *k)
+{
+	add_val(k, "%d", getpid());
+	add_val(k, "%d", getppid());
+	k->vals = realloc(k->vals, (k->nvals + 1) * sizeof(*k->vals));
+	if (k->vals == NULL)
+		tst_brkm(TBROK | TERRNO, cleanup, "realloc");
+	k->vals[k->nvals++] = NULL;
+}
+
+static int knob_trunc(struct knob *k)
+{
+	int fd;
+
+	fd = open(k->fullpath, O_WRONLY | O_TRUNC);
+	if (fd == -1)
+		return -1;
+	close(fd);
+	return 0;
+}
+
+static void *knob_thread(void *arg)
+{
+	struct knob_thread *t = arg;
+	struct knob *k = t->knob;
+	char buf[READ_BUF];
+	unsigned long i = t->idx;
+	ssize_t ret;
+	char *val;
+	int fd;
+
+	while (!stop) {
+		switch (k->kind) {
+		case K_READ:
+			ret = pread(k->fd, buf, sizeof(buf), 0);
+			break;
+		case K_CAT:
+			fd = open(k->fullpath, O_RDONLY);
+			ret = fd;
+			if (fd == -1)
+				break;
+			while (!stop && (ret = read(fd, buf, sizeof(buf))) > 0)
+				;
+			close(fd);
+			break;
+		case K_TRUNC:
+			ret = knob_trunc(k);
+			break;
+		default:
+			val = k->vals[i++ % k->nvals];
+			if (val == NULL) {
+				ret = knob_trunc(k);
+				break;
+			}
+			/*
+			 * pwrite() keeps the sysctls at offset 0, the tracefs
+			 * files opened with seq_open() refuse it.
+			 */
+			if (!k->no_pwrite) {
+				ret = pwrite(k->fd, val, strlen(val), 0);
+				if (ret == -1 && errno == ESPIPE)
+					k->no_pwrite = 1;
+				else
+					break;
+			}
+			ret = write(k->fd, val, strlen(val));
+			break;
+		}
+		if (ret == -1) {
+			if (!t->err)
+				t->err = errno;
+			t->errs++;
+		}
+		t->ops++;
+	}
+	return NULL;
+}
+
+/* adds what the "name: value" lines of per_cpu/cpuN/stats went up by */
+static void sample_stats(struct cpu_data *cd)
+{
+	char buf[1024], *p, *line, *save;
+	unsigned long long val;
+	ssize_t n;
+	int i;
+
+	n = pread(cd->stats_fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0)
+		return;
+	buf[n] = '\0';
+	for (line = strtok_r(buf, "\n", &save); line != NULL;
+	     line = strtok_r(NULL, "\n", &save)) {
+		p = strchr(line, ':');
+		if (p == NULL)
+			continue;
+		*p++ = '\0';
+		for (i = 0; i < NR_LOST; i++) {
+			if (strcmp(line, lost_names[i]) != 0)
+				continue;
+			val = strtoull(p, NULL, 10);
+			/* the tracer switches reset the buffer */
+			if (val >= cd->last[i])
+				cd->lost[i] += val - cd->last[i];
+			else
+				cd->lost[i] += val;
+			cd->last[i] = val;
+		}
+	}
+}
+
+/* empties the pipe into /dev/null, reading it if that can't be spliced */
+static void flush_pipe(struct cpu_data *cd, ssize_t len)
+{
+	char buf[READ_BUF];
+	ssize_t n;
+
+	while (len > 0) {
+		n = splice(cd->pipe_fd[0], NULL, null_fd, NULL, len,
+			   SPLICE_F_MOVE);
+		if (n == -1)
+			n = read(cd->pipe_fd[0], buf,
+				 len < READ_BUF ? len : READ_BUF);
+		if (n <= 0)
+			break;
+		len -= n;
+	}
+}
+
+static void *drain_thread(void *arg)
+{
+	struct cpu_data *cd = arg;
+	char *buf;
+	ssize_t n;
+
+	buf = malloc(pagesize);
+	if (buf == NULL)
+		return NULL;
+
+	while (!stop) {
+		if (cd->use_read) {
+			n = read(cd->raw_fd, buf, pagesize);
+		} else {
+			n = splice(cd->raw_fd, NULL, cd->pipe_fd[1], NULL,
+				   DRAIN_PAGES * pagesize,
+				   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n > 0)
+				flush_pipe(cd, n);
+		}
+		if (n > 0) {
+			cd->bytes += n;
+			cd->splices++;
+			continue;
+		}
+		if (n == -1 && errno == EINVAL && !cd->use_read &&
+		    cd->splices == 0) {
+			tst_resm(TINFO, "cpu%d: trace_pipe_raw can't be "
+				 "spliced, reading it", cd->cpu);
+			cd->use_read = 1;
+			continue;
+		}
+		if (n == -1 && errno != EAGAIN && errno != EINTR) {
+			if (!cd->err)
+				cd->err = errno;
+			cd->errs++;
+		}
+		usleep(DRAIN_IDLE_US);
+	}
+	free(buf);
+	return NULL;
+}
+
+static unsigned long read_taint(void)
+{
+	char *buf;
+	unsigned long val;
+
+	buf = read_file("/proc/sys/kernel/tainted");
+	if (buf == NULL)
+		return 0;
+	val = strtoul(buf, NULL, 10);
+	free(buf);
+	return val;
+}
+
+static void save_knob(struct knob *k)
+{
+	char *buf, *p;
+
+	if (k->kind == K_READ || k->kind == K_CAT || k->kind == K_TRUNC)
+		return;
+	buf = read_file(k->fullpath);
+	if (buf == NULL)
+		return;
+
+	switch (k->kind) {
+	case K_NUM:
+		/* buffer_size_kb reads "7 (expanded: 1408)" until first used */
+		p = strstr(buf, "expanded:");
+		p = p != NULL ? p + 9 : buf;
+		while (isspace(*p))
+			p++;
+		if (isdigit(*p) || *p == '-')
+			k->saved = strndup(p, strspn(p, "-0123456789"));
+		break;
+	case K_WORD:
+		p = strchr(buf, '[');
+		p = p != NULL ? p + 1 : buf;
+		k->saved = strndup(p, strcspn(p, "] \t\n"));
+		break;
+	default:
+		k->saved = strdup(buf);
+		break;
+	}
+	free(buf);
+}
+
+static void restore_knob(struct knob *k)
+{
+	char *tok, *save;
+	int fd;
+
+	if (k->kind == K_TRUNC) {
+		knob_trunc(k);
+		return;
+	}
+	if (k->saved == NULL)
+		return;
+	/* nothing got through, e.g. ftrace_enabled under lockdown */
+	if (k->ops && k->errs == k->ops) {
+		free(k->saved);
+		k->saved = NULL;
+		return;
+	}
+
+	fd = open(k->fullpath, O_WRONLY | (k->kind == K_LIST ? O_TRUNC : 0));
+	if (fd == -1)
+		return;
+	if (k->kind == K_NUM || k->kind == K_WORD) {
+		if (write(fd, k->saved, strlen(k->saved)) == -1)
+			tst_resm(TWARN | TERRNO, "failed to restore %s",
+				 k->path);
+	} else {
+		for (tok = strtok_r(k->saved, " \t\n", &save); tok != NULL;
+		     tok = strtok_r(NULL, " \t\n", &save)) {
+			/* set_ftrace_pid reads "no pid" when empty */
+			if (k->kind == K_LIST && (tok[0] == '#' ||
+			    strcmp(tok, "no") == 0 || strcmp(tok, "pid") == 0))
+				continue;
+			/* some options, like test_nop_refuse, can't be set */
+			if (write(fd, tok, strlen(tok)) == -1 &&
+			    k->kind == K_LIST)
+				tst_resm(TWARN | TERRNO, "failed to restore "
+					 "'%s' in %s", tok, k->path);
+		}
+	}
+	close(fd);
+	free(k->saved);
+	k->saved = NULL;
+}
+
+static void open_knob(struct knob *k)
+{
+	char path[PATH_MAX];
+	int flags;
+
+	trace_path(path, k->path);
+	k->fullpath = strdup(path);
+	if (k->fullpath == NULL)
+		tst_brkm(TBROK | TERRNO, cleanup, "strdup");
+
+	if (access(path, F_OK) != 0) {
+		tst_resm(TINFO, "%s: %s is not there, skipped", k->name, path);
+		return;
+	}
+
+	if (k->kind == K_CAT || k->kind == K_TRUNC) {
+		k->used = 1;
+		return;
+	}
+
+	if (k->fill != NULL) {
+		k->fill(k);
+		if (k->nvals == 0) {
+			tst_resm(TINFO, "%s: nothing to write, skipped",
+				 k->name);
+			return;
+		}
+	}
+
+	flags = k->kind == K_READ ? O_RDONLY : O_WRONLY;
+	k->fd = open(path, flags);
+	if (k->fd == -1) {
+		tst_resm(TINFO | TERRNO, "%s: can't open %s, skipped",
+			 k->name, path);
+		return;
+	}
+	save_knob(k);
+	k->used = 1;
+}
+
+static void select_knobs(void)
+{
+	char *tok, *save;
+	unsigned int i;
+
+	for (i = 0; i < NR_KNOBS; i++)
+		knobs[i].fd = -1;
+	if (!opt_knobs)
+		return;
+
+	/* knobs left out of -k are marked by a fd of -2 */
+	for (i = 0; i < NR_KNOBS; i++)
+		knobs[i].fd = -2;
+	for (tok = strtok_r(knobs_str, ",", &save); tok != NULL;
+	     tok = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < NR_KNOBS; i++) {
+			if (strcmp(tok, knobs[i].name) == 0)
+				break;
+		}
+		if (i == NR_KNOBS)
+			tst_brkm(TBROK, NULL, "unknown knob '%s', see -h", tok);
+		knobs[i].fd = -1;
+	}
+}
+
+static void setup_cpus(void)
+{
+	char path[PATH_MAX], name[64];
+	int i, nconf;
+
+	nconf = sysconf(_SC_NPROCESSORS_CONF);
+	cpus = calloc(nconf, sizeof(*cpus));
+	if (cpus == NULL)
+		tst_brkm(TBROK | TERRNO, cleanup, "calloc");
+
+	for (i = 0; i < nconf; i++) {
+		struct cpu_data *cd = &cpus[ncpus];
+
+		snprintf(name, sizeof(name), "per_cpu/cpu%d/stats", i);
+		trace_path(path, name);
+		cd->stats_fd = open(path, O_RDONLY);
+		if (cd->stats_fd == -1)
+			continue;
+		cd->cpu = i;
+		cd->raw_fd = -1;
+		cd->pipe_fd[0] = cd->pipe_fd[1] = -1;
+		ncpus++;
+		sample_stats(cd);
+		memset(cd->lost, 0, sizeof(cd->lost));
+
+		if (opt_nodrain)
+			continue;
+		snprintf(name, sizeof(name), "per_cpu/cpu%d/trace_pipe_raw", i);
+		trace_path(path, name);
+		cd->raw_fd = open(path, O_RDONLY | O_NONBLOCK);
+		if (cd->raw_fd == -1)
+			tst_brkm(TBROK | TERRNO, cleanup, "open %s", path);
+		if (pipe(cd->pipe_fd))
+			tst_brkm(TBROK | TERRNO, cleanup, "pipe");
+	}
+	if (ncpus == 0)
+		tst_brkm(TCONF, cleanup, "no per_cpu buffers in %s",
+			 tracing_dir);
+}
+
+static void report(double secs)
+{
+	unsigned long long bytes = 0, lost[NR_LOST] = { 0 };
+	unsigned long ops = 0, errs = 0, drain_errs = 0;
+	unsigned long taint;
+	int i, j;
+
+	for (i = 0; i < nkt; i++) {
+		kt[i].knob->ops += kt[i].ops;
+		kt[i].knob->errs += kt[i].errs;
+		if (!kt[i].knob->err)
+			kt[i].knob->err = kt[i].err;
+	}
+
+	tst_resm(TINFO, "%-16s %12s %10s %10s", "knob", "ops", "ops/s",
+		 "errors");
+	for (i = 0; i < (int)NR_KNOBS; i++) {
+		struct knob *k = &knobs[i];
+
+		if (!k->used)
+			continue;
+		tst_resm(TINFO, "%-16s %12lu %10.0f %10lu%s%s", k->name, k->ops,
+			 k->ops / secs, k->errs, k->err ? " " : "",
+			 k->err ? strerror(k->err) : "");
+		ops += k->ops;
+		errs += k->errs;
+	}
+	tst_resm(TINFO, "%-16s %12lu %10.0f %10lu", "total", ops, ops / secs,
+		 errs);
+
+	for (i = 0; i < ncpus; i++) {
+		struct cpu_data *cd = &cpus[i];
+
+		bytes += cd->bytes;
+		drain_errs += cd->errs;
+		for (j = 0; j < NR_LOST; j++)
+			lost[j] += cd->lost[j];
+		if (!opt_verbose)
+			continue;
+		tst_resm(TINFO, "cpu%d: drained %llu bytes in %llu %s, "
+			 "%lu errors%s%s, lost %llu/%llu/%llu", cd->cpu,
+			 cd->bytes, cd->splices,
+			 cd->use_read ? "reads" : "splices", cd->errs,
+			 cd->err ? " " : "", cd->err ? strerror(cd->err) : "",
+			 cd->lost[L_OVERRUN], cd->lost[L_COMMIT],
+			 cd->lost[L_DROPPED]);
+	}
+	if (!opt_nodrain)
+		tst_resm(TINFO, "drained %llu bytes from %d CPUs, %.2f MB/s, "
+			 "%lu drain errors", bytes, ncpus,
+			 bytes / secs / (1 << 20), drain_errs);
+	tst_resm(TINFO, "lost events: %llu overrun, %llu commit overrun, "
+		 "%llu dropped", lost[L_OVERRUN], lost[L_COMMIT],
+		 lost[L_DROPPED]);
+
+	taint = read_taint();
+	if ((taint & ~taint_before) & TAINT_BAD)
+		tst_resm(TFAIL, "kernel got tainted during the run: %lu -> %lu",
+			 taint_before, taint);
+	else
+		tst_resm(TPASS, "%lu knob ops from %d threads in %.0fs", ops,
+			 nkt, secs);
+}
+
+static void run(void)
+{
+	unsigned long long start, end;
+	int i, j;
+
+	for (i = 0; i < (int)NR_KNOBS; i++)
+		if (knobs[i].used)
+			nkt += threads_per_knob;
+	kt = calloc(nkt, sizeof(*kt));
+	if (kt == NULL)
+		tst_brkm(TBROK | TERRNO, cleanup, "calloc");
+
+	tst_resm(TINFO, "%d knob threads, %s %d CPUs, %d s", nkt,
+		 opt_nodrain ? "sampling" : "draining", ncpus, runtime);
+
+	start = now_us();
+	for (i = 0; i < ncpus && !opt_nodrain; i++) {
+		errno = pthread_create(&cpus[i].tid, NULL, drain_thread,
+				       &cpus[i]);
+		if (errno)
+			tst_brkm(TBROK | TERRNO, cleanup, "pthread_create");
+	}
+	for (i = 0, j = 0; i < (int)NR_KNOBS; i++) {
+		int n;
+
+		if (!knobs[i].used)
+			continue;
+		for (n = 0; n < threads_per_knob; n++, j++) {
+			kt[j].knob = &knobs[i];
+			/* spread the threads of a knob over its values */
+			if (knobs[i].nvals)
+				kt[j].idx = n * knobs[i].nvals /
+				    threads_per_knob;
+			errno = pthread_create(&kt[j].tid, NULL, knob_thread,
+					       &kt[j]);
+			if (errno)
+				tst_brkm(TBROK | TERRNO, cleanup,
+					 "pthread_create");
+		}
+	}
+
+	while (now_us() - start < runtime * 1000000ULL) {
+		usleep(SAMPLE_US);
+		for (i = 0; i < ncpus; i++)
+			sample_stats(&cpus[i]);
+	}
+	stop = 1;
+	for (i = 0; i < nkt; i++)
+		pthread_join(kt[i].tid, NULL);
+	for (i = 0; i < ncpus && !opt_nodrain; i++)
+		pthread_join(cpus[i].tid, NULL);
+	end = now_us();
+	for (i = 0; i < ncpus; i++)
+		sample_stats(&cpus[i]);
+
+	report((end - start) / 1e6);
+}
+
+static long parse_num(const char *str, const char *what, long min, long max)
+{
+	char *end;
+	long val;
+
+	val = strtol(str, &end, 10);
+	if (*end != '\0' || val < min || val > max)
+		tst_brkm(TBROK, NULL, "invalid %s '%s' (%ld-%ld)", what, str,
+			 min, max);
+	return val;
+}
+
+int main(int argc, char *argv[])
+{
+	char *msg;
+
+	msg = parse_opts(argc, argv, options, help);
+	if (msg != NULL)
+		tst_brkm(TBROK, NULL, "OPTION PARSING ERROR - %s", msg);
+
+	if (opt_threads)
+		threads_per_knob = parse_num(threads_str, "threads", 1, 1024);
+	if (opt_time)
+		runtime = parse_num(time_str, "runtime", 1, INT_MAX / 1000);
+	if (opt_bufmax)
+		buffer_max_kb = parse_num(bufmax_str, "buffer size", 2,
+					  1 << 20);
+	select_knobs();
+
+	setup();
+	run();
+	cleanup();
+	tst_exit();
+}
+
+/* tracefs, or debugfs with a tracing dir, mounted under the tmpdir */
+static void mount_tracing(void)
+{
+	tst_tmpdir();
+	tmpdir_made = 1;
+
+	if (snprintf(mount_dir, sizeof(mount_dir), "%s/tracing",
+		     get_tst_tmpdir()) >= (int)sizeof(mount_dir)) {
+		mount_dir[0] = '\0';
+		tst_brkm(TBROK, cleanup, "tmpdir path longer than %zu",
+			 sizeof(mount_dir) - sizeof("/tracing"));
+	}
+	SAFE_MKDIR(cleanup, mount_dir, 0755);
+	if (mount("nodev", mount_dir, "tracefs", 0, NULL) == 0) {
+		snprintf(tracing_dir, sizeof(tracing_dir), "%s", mount_dir);
+		return;
+	}
+	if (mount("nodev", mount_dir, "debugfs", 0, NULL) == -1) {
+		rmdir(mount_dir);
+		mount_dir[0] = '\0';
+		tst_brkm(TCONF | TERRNO, cleanup, "can't mount tracefs or "
+			 "debugfs");
+	}
+	snprintf(tracing_dir, sizeof(tracing_dir), "%s/tracing", mount_dir);
+}
+
+static void setup(void)
+{
+	static const char * const dirs[] = {
+		"/sys/kernel/tracing",
+		"/sys/kernel/debug/tracing",
+	};
+	char path[PATH_MAX];
+	unsigned int i;
+
+	tst_require_root(NULL);
+
+	/* same as ftrace_stress_test.sh */
+	if (tst_kvercmp(2, 6, 34) < 0)
+		tst_brkm(TCONF, NULL, "the test needs kernel 2.6.34 or newer");
+
+	pagesize = sysconf(_SC_PAGESIZE);
+
+	if (opt_dir) {
+		if (snprintf(tracing_dir, sizeof(tracing_dir), "%s",
+			     dir_str) >= (int)sizeof(tracing_dir))
+			tst_brkm(TBROK, NULL, "-d path longer than %zu",
+				 sizeof(tracing_dir) - 1);
+	} else {
+		for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+			snprintf(path, sizeof(path), "%s/trace", dirs[i]);
+			if (access(path, F_OK) == 0) {
+				snprintf(tracing_dir, sizeof(tracing_dir),
+					 "%s", dirs[i]);
+				break;
+			}
+		}
+		if (tracing_dir[0] == '\0')
+			mount_tracing();
+	}
+	trace_path(path, "trace");
+	if (access(path, F_OK) != 0)
+		tst_brkm(TCONF, cleanup, "tracing is not supported");
+
+	null_fd = open("/dev/null", O_WRONLY);
+	if (null_fd == -1)
+		tst_brkm(TBROK | TERRNO, cleanup, "open /dev/null");
+
+	for (i = 0; i < NR_KNOBS; i++)
+		if (knobs[i].fd == -1)
+			open_knob(&knobs[i]);
+	for (i = 0; i < NR_KNOBS; i++)
+		if (knobs[i].used)
+			break;
+	if (i == NR_KNOBS)
+		tst_brkm(TCONF, cleanup, "none of the knobs is there");
+
+	setup_cpus();
+	taint_before = read_taint();
+
+	TEST_PAUSE;
+}
+
+static void cleanup(void)
+{
+	unsigned int i;
+	int j;
+
+	TEST_CLEANUP;
+
+	for (i = 0; i < NR_KNOBS; i++) {
+		if (knobs[i].fd >= 0)
+			close(knobs[i].fd);
+		if (knobs[i].used)
+			restore_knob(&knobs[i]);
+	}
+	for (j = 0; j < ncpus; j++) {
+		if (cpus[j].raw_fd != -1)
+			close(cpus[j].raw_fd);
+		if (cpus[j].pipe_fd[0] != -1) {
+			close(cpus[j].pipe_fd[0]);
+			close(cpus[j].pipe_fd[1]);
+		}
+		close(cpus[j].stats_fd);
+	}
+	if (null_fd != -1)
+		close(null_fd);
+
+	if (mount_dir[0] != '\0') {
+		if (umount(mount_dir) == -1)
+			tst_resm(TWARN | TERRNO, "umount %s", mount_dir);
+		rmdir(mount_dir);
+	}
+	if (tmpdir_made)
+		tst_rmdir();
+}
+
+static void help(void)
+{
+	unsigned int i;
+
+	printf("  -d dir  tracing dir (default: /sys/kernel/tracing, "
+	       "/sys/kernel/debug/tracing\n"
+	       "          or a tracefs mounted for the test)\n");
+	printf("  -k list comma separated knobs to stress (default all):\n"
+	       "         ");
+	for (i = 0; i < NR_KNOBS; i++)
+		printf(" %s", knobs[i].name);
+	printf("\n");
+	printf("  -n n    threads per knob (default 1)\n");
+	printf("  -T sec  run time (default 30)\n");
+	printf("  -B kb   largest buffer_size_kb written (default 4096)\n");
+	printf("  -D      don't drain trace_pipe_raw\n");
+	printf("  -v      print per CPU results\n");
+}
@@ -31,8 +31,10 @@
  *
  * History:
  *	Oct 19 2005 - Created (Mitsuru Chinen)
+ *	2013 - Added the epoll based multi-threaded server mode
  *---------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE		/* accept4() */
 #include "ns-traffic.h"
 
 /*
@@ -44,8 +46,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -54,6 +59,16 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
+/*
+ * Fixed values of the event driven mode
+ */
+#define EVENT_MAX_EVENTS	256	/* events handled per epoll_wait() */
+#define EVENT_BUFSIZE		65536	/* size of the send/recv buffer */
+#define EVENT_MAX_CALLS		16	/* I/O calls per event, for fairness */
+
+/* What the event driven server does with a connection */
+enum { HANDLER_SEND, HANDLER_ECHO, HANDLER_SINK };
+
 /*
  * Gloval variables
  */
@@ -77,8 +92,52 @@ struct server_info {
 	size_t lost_connection;	/* number of lost connection */
 	size_t small_sending;	/* if non-zero, in the small sending mode */
 	size_t window_scaling;	/* if non-zero, in the window scaling mode */
+	int threads;		/* if non-zero, number of event loop threads */
+	int reuseport;		/* if non-zero, a listen socket per thread */
+	int handler;		/* HANDLER_* of the event driven server */
+	int stat_interval;	/* seconds between statistics reports */
+	FILE *stat_fp;		/* FILE pointer where statistics go */
+};
+
+/*
+ * Structure: connection
+ *
+ * Description:
+ *  This structure stores the state of a connection in the event driven
+ *  mode. Only the echo handler needs more than the descriptor: the data
+ *  which could not be sent back yet.
+ */
+struct connection {
+	int sd;			/* socket descriptor */
+	char *pending;		/* data to echo back, NULL if none */
+	size_t pending_off;	/* offset of the unsent data in pending */
+	size_t pending_len;	/* length of the pending data */
+};
+
+/*
+ * Structure: event_thread
+ *
+ * Description:
+ *  This structure stores the information of an event loop thread.
+ *  The counters are only written by the thread itself.
+ */
+struct event_thread {
+	pthread_t thread;	/* thread id */
+	struct server_info *info_p;	/* server information */
+	int listen_sd;		/* socket descriptor for listening */
+	struct connection listener;	/* epoll tag of listen_sd */
+	int epoll_fd;		/* epoll instance of the thread */
+	char *buf;		/* send/recv buffer */
+	unsigned long long accepted;	/* number of accepted connection */
+	unsigned long long lost;	/* number of lost connection */
+	unsigned long long bytes_in;	/* received bytes */
+	unsigned long long bytes_out;	/* sent bytes */
 };
 
+volatile int event_stop;	/* if non-zero, the event loops finish */
+volatile size_t event_current;	/* number of the current connection */
+volatile size_t event_max;	/* maximum connection number */
+
 /*
  * Function: usage()
  *
@@ -105,13 +164,23 @@ void usage(char *program_name, int exit_value)
 		"\t\t  6 : IPv6\n"
 		"\t-p\tport number\n"
 		"\t-b\twork in the background\n"
-		"\t-c\twork in the concurrent server mode\n"
+		"\t-c\twork in the concurrent server mode (fork per client)\n"
+		"\t-t num\twork in the event driven mode with num epoll\n"
+		"\t\tthreads, each with its own SO_REUSEPORT listen socket\n"
+		"\t-m\twhat the event driven mode does with the clients\n"
+		"\t\t  send : send segments to them (default)\n"
+		"\t\t  echo : send back what they send\n"
+		"\t\t  sink : discard what they send\n"
+		"\t-i sec\treport connections/sec and bytes/sec every sec\n"
+		"\t-l\tfilename where the statistics are outputted\n"
 		"\t-s\twork in the small sending mode\n"
 		"\t-w\twork in the window scaling mode\n"
 		"\t-o\tfilename where the server infomation is outputted\n"
 		"\t-d\twork in the debug mode\n"
 		"\t-h\tdisplay this usage\n"
-		"" "*) Server works till it receives SIGHUP\n", program_name);
+		"" "*) Server works till it receives SIGHUP\n"
+		"" "*) The event driven mode reports the statistics when it"
+		" ends\n", program_name);
 	exit(exit_value);
 }
 
@@ -192,16 +261,18 @@ void delete_zombies(struct server_info *info_p)
  *
  * Descripton:
  *  Create a socket to listen for connections on a socket.
- *  The socket discripter is stored info_p->listen_sd.
+ *  In the event driven mode with more than one thread, every thread calls
+ *  this to get its own socket bound with SO_REUSEPORT.
  *
  * Argument:
  *  info_p:	pointer to a server infomation
  *
  * Return value:
- *  None
+ *  socket descriptor for listening
  */
-void create_listen_socket(struct server_info *info_p)
+int create_listen_socket(struct server_info *info_p)
 {
+	int sd;			/* socket descriptor for listening */
 	int on;			/* on/off at an socket option */
 	int err;		/* return value of getaddrinfo */
 	struct addrinfo hints;	/* hints for getaddrinfo() */
@@ -226,16 +297,16 @@ void create_listen_socket(struct server_info *info_p)
 	}
 
 	/* Create a socket for listening. */
-	info_p->listen_sd = socket(res->ai_family,
+	sd = socket(res->ai_family,
 				   res->ai_socktype, res->ai_protocol);
-	if (info_p->listen_sd < 0)
+	if (sd < 0)
 		fatal_error("socket()");
 
 #ifdef IPV6_V6ONLY
 	/* Don't accept IPv4 mapped address if the protocol family is IPv6 */
 	if (res->ai_family == PF_INET6) {
 		on = 1;
-		if (setsockopt(info_p->listen_sd,
+		if (setsockopt(sd,
 			       IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(int)))
 			fatal_error("setsockopt()");
 	}
@@ -243,14 +314,26 @@ void create_listen_socket(struct server_info *info_p)
 
 	/* Enable to reuse the socket */
 	on = 1;
-	if (setsockopt(info_p->listen_sd,
+	if (setsockopt(sd,
 		       SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)))
 		fatal_error("setsockopt()");
 
+#ifdef SO_REUSEPORT
+	/* Let the kernel spread the connections over the threads */
+	if (info_p->reuseport) {
+		on = 1;
+		if (setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(int))) {
+			if (debug)
+				perror("setsockopt(SO_REUSEPORT)");
+			info_p->reuseport = 0;
+		}
+	}
+#endif
+
 	/* Disable the Nagle algorithm, when small sending mode */
 	if (info_p->small_sending) {
 		on = 1;
-		if (setsockopt(info_p->listen_sd,
+		if (setsockopt(sd,
 			       IPPROTO_TCP, TCP_NODELAY, &on, sizeof(int)))
 			fatal_error("setsockopt()");
 		if (debug) {
@@ -260,16 +343,18 @@ void create_listen_socket(struct server_info *info_p)
 
 	/* Maximize socket buffer, when window scaling mode */
 	if (info_p->window_scaling)
-		maximize_sockbuf(info_p->listen_sd);
+		maximize_sockbuf(sd);
 
 	/* Bind to the local address */
-	if (bind(info_p->listen_sd, res->ai_addr, res->ai_addrlen) < 0)
+	if (bind(sd, res->ai_addr, res->ai_addrlen) < 0)
 		fatal_error("bind()");
 	freeaddrinfo(res);
 
 	/* Start to listen for connections */
-	if (listen(info_p->listen_sd, 5) < 0)
+	if (listen(sd, info_p->threads ? SOMAXCONN : 5) < 0)
 		fatal_error("listen()");
+
+	return sd;
 }
 
 /*
@@ -522,6 +607,478 @@ int handle_client(struct server_info *info_p)
 	return ret;
 }
 
+/*
+ * Function: close_connection()
+ *
+ * Descripton:
+ *  Close a connection of the event driven mode and free its state
+ *
+ * Argument:
+ *  th:	  pointer to the event loop thread
+ *  conn: pointer to the connection
+ *  lost: if non-zero, the connection ended with an error
+ *
+ * Return value:
+ *  None
+ */
+void close_connection(struct event_thread *th, struct connection *conn,
+		      int lost)
+{
+	/* close() removes the descriptor from the epoll set too */
+	if (close(conn->sd))
+		fatal_error("close()");
+	__sync_sub_and_fetch(&event_current, 1);
+	if (lost) {
+		++th->lost;
+		if (debug)
+			fprintf(stderr, "The number of lost conncections is "
+				"%llu\n", th->lost);
+	}
+	free(conn->pending);
+	free(conn);
+}
+
+/*
+ * Function: connection_error()
+ *
+ * Descripton:
+ *  Decide whether a failed send/recv is an error or the client has just
+ *  gone away
+ *
+ * Argument:
+ *  err: errno of the failed call
+ *
+ * Return value:
+ *  0:	    the client closed the connection
+ *  other:  error
+ */
+int connection_error(int err)
+{
+	if (err == EPIPE || err == ECONNRESET) {
+		if (debug)
+			fprintf(stderr, "The client closed the connection.\n");
+		return 0;
+	}
+	errno = err;
+	perror("send()/recv()");
+	return 1;
+}
+
+/*
+ * Function: event_accept()
+ *
+ * Descripton:
+ *  Accept all of the pending connections of the thread's listen socket
+ *  and add them to its epoll set
+ *
+ * Argument:
+ *  th:	pointer to the event loop thread
+ *
+ * Return value:
+ *  None
+ */
+void event_accept(struct event_thread *th)
+{
+	struct epoll_event ev;	/* epoll event of the new connection */
+	struct connection *conn;	/* state of the new connection */
+	int data_sd;		/* socket descriptor for send/recv data */
+	size_t current, max;	/* number of the current connection */
+
+	for (;;) {
+		data_sd = accept4(th->listen_sd, NULL, NULL, SOCK_NONBLOCK);
+		if (data_sd < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK
+			    || errno == EINTR)
+				return;
+			if (errno == ECONNABORTED)
+				continue;
+			/* EMFILE etc., try again at the next event */
+			if (debug)
+				perror("accept()");
+			return;
+		}
+
+		conn = calloc(1, sizeof(struct connection));
+		if (conn == NULL) {
+			fprintf(stderr, "malloc() is failed.\n");
+			if (close(data_sd))
+				fatal_error("close()");
+			continue;
+		}
+		conn->sd = data_sd;
+
+		ev.events = th->info_p->handler == HANDLER_SEND ?
+		    EPOLLOUT : EPOLLIN;
+		ev.data.ptr = conn;
+		if (epoll_ctl(th->epoll_fd, EPOLL_CTL_ADD, data_sd, &ev) < 0)
+			fatal_error("epoll_ctl()");
+
+		++th->accepted;
+		current = __sync_add_and_fetch(&event_current, 1);
+		while ((max = event_max) < current
+		       && !__sync_bool_compare_and_swap(&event_max, max,
+							current))
+			;
+	}
+}
+
+/*
+ * Function: event_echo()
+ *
+ * Descripton:
+ *  Echo handler of the event driven mode. What can't be sent back right
+ *  away is kept in the connection, and reading stops until it is sent.
+ *
+ * Argument:
+ *  th:	  pointer to the event loop thread
+ *  conn: pointer to the connection
+ *
+ * Return value:
+ *  0:	    success
+ *  -1:	    the connection is finished
+ *  other:  error
+ */
+int event_echo(struct event_thread *th, struct connection *conn)
+{
+	struct epoll_event ev;	/* epoll event of the connection */
+	ssize_t recvbyte_size;	/* size of the received byte */
+	ssize_t sntbyte_size;	/* size of the sent byte */
+	int calls;
+
+	for (calls = 0; calls < EVENT_MAX_CALLS; calls++) {
+		/* Send back the rest of the last read first */
+		while (conn->pending) {
+			sntbyte_size = send(conn->sd,
+					    conn->pending + conn->pending_off,
+					    conn->pending_len -
+					    conn->pending_off, MSG_NOSIGNAL);
+			if (sntbyte_size < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return 0;
+				return connection_error(errno) ? 1 : -1;
+			}
+			th->bytes_out += sntbyte_size;
+			conn->pending_off += sntbyte_size;
+			if (conn->pending_off == conn->pending_len) {
+				free(conn->pending);
+				conn->pending = NULL;
+				ev.events = EPOLLIN;
+				ev.data.ptr = conn;
+				if (epoll_ctl(th->epoll_fd, EPOLL_CTL_MOD,
+					      conn->sd, &ev) < 0)
+					fatal_error("epoll_ctl()");
+			}
+		}
+
+		recvbyte_size = recv(conn->sd, th->buf, EVENT_BUFSIZE, 0);
+		if (recvbyte_size == 0)
+			return -1;
+		if (recvbyte_size < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return connection_error(errno) ? 1 : -1;
+		}
+		th->bytes_in += recvbyte_size;
+
+		sntbyte_size = send(conn->sd, th->buf, recvbyte_size,
+				    MSG_NOSIGNAL);
+		if (sntbyte_size < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return connection_error(errno) ? 1 : -1;
+			sntbyte_size = 0;
+		}
+		th->bytes_out += sntbyte_size;
+		if (sntbyte_size == recvbyte_size)
+			continue;
+
+		/* Keep the rest and wait until it can be sent */
+		conn->pending_len = recvbyte_size - sntbyte_size;
+		conn->pending_off = 0;
+		conn->pending = malloc(conn->pending_len);
+		if (conn->pending == NULL) {
+			fprintf(stderr, "malloc() is failed.\n");
+			return 1;
+		}
+		memcpy(conn->pending, th->buf + sntbyte_size,
+		       conn->pending_len);
+		ev.events = EPOLLOUT;
+		ev.data.ptr = conn;
+		if (epoll_ctl(th->epoll_fd, EPOLL_CTL_MOD, conn->sd, &ev) < 0)
+			fatal_error("epoll_ctl()");
+		return 0;
+	}
+	return 0;
+}
+
+/*
+ * Function: event_handle()
+ *
+ * Descripton:
+ *  Handle an event of a connection in the event driven mode. The send
+ *  handler sends like communicate_client() does, the sink handler reads
+ *  and discards, the echo handler is event_echo().
+ *
+ * Argument:
+ *  th:	  pointer to the event loop thread
+ *  conn: pointer to the connection
+ *
+ * Return value:
+ *  None
+ */
+void event_handle(struct event_thread *th, struct connection *conn)
+{
+	size_t sndsize;		/* size of the message to send */
+	ssize_t ret;		/* size of the sent/received byte */
+	int calls;
+	int done = 0;		/* -1: finished, other non-zero: error */
+
+	switch (th->info_p->handler) {
+	case HANDLER_SEND:
+		sndsize = th->info_p->small_sending ? 1 : EVENT_BUFSIZE;
+		for (calls = 0; calls < EVENT_MAX_CALLS; calls++) {
+			ret = send(conn->sd, th->buf, sndsize, MSG_NOSIGNAL);
+			if (ret < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+					done = connection_error(errno) ? 1 : -1;
+				break;
+			}
+			th->bytes_out += ret;
+		}
+		break;
+
+	case HANDLER_SINK:
+		for (calls = 0; calls < EVENT_MAX_CALLS; calls++) {
+			ret = recv(conn->sd, th->buf, EVENT_BUFSIZE, 0);
+			if (ret == 0) {
+				done = -1;
+				break;
+			}
+			if (ret < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+					done = connection_error(errno) ? 1 : -1;
+				break;
+			}
+			th->bytes_in += ret;
+		}
+		break;
+
+	case HANDLER_ECHO:
+		done = event_echo(th, conn);
+		break;
+	}
+
+	if (done)
+		close_connection(th, conn, done > 0);
+}
+
+/*
+ * Function: event_loop()
+ *
+ * Descripton:
+ *  The event loop of a thread: accept connections from its listen socket
+ *  and handle them until event_stop is set
+ *
+ * Argument:
+ *  arg: pointer to the event loop thread
+ *
+ * Return value:
+ *  NULL
+ */
+void *event_loop(void *arg)
+{
+	struct event_thread *th = arg;
+	struct epoll_event events[EVENT_MAX_EVENTS];	/* ready events */
+	struct epoll_event ev;	/* epoll event of the listen socket */
+	int nfds;		/* number of ready events */
+	int i;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &th->listener;
+	if (epoll_ctl(th->epoll_fd, EPOLL_CTL_ADD, th->listen_sd, &ev) < 0)
+		fatal_error("epoll_ctl()");
+
+	while (!event_stop) {
+		/* Wake up every 0.5 sec to check event_stop */
+		nfds = epoll_wait(th->epoll_fd, events, EVENT_MAX_EVENTS, 500);
+		if (nfds < 0) {
+			if (errno == EINTR)
+				continue;
+			fatal_error("epoll_wait()");
+		}
+		for (i = 0; i < nfds; i++) {
+			if (events[i].data.ptr == &th->listener)
+				event_accept(th);
+			else
+				event_handle(th, events[i].data.ptr);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Function: report_stats()
+ *
+ * Descripton:
+ *  Output the statistics of the event driven mode
+ *
+ * Argument:
+ *  info_p:   pointer to a server infomation
+ *  threads:  array of the event loop threads
+ *  elapsed:  seconds since the server started
+ *  interval: seconds since the last report, 0 for the final report
+ *  last:     totals of the last report, updated to the current totals
+ *
+ * Return value:
+ *  None
+ */
+void report_stats(struct server_info *info_p, struct event_thread *threads,
+		  double elapsed, double interval, unsigned long long *last)
+{
+	unsigned long long now[3] = { 0, 0, 0 };	/* conns, in, out */
+	unsigned long long lost = 0;
+	double period;
+	int i;
+
+	for (i = 0; i < info_p->threads; i++) {
+		now[0] += threads[i].accepted;
+		now[1] += threads[i].bytes_in;
+		now[2] += threads[i].bytes_out;
+		lost += threads[i].lost;
+	}
+	info_p->current_connection = event_current;
+	info_p->max_connection = event_max;
+	info_p->lost_connection = lost;
+
+	if (interval > 0) {
+		fprintf(info_p->stat_fp, "%.1fs: %zu connections, "
+			"%.0f conn/s, %.0f bytes/s in, %.0f bytes/s out\n",
+			elapsed, info_p->current_connection,
+			(now[0] - last[0]) / interval,
+			(now[1] - last[1]) / interval,
+			(now[2] - last[2]) / interval);
+	} else {
+		period = elapsed > 0 ? elapsed : 1;
+		fprintf(info_p->stat_fp, "total: %llu connections (max %zu "
+			"concurrent, %zu lost) in %.1fs, %.0f conn/s, "
+			"%.0f bytes/s in, %.0f bytes/s out\n", now[0],
+			info_p->max_connection, info_p->lost_connection,
+			elapsed, now[0] / period, now[1] / period,
+			now[2] / period);
+	}
+	fflush(info_p->stat_fp);
+	memcpy(last, now, sizeof(now));
+}
+
+/*
+ * Function: event_server()
+ *
+ * Descripton:
+ *  Run the event driven server: info_p->threads threads each run an epoll
+ *  loop over their own SO_REUSEPORT listen socket (or all of them over
+ *  the one listen socket where SO_REUSEPORT is missing) and the client
+ *  connections they accepted, until SIGHUP is caught.
+ *
+ * Argument:
+ *  info_p:	pointer to a server infomation
+ *
+ * Return value:
+ *  0:	    success
+ *  other:  fail
+ */
+int event_server(struct server_info *info_p)
+{
+	struct event_thread *threads;	/* the event loop threads */
+	unsigned long long last[3] = { 0, 0, 0 };	/* last totals */
+	struct timespec start, now, last_report;
+	struct rlimit rlim;	/* limit of the file descriptors */
+	sigset_t sigset;	/* SIGHUP, to be handled by this thread */
+	double elapsed, interval;
+	int i;
+
+	/* Tens of thousands of connections need as many descriptors */
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0
+	    && rlim.rlim_cur < rlim.rlim_max) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	threads = calloc(info_p->threads, sizeof(struct event_thread));
+	if (threads == NULL) {
+		fprintf(stderr, "malloc() is failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Catch SIGHUP in this thread only */
+	handler.sa_handler = set_signal_flag;
+	if (sigaction(SIGHUP, &handler, NULL) < 0)
+		fatal_error("sigaction()");
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	for (i = 0; i < info_p->threads; i++) {
+		threads[i].info_p = info_p;
+		if (i == 0 || !info_p->reuseport)
+			threads[i].listen_sd = info_p->listen_sd;
+		else
+			threads[i].listen_sd = create_listen_socket(info_p);
+		if (fcntl(threads[i].listen_sd, F_SETFL, O_NONBLOCK) < 0)
+			fatal_error("fcntl()");
+		threads[i].epoll_fd = epoll_create(EVENT_MAX_EVENTS);
+		if (threads[i].epoll_fd < 0)
+			fatal_error("epoll_create()");
+		threads[i].buf = calloc(1, EVENT_BUFSIZE);
+		if (threads[i].buf == NULL) {
+			fprintf(stderr, "malloc() is failed.\n");
+			return EXIT_FAILURE;
+		}
+		if (pthread_create(&threads[i].thread, NULL, event_loop,
+				   &threads[i]))
+			fatal_error("pthread_create()");
+	}
+	if (debug)
+		fprintf(stderr, "%d event loop threads, %s\n", info_p->threads,
+			info_p->reuseport ? "SO_REUSEPORT" :
+			"one listen socket");
+
+	pthread_sigmask(SIG_UNBLOCK, &sigset, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	last_report = start;
+	while (!catch_sighup) {
+		usleep(100000);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		interval = (now.tv_sec - last_report.tv_sec) +
+		    (now.tv_nsec - last_report.tv_nsec) / 1e9;
+		if (info_p->stat_interval
+		    && interval >= info_p->stat_interval) {
+			elapsed = (now.tv_sec - start.tv_sec) +
+			    (now.tv_nsec - start.tv_nsec) / 1e9;
+			report_stats(info_p, threads, elapsed, interval, last);
+			last_report = now;
+		}
+	}
+
+	/* No more connection is accepted, the clients are disconnected */
+	event_stop = 1;
+	for (i = 0; i < info_p->threads; i++)
+		pthread_join(threads[i].thread, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - start.tv_sec) +
+	    (now.tv_nsec - start.tv_nsec) / 1e9;
+	report_stats(info_p, threads, elapsed, 0, last);
+
+	for (i = 0; i < info_p->threads; i++) {
+		if (i == 0 || info_p->reuseport)
+			close(threads[i].listen_sd);
+		close(threads[i].epoll_fd);
+		free(threads[i].buf);
+	}
+	free(threads);
+	return EXIT_SUCCESS;
+}
+
 /*
  *
  *  Function: main()
@@ -544,7 +1101,7 @@ int main(int argc, char *argv[])
 	server.portnum = NULL;
 
 	/* Retrieve the options */
-	while ((optc = getopt(argc, argv, "f:p:bcswo:dh")) != EOF) {
+	while ((optc = getopt(argc, argv, "f:p:bct:m:i:l:swo:dh")) != EOF) {
 		switch (optc) {
 		case 'f':
 			if (strncmp(optarg, "4", 1) == 0)
@@ -580,6 +1137,42 @@ int main(int argc, char *argv[])
 			server.concurrent = 1;
 			break;
 
+		case 't':
+			server.threads = strtol(optarg, NULL, 0);
+			if (server.threads < 1) {
+				fprintf(stderr,
+					"The number of threads should be "
+					"positive\n");
+				usage(program_name, EXIT_FAILURE);
+			}
+			break;
+
+		case 'm':
+			if (strcmp(optarg, "send") == 0)
+				server.handler = HANDLER_SEND;
+			else if (strcmp(optarg, "echo") == 0)
+				server.handler = HANDLER_ECHO;
+			else if (strcmp(optarg, "sink") == 0)
+				server.handler = HANDLER_SINK;
+			else {
+				fprintf(stderr,
+					"handler should be send, echo or "
+					"sink.\n");
+				usage(program_name, EXIT_FAILURE);
+			}
+			break;
+
+		case 'i':
+			server.stat_interval = strtol(optarg, NULL, 0);
+			break;
+
+		case 'l':
+			if ((server.stat_fp = fopen(optarg, "w")) == NULL) {
+				fprintf(stderr, "Cannot open %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+
 		case 's':
 			server.small_sending = 1;
 			break;
@@ -614,6 +1207,15 @@ int main(int argc, char *argv[])
 		usage(program_name, EXIT_FAILURE);
 	}
 
+	/* The fork model and the event driven model exclude each other */
+	if (server.concurrent && server.threads) {
+		fprintf(stderr, "-c and -t can't be used together.\n");
+		usage(program_name, EXIT_FAILURE);
+	}
+	server.reuseport = server.threads > 1;
+	if (server.stat_fp == NULL)
+		server.stat_fp = stdout;
+
 	/* Check the port number is specfied. */
 	if (server.portnum == NULL) {
 		server.portnum = (char *)calloc(6, sizeof(char));
@@ -635,7 +1237,7 @@ int main(int argc, char *argv[])
 		fatal_error("sigaction()");
 
 	/* Create a listen socket */
-	create_listen_socket(&server);
+	server.listen_sd = create_listen_socket(&server);
 
 	/* Output any server information to the information file */
 	fprintf(info_fp, "PID: %u\n", getpid());
@@ -645,6 +1247,9 @@ int main(int argc, char *argv[])
 			fatal_error("fclose()");
 
 	/* Handle one or more tcp clients. */
-	ret = handle_client(&server);
+	if (server.threads)
+		ret = event_server(&server);
+	else
+		ret = handle_client(&server);
 	exit(ret);
 }
@@ -91,10 +91,33 @@ EXTERN int debug;		/* If nonzero, output debug information. */
 #define PROC_IFINET6_FILE_LINELENGTH	64
 #define PROC_IFINET6_LINKLOCAL		0x20
 
+/* Sequence header stamped into UDP payloads by ns-udpsender batch mode */
+#define UDP_SEQ_MAGIC		0x4C545055	/* "LTPU" */
+#define UDP_GSO_MAXSEGS		64		/* UDP_MAX_SEGMENTS in the kernel */
+#define UDP_DATAGRAM_MAXSIZE	65507
+
+#ifndef SOL_UDP
+#define SOL_UDP			17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT		103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO			104
+#endif
+
 
 /*
  * Structure definition
  */
+/* All fields are in network byte order */
+struct udp_seq_hdr {
+    u_int32_t magic;
+    u_int32_t stream;		/* identifies the sending socket */
+    u_int32_t seq_hi;
+    u_int32_t seq_lo;
+};
+
 struct eth_frame {
     struct ethhdr hdr;
     unsigned char data[ETH_DATA_MAXSIZE];
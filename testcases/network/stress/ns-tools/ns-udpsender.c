@@ -30,11 +30,16 @@
  *
  * History:
  *	Mar 17 2006 - Created (Mitsuru Chinen)
+ *	Oct 2013 - Added batched (sendmmsg/UDP_SEGMENT), multi-socket and
+ *		   rate limited sending with sequence numbered payloads
  *---------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE
+
 /*
  * Header Files
  */
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -46,6 +51,7 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "ns-traffic.h"
 
@@ -61,9 +67,25 @@ struct udp_info {
 	char *dst_name;
 	char *dst_port;
 	struct addrinfo addr_info;
+	struct sockaddr_storage dst_addr;	/* ai_addr of addr_info */
 	unsigned char *msg;
 	size_t msgsize;
 	double timeout;
+	int batch;		/* datagrams per sendmmsg() */
+	int segs;		/* UDP_SEGMENT segments per datagram, 0: no GSO */
+	int nsocks;		/* number of sending sockets (threads) */
+	double rate;		/* datagrams per second, 0: unlimited */
+	int interval;		/* statistics interval [sec], 0: none */
+};
+
+struct send_thread {
+	pthread_t thread;
+	struct udp_info *udp_p;
+	int sd;
+	u_int32_t stream;
+	unsigned long long sent;	/* datagrams handed to the kernel */
+	unsigned long long bytes;
+	unsigned long long dropped;	/* refused with ENOBUFS or EAGAIN */
 };
 
 /*
@@ -72,6 +94,7 @@ struct udp_info {
 char *program_name;		/* program name */
 struct sigaction handler;	/* Behavior for a signal */
 int catch_sighup;		/* When catch the SIGHUP, set to non-zero */
+int running_threads;		/* sending threads not finished yet */
 
 /*
  * Function: usage()
@@ -106,6 +129,15 @@ void usage(char *program_name, int exit_value)
 		"\t-d\t\tdisplay debug informations\n"
 		"\t-h\t\tdisplay this usage\n"
 		"\n"
+		"\t[options for batched sending]\n"
+		"\t  -B num\tdatagrams per sendmmsg()\n"
+		"\t  -g num\tsend num UDP_SEGMENT (GSO) segments of size\n"
+		"\t\t\tbytes in every datagram\n"
+		"\t  -n num\tsend through num sockets, one thread each\n"
+		"\t  -r pps\tlimit the total rate in datagrams per second\n"
+		"\t  -i sec\tprint the sending rate every sec seconds\n"
+		"\t  Any of these stamps a sequence number into every payload\n"
+		"\n"
 		"\t[options for multicast]\n"
 		"\t  -m\t\tsend multicast datagrams\n"
 		"\t  -I if_name\tinterface name of the source host\n",
@@ -168,7 +200,7 @@ void parse_options(int argc, char *argv[], struct udp_info *udp_p, int *bg_p)
 	int is_specified_daddr = 0;
 	int is_specified_port = 0;
 
-	while ((optc = getopt(argc, argv, "f:D:p:s:t:obdhmI:")) != EOF) {
+	while ((optc = getopt(argc, argv, "f:D:p:s:t:obdhmI:B:g:n:r:i:")) != EOF) {
 		switch (optc) {
 		case 'f':
 			if (optarg[0] == '4')
@@ -244,6 +276,58 @@ void parse_options(int argc, char *argv[], struct udp_info *udp_p, int *bg_p)
 				fatal_error("strdup() failed.");
 			break;
 
+			/* Options for batched sending */
+		case 'B':
+			opt_ul = strtoul(optarg, NULL, 0);
+			if (opt_ul < 1 || opt_ul > UIO_MAXIOV) {
+				fprintf(stderr,
+					"The batch size should be from 1 to %d\n",
+					UIO_MAXIOV);
+				usage(program_name, EXIT_FAILURE);
+			}
+			udp_p->batch = opt_ul;
+			break;
+
+		case 'g':
+			opt_ul = strtoul(optarg, NULL, 0);
+			if (opt_ul < 1 || opt_ul > UDP_GSO_MAXSEGS) {
+				fprintf(stderr,
+					"The number of segments should be from 1 to %d\n",
+					UDP_GSO_MAXSEGS);
+				usage(program_name, EXIT_FAILURE);
+			}
+			udp_p->segs = opt_ul;
+			break;
+
+		case 'n':
+			opt_ul = strtoul(optarg, NULL, 0);
+			if (opt_ul < 1 || opt_ul > 1024) {
+				fprintf(stderr,
+					"The number of sockets should be from 1 to 1024\n");
+				usage(program_name, EXIT_FAILURE);
+			}
+			udp_p->nsocks = opt_ul;
+			break;
+
+		case 'r':
+			opt_d = strtod(optarg, NULL);
+			if (opt_d <= 0.0) {
+				fprintf(stderr, "Rate should be positive value\n");
+				usage(program_name, EXIT_FAILURE);
+			}
+			udp_p->rate = opt_d;
+			break;
+
+		case 'i':
+			opt_ul = strtoul(optarg, NULL, 0);
+			if (opt_ul < 1) {
+				fprintf(stderr,
+					"Interval should be positive value\n");
+				usage(program_name, EXIT_FAILURE);
+			}
+			udp_p->interval = opt_ul;
+			break;
+
 		default:
 			usage(program_name, EXIT_FAILURE);
 		}
@@ -271,53 +355,43 @@ void parse_options(int argc, char *argv[], struct udp_info *udp_p, int *bg_p)
 			usage(program_name, EXIT_FAILURE);
 		}
 	}
+
+	if (udp_p->segs
+	    && udp_p->msgsize * udp_p->segs > UDP_DATAGRAM_MAXSIZE) {
+		fprintf(stderr, "size * segments should be %d or less\n",
+			UDP_DATAGRAM_MAXSIZE);
+		usage(program_name, EXIT_FAILURE);
+	}
 }
 
 /*
- * Function: create_udp_datagram()
+ * Function: create_udp_socket()
  *
  * Description:
- *  This function creates udp datagram
+ *  This function creates a socket to send udp datagrams to the destination
+ *  stored in udp_p->addr_info
  *
  * Argument:
  *  udp_p: pointer to data of udp data structure
  *
  * Return value:
- *  None
+ *  socket descriptor
  */
-void create_udp_datagram(struct udp_info *udp_p)
+int create_udp_socket(struct udp_info *udp_p)
 {
-	struct addrinfo hints;	/* hints for getaddrinfo() */
-	struct addrinfo *res;	/* pointer to addrinfo structure */
+	struct addrinfo *res = &udp_p->addr_info;
 	struct ifreq ifinfo;	/* Interface information */
-	int err;		/* return value of getaddrinfo */
+	int sd;			/* socket descriptor */
 	int on;			/* variable for socket option */
 
-	/* Set the hints to addrinfo() */
-	memset(&hints, '\0', sizeof(struct addrinfo));
-	hints.ai_family = udp_p->family;
-	hints.ai_socktype = SOCK_DGRAM;
-	hints.ai_protocol = IPPROTO_UDP;
-
-	/* Get the address information */
-	err = getaddrinfo(udp_p->dst_name, udp_p->dst_port, &hints, &res);
-	if (err) {
-		fprintf(stderr, "getaddrinfo(): %s\n", gai_strerror(err));
-		exit(EXIT_FAILURE);
-	}
-	if (res->ai_next) {
-		fprintf(stderr, "getaddrinfo(): multiple address is found.");
-		exit(EXIT_FAILURE);
-	}
-
 	/* Create a socket */
-	udp_p->sd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-	if (udp_p->sd < 0)
+	sd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (sd < 0)
 		fatal_error("socket()");
 
 	/* Enable to reuse the socket */
 	on = 1;
-	if (setsockopt(udp_p->sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)))
+	if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)))
 		fatal_error("setsockopt()");
 
 	/* In multicast case, specify the interface for outgoing datagrams */
@@ -325,7 +399,7 @@ void create_udp_datagram(struct udp_info *udp_p)
 		struct ip_mreqn mcast_req, *req_p = &mcast_req;
 		int ifindex, *id_p = &ifindex;
 
-		get_ifinfo(&ifinfo, udp_p->sd, udp_p->ifname, SIOCGIFINDEX);
+		get_ifinfo(&ifinfo, sd, udp_p->ifname, SIOCGIFINDEX);
 		ifindex = ifinfo.ifr_ifindex;
 
 		switch (udp_p->family) {
@@ -334,7 +408,7 @@ void create_udp_datagram(struct udp_info *udp_p)
 			    ((struct sockaddr_in *)(res->ai_addr))->sin_addr;
 			req_p->imr_address.s_addr = htonl(INADDR_ANY);
 			req_p->imr_ifindex = ifindex;
-			if (setsockopt(udp_p->sd, IPPROTO_IP, IP_MULTICAST_IF,
+			if (setsockopt(sd, IPPROTO_IP, IP_MULTICAST_IF,
 				       req_p, sizeof(struct ip_mreqn))) {
 				fatal_error("setsockopt()");
 			}
@@ -342,7 +416,7 @@ void create_udp_datagram(struct udp_info *udp_p)
 
 		case PF_INET6:	/* IPv6 */
 			if (setsockopt
-			    (udp_p->sd, IPPROTO_IPV6, IPV6_MULTICAST_IF, id_p,
+			    (sd, IPPROTO_IPV6, IPV6_MULTICAST_IF, id_p,
 			     sizeof(int))) {
 				fatal_error("setsockopt()");
 			}
@@ -350,6 +424,63 @@ void create_udp_datagram(struct udp_info *udp_p)
 		}
 	}
 
+	/* Let the kernel split every datagram into msgsize segments */
+	if (udp_p->segs) {
+		int gso_size = udp_p->msgsize;
+
+		if (setsockopt(sd, SOL_UDP, UDP_SEGMENT, &gso_size,
+			       sizeof(int)))
+			fatal_error("setsockopt(UDP_SEGMENT)");
+	}
+
+	return sd;
+}
+
+/*
+ * Function: create_udp_datagram()
+ *
+ * Description:
+ *  This function creates udp datagram
+ *
+ * Argument:
+ *  udp_p: pointer to data of udp data structure
+ *
+ * Return value:
+ *  None
+ */
+void create_udp_datagram(struct udp_info *udp_p)
+{
+	struct addrinfo hints;	/* hints for getaddrinfo() */
+	struct addrinfo *res;	/* pointer to addrinfo structure */
+	int err;		/* return value of getaddrinfo */
+
+	/* Set the hints to addrinfo() */
+	memset(&hints, '\0', sizeof(struct addrinfo));
+	hints.ai_family = udp_p->family;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+
+	/* Get the address information */
+	err = getaddrinfo(udp_p->dst_name, udp_p->dst_port, &hints, &res);
+	if (err) {
+		fprintf(stderr, "getaddrinfo(): %s\n", gai_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	if (res->ai_next) {
+		fprintf(stderr, "getaddrinfo(): multiple address is found.");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Store addrinfo, ai_addr is released by freeaddrinfo() */
+	memcpy(&(udp_p->addr_info), res, sizeof(struct addrinfo));
+	memcpy(&(udp_p->dst_addr), res->ai_addr, res->ai_addrlen);
+	udp_p->addr_info.ai_addr = (struct sockaddr *)&(udp_p->dst_addr);
+	udp_p->addr_info.ai_canonname = NULL;
+	udp_p->addr_info.ai_next = NULL;
+	freeaddrinfo(res);
+
+	udp_p->sd = create_udp_socket(udp_p);
+
 	/* Make the payload */
 	udp_p->msg = (unsigned char *)malloc(udp_p->msgsize);
 	if (udp_p->msg == NULL) {
@@ -357,10 +488,241 @@ void create_udp_datagram(struct udp_info *udp_p)
 		exit(EXIT_FAILURE);
 	}
 	fill_payload(udp_p->msg, udp_p->msgsize);
+}
 
-	/* Store addrinfo */
-	memcpy(&(udp_p->addr_info), res, sizeof(struct addrinfo));
-	freeaddrinfo(res);
+/*
+ * Function: now_sec()
+ *
+ * Description:
+ *  This function returns the monotonic clock in seconds
+ *
+ * Argument:
+ *  None
+ *
+ * Return value:
+ *  current time [sec]
+ */
+double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/*
+ * Function: send_thread_main()
+ *
+ * Description:
+ *  This function is the body of a sending thread. It sends batches of
+ *  datagrams with sendmmsg() through its own socket, stamps a sequence
+ *  number into every datagram (every GSO segment) so that ns-udpserver can
+ *  count the drops, and paces itself with a token bucket when a rate is
+ *  specified.
+ *
+ * Argument:
+ *  arg: pointer to the send_thread structure
+ *
+ * Return value:
+ *  NULL
+ */
+void *send_thread_main(void *arg)
+{
+	struct send_thread *th = arg;
+	struct udp_info *udp_p = th->udp_p;
+	int batch = udp_p->batch ? udp_p->batch : 1;
+	int segs = udp_p->segs ? udp_p->segs : 1;
+	int per_call = batch * segs;	/* datagrams on the wire per call */
+	size_t dgsize = udp_p->msgsize * segs;
+	unsigned char *buf;		/* payloads of all the datagrams */
+	struct mmsghdr *msgs;
+	struct iovec *iov;
+	struct udp_seq_hdr hdr;
+	u_int64_t seq = 0;
+	double rate, burst, tokens;	/* token bucket */
+	double start, last, now;
+	int i, j, ret;
+
+	buf = malloc(dgsize * batch);
+	msgs = calloc(batch, sizeof(struct mmsghdr));
+	iov = calloc(batch, sizeof(struct iovec));
+	if (buf == NULL || msgs == NULL || iov == NULL)
+		fatal_error("malloc()");
+
+	for (i = 0; i < batch; i++) {
+		for (j = 0; j < segs; j++)
+			memcpy(buf + i * dgsize + j * udp_p->msgsize,
+			       udp_p->msg, udp_p->msgsize);
+		iov[i].iov_base = buf + i * dgsize;
+		iov[i].iov_len = dgsize;
+		msgs[i].msg_hdr.msg_name = udp_p->addr_info.ai_addr;
+		msgs[i].msg_hdr.msg_namelen = udp_p->addr_info.ai_addrlen;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	hdr.magic = htonl(UDP_SEQ_MAGIC);
+	hdr.stream = htonl(th->stream);
+
+	/* Each socket gets an equal part of the rate, bursts up to 10ms */
+	rate = udp_p->rate / udp_p->nsocks;
+	burst = rate / 100.0;
+	if (burst < per_call)
+		burst = per_call;
+	tokens = per_call;
+
+	start = last = now_sec();
+
+	while (!catch_sighup) {
+		if (rate > 0.0) {
+			now = now_sec();
+			tokens += (now - last) * rate;
+			last = now;
+			if (tokens > burst)
+				tokens = burst;
+			if (tokens < per_call) {
+				struct timespec ts;
+				double wait = (per_call - tokens) / rate;
+
+				ts.tv_sec = wait;
+				ts.tv_nsec = (wait - ts.tv_sec) * 1000000000.0;
+				nanosleep(&ts, NULL);
+				continue;
+			}
+			tokens -= per_call;
+		}
+
+		if (udp_p->msgsize >= sizeof(hdr)) {
+			for (i = 0; i < batch; i++)
+				for (j = 0; j < segs; j++, seq++) {
+					hdr.seq_hi = htonl(seq >> 32);
+					hdr.seq_lo = htonl(seq & 0xffffffff);
+					memcpy(buf + i * dgsize
+					       + j * udp_p->msgsize,
+					       &hdr, sizeof(hdr));
+				}
+		}
+
+		ret = sendmmsg(th->sd, msgs, batch, 0);
+		if (ret < 0) {
+			if (catch_sighup)
+				break;
+			/* The queue is full, the datagrams are lost */
+			if (errno != ENOBUFS && errno != EAGAIN
+			    && errno != EINTR)
+				fatal_error("sendmmsg()");
+			ret = 0;
+		}
+		__sync_fetch_and_add(&th->sent, (unsigned long long)ret * segs);
+		__sync_fetch_and_add(&th->bytes,
+				     (unsigned long long)ret * dgsize);
+		if (ret < batch)
+			__sync_fetch_and_add(&th->dropped,
+				(unsigned long long)(batch - ret) * segs);
+
+		/* Check timeout:
+		   If timeout value is negative only send one batch */
+		if (udp_p->timeout) {
+			if (udp_p->timeout < 0.0)
+				break;
+			if (udp_p->timeout < now_sec() - start)
+				break;
+		}
+	}
+
+	__sync_fetch_and_sub(&running_threads, 1);
+
+	free(iov);
+	free(msgs);
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Function: send_udp_batches()
+ *
+ * Description:
+ *  This function starts a sending thread for every socket, reports the
+ *  sending rate every interval and the totals at the end
+ *
+ * Argument:
+ *  udp_p: pointer to the udp data structure
+ *
+ * Return value:
+ *  None
+ */
+void send_udp_batches(struct udp_info *udp_p)
+{
+	struct send_thread *threads;
+	sigset_t sigset, oldset;
+	unsigned long long sent, bytes, dropped;
+	unsigned long long last_sent = 0, last_bytes = 0;
+	double start, last, now;
+	int i;
+
+	threads = calloc(udp_p->nsocks, sizeof(struct send_thread));
+	if (threads == NULL)
+		fatal_error("calloc()");
+
+	/* Only the main thread handles SIGHUP */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGHUP);
+	if (pthread_sigmask(SIG_BLOCK, &sigset, &oldset))
+		fatal_error("pthread_sigmask()");
+
+	running_threads = udp_p->nsocks;
+	for (i = 0; i < udp_p->nsocks; i++) {
+		threads[i].udp_p = udp_p;
+		threads[i].sd = i ? create_udp_socket(udp_p) : udp_p->sd;
+		threads[i].stream = (getpid() << 10) | i;
+		if (pthread_create(&threads[i].thread, NULL,
+				   send_thread_main, &threads[i]))
+			fatal_error("pthread_create()");
+	}
+
+	if (pthread_sigmask(SIG_SETMASK, &oldset, NULL))
+		fatal_error("pthread_sigmask()");
+
+	start = last = now_sec();
+	while (!catch_sighup && running_threads > 0) {
+		usleep(100000);
+		if (!udp_p->interval)
+			continue;
+
+		now = now_sec();
+		if (now - last < udp_p->interval)
+			continue;
+
+		for (sent = bytes = dropped = 0, i = 0; i < udp_p->nsocks; i++) {
+			sent += threads[i].sent;
+			bytes += threads[i].bytes;
+			dropped += threads[i].dropped;
+		}
+		printf("%.0fs: %.0f pps %.2f Mbps dropped %llu\n",
+		       now - start, (sent - last_sent) / (now - last),
+		       (bytes - last_bytes) * 8 / (now - last) / 1000000,
+		       dropped);
+		fflush(stdout);
+		last_sent = sent;
+		last_bytes = bytes;
+		last = now;
+	}
+
+	for (i = 0; i < udp_p->nsocks; i++)
+		pthread_join(threads[i].thread, NULL);
+	now = now_sec();
+
+	for (sent = bytes = dropped = 0, i = 0; i < udp_p->nsocks; i++) {
+		sent += threads[i].sent;
+		bytes += threads[i].bytes;
+		dropped += threads[i].dropped;
+		close(threads[i].sd);
+	}
+	printf("total: %llu datagrams %llu bytes dropped %llu "
+	       "in %.1fs (%.0f pps)\n",
+	       sent, bytes, dropped, now - start, sent / (now - start));
+
+	free(threads);
 }
 
 /*
@@ -388,6 +750,14 @@ void send_udp_datagram(struct udp_info *udp_p)
 	if (sigaction(SIGHUP, &handler, NULL) < 0)
 		fatal_error("sigaction()");
 
+	if (udp_p->batch || udp_p->segs || udp_p->nsocks || udp_p->rate
+	    || udp_p->interval) {
+		if (udp_p->nsocks == 0)
+			udp_p->nsocks = 1;
+		send_udp_batches(udp_p);
+		return;
+	}
+
 	/*
 	 * loop for sending packets
 	 */
@@ -31,13 +31,19 @@
  *
  * History:
  *	Oct 19 2005 - Created (Mitsuru Chinen)
+ *	Oct 2013 - Added recvmmsg()/UDP_GRO batch mode with SO_REUSEPORT
+ *		   threads and sequence number based loss statistics
  *---------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE
+
 #include "ns-traffic.h"
 
 /*
  * Standard Include Files
  */
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -51,8 +57,46 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
+/*
+ * Fixed values
+ */
+#define RECV_BUFSIZE	65536	/* one datagram, GRO coalesced or not */
+#define SEQ_STREAMS	1024	/* sender sockets tracked by every thread */
+
+/*
+ * Structure definitions
+ */
+struct batch_info {
+	int batch;		/* datagrams per recvmmsg() */
+	int threads;		/* number of receiving threads */
+	int reuseport;		/* every thread has its own socket */
+	int gro;		/* receive with UDP_GRO */
+	int sink;		/* don't return the data to the client */
+	int stat_interval;	/* statistics interval [sec], 0: none */
+	FILE *stat_fp;		/* FILE pointer where statistics go */
+};
+
+struct seq_stream {
+	int used;
+	u_int32_t stream;
+	u_int64_t next;		/* next expected sequence number */
+};
+
+struct recv_thread {
+	pthread_t thread;
+	struct batch_info *bi;
+	int sd;
+	unsigned long long received;	/* datagrams (GRO segments) */
+	unsigned long long bytes;
+	unsigned long long gaps;	/* skipped sequence numbers */
+	unsigned long long late;	/* arrived after a higher one */
+	unsigned long long unsequenced;	/* without a sequence header */
+	struct seq_stream streams[SEQ_STREAMS];
+};
+
 /*
  * Gloval variables
  */
@@ -89,6 +133,17 @@ void usage(char *program_name, int exit_value)
 		"\t-o\tfilename where the server infomation is outputted\n"
 		"\t-d\twork in the debug mode\n"
 		"\t-h\tdisplay this usage\n"
+		"\n"
+		"\t[options for batch mode]\n"
+		"\t  -B num\tdatagrams per recvmmsg()\n"
+		"\t  -t num\tnumber of receiving threads, each with its own\n"
+		"\t\t\tSO_REUSEPORT socket\n"
+		"\t  -g\treceive with UDP_GRO, split the coalesced segments\n"
+		"\t  -m mode\techo: return the data to the client (default)\n"
+		"\t\t\tsink: only count the data\n"
+		"\t  -i sec\tprint the receive rate and the losses counted from\n"
+		"\t\t\tthe ns-udpsender sequence numbers every sec seconds\n"
+		"\t  -l file\tfile where the statistics are outputted\n"
 		"" "*) Server works till it receives SIGHUP\n", program_name);
 	exit(exit_value);
 }
@@ -182,6 +237,410 @@ void respond_to_client(sock_fd)
 	free(msgbuf);
 }
 
+/*
+ * Function: create_server_socket()
+ *
+ * Description:
+ *  Create a socket bound to the local address. In the batch mode with more
+ *  than one thread, every thread gets its own socket bound with
+ *  SO_REUSEPORT.
+ *
+ * Argument:
+ *  res:	pointer to the local address
+ *  bi:		pointer to the batch mode information, NULL if not batch mode
+ *
+ * Return value:
+ *  socket descriptor
+ */
+int create_server_socket(struct addrinfo *res, struct batch_info *bi)
+{
+	int sock_fd;		/* socket descriptor */
+	int on;			/* on/off at an socket option */
+
+	sock_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (sock_fd < 0)
+		fatal_error("socket()");
+
+#ifdef IPV6_V6ONLY
+	/* Don't accept IPv4 mapped address if the protocol family is IPv6 */
+	if (res->ai_family == PF_INET6) {
+		on = 1;
+		if (setsockopt
+		    (sock_fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(int)))
+			fatal_error("setsockopt()");
+	}
+#endif
+
+	/* Enable to reuse the socket */
+	on = 1;
+	if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)))
+		fatal_error("setsockopt()");
+
+#ifdef SO_REUSEPORT
+	/* Let the kernel spread the clients over the threads */
+	if (bi != NULL && bi->reuseport) {
+		on = 1;
+		if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &on,
+			       sizeof(int))) {
+			if (debug)
+				perror("setsockopt(SO_REUSEPORT)");
+			bi->reuseport = 0;
+		}
+	}
+#endif
+
+	if (bi != NULL && bi->gro) {
+		on = 1;
+		if (setsockopt(sock_fd, SOL_UDP, UDP_GRO, &on, sizeof(int)))
+			fatal_error("setsockopt(UDP_GRO)");
+	}
+
+	/* Bind to the local address */
+	if (bind(sock_fd, res->ai_addr, res->ai_addrlen) < 0)
+		fatal_error("bind()");
+
+	return sock_fd;
+}
+
+/*
+ * Function: account_datagram()
+ *
+ * Description:
+ *  Count a received datagram. When it carries the sequence header of
+ *  ns-udpsender, compare its sequence number with the next one expected
+ *  from that sender socket; a jump counts the skipped numbers as gaps, a
+ *  smaller number is a late (reordered) datagram which fills a gap.
+ *
+ * Argument:
+ *  th:		pointer to the receiving thread
+ *  data:	pointer to the datagram
+ *  len:	length of the datagram
+ *
+ * Return value:
+ *  None
+ */
+void account_datagram(struct recv_thread *th, unsigned char *data,
+		      size_t len)
+{
+	struct udp_seq_hdr hdr;
+	struct seq_stream *st;
+	u_int32_t stream;
+	u_int64_t seq;
+	int idx, probe;
+
+	th->received++;
+	th->bytes += len;
+
+	if (len < sizeof(hdr)) {
+		th->unsequenced++;
+		return;
+	}
+	memcpy(&hdr, data, sizeof(hdr));
+	if (ntohl(hdr.magic) != UDP_SEQ_MAGIC) {
+		th->unsequenced++;
+		return;
+	}
+	stream = ntohl(hdr.stream);
+	seq = ((u_int64_t)ntohl(hdr.seq_hi) << 32) | ntohl(hdr.seq_lo);
+
+	/* Find the sender socket in the open addressing table */
+	idx = (stream * 2654435761U) % SEQ_STREAMS;
+	for (probe = 0; probe < SEQ_STREAMS; probe++) {
+		st = &th->streams[(idx + probe) % SEQ_STREAMS];
+		if (!st->used) {
+			st->used = 1;
+			st->stream = stream;
+			st->next = 0;
+			break;
+		}
+		if (st->stream == stream)
+			break;
+	}
+	if (probe == SEQ_STREAMS) {
+		th->unsequenced++;
+		return;
+	}
+
+	if (seq >= st->next) {
+		th->gaps += seq - st->next;
+		st->next = seq + 1;
+	} else {
+		th->late++;
+	}
+}
+
+/*
+ * Function: recv_thread_main()
+ *
+ * Description:
+ *  Body of a receiving thread. Receive batches of datagrams with
+ *  recvmmsg(), split the GRO coalesced ones by the segment size reported
+ *  in the UDP_GRO control message, count them, and unless in the sink mode
+ *  return the batch to the clients with sendmmsg() (coalesced datagrams
+ *  go back as UDP_SEGMENT datagrams of the same segment size).
+ *
+ * Argument:
+ *  arg:	pointer to the recv_thread structure
+ *
+ * Return value:
+ *  NULL
+ */
+void *recv_thread_main(void *arg)
+{
+	struct recv_thread *th = arg;
+	struct batch_info *bi = th->bi;
+	int batch = bi->batch;
+	size_t ctrl_size = CMSG_SPACE(sizeof(int));
+	unsigned char *buf;	/* payloads */
+	char *ctrl;		/* control messages */
+	struct sockaddr_storage *addrs;	/* addresses of the clients */
+	struct mmsghdr *msgs;
+	struct iovec *iov;
+	struct timeval timeout;
+	int i, ret, num, done;
+
+	buf = malloc((size_t)batch * RECV_BUFSIZE);
+	ctrl = calloc(batch, ctrl_size);
+	addrs = calloc(batch, sizeof(struct sockaddr_storage));
+	msgs = calloc(batch, sizeof(struct mmsghdr));
+	iov = calloc(batch, sizeof(struct iovec));
+	if (buf == NULL || ctrl == NULL || addrs == NULL || msgs == NULL
+	    || iov == NULL)
+		fatal_error("malloc()");
+
+	/* Wake up every 0.5 sec to check SIGHUP */
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 500000;
+	if (setsockopt(th->sd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+		       sizeof(timeout)))
+		fatal_error("setsockopt()");
+
+	while (!catch_sighup) {
+		for (i = 0; i < batch; i++) {
+			iov[i].iov_base = buf + (size_t)i * RECV_BUFSIZE;
+			iov[i].iov_len = RECV_BUFSIZE;
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control =
+			    bi->gro ? ctrl + i * ctrl_size : NULL;
+			msgs[i].msg_hdr.msg_controllen =
+			    bi->gro ? ctrl_size : 0;
+			msgs[i].msg_hdr.msg_flags = 0;
+		}
+
+		num = recvmmsg(th->sd, msgs, batch, MSG_WAITFORONE, NULL);
+		if (num < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK
+			    || errno == EINTR)
+				continue;
+			fatal_error("recvmmsg()");
+		}
+
+		for (i = 0; i < num; i++) {
+			struct msghdr *mh = &msgs[i].msg_hdr;
+			struct cmsghdr *cmsg;
+			size_t len = msgs[i].msg_len;
+			size_t seg = len;
+			size_t off = 0;
+
+			for (cmsg = CMSG_FIRSTHDR(mh); cmsg != NULL;
+			     cmsg = CMSG_NXTHDR(mh, cmsg)) {
+				if (cmsg->cmsg_level == SOL_UDP
+				    && cmsg->cmsg_type == UDP_GRO) {
+					int gso_size;
+
+					memcpy(&gso_size, CMSG_DATA(cmsg),
+					       sizeof(int));
+					if (gso_size > 0 && gso_size < len)
+						seg = gso_size;
+				}
+			}
+
+			do {
+				account_datagram(th,
+						 (unsigned char *)iov[i].iov_base + off,
+						 len - off < seg ?
+						 len - off : seg);
+				off += seg;
+			} while (off < len);
+
+			if (bi->sink)
+				continue;
+
+			/* Prepare the echo */
+			iov[i].iov_len = len;
+			if (seg < len) {
+				u_int16_t gso_size = seg;
+
+				mh->msg_controllen =
+				    CMSG_SPACE(sizeof(u_int16_t));
+				cmsg = CMSG_FIRSTHDR(mh);
+				cmsg->cmsg_level = SOL_UDP;
+				cmsg->cmsg_type = UDP_SEGMENT;
+				cmsg->cmsg_len = CMSG_LEN(sizeof(u_int16_t));
+				memcpy(CMSG_DATA(cmsg), &gso_size,
+				       sizeof(u_int16_t));
+			} else {
+				mh->msg_control = NULL;
+				mh->msg_controllen = 0;
+			}
+		}
+
+		if (bi->sink)
+			continue;
+
+		/* Return the batch to the clients */
+		for (done = 0; done < num; done += ret) {
+			ret = sendmmsg(th->sd, msgs + done, num - done, 0);
+			if (ret < 0) {
+				/* The client may be gone, drop the rest */
+				if (errno == ENOBUFS || errno == EAGAIN
+				    || errno == ECONNREFUSED
+				    || errno == EINTR)
+					break;
+				fatal_error("sendmmsg()");
+			}
+		}
+	}
+
+	free(iov);
+	free(msgs);
+	free(addrs);
+	free(ctrl);
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Function: report_stats()
+ *
+ * Description:
+ *  Print the receive rate and the losses of all the threads.
+ *
+ * Argument:
+ *  threads:	array of the receiving threads
+ *  bi:		pointer to the batch mode information
+ *  elapsed:	time since the start [sec]
+ *  interval:	time since the last report [sec], 0 for the final report
+ *  last:	counters at the last report, updated
+ *
+ * Return value:
+ *  None
+ */
+void report_stats(struct recv_thread *threads, struct batch_info *bi,
+		  double elapsed, double interval, struct recv_thread *last)
+{
+	struct recv_thread sum;
+	long long lost;
+	int i;
+
+	memset(&sum, '\0', sizeof(sum));
+	for (i = 0; i < bi->threads; i++) {
+		sum.received += threads[i].received;
+		sum.bytes += threads[i].bytes;
+		sum.gaps += threads[i].gaps;
+		sum.late += threads[i].late;
+		sum.unsequenced += threads[i].unsequenced;
+	}
+
+	if (interval > 0.0) {
+		lost = (long long)(sum.gaps - last->gaps)
+		    - (long long)(sum.late - last->late);
+		fprintf(bi->stat_fp, "%.0fs: %.0f pps %.2f Mbps "
+			"lost %lld reordered %llu\n", elapsed,
+			(sum.received - last->received) / interval,
+			(sum.bytes - last->bytes) * 8 / interval / 1000000,
+			lost, sum.late - last->late);
+	} else {
+		lost = (long long)sum.gaps - (long long)sum.late;
+		fprintf(bi->stat_fp, "total: %llu datagrams %llu bytes "
+			"lost %lld (%.3f%%) reordered %llu unsequenced %llu "
+			"in %.1fs\n", sum.received, sum.bytes, lost,
+			lost > 0 ? 100.0 * lost / (sum.received + lost) : 0.0,
+			sum.late, sum.unsequenced, elapsed);
+	}
+	fflush(bi->stat_fp);
+
+	last->received = sum.received;
+	last->bytes = sum.bytes;
+	last->gaps = sum.gaps;
+	last->late = sum.late;
+}
+
+/*
+ * Function: serve_batches()
+ *
+ * Description:
+ *  Run the receiving threads till SIGHUP is caught and report the
+ *  statistics every interval and at the end.
+ *
+ * Argument:
+ *  socks:	socket of every thread
+ *  bi:		pointer to the batch mode information
+ *
+ * Return value:
+ *  None
+ */
+void serve_batches(int *socks, struct batch_info *bi)
+{
+	struct recv_thread *threads;
+	struct recv_thread last;
+	sigset_t sigset, oldset;
+	double start, last_report, now;
+	struct timespec ts;
+	int i;
+
+	threads = calloc(bi->threads, sizeof(struct recv_thread));
+	if (threads == NULL)
+		fatal_error("calloc()");
+	memset(&last, '\0', sizeof(last));
+
+	/* Only the main thread handles SIGHUP */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGHUP);
+	if (pthread_sigmask(SIG_BLOCK, &sigset, &oldset))
+		fatal_error("pthread_sigmask()");
+
+	for (i = 0; i < bi->threads; i++) {
+		threads[i].bi = bi;
+		threads[i].sd = socks[i];
+		if (pthread_create(&threads[i].thread, NULL,
+				   recv_thread_main, &threads[i]))
+			fatal_error("pthread_create()");
+	}
+	if (debug)
+		fprintf(stderr, "%d receiving threads, %s\n", bi->threads,
+			bi->reuseport ? "SO_REUSEPORT" : "one socket");
+
+	if (pthread_sigmask(SIG_SETMASK, &oldset, NULL))
+		fatal_error("pthread_sigmask()");
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	start = last_report = ts.tv_sec + ts.tv_nsec / 1e9;
+	while (!catch_sighup) {
+		usleep(100000);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = ts.tv_sec + ts.tv_nsec / 1e9;
+		if (bi->stat_interval
+		    && now - last_report >= bi->stat_interval) {
+			report_stats(threads, bi, now - start,
+				     now - last_report, &last);
+			last_report = now;
+		}
+	}
+
+	for (i = 0; i < bi->threads; i++)
+		pthread_join(threads[i].thread, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec + ts.tv_nsec / 1e9;
+	report_stats(threads, bi, now - start, 0.0, &last);
+
+	free(threads);
+}
+
 /*
  *
  *  Function: main()
@@ -194,20 +653,24 @@ int main(int argc, char *argv[])
 	sa_family_t family;	/* protocol family */
 	char *portnum = NULL;	/* port number */
 	int sock_fd;		/* socket binded open ports */
+	int *socks = NULL;	/* sockets of the batch mode threads */
+	struct batch_info batch;	/* batch mode information */
+	int is_batch = 0;	/* work in the batch mode if non-zero */
+	int i;
 	int background = 0;	/* work in the background if non-zero */
 	fd_set read_fds;	/* list of file descriptor for reading */
 	int max_read_fd = 0;	/* maximum number in the read fds */
 	FILE *info_fp = stdout;	/* FILE pointer to a information file */
-	int on;			/* on/off at an socket option */
 	int err;		/* return value of getaddrinfo */
 	struct addrinfo hints;	/* hints for getaddrinfo() */
 	struct addrinfo *res;	/* pointer to addrinfo */
 
 	debug = 0;
 	family = PF_UNSPEC;
+	memset(&batch, '\0', sizeof(batch));
 
 	/* Retrieve the options */
-	while ((optc = getopt(argc, argv, "f:p:bo:dh")) != EOF) {
+	while ((optc = getopt(argc, argv, "f:p:bo:dhB:t:gm:i:l:")) != EOF) {
 		switch (optc) {
 		case 'f':
 			if (strncmp(optarg, "4", 1) == 0)
@@ -254,6 +717,62 @@ int main(int argc, char *argv[])
 			usage(program_name, EXIT_SUCCESS);
 			break;
 
+			/* Options for the batch mode */
+		case 'B':
+			batch.batch = strtoul(optarg, NULL, 0);
+			if (batch.batch < 1 || batch.batch > UIO_MAXIOV) {
+				fprintf(stderr,
+					"The batch size should be from 1 to %d\n",
+					UIO_MAXIOV);
+				usage(program_name, EXIT_FAILURE);
+			}
+			is_batch = 1;
+			break;
+
+		case 't':
+			batch.threads = strtoul(optarg, NULL, 0);
+			if (batch.threads < 1 || batch.threads > 1024) {
+				fprintf(stderr,
+					"The number of threads should be from 1 to 1024\n");
+				usage(program_name, EXIT_FAILURE);
+			}
+			is_batch = 1;
+			break;
+
+		case 'g':
+			batch.gro = 1;
+			is_batch = 1;
+			break;
+
+		case 'm':
+			if (strcmp(optarg, "echo") == 0)
+				batch.sink = 0;
+			else if (strcmp(optarg, "sink") == 0)
+				batch.sink = 1;
+			else {
+				fprintf(stderr, "mode should be echo or sink\n");
+				usage(program_name, EXIT_FAILURE);
+			}
+			is_batch = 1;
+			break;
+
+		case 'i':
+			batch.stat_interval = strtoul(optarg, NULL, 0);
+			if (batch.stat_interval < 1) {
+				fprintf(stderr,
+					"Interval should be positive value\n");
+				usage(program_name, EXIT_FAILURE);
+			}
+			is_batch = 1;
+			break;
+
+		case 'l':
+			if ((batch.stat_fp = fopen(optarg, "w")) == NULL) {
+				fprintf(stderr, "Cannot open %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+
 		default:
 			usage(program_name, EXIT_FAILURE);
 		}
@@ -292,29 +811,29 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	/* Create a socket for listening. */
-	sock_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-	if (sock_fd < 0)
-		fatal_error("socket()");
-
-#ifdef IPV6_V6ONLY
-	/* Don't accept IPv4 mapped address if the protocol family is IPv6 */
-	if (res->ai_family == PF_INET6) {
-		on = 1;
-		if (setsockopt
-		    (sock_fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(int)))
-			fatal_error("setsockopt()");
+	if (is_batch) {
+		if (batch.batch == 0)
+			batch.batch = 1;
+		if (batch.threads == 0)
+			batch.threads = 1;
+		if (batch.stat_fp == NULL)
+			batch.stat_fp = stdout;
+		batch.reuseport = (batch.threads > 1);
+
+		/* Every thread gets its own socket unless SO_REUSEPORT is
+		   missing, then they all share the first one */
+		socks = calloc(batch.threads, sizeof(int));
+		if (socks == NULL)
+			fatal_error("calloc()");
+		socks[0] = create_server_socket(res, &batch);
+		for (i = 1; i < batch.threads; i++)
+			socks[i] = batch.reuseport ?
+			    create_server_socket(res, &batch) : socks[0];
+		sock_fd = socks[0];
+	} else {
+		/* Create a socket for listening. */
+		sock_fd = create_server_socket(res, NULL);
 	}
-#endif
-
-	/* Enable to reuse the socket */
-	on = 1;
-	if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int)))
-		fatal_error("setsockopt()");
-
-	/* Bind to the local address */
-	if (bind(sock_fd, res->ai_addr, res->ai_addrlen) < 0)
-		fatal_error("bind()");
 
 	freeaddrinfo(res);
 
@@ -335,6 +854,18 @@ int main(int argc, char *argv[])
 	if (sigaction(SIGHUP, &handler, NULL) < 0)
 		fatal_error("sigaction()");
 
+	if (is_batch) {
+		serve_batches(socks, &batch);
+		for (i = 1; i < batch.threads && batch.reuseport; i++)
+			close(socks[i]);
+		free(socks);
+		if (batch.stat_fp != stdout)
+			fclose(batch.stat_fp);
+		if (close(sock_fd))
+			fatal_error("close()");
+		exit(EXIT_SUCCESS);
+	}
+
 	/* Loop to wait a client access */
 	FD_ZERO(&read_fds);
 	FD_SET(sock_fd, &read_fds);
@@ -99,6 +99,14 @@ fi
 
 SCRIPT_DIR=$(dirname "$0")
 TEST_PATH=$1; shift
+
+# Hand over to the native runner (tools/run_tests.c) when it's been built
+# and asked for through RUN_TESTS_FLAGS, unless test_defs needs to be sourced.
+if [ -x "$SCRIPT_DIR/run-tests" -a ! -f test_defs -a -n "$RUN_TESTS_FLAGS" ]
+then
+	exec "$SCRIPT_DIR/run-tests" $RUN_TESTS_FLAGS "$TEST_PATH" "$@"
+fi
+
 T0=$SCRIPT_DIR/t0
 T0_VAL=$SCRIPT_DIR/t0.val
 
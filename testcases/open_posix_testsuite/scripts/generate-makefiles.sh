@@ -129,7 +129,7 @@ EOF
 	if [ ! -f "$makefile.3" ]; then
 
 		cat > "$makefile.3" <<EOF
-all: \$(MAKE_TARGETS)
+all: \$(MAKE_TARGETS) run.sh
 	@if [ -d speculative ]; then \$(MAKE) -C speculative all; fi
 
 clean:
@@ -0,0 +1,806 @@
+/*
+ * Copyright (c) 2013 Linux Test Project
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+ * Native replacement for bin/run-tests.sh + bin/t0.
+ *
+ * The syntax is:
+ * $ run-tests [options] test_path test...
+ *   runs the given test executables from the current directory, exactly
+ *   as run-tests.sh would (this is what the generated run.sh files call).
+ * $ run-tests [options] -d dir...
+ *   walks the given directories for run.sh files and runs every test they
+ *   list as one pool, so the whole suite is spread over all of the jobs.
+ *
+ * Options:
+ *   -j n     run up to n tests at once (default: 1)
+ *   -t n     per test timeout in seconds (default: $TIMEOUT_VAL or 240)
+ *   -l file  logfile (default: $LOGFILE or "logfile")
+ *   -J file  journal; every finished test is appended to it and tests
+ *            already recorded there are not run again, so an interrupted
+ *            run can be resumed by starting it again with the same journal
+ *   -T file  timings; per test durations from earlier runs are used to
+ *            start the longest tests first, and are updated on exit
+ *
+ * Each test runs in its own process group with stdin on /dev/null and its
+ * stdout/stderr captured in memory.  On timeout the whole group is killed
+ * and the test is reported as HUNG; stray children left behind by a test
+ * are killed when the test itself exits.  Exit codes are mapped to the
+ * same PASS/FAILED/UNRESOLVED/UNSUPPORTED/UNTESTED/HUNG/SIGNALED results
+ * and written to the logfile in the same format as run-tests.sh.
+ *
+ * The journal and timings files hold one "name<TAB>result<TAB>exit
+ * code<TAB>msec" resp. "name<TAB>msec" line per test.
+ */
+
+/* This utility should compile on any POSIX-conformant implementation. */
+#define _POSIX_C_SOURCE 200112L
+#define _XOPEN_SOURCE 600
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Same code t0 exits with on timeout; see t0.val */
+#define TIMEOUT_RET	(SIGALRM + 128)
+/* Cap for the captured output of a single test */
+#define MAX_OUTPUT	(1024 * 1024)
+
+struct test {
+	char *dir;		/* directory the test is run from */
+	char *file;		/* executable, relative to dir */
+	char *name;		/* test_path/file without the extension */
+	long prev_ms;		/* duration from the timings file, or -1 */
+	long ms;		/* duration of this run, or -1 */
+	int idx;
+};
+
+struct job {
+	struct test *test;
+	pid_t pid;
+	int fd;
+	int hung;
+	int status;
+	char *out;
+	size_t len;
+	size_t cap;
+	int truncated;
+	struct timespec start;
+};
+
+struct done {
+	char *name;
+	int ret;
+	long ms;
+};
+
+static struct test *tests;
+static int ntests, tests_cap;
+
+static struct done *done;
+static int ndone, done_cap;
+
+static struct job *jobs;
+static int njobs, running;
+
+static int timeout_val = 240;
+static char *logfile = "logfile";
+static char *journal;
+static char *timings;
+
+static FILE *log_fp;
+static FILE *journal_fp;
+
+static int num_pass, num_fail, num_tests, num_resumed;
+
+static int chld_pipe[2] = { -1, -1 };
+static volatile sig_atomic_t interrupted;
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	void *p = realloc(ptr, size);
+
+	if (p == NULL) {
+		perror("realloc failed");
+		exit(1);
+	}
+	return p;
+}
+
+static char *xstrndup(const char *s, size_t len)
+{
+	char *p = xrealloc(NULL, len + 1);
+
+	memcpy(p, s, len);
+	p[len] = '\0';
+	return p;
+}
+
+static char *xstrdup(const char *s)
+{
+	return xstrndup(s, strlen(s));
+}
+
+static long elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+	    (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void add_test(const char *dir, const char *test_path, const char *file)
+{
+	struct test *t;
+	const char *dot = strrchr(file, '.');
+	size_t stem = dot ? (size_t)(dot - file) : strlen(file);
+
+	if (ntests == tests_cap) {
+		tests_cap = tests_cap ? tests_cap * 2 : 256;
+		tests = xrealloc(tests, tests_cap * sizeof(*tests));
+	}
+	t = &tests[ntests];
+	t->dir = xstrdup(dir);
+	t->file = xstrdup(file);
+	/* "$TEST_PATH/${1%.*}" */
+	t->name = xrealloc(NULL, strlen(test_path) + stem + 2);
+	sprintf(t->name, "%s/%.*s", test_path, (int)stem, file);
+	t->prev_ms = -1;
+	t->ms = -1;
+	t->idx = ntests++;
+}
+
+/*
+ * Picks up the test list out of a run.sh generated by generate-makefiles.sh,
+ * i.e. "$(top_srcdir)/bin/run-tests.sh $(subdir) $(INSTALL_TARGETS)".
+ */
+static int scan_run_sh(const char *path, const struct stat *sb, int flag,
+		       struct FTW *ftw)
+{
+	char line[65536], dir[4096], *tok, *test_path = NULL;
+	FILE *fp;
+
+	(void)sb;
+
+	if (flag != FTW_F || strcmp(path + ftw->base, "run.sh") != 0)
+		return 0;
+
+	if ((size_t)ftw->base >= sizeof(dir))
+		return 0;
+	memcpy(dir, path, ftw->base);
+	dir[ftw->base] = '\0';
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		return 0;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		tok = strtok(line, " \t\n");
+		if (tok == NULL || strstr(tok, "run-tests") == NULL)
+			continue;
+		while ((tok = strtok(NULL, " \t\n")) != NULL) {
+			if (test_path == NULL)
+				test_path = xstrdup(tok);
+			else
+				add_test(dir, test_path, tok);
+		}
+		break;
+	}
+	fclose(fp);
+	free(test_path);
+
+	return 0;
+}
+
+static int cmp_done(const void *a, const void *b)
+{
+	return strcmp(((const struct done *)a)->name,
+		      ((const struct done *)b)->name);
+}
+
+static struct done *find_done(const char *name)
+{
+	struct done key;
+
+	if (ndone == 0)
+		return NULL;
+	key.name = (char *)name;
+	return bsearch(&key, done, ndone, sizeof(*done), cmp_done);
+}
+
+/* Reads "name\tfield\t..." lines and hands them to the callback. */
+static void read_table(const char *path,
+		       void (*cb)(char *name, char **fields, int nfields))
+{
+	char line[8192], *fields[4], *p;
+	int n;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		if (errno != ENOENT)
+			perror(path);
+		return;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		/* A partially written last line is simply ignored */
+		if ((p = strchr(line, '\n')) == NULL)
+			continue;
+		*p = '\0';
+		n = 0;
+		p = line;
+		while (n < 4 && (p = strchr(p, '\t')) != NULL) {
+			*p++ = '\0';
+			fields[n++] = p;
+		}
+		if (n > 0)
+			cb(line, fields, n);
+	}
+	fclose(fp);
+}
+
+static void journal_entry(char *name, char **fields, int nfields)
+{
+	if (nfields < 2)
+		return;
+	if (ndone == done_cap) {
+		done_cap = done_cap ? done_cap * 2 : 256;
+		done = xrealloc(done, done_cap * sizeof(*done));
+	}
+	done[ndone].name = xstrdup(name);
+	done[ndone].ret = atoi(fields[1]);
+	done[ndone].ms = nfields > 2 ? atol(fields[2]) : -1;
+	ndone++;
+}
+
+static struct test **by_name;
+
+static int cmp_by_name(const void *a, const void *b)
+{
+	return strcmp((*(struct test * const *)a)->name,
+		      (*(struct test * const *)b)->name);
+}
+
+static struct test *find_test(const char *name)
+{
+	struct test key, *kp = &key, **t;
+
+	key.name = (char *)name;
+	t = bsearch(&kp, by_name, ntests, sizeof(*by_name), cmp_by_name);
+	return t ? *t : NULL;
+}
+
+static void timings_entry(char *name, char **fields, int nfields)
+{
+	struct test *t = find_test(name);
+
+	if (t != NULL && nfields >= 1)
+		t->prev_ms = atol(fields[0]);
+}
+
+/* Longest first; tests that were never timed go first of all. */
+static int cmp_schedule(const void *a, const void *b)
+{
+	const struct test *ta = a, *tb = b;
+	long ma = ta->prev_ms < 0 ? 0x7fffffffL : ta->prev_ms;
+	long mb = tb->prev_ms < 0 ? 0x7fffffffL : tb->prev_ms;
+
+	if (ma != mb)
+		return ma < mb ? 1 : -1;
+	return ta->idx - tb->idx;
+}
+
+static void write_timings(void)
+{
+	char *tmp;
+	FILE *fp;
+	int i;
+
+	tmp = xrealloc(NULL, strlen(timings) + 5);
+	sprintf(tmp, "%s.tmp", timings);
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		perror(tmp);
+		free(tmp);
+		return;
+	}
+	for (i = 0; i < ntests; i++) {
+		long ms = tests[i].ms >= 0 ? tests[i].ms : tests[i].prev_ms;
+
+		if (ms >= 0)
+			fprintf(fp, "%s\t%ld\n", tests[i].name, ms);
+	}
+	if (fclose(fp) != 0 || rename(tmp, timings) != 0)
+		perror(timings);
+	free(tmp);
+}
+
+/* The .args file is "$(echo "$1" | sed 's,\.[^\.]*,,').args" */
+static char **read_args(const char *file)
+{
+	char path[4096], buf[4096], *tok, **argv;
+	const char *dot = strchr(file, '.');
+	size_t len = dot ? (size_t)(dot - file) : strlen(file);
+	int argc = 1, fd;
+	ssize_t rd;
+
+	argv = xrealloc(NULL, 2 * sizeof(*argv));
+	argv[0] = xrealloc(NULL, strlen(file) + 3);
+	sprintf(argv[0], "./%s", file);
+	argv[1] = NULL;
+
+	snprintf(path, sizeof(path), "%.*s%s.args", (int)len, file,
+		 dot ? dot + 1 + strcspn(dot + 1, ".") : "");
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return argv;
+	rd = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (rd <= 0)
+		return argv;
+	buf[rd] = '\0';
+
+	for (tok = strtok(buf, " \t\n"); tok; tok = strtok(NULL, " \t\n")) {
+		argv = xrealloc(argv, (argc + 2) * sizeof(*argv));
+		argv[argc++] = xstrdup(tok);
+		argv[argc] = NULL;
+	}
+	return argv;
+}
+
+static void sigchld_handler(int sig)
+{
+	int saved = errno;
+
+	(void)sig;
+	/* If the pipe is full a wakeup is pending already */
+	while (write(chld_pipe[1], "", 1) == -1 && errno == EINTR)
+		;
+	errno = saved;
+}
+
+static void sigint_handler(int sig)
+{
+	interrupted = sig;
+	sigchld_handler(sig);
+}
+
+static void start_test(struct job *job, struct test *t)
+{
+	int fds[2], null_fd;
+	char **argv;
+
+	if (pipe(fds) == -1) {
+		perror("pipe failed");
+		exit(1);
+	}
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+	memset(job, 0, sizeof(*job));
+	job->test = t;
+	job->fd = fds[0];
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+
+	switch (job->pid = fork()) {
+	case -1:
+		perror("fork failed");
+		exit(1);
+	case 0:
+		setpgid(0, 0);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGCHLD, SIG_DFL);
+		if (chdir(t->dir) == -1) {
+			perror(t->dir);
+			_exit(1);
+		}
+		null_fd = open("/dev/null", O_RDONLY);
+		if (null_fd != -1 && null_fd != STDIN_FILENO) {
+			dup2(null_fd, STDIN_FILENO);
+			close(null_fd);
+		}
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		close(fds[1]);
+		argv = read_args(t->file);
+		execv(argv[0], argv);
+		perror("execv failed");
+		_exit(1);
+	}
+	/* Either side may get here first */
+	setpgid(job->pid, job->pid);
+	close(fds[1]);
+	running++;
+}
+
+static void drain_output(struct job *job)
+{
+	char buf[4096];
+	ssize_t rd;
+
+	while (job->fd != -1) {
+		rd = read(job->fd, buf, sizeof(buf));
+		if (rd == -1 && errno == EINTR)
+			continue;
+		if (rd <= 0) {
+			if (rd == 0 || errno != EAGAIN) {
+				close(job->fd);
+				job->fd = -1;
+			}
+			return;
+		}
+		if (job->len + rd > MAX_OUTPUT) {
+			job->truncated = 1;
+			rd = MAX_OUTPUT - job->len;
+		}
+		if (job->len + rd > job->cap) {
+			job->cap = job->cap ? job->cap * 2 : 4096;
+			while (job->cap < job->len + rd)
+				job->cap *= 2;
+			job->out = xrealloc(job->out, job->cap);
+		}
+		memcpy(job->out + job->len, buf, rd);
+		job->len += rd;
+	}
+}
+
+static const char *result(const char *file, int ret)
+{
+	struct stat st;
+
+	if (stat(file, &st) == -1)
+		return NULL;
+
+	switch (ret) {
+	case 0:
+		return "PASS";
+	case 1:
+		return "FAILED";
+	case 2:
+		return "UNRESOLVED";
+	case 4:
+		return "UNSUPPORTED";
+	case 5:
+		return "UNTESTED";
+	case TIMEOUT_RET:
+		return "HUNG";
+	default:
+		return ret > 128 ? "SIGNALED" : "EXITED ABNORMALLY";
+	}
+}
+
+static void finish_test(struct job *job)
+{
+	struct test *t = job->test;
+	const char *msg;
+	char *file;
+	int ret;
+
+	/* Don't leave anything the test started behind */
+	kill(-job->pid, SIGKILL);
+	drain_output(job);
+	if (job->fd != -1)
+		close(job->fd);
+
+	if (job->hung)
+		ret = TIMEOUT_RET;
+	else if (WIFEXITED(job->status))
+		ret = WEXITSTATUS(job->status);
+	else if (WIFSIGNALED(job->status))
+		ret = WTERMSIG(job->status) + 128;
+	else
+		ret = 1;
+
+	t->ms = elapsed_ms(&job->start);
+
+	file = xrealloc(NULL, strlen(t->dir) + strlen(t->file) + 2);
+	sprintf(file, "%s/%s", t->dir, t->file);
+	msg = result(file, ret);
+	free(file);
+
+	if (ret == 0) {
+		fprintf(log_fp, "%s: execution: PASS\n", t->name);
+		num_pass++;
+	} else {
+		if (msg != NULL) {
+			fprintf(log_fp, "%s: execution: %s: Output: \n",
+				t->name, msg);
+			fwrite(job->out, 1, job->len, log_fp);
+			if (job->truncated)
+				fprintf(log_fp, "[output truncated]\n");
+			printf("%s: execution: %s \n", t->name, msg);
+		} else {
+			printf("%s: execution: SKIPPED (test not present)\n",
+			       t->name);
+		}
+		num_fail++;
+	}
+	num_tests++;
+	fflush(log_fp);
+	fflush(stdout);
+
+	if (journal_fp != NULL) {
+		fprintf(journal_fp, "%s\t%s\t%d\t%ld\n", t->name,
+			msg ? msg : "SKIPPED", ret, t->ms);
+		fflush(journal_fp);
+	}
+
+	free(job->out);
+	job->test = NULL;
+	running--;
+}
+
+static void reap(void)
+{
+	char buf[64];
+	pid_t pid;
+	int i, status;
+
+	while (read(chld_pipe[0], buf, sizeof(buf)) > 0)
+		;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (i = 0; i < njobs; i++) {
+			if (jobs[i].test != NULL && jobs[i].pid == pid) {
+				jobs[i].status = status;
+				finish_test(&jobs[i]);
+				break;
+			}
+		}
+	}
+}
+
+/* Kills what is still running; those tests are not journaled. */
+static void abort_jobs(void)
+{
+	int i;
+
+	for (i = 0; i < njobs; i++) {
+		if (jobs[i].test == NULL)
+			continue;
+		kill(-jobs[i].pid, SIGKILL);
+		waitpid(jobs[i].pid, NULL, 0);
+		if (jobs[i].fd != -1)
+			close(jobs[i].fd);
+		free(jobs[i].out);
+		jobs[i].test = NULL;
+		running--;
+	}
+}
+
+static void run_tests(void)
+{
+	struct pollfd *pfd;
+	struct job **pjob;
+	int next = 0, i, n, wait_ms;
+	long left;
+
+	pfd = xrealloc(NULL, (njobs + 1) * sizeof(*pfd));
+	pjob = xrealloc(NULL, (njobs + 1) * sizeof(*pjob));
+
+	while (!interrupted && (next < ntests || running > 0)) {
+
+		for (i = 0; i < njobs && next < ntests; i++) {
+			if (jobs[i].test != NULL)
+				continue;
+			while (next < ntests && find_done(tests[next].name))
+				next++;
+			if (next < ntests)
+				start_test(&jobs[i], &tests[next++]);
+		}
+		if (running == 0)
+			continue;
+
+		pfd[0].fd = chld_pipe[0];
+		pfd[0].events = POLLIN;
+		n = 1;
+		wait_ms = 1000;
+		for (i = 0; i < njobs; i++) {
+			if (jobs[i].test == NULL)
+				continue;
+			left = timeout_val * 1000L - elapsed_ms(&jobs[i].start);
+			if (!jobs[i].hung && left <= 0) {
+				kill(-jobs[i].pid, SIGKILL);
+				jobs[i].hung = 1;
+			} else if (!jobs[i].hung && left < wait_ms) {
+				wait_ms = left;
+			}
+			if (jobs[i].fd != -1) {
+				pfd[n].fd = jobs[i].fd;
+				pfd[n].events = POLLIN;
+				pjob[n++] = &jobs[i];
+			}
+		}
+
+		if (poll(pfd, n, wait_ms) == -1 && errno != EINTR) {
+			perror("poll failed");
+			exit(1);
+		}
+		for (i = 1; i < n; i++) {
+			if (pfd[i].revents)
+				drain_output(pjob[i]);
+		}
+		reap();
+	}
+
+	if (interrupted)
+		abort_jobs();
+
+	free(pfd);
+	free(pjob);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-j jobs] [-t timeout] [-l logfile] [-J journal]\n"
+		"       %*s [-T timings] test_path test...\n"
+		"       %s [options] -d dir...\n",
+		name, (int)strlen(name), "", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sigaction sa;
+	struct done *d;
+	int c, i, dirs = 0;
+	char *env;
+
+	if ((env = getenv("LOGFILE")) != NULL && *env)
+		logfile = env;
+	if ((env = getenv("TIMEOUT_VAL")) != NULL && *env)
+		timeout_val = atoi(env);
+	njobs = 1;
+
+	while ((c = getopt(argc, argv, "dj:J:l:t:T:")) != -1) {
+		switch (c) {
+		case 'd':
+			dirs = 1;
+			break;
+		case 'j':
+			njobs = atoi(optarg);
+			break;
+		case 'J':
+			journal = optarg;
+			break;
+		case 'l':
+			logfile = optarg;
+			break;
+		case 't':
+			timeout_val = atoi(optarg);
+			break;
+		case 'T':
+			timings = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind >= argc || njobs < 1 || timeout_val < 1)
+		usage(argv[0]);
+
+	if (dirs) {
+		for (i = optind; i < argc; i++) {
+			if (nftw(argv[i], scan_run_sh, 16, FTW_PHYS) == -1)
+				perror(argv[i]);
+		}
+	} else {
+		for (i = optind + 1; i < argc; i++)
+			add_test(".", argv[optind], argv[i]);
+	}
+
+	log_fp = fopen(logfile, "a");
+	if (log_fp == NULL) {
+		fprintf(stderr, "ERROR: %s not writable\n", logfile);
+		exit(1);
+	}
+	fcntl(fileno(log_fp), F_SETFD, FD_CLOEXEC);
+
+	if (journal != NULL) {
+		read_table(journal, journal_entry);
+		qsort(done, ndone, sizeof(*done), cmp_done);
+		journal_fp = fopen(journal, "a");
+		if (journal_fp == NULL) {
+			perror(journal);
+			exit(1);
+		}
+		fcntl(fileno(journal_fp), F_SETFD, FD_CLOEXEC);
+	}
+
+	if (timings != NULL) {
+		by_name = xrealloc(NULL, (ntests + 1) * sizeof(*by_name));
+		for (i = 0; i < ntests; i++)
+			by_name[i] = &tests[i];
+		qsort(by_name, ntests, sizeof(*by_name), cmp_by_name);
+		read_table(timings, timings_entry);
+		free(by_name);
+		qsort(tests, ntests, sizeof(*tests), cmp_schedule);
+	}
+
+	jobs = xrealloc(NULL, njobs * sizeof(*jobs));
+	memset(jobs, 0, njobs * sizeof(*jobs));
+
+	if (pipe(chld_pipe) == -1) {
+		perror("pipe failed");
+		exit(1);
+	}
+	for (i = 0; i < 2; i++) {
+		fcntl(chld_pipe[i], F_SETFD, FD_CLOEXEC);
+		fcntl(chld_pipe[i], F_SETFL, O_NONBLOCK);
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sa.sa_handler = sigchld_handler;
+	sigaction(SIGCHLD, &sa, NULL);
+	sa.sa_flags = 0;
+	sa.sa_handler = sigint_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	run_tests();
+
+	/* Fold in what earlier, interrupted runs already did */
+	for (i = 0; i < ntests; i++) {
+		d = find_done(tests[i].name);
+		if (d == NULL)
+			continue;
+		if (tests[i].ms < 0)
+			tests[i].ms = d->ms;
+		if (d->ret == 0)
+			num_pass++;
+		else
+			num_fail++;
+		num_tests++;
+		num_resumed++;
+	}
+
+	if (timings != NULL)
+		write_timings();
+
+	printf("*******************\n"
+	       "SUMMARY\n"
+	       "*******************\n"
+	       "PASS\t\t%3d\n"
+	       "FAIL\t\t%3d\n"
+	       "*******************\n"
+	       "TOTAL\t\t%3d\n"
+	       "*******************\n", num_pass, num_fail, num_tests);
+	if (num_resumed)
+		printf("(%d of them taken from %s)\n", num_resumed, journal);
+	if (interrupted) {
+		printf("Interrupted, %d tests left; rerun with the same "
+		       "journal to resume\n",
+		       ntests - num_tests);
+		return 128 + interrupted;
+	}
+
+	return num_fail > 255 ? 255 : num_fail;
+}
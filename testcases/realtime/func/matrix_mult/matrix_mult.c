@@ -22,7 +22,10 @@
  * DESCRIPTION
  *      Compare running sequential matrix multiplication routines
  *      to running them in parallel to judge mutliprocessor
- *      performance
+ *      performance.  The multiplication kernel (naive, cache blocked
+ *      or vectorised) and the matrix size can be chosen, and -S sweeps
+ *      the number of concurrent CPUs from 1 to all of them, reporting
+ *      the speedup and the iteration time jitter of every step.
  *
  * USAGE:
  *      Use run_auto.sh script in current directory to build and run test.
@@ -33,11 +36,14 @@
  * HISTORY
  *      2007-Mar-09:  Initial version by Darren Hart <dvhltc@us.ibm.com>
  *      2008-Feb-26:  Closely emulate jvm Dinakar Guniguntala <dino@in.ibm.com>
+ *      2013:         Selectable kernels and sizes, CPU count sweep
  *
  *****************************************************************************/
 
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <librttest.h>
 #include <libstats.h>
@@ -45,26 +51,46 @@
 #define MAX_CPUS	8192
 #define PRIO		43
 #define MATRIX_SIZE	100
+#define MATRIX_MAX	10000	/* keeps every C[i][j] exact, see matrix_check() */
+#define BLOCK_SIZE	32	/* doubles, 3 blocks fit in a 32k L1 */
 #define DEF_OPS		8	/* the higher the number, the more CPU intensive */
 					/* (and therefore SMP performance goes up) */
 #define PASS_CRITERIA	0.75	/* Avg concurrent time * pass criteria < avg seq time - */
 					/* for every addition of a cpu */
 #define ITERATIONS	128
 #define HIST_BUCKETS	100
+#define PRINT_BUCKETS	10
+
+#define VLEN		4	/* doubles per vector */
+
+typedef double vdouble __attribute__ ((vector_size(VLEN * sizeof(double))));
 
-#define THREAD_WAIT	1
-#define THREAD_WORK	2
-#define THREAD_DONE	3
+#define KERNEL_NAIVE	0
+#define KERNEL_BLOCKED	1
+#define KERNEL_SIMD	2
 
-#define THREAD_SLEEP	1 * NS_PER_US
+static const char *kernel_names[] = { "naive", "blocked", "simd" };
+
+struct matrices {
+	double *A;
+	double *B;
+	double *C;
+};
 
 static int ops = DEF_OPS;
 static int numcpus;
 static float criteria;
-static int *tids;
 static int online_cpu_id = -1;
 static int iterations = ITERATIONS;
 static int iterations_percpu;
+static int matrix_size = MATRIX_SIZE;
+static int ld;			/* row length, matrix_size rounded up to VLEN */
+static int block = BLOCK_SIZE;
+static int kernel = KERNEL_NAIVE;
+static int sweep;
+static struct matrices *mats;	/* one set per CPU */
+static void (*mult) (struct matrices *m);
+static nsec_t conc_start, conc_end;	/* first start, last end of a run */
 
 stats_container_t sdat, cdat, *curdat;
 stats_container_t shist, chist;
@@ -78,6 +104,12 @@ void usage(void)
 	printf
 	    ("  -l#	   #: number of multiplications per iteration (load)\n");
 	printf("  -i#	   #: number of iterations\n");
+	printf("  -k NAME  kernel: naive, blocked or simd (default naive)\n");
+	printf("  -n#	   #: matrix size (default %d, at most %d)\n",
+	       MATRIX_SIZE, MATRIX_MAX);
+	printf("  -B#	   #: block size of the blocked and simd kernels "
+	       "(default %d)\n", BLOCK_SIZE);
+	printf("  -S	   sweep the concurrent CPUs from 1 to all\n");
 }
 
 int parse_args(int c, char *v)
@@ -90,6 +122,24 @@ int parse_args(int c, char *v)
 	case 'l':
 		ops = atoi(v);
 		break;
+	case 'k':
+		for (kernel = 0; kernel <= KERNEL_SIMD; kernel++)
+			if (!strcmp(v, kernel_names[kernel]))
+				break;
+		if (kernel > KERNEL_SIMD) {
+			fprintf(stderr, "unknown kernel %s\n", v);
+			exit(1);
+		}
+		break;
+	case 'n':
+		matrix_size = atoi(v);
+		break;
+	case 'B':
+		block = atoi(v);
+		break;
+	case 'S':
+		sweep = 1;
+		break;
 	case 'h':
 		usage();
 		exit(0);
@@ -100,45 +150,152 @@ int parse_args(int c, char *v)
 	return handled;
 }
 
-void matrix_init(double A[MATRIX_SIZE][MATRIX_SIZE],
-		 double B[MATRIX_SIZE][MATRIX_SIZE])
+/*
+ * The matrices are ld x ld with zeroes past matrix_size, so that the simd
+ * kernel can work on whole, aligned vectors and groups of four rows.
+ */
+void matrix_init(struct matrices *m)
 {
+	size_t len = (size_t)ld * ld * sizeof(double);
 	int i, j;
-	for (i = 0; i < MATRIX_SIZE; i++) {
-		for (j = 0; j < MATRIX_SIZE; j++) {
-			A[i][j] = (double)(i * j);
-			B[i][j] = (double)((i * j) % 10);
+
+	if (posix_memalign((void **)&m->A, 64, len) ||
+	    posix_memalign((void **)&m->B, 64, len) ||
+	    posix_memalign((void **)&m->C, 64, len)) {
+		fprintf(stderr, "Cannot allocate %dx%d matrices\n",
+			matrix_size, matrix_size);
+		exit(1);
+	}
+	memset(m->A, 0, len);
+	memset(m->B, 0, len);
+	memset(m->C, 0, len);
+	for (i = 0; i < matrix_size; i++) {
+		for (j = 0; j < matrix_size; j++) {
+			m->A[i * ld + j] = (double)(i * j);
+			m->B[i * ld + j] = (double)((i * j) % 10);
 		}
 	}
 }
 
-void matrix_mult(int m_size)
+/* Dot products walking B by column, mostly waits for memory */
+void matrix_mult_naive(struct matrices *m)
 {
-	double A[m_size][m_size];
-	double B[m_size][m_size];
-	double C[m_size][m_size];
+	double *A = m->A, *B = m->B, *C = m->C;
 	int i, j, k;
 
-	matrix_init(A, B);
-	for (i = 0; i < m_size; i++) {
-		int i_m = m_size - i;
-		for (j = 0; j < m_size; j++) {
-			double sum = A[i_m][j] * B[j][i];
-			for (k = 0; k < m_size; k++)
-				sum += A[i_m][k] * B[k][j];
-			C[i][j] = sum;
+	for (i = 0; i < matrix_size; i++) {
+		for (j = 0; j < matrix_size; j++) {
+			double sum = 0;
+			for (k = 0; k < matrix_size; k++)
+				sum += A[i * ld + k] * B[k * ld + j];
+			C[i * ld + j] = sum;
+		}
+	}
+}
+
+/* Same, on block x block tiles that stay in cache, B walked by row */
+void matrix_mult_blocked(struct matrices *m)
+{
+	double *A = m->A, *B = m->B, *C = m->C;
+	int i, j, k, ii, jj, kk, iend, jend, kend;
+	double a;
+
+	memset(C, 0, (size_t)ld * ld * sizeof(double));
+	for (ii = 0; ii < matrix_size; ii += block) {
+		iend = MIN(ii + block, matrix_size);
+		for (kk = 0; kk < matrix_size; kk += block) {
+			kend = MIN(kk + block, matrix_size);
+			for (jj = 0; jj < matrix_size; jj += block) {
+				jend = MIN(jj + block, matrix_size);
+				for (i = ii; i < iend; i++) {
+					for (k = kk; k < kend; k++) {
+						a = A[i * ld + k];
+						for (j = jj; j < jend; j++)
+							C[i * ld + j] +=
+							    a * B[k * ld + j];
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Blocked, computing a 4 x VLEN tile of C in registers at a time.  Uses
+ * the gcc vector extensions, which map to SSE/AVX, AltiVec or NEON as
+ * the target allows.
+ */
+void matrix_mult_simd(struct matrices *m)
+{
+	double *A = m->A, *B = m->B, *C = m->C;
+	int i, j, k, jj, kk, jend, kend;
+	vdouble c0, c1, c2, c3, b;
+
+	memset(C, 0, (size_t)ld * ld * sizeof(double));
+	for (kk = 0; kk < ld; kk += block) {
+		kend = MIN(kk + block, ld);
+		for (jj = 0; jj < ld; jj += block) {
+			jend = MIN(jj + block, ld);
+			for (i = 0; i < ld; i += 4) {
+				for (j = jj; j < jend; j += VLEN) {
+					c0 = *(vdouble *)&C[i * ld + j];
+					c1 = *(vdouble *)&C[(i + 1) * ld + j];
+					c2 = *(vdouble *)&C[(i + 2) * ld + j];
+					c3 = *(vdouble *)&C[(i + 3) * ld + j];
+					for (k = kk; k < kend; k++) {
+						b = *(vdouble *)&B[k * ld + j];
+						c0 += b * A[i * ld + k];
+						c1 += b * A[(i + 1) * ld + k];
+						c2 += b * A[(i + 2) * ld + k];
+						c3 += b * A[(i + 3) * ld + k];
+					}
+					*(vdouble *)&C[i * ld + j] = c0;
+					*(vdouble *)&C[(i + 1) * ld + j] = c1;
+					*(vdouble *)&C[(i + 2) * ld + j] = c2;
+					*(vdouble *)&C[(i + 3) * ld + j] = c3;
+				}
+			}
 		}
 	}
 }
 
-void matrix_mult_record(int m_size, int index)
+/*
+ * C[i][j] is a sum of integers no bigger than n * (n - 1)^2 * 9, which for
+ * n up to MATRIX_MAX is well below 2^53, so compare exactly
+ */
+void matrix_check(void)
+{
+	struct matrices ref;
+	int i, j;
+
+	matrix_init(&ref);
+	matrix_mult_naive(&ref);
+	mult(&mats[0]);
+	for (i = 0; i < matrix_size; i++) {
+		for (j = 0; j < matrix_size; j++) {
+			if (mats[0].C[i * ld + j] != ref.C[i * ld + j]) {
+				printf("%s kernel: C[%d][%d] = %f, expected "
+				       "%f\n", kernel_names[kernel], i, j,
+				       mats[0].C[i * ld + j],
+				       ref.C[i * ld + j]);
+				printf("Result: FAIL\n");
+				exit(1);
+			}
+		}
+	}
+	free(ref.A);
+	free(ref.B);
+	free(ref.C);
+}
+
+void matrix_mult_record(struct matrices *m, int index)
 {
 	nsec_t start, end, delta;
 	int i;
 
 	start = rt_gettime();
 	for (i = 0; i < ops; i++)
-		matrix_mult(MATRIX_SIZE);
+		mult(m);
 	end = rt_gettime();
 	delta = (long)((end - start) / NS_PER_US);
 	curdat->records[index].x = index;
@@ -169,7 +326,8 @@ int set_affinity(void)
 void *concurrent_thread(void *thread)
 {
 	struct thread *t = (struct thread *)thread;
-	int thread_id = (intptr_t) t->id;
+	int thread_id = (intptr_t) t->arg;
+	nsec_t start, end;
 	int cpuid;
 	int i;
 	int index;
@@ -182,18 +340,80 @@ void *concurrent_thread(void *thread)
 
 	index = iterations_percpu * thread_id;	/* To avoid stats overlapping */
 	pthread_barrier_wait(&mult_start);
+	start = rt_gettime();
 	for (i = 0; i < iterations_percpu; i++)
-		matrix_mult_record(MATRIX_SIZE, index++);
+		matrix_mult_record(&mats[thread_id], index++);
+	end = rt_gettime();
+
+	/*
+	 * Timed here rather than around the join: the thread sharing the
+	 * CPU of the main thread may well be done before main runs again.
+	 */
+	pthread_mutex_lock(&mutex_cpu);
+	if (!conc_start || start < conc_start)
+		conc_start = start;
+	if (end > conc_end)
+		conc_end = end;
+	pthread_mutex_unlock(&mutex_cpu);
 
 	return NULL;
 }
 
+void print_hist(stats_container_t *dat)
+{
+	stats_container_t hist;
+
+	if (stats_container_init(&hist, PRINT_BUCKETS))
+		return;
+	if (!stats_hist(&hist, dat)) {
+		printf("Histogram (us):\n");
+		stats_hist_print(&hist);
+	}
+	stats_container_free(&hist);
+}
+
+/*
+ * Runs iterations spread over ncpus FIFO threads, one per CPU, and
+ * returns the time it took in us.  The per iteration times are in cdat.
+ */
+long run_concurrent(int ncpus)
+{
+	int j;
+
+	iterations_percpu = (iterations + ncpus - 1) / ncpus;
+	stats_container_free(&cdat);
+	if (stats_container_init(&cdat, iterations_percpu * ncpus)) {
+		fprintf(stderr, "Cannot init stats container\n");
+		exit(1);
+	}
+	curdat = &cdat;
+	curdat->index = iterations_percpu * ncpus - 1;
+
+	pthread_barrier_init(&mult_start, NULL, ncpus + 1);
+	conc_start = conc_end = 0;
+	online_cpu_id = -1;	/* Redispatch cpus */
+	for (j = 0; j < ncpus; j++) {
+		if (create_fifo_thread(concurrent_thread, (void *)(intptr_t)j,
+				       PRIO) == -1) {
+			printf
+			    ("Thread creation failed (max threads exceeded?)\n");
+			exit(1);
+		}
+	}
+
+	pthread_barrier_wait(&mult_start);
+	join_threads();
+	pthread_barrier_destroy(&mult_start);
+
+	return (long)((conc_end - conc_start) / NS_PER_US);
+}
+
 void main_thread(void)
 {
-	int ret, i, j;
+	int ret, i, ncpus;
 	nsec_t start, end;
 	long smin = 0, smax = 0, cmin = 0, cmax = 0, delta = 0;
-	float savg, cavg;
+	float savg, cavg = 0, speedup;
 	int cpuid;
 
 	if (stats_container_init(&sdat, iterations) ||
@@ -205,12 +425,14 @@ void main_thread(void)
 		exit(1);
 	}
 
-	tids = malloc(sizeof(int) * numcpus);
-	if (!tids) {
-		perror("malloc");
+	mats = calloc(numcpus, sizeof(*mats));
+	if (!mats) {
+		perror("calloc");
 		exit(1);
 	}
-	memset(tids, 0, numcpus);
+	for (i = 0; i < numcpus; i++)
+		matrix_init(&mats[i]);
+	matrix_check();
 
 	cpuid = set_affinity();
 	if (cpuid == -1) {
@@ -224,11 +446,11 @@ void main_thread(void)
 	printf("\nRunning sequential operations\n");
 	start = rt_gettime();
 	for (i = 0; i < iterations; i++)
-		matrix_mult_record(MATRIX_SIZE, i);
+		matrix_mult_record(&mats[0], i);
 	end = rt_gettime();
 	delta = (long)((end - start) / NS_PER_US);
 
-	savg = delta / iterations;	/* don't use the stats record, use the total time recorded */
+	savg = (float)delta / iterations;	/* don't use the stats record, use the total time recorded */
 	smin = stats_min(&sdat);
 	smax = stats_max(&sdat);
 
@@ -236,6 +458,7 @@ void main_thread(void)
 	printf("Max: %ld us\n", smax);
 	printf("Avg: %.4f us\n", savg);
 	printf("StdDev: %.4f us\n", stats_stddev(&sdat));
+	print_hist(&sdat);
 
 	if (stats_hist(&shist, &sdat) ||
 	    stats_container_save("sequential",
@@ -249,31 +472,41 @@ void main_thread(void)
 			"Warning: could not save sequential mults stats\n");
 	}
 
-	pthread_barrier_init(&mult_start, NULL, numcpus + 1);
 	set_priority(PRIO);
-	curdat = &cdat;
-	curdat->index = iterations - 1;
-	online_cpu_id = -1;	/* Redispatch cpus */
-	/* Create numcpus-1 concurrent threads */
-	for (j = 0; j < numcpus; j++) {
-		tids[j] = create_fifo_thread(concurrent_thread, NULL, PRIO);
-		if (tids[j] == -1) {
-			printf
-			    ("Thread creation failed (max threads exceeded?)\n");
-			exit(1);
-		}
-	}
 
-	/* run matrix mult operation concurrently */
-	printf("\nRunning concurrent operations\n");
-	pthread_barrier_wait(&mult_start);
-	start = rt_gettime();
-	join_threads();
-	end = rt_gettime();
-
-	delta = (long)((end - start) / NS_PER_US);
+	/*
+	 * Every step must reach pass_criteria * ncpus of the sequential
+	 * speed; without -S the only step is all of the CPUs.
+	 */
+	ret = 0;
+	if (sweep) {
+		printf("\nRunning concurrent operations on 1 to %d CPUs\n",
+		       numcpus);
+		printf("%6s %12s %10s %10s %10s %8s %8s %6s\n", "CPUs",
+		       "Avg us", "Min us", "Max us", "StdDev", "Jitter",
+		       "Speedup", "Eff");
+	}
+	for (ncpus = sweep ? 1 : numcpus; ; ncpus = MIN(ncpus * 2, numcpus)) {
+		if (!sweep)
+			printf("\nRunning concurrent operations\n");
+		delta = run_concurrent(ncpus);
+		cavg = (float)delta / (iterations_percpu * ncpus);
+		speedup = savg / cavg;
+		if (speedup < pass_criteria * ncpus)
+			ret = 1;
+		if (sweep)
+			printf("%6d %12.2f %10ld %10ld %10.2f %7.2f%% %8.2f "
+			       "%5.0f%%\n", ncpus, cavg, stats_min(&cdat),
+			       stats_max(&cdat), stats_stddev(&cdat),
+			       100.0 * (stats_max(&cdat) - stats_min(&cdat)) /
+			       stats_avg(&cdat), speedup,
+			       100.0 * speedup / ncpus);
+		if (ncpus == numcpus)
+			break;
+	}
+	if (sweep)
+		printf("\nConcurrent operations on %d CPUs\n", numcpus);
 
-	cavg = delta / iterations;	/* don't use the stats record, use the total time recorded */
 	cmin = stats_min(&cdat);
 	cmax = stats_max(&cdat);
 
@@ -281,6 +514,7 @@ void main_thread(void)
 	printf("Max: %ld us\n", cmax);
 	printf("Avg: %.4f us\n", cavg);
 	printf("StdDev: %.4f us\n", stats_stddev(&cdat));
+	print_hist(&cdat);
 
 	if (stats_hist(&chist, &cdat) ||
 	    stats_container_save("concurrent",
@@ -300,12 +534,12 @@ void main_thread(void)
 	printf("Max: %.4f\n", (float)smax / cmax);
 	printf("Avg: %.4f\n", (float)savg / cavg);
 
-	ret = 1;
-	if (savg > (cavg * criteria))
-		ret = 0;
 	printf
 	    ("\nCriteria: %.2f * average concurrent time < average sequential time\n",
 	     criteria);
+	if (sweep)
+		printf("          (%.2f * CPUs at every step)\n",
+		       pass_criteria);
 	printf("Result: %s\n", ret ? "FAIL" : "PASS");
 
 	return;
@@ -315,16 +549,39 @@ int main(int argc, char *argv[])
 {
 	setup();
 	pass_criteria = PASS_CRITERIA;
-	rt_init("l:i:h", parse_args, argc, argv);
+	rt_init("l:i:k:n:B:Sh", parse_args, argc, argv);
 	numcpus = sysconf(_SC_NPROCESSORS_ONLN);
 	/* the minimum avg concurrent multiplier to pass */
 	criteria = pass_criteria * numcpus;
-	int new_iterations;
 
 	if (iterations <= 0) {
 		fprintf(stderr, "iterations must be greater than zero\n");
 		exit(1);
 	}
+	if (matrix_size <= 0 || block <= 0) {
+		fprintf(stderr, "matrix and block size must be greater than "
+			"zero\n");
+		exit(1);
+	}
+	if (matrix_size > MATRIX_MAX) {
+		fprintf(stderr, "matrix size must be at most %d\n",
+			MATRIX_MAX);
+		exit(1);
+	}
+	ld = (matrix_size + VLEN - 1) / VLEN * VLEN;
+	/* the simd kernel works on whole vectors */
+	block = (block + VLEN - 1) / VLEN * VLEN;
+	switch (kernel) {
+	case KERNEL_NAIVE:
+		mult = matrix_mult_naive;
+		break;
+	case KERNEL_BLOCKED:
+		mult = matrix_mult_blocked;
+		break;
+	case KERNEL_SIMD:
+		mult = matrix_mult_simd;
+		break;
+	}
 
 	printf("\n---------------------------------------\n");
 	printf("Matrix Multiplication (SMP Performance)\n");
@@ -334,17 +591,17 @@ int main(int argc, char *argv[])
 	 * Without this, having iterations not a mutiple of numcpus causes
 	 * stats to segfault (overflow stats array).
 	 */
-	new_iterations = (int)((iterations + numcpus - 1) / numcpus) * numcpus;
-	if (new_iterations != iterations)
+	if (iterations % numcpus)
 		printf
 		    ("Rounding up iterations value to nearest multiple of total online CPUs\n");
-
-	iterations = new_iterations;
-	iterations_percpu = iterations / numcpus;
+	iterations = (iterations + numcpus - 1) / numcpus * numcpus;
 
 	printf("Running %d iterations\n", iterations);
-	printf("Matrix Dimensions: %dx%d\n", MATRIX_SIZE, MATRIX_SIZE);
-	printf("Calculations per iteration: %d\n", ops);
+	printf("Matrix Dimensions: %dx%d\n", matrix_size, matrix_size);
+	printf("Kernel: %s", kernel_names[kernel]);
+	if (kernel != KERNEL_NAIVE)
+		printf(" (%dx%d blocks)", block, block);
+	printf("\nCalculations per iteration: %d\n", ops);
 	printf("Number of CPUs: %u\n", numcpus);
 
 	set_priority(PRIO);
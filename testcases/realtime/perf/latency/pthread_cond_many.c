@@ -21,6 +21,9 @@
  *
  * DESCRIPTION
  *      Measure pthread_cond_t latencies , but in presence of many processes.
+ *      The same wakeups can be done with a raw futex, an eventfd or a pipe
+ *      (-M), so that the tail latency of each primitive can be compared
+ *      with the same number of threads, priorities and load.
  *
  * USAGE:
  *      Use run_auto.sh script in current directory to build and run test.
@@ -30,216 +33,375 @@
  *
  * HISTORY
  *      librttest parsing, threading, and mutex initialization - Darren Hart
+ *      2013: futex, eventfd and pipe wakeups, in-process histograms
  *
  *
  *      This line has to be added to avoid a stupid CVS problem
  *****************************************************************************/
 
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <sys/time.h>
 #include <sched.h>
 #include <string.h>
-#include <sys/poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <linux/futex.h>
 #include <librttest.h>
 #include <libstats.h>
 #define PASS_US 100
-pthread_mutex_t child_mutex;
-volatile int *child_waiting = NULL;
-double endtime;
-pthread_cond_t *condlist = NULL;
+#define HIST_BUCKETS	40	/* log2(ns) */
+
+#define MECH_COND	0
+#define MECH_FUTEX	1
+#define MECH_EVENTFD	2
+#define MECH_PIPE	3
+#define NR_MECHS	4
+
+static const char *mech_names[] = { "cond", "futex", "eventfd", "pipe" };
+
+#define CHILD_IDLE	0
+#define CHILD_WAITING	1
+
+struct child {
+	pthread_t thread;
+	pid_t tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int futex;		/* wakeup flag, also the cond predicate */
+	int fds[2];		/* eventfd in fds[0] and fds[1], or a pipe */
+	volatile int state;
+	volatile int quit;
+	volatile nsec_t start;	/* set by the waker right before the wakeup */
+	long index;		/* record of this wakeup */
+};
+
+struct result {
+	long min, max, p50, p99, p999;
+	float avg, stddev;
+};
+
+struct child *children = NULL;
 int iterations = 0;
 int nthreads = 0;
 int realtime = 0;
 int broadcast_flag = 0;
-unsigned long latency = 0;
+int mech = MECH_COND;
+int all_mechs = 0;
+int child_prio = 0;		/* 0 is SCHED_OTHER */
+int waker_prio = 0;
+int nload = 0;
 int fail = 0;
-/*
- * Return time as a floating-point number rather than struct timeval.
- */
+stats_container_t dat;
+sem_t done;
+volatile int load_stop = 0;
 
-double d_gettimeofday(void)
+static int futex_wait(int *uaddr, int val)
 {
-	int retval;
-	struct timeval tv;
+	return syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, NULL,
+		       NULL, 0);
+}
 
-	retval = gettimeofday(&tv, NULL);
-	if (retval != 0) {
-		perror("gettimeofday");
-		exit(-1);
-	}
-	return (tv.tv_sec + ((double)tv.tv_usec) / 1000000.);
+static int futex_wake(int *uaddr, int nr)
+{
+	return syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, nr, NULL,
+		       NULL, 0);
 }
 
+/*
+ * Sleeps until woken by wake_child() and records the latency of the
+ * wakeup itself, from the woken thread, before telling the waker.
+ */
 void *childfunc(void *arg)
 {
-	int myid = (intptr_t) arg;
-	pthread_cond_t *cp;
-	volatile int *cw;
-
-	cp = &condlist[myid];
-	cw = &child_waiting[myid];
-	while (*cw == 0) {
-		pthread_mutex_lock(&child_mutex);
-		*cw = 1;
-		if (pthread_cond_wait(cp, &child_mutex) != 0) {
-			perror("pthread_cond_wait");
-			exit(-1);
-		}
-		endtime = d_gettimeofday();
-		*cw = 2;
-		pthread_mutex_unlock(&child_mutex);
-		while (*cw == 2) {
-			poll(NULL, 0, 10);
+	struct child *c = arg;
+	uint64_t val;
+	nsec_t end;
+	char ch;
+
+	c->tid = syscall(SYS_gettid);
+	for (;;) {
+		switch (mech) {
+		case MECH_COND:
+			pthread_mutex_lock(&c->mutex);
+			c->state = CHILD_WAITING;
+			while (c->futex == 0)
+				pthread_cond_wait(&c->cond, &c->mutex);
+			end = rt_gettime();
+			c->futex = 0;
+			pthread_mutex_unlock(&c->mutex);
+			break;
+		case MECH_FUTEX:
+			c->state = CHILD_WAITING;
+			while (c->futex == 0)
+				futex_wait(&c->futex, 0);
+			end = rt_gettime();
+			c->futex = 0;
+			break;
+		case MECH_EVENTFD:
+			c->state = CHILD_WAITING;
+			if (read(c->fds[0], &val, sizeof(val)) != sizeof(val)) {
+				perror("read eventfd");
+				exit(-1);
+			}
+			end = rt_gettime();
+			break;
+		default:
+			c->state = CHILD_WAITING;
+			if (read(c->fds[0], &ch, 1) != 1) {
+				perror("read pipe");
+				exit(-1);
+			}
+			end = rt_gettime();
+			break;
 		}
+		c->state = CHILD_IDLE;
+		if (c->quit)
+			break;
+		dat.records[c->index].x = c->index;
+		dat.records[c->index].y = end - c->start;
+		sem_post(&done);
 	}
-	pthread_exit(NULL);
+	return NULL;
 }
 
-pthread_t create_thread_(int itsid)
+void *loadfunc(void *arg)
+{
+	while (!load_stop) ;
+	return NULL;
+}
+
+pthread_t create_thread_(void *(*func) (void *), void *arg, int prio)
 {
 	pthread_attr_t attr;
 	pthread_t childid;
-	int prio;
 	struct sched_param schparm;
 
 	if (pthread_attr_init(&attr) != 0) {
 		perror("pthread_attr_init");
 		exit(-1);
 	}
-	if (realtime) {
-		prio = sched_get_priority_max(SCHED_FIFO);
-		if (prio == -1) {
-			perror("sched_get_priority_max");
-			exit(-1);
-		}
-		schparm.sched_priority = prio;
-		if (sched_setscheduler(getpid(), SCHED_FIFO, &schparm) != 0) {
-			perror("sched_setscheduler");
-			exit(-1);
-		}
-
-		if (pthread_attr_setschedpolicy(&attr, SCHED_FIFO) != 0) {
-			perror("pthread_attr_setschedpolicy");
-			exit(-1);
-		}
-		if (pthread_attr_setschedparam(&attr, &schparm) != 0) {
-			perror("pthread_attr_setschedparam");
-			exit(-1);
-		}
+	/* Explicit SCHED_OTHER too, not whatever the waker runs at */
+	schparm.sched_priority = prio;
+	if (pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED) != 0) {
+		perror("pthread_attr_setinheritsched");
+		exit(-1);
 	}
-	if (pthread_attr_setstacksize(&attr, (size_t) (32 * 1024)) != 0) {
-		perror("pthread_attr_setstacksize");
+	if (pthread_attr_setschedpolicy(&attr,
+					prio ? SCHED_FIFO : SCHED_OTHER) != 0) {
+		perror("pthread_attr_setschedpolicy");
 		exit(-1);
 	}
-	if (pthread_cond_init(&condlist[itsid], NULL) != 0) {
-		perror("pthread_cond_init");
+	if (pthread_attr_setschedparam(&attr, &schparm) != 0) {
+		perror("pthread_attr_setschedparam");
 		exit(-1);
 	}
-	if (pthread_create(&childid, &attr, childfunc, (void *)(intptr_t) itsid)
-	    != 0) {
+	if (pthread_attr_setstacksize(&attr, (size_t) (32 * 1024)) != 0) {
+		perror("pthread_attr_setstacksize");
+		exit(-1);
+	}
+	if (pthread_create(&childid, &attr, func, arg) != 0) {
 		perror("pthread_create");
 		exit(-1);
 	}
+	pthread_attr_destroy(&attr);
 	return (childid);
 }
 
-void wake_child(int itsid, int broadcast_flag)
+void create_child(struct child *c)
 {
-	double starttime;
-
-	pthread_mutex_lock(&child_mutex);
-	while (child_waiting[itsid] == 0) {
-		pthread_mutex_unlock(&child_mutex);
-		sched_yield();
-		pthread_mutex_lock(&child_mutex);
-	}
-	pthread_mutex_unlock(&child_mutex);
-	if (broadcast_flag) {
-		starttime = d_gettimeofday();
-		if (pthread_cond_broadcast(&condlist[itsid]) != 0) {
-			perror("pthread_cond_broadcast");
+	memset(c, 0, sizeof(*c));
+	c->fds[0] = c->fds[1] = -1;
+	switch (mech) {
+	case MECH_COND:
+		init_pi_mutex(&c->mutex);
+		if (pthread_cond_init(&c->cond, NULL) != 0) {
+			perror("pthread_cond_init");
 			exit(-1);
 		}
-	} else {
-		starttime = d_gettimeofday();
-		if (pthread_cond_signal(&condlist[itsid]) != 0) {
-			perror("pthread_cond_signal");
+		break;
+	case MECH_EVENTFD:
+		c->fds[0] = c->fds[1] = eventfd(0, 0);
+		if (c->fds[0] == -1) {
+			perror("eventfd");
 			exit(-1);
 		}
+		break;
+	case MECH_PIPE:
+		if (pipe(c->fds) == -1) {
+			perror("pipe");
+			exit(-1);
+		}
+		break;
 	}
+	c->thread = create_thread_(childfunc, c, child_prio);
+}
+
+/*
+ * Waits until the child really sleeps in the kernel, so that every
+ * wakeup is a wakeup and not a child still on its way to wait.  Polls
+ * with short sleeps, the child may have a lower priority on our CPU.
+ */
+void wait_asleep(struct child *c)
+{
+	char path[64], buf[512], *p;
+	ssize_t n;
+	int fd;
+
+	while (c->state != CHILD_WAITING || c->tid == 0)
+		usleep(10);
+	snprintf(path, sizeof(path), "/proc/self/task/%d/stat", c->tid);
 	for (;;) {
-		pthread_mutex_lock(&child_mutex);
-		if (child_waiting[itsid] == 2) {
-			break;
+		fd = open(path, O_RDONLY);
+		if (fd == -1) {
+			perror(path);
+			exit(-1);
 		}
-		pthread_mutex_unlock(&child_mutex);
-		poll(NULL, 0, 10);
+		n = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		if (n <= 0) {
+			perror(path);
+			exit(-1);
+		}
+		buf[n] = '\0';
+		p = strrchr(buf, ')');
+		if (p != NULL && p[1] == ' ' && p[2] == 'S')
+			return;
+		usleep(10);
 	}
-	latency = (unsigned long)((endtime - starttime) * 1000000.);
-	pthread_mutex_unlock(&child_mutex);
 }
 
-void test_signal(long iter, long nthreads)
+void wake_child(struct child *c)
+{
+	uint64_t val = 1;
+
+	wait_asleep(c);
+	switch (mech) {
+	case MECH_COND:
+		pthread_mutex_lock(&c->mutex);
+		c->futex = 1;
+		c->start = rt_gettime();
+		if (broadcast_flag) {
+			if (pthread_cond_broadcast(&c->cond) != 0) {
+				perror("pthread_cond_broadcast");
+				exit(-1);
+			}
+		} else {
+			if (pthread_cond_signal(&c->cond) != 0) {
+				perror("pthread_cond_signal");
+				exit(-1);
+			}
+		}
+		pthread_mutex_unlock(&c->mutex);
+		break;
+	case MECH_FUTEX:
+		c->start = rt_gettime();
+		__sync_lock_test_and_set(&c->futex, 1);
+		futex_wake(&c->futex, 1);
+		break;
+	case MECH_EVENTFD:
+		c->start = rt_gettime();
+		if (write(c->fds[1], &val, sizeof(val)) != sizeof(val)) {
+			perror("write eventfd");
+			exit(-1);
+		}
+		break;
+	default:
+		c->start = rt_gettime();
+		if (write(c->fds[1], "w", 1) != 1) {
+			perror("write pipe");
+			exit(-1);
+		}
+		break;
+	}
+}
+
+void print_histogram(stats_container_t *d)
+{
+	unsigned long hist[HIST_BUCKETS] = { 0 };
+	long i, y;
+	int b, first = HIST_BUCKETS, last = 0;
+
+	for (i = 0; i <= d->index; i++) {
+		y = d->records[i].y;
+		for (b = 0; b < HIST_BUCKETS - 1 && (2L << b) <= y; b++) ;
+		hist[b]++;
+		first = MIN(first, b);
+		last = MAX(last, b);
+	}
+	printf("Histogram (us):\n");
+	for (b = first; b <= last; b++)
+		printf("[%.3f,%.3f) = %lu\n", (b ? (1L << b) : 0) / 1000.,
+		       (2L << b) / 1000., hist[b]);
+}
+
+void test_signal(long iter, long nthreads, struct result *r)
 {
 	int i;
 	int j;
-	int k;
-	pthread_t *pt;
-	unsigned long max = 0;
-	unsigned long min = 0;
-	stats_container_t dat;
-	stats_record_t rec;
-
-	stats_container_init(&dat, iter * nthreads);
 
-	pt = (pthread_t *) malloc(sizeof(*pt) * nthreads);
-	if (pt == NULL) {
-		fprintf(stderr, "Out of memory\n");
+	if (stats_container_init(&dat, iter * nthreads)) {
+		fprintf(stderr, "Cannot init stats container\n");
 		exit(-1);
 	}
-	for (j = 0; j < nthreads; j++) {
-		child_waiting[j] = 0;
-		pt[j] = create_thread_(j);
-	}
-	for (i = 0; i < (iter - 1) * nthreads; i += nthreads) {
-		for (j = 0, k = i; j < nthreads; j++, k++) {
-			wake_child(j, broadcast_flag);
-			rec.x = k;
-			rec.y = latency;
-			stats_container_append(&dat, rec);
-			pthread_mutex_lock(&child_mutex);
-			child_waiting[j] = 0;
-			pthread_mutex_unlock(&child_mutex);
+	dat.index = iter * nthreads - 1;
+
+	for (j = 0; j < nthreads; j++)
+		create_child(&children[j]);
+	for (i = 0; i < iter; i++) {
+		for (j = 0; j < nthreads; j++) {
+			children[j].index = i * nthreads + j;
+			wake_child(&children[j]);
+			while (sem_wait(&done) == -1 && errno == EINTR) ;
 		}
 	}
 	for (j = 0; j < nthreads; j++) {
-		wake_child(j, broadcast_flag);
-		pthread_mutex_lock(&child_mutex);
-		child_waiting[j] = 3;
-		pthread_mutex_unlock(&child_mutex);
-		if (pthread_join(pt[j], NULL) != 0) {
+		children[j].quit = 1;
+		wake_child(&children[j]);
+		if (pthread_join(children[j].thread, NULL) != 0) {
 			fprintf(stderr, "%d: ", j);
 			perror("pthread_join");
 			exit(-1);
 		}
+		if (mech == MECH_COND) {
+			pthread_cond_destroy(&children[j].cond);
+			pthread_mutex_destroy(&children[j].mutex);
+		}
+		if (children[j].fds[0] != -1)
+			close(children[j].fds[0]);
+		if (children[j].fds[1] != children[j].fds[0])
+			close(children[j].fds[1]);
 	}
-	min = (unsigned long)-1;
-	for (i = 0; i < iter * nthreads; i++) {
-		latency = dat.records[i].y;
-		if (latency > PASS_US)
-			fail = 1;
-		min = MIN(min, latency);
-		max = MAX(max, latency);
-	}
+
+	r->min = stats_min(&dat);
+	r->max = stats_max(&dat);
+	r->avg = stats_avg(&dat);
+	r->stddev = stats_stddev(&dat);
+	stats_sort(&dat, ASCENDING_ON_Y);
+	r->p50 = dat.records[dat.index / 2].y;
+	r->p99 = dat.records[dat.index * 99 / 100].y;
+	r->p999 = dat.records[dat.index * 999 / 1000].y;
+	if (r->max > pass_criteria * NS_PER_US)
+		fail = 1;
+
+	printf("\nMechanism: %s\n", mech_names[mech]);
 	printf("Recording statistics...\n");
-	printf("Minimum: %lu us\n", min);
-	printf("Maximum: %lu us\n", max);
-	printf("Average: %f us\n", stats_avg(&dat));
-	printf("Standard Deviation: %f\n", stats_stddev(&dat));
+	printf("Minimum: %.3f us\n", r->min / 1000.);
+	printf("Maximum: %.3f us\n", r->max / 1000.);
+	printf("Average: %f us\n", r->avg / 1000.);
+	printf("Standard Deviation: %f\n", r->stddev / 1000.);
+	printf("Percentiles: 50%% %.3f us, 99%% %.3f us, 99.9%% %.3f us\n",
+	       r->p50 / 1000., r->p99 / 1000., r->p999 / 1000.);
+	print_histogram(&dat);
+	stats_container_free(&dat);
 }
 
 void usage(void)
@@ -250,13 +412,18 @@ void usage(void)
 	printf("  -b,--broadcast  use cond_broadcast instead of cond_signal\n");
 	printf("  -iITERATIONS    iterations (required)\n");
 	printf("  -nNTHREADS      number of threads (required)\n");
+	printf("  -MMECH          wakeup mechanism: cond, futex, eventfd, pipe "
+	       "or all\n");
+	printf("  -PPRIO          SCHED_FIFO priority of the woken threads\n");
+	printf("  -WPRIO          SCHED_FIFO priority of the waking thread\n");
+	printf("  -LNLOAD         number of busy looping load threads\n");
 	printf("deprecated unnamed arguments:\n");
 	printf("  pthread_cond_many [options] iterations nthreads\n");
 }
 
 int parse_args(int c, char *v)
 {
-	int handled;
+	int handled = 1;
 	switch (c) {
 	case 'h':
 		usage();
@@ -273,6 +440,28 @@ int parse_args(int c, char *v)
 	case 'r':
 		realtime = 1;
 		break;
+	case 'M':
+		if (!strcmp(v, "all")) {
+			all_mechs = 1;
+			break;
+		}
+		for (mech = 0; mech < NR_MECHS; mech++)
+			if (!strcmp(v, mech_names[mech]))
+				break;
+		if (mech == NR_MECHS) {
+			fprintf(stderr, "unknown mechanism %s\n", v);
+			exit(1);
+		}
+		break;
+	case 'P':
+		child_prio = atoi(v);
+		break;
+	case 'W':
+		waker_prio = atoi(v);
+		break;
+	case 'L':
+		nload = atoi(v);
+		break;
 	default:
 		handled = 0;
 		break;
@@ -285,12 +474,20 @@ int main(int argc, char *argv[])
 	struct option longopts[] = {
 		{"broadcast", 0, NULL, 'a'},
 		{"realtime", 0, NULL, 'r'},
+		{"mech", 1, NULL, 'M'},
+		{"prio", 1, NULL, 'P'},
+		{"waker-prio", 1, NULL, 'W'},
+		{"load", 1, NULL, 'L'},
 		{NULL, 0, NULL, 0},
 	};
+	struct result res[NR_MECHS];
+	pthread_t *load = NULL;
+	int first, last, m, i;
+
 	setup();
 
-	init_pi_mutex(&child_mutex);
-	rt_init_long("ahi:n:r", longopts, parse_args, argc, argv);
+	pass_criteria = PASS_US;
+	rt_init_long("ahi:n:rM:P:W:L:", longopts, parse_args, argc, argv);
 
 	/* Legacy command line arguments support, overrides getopt args. */
 	if (optind < argc)
@@ -299,19 +496,64 @@ int main(int argc, char *argv[])
 		nthreads = strtol(argv[optind++], NULL, 0);
 
 	/* Ensure we have the required arguments. */
-	if (iterations == 0 || nthreads == 0) {
+	if (iterations <= 0 || nthreads <= 0) {
 		usage();
 		exit(1);
 	}
 
-	child_waiting = (int *)malloc(sizeof(*child_waiting) * nthreads);
-	condlist = (pthread_cond_t *) malloc(sizeof(*condlist) * nthreads);
-	if ((child_waiting == NULL) || (condlist == NULL)) {
+	if (realtime) {
+		if (!child_prio)
+			child_prio = sched_get_priority_max(SCHED_FIFO);
+		if (!waker_prio)
+			waker_prio = sched_get_priority_max(SCHED_FIFO);
+	}
+	if (waker_prio && set_priority(waker_prio) != 0)
+		exit(-1);
+
+	children = calloc(nthreads, sizeof(*children));
+	load = calloc(nload + 1, sizeof(*load));
+	if ((children == NULL) || (load == NULL) ||
+	    sem_init(&done, 0, 0) != 0) {
 		fprintf(stderr, "Out of memory\n");
 		exit(-1);
 	}
-	test_signal(iterations, nthreads);
-	printf("\nCriteria: latencies < %d us\n", PASS_US);
+	for (i = 0; i < nload; i++)
+		load[i] = create_thread_(loadfunc, NULL, 0);
+
+	printf("%d threads, %d iterations, %d load threads\n", nthreads,
+	       iterations, nload);
+	if (child_prio)
+		printf("Woken threads: SCHED_FIFO %d\n", child_prio);
+	else
+		printf("Woken threads: SCHED_OTHER\n");
+	if (waker_prio)
+		printf("Waking thread: SCHED_FIFO %d\n", waker_prio);
+	else
+		printf("Waking thread: SCHED_OTHER\n");
+
+	first = all_mechs ? 0 : mech;
+	last = all_mechs ? NR_MECHS - 1 : mech;
+	for (m = first; m <= last; m++) {
+		mech = m;
+		test_signal(iterations, nthreads, &res[m]);
+	}
+
+	load_stop = 1;
+	for (i = 0; i < nload; i++)
+		pthread_join(load[i], NULL);
+
+	if (all_mechs) {
+		printf("\n%-8s %10s %10s %10s %10s %10s %10s\n", "(us)", "min",
+		       "avg", "50%", "99%", "99.9%", "max");
+		for (m = 0; m < NR_MECHS; m++)
+			printf("%-8s %10.3f %10.3f %10.3f %10.3f %10.3f "
+			       "%10.3f\n", mech_names[m], res[m].min / 1000.,
+			       res[m].avg / 1000., res[m].p50 / 1000.,
+			       res[m].p99 / 1000., res[m].p999 / 1000.,
+			       res[m].max / 1000.);
+	}
+
+	printf("\nCriteria: latencies < %d us\n", (int)pass_criteria);
 	printf("Result: %s\n", fail ? "FAIL" : "PASS");
 
 	return 0;
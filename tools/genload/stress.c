@@ -27,6 +27,12 @@
 #include <signal.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
 #include <sys/wait.h>
 
 /* By default, print all messages of severity info and above.  */
@@ -85,6 +91,12 @@ int hogio(long long forks);
 int hogvm(long long forks, long long chunks, long long bytes);
 int hoghdd(long long forks, int clean, long long files, long long bytes);
 
+/* Prototypes for the closed loop controller.  */
+int ctl_profile_add(long start, double cpu, long long hdd, long long vm);
+int ctl_profile_load(const char *path);
+int hogctl(long long cpu_max, long long hdd_max, long long hdd_bytes,
+	   long long vm_max, int interval, const char *logpath);
+
 int main(int argc, char **argv)
 {
 	int i, pid, children = 0, retval = 0;
@@ -106,6 +118,13 @@ int main(int argc, char **argv)
 	int do_hdd_clean = 0;
 	long long do_hdd_files = 1;
 	long long do_hdd_bytes = 1024 * 1024 * 1024;
+	int do_ctl = 0;		/* Closed loop control of cpu, hdd and vm.  */
+	double do_ctl_cpu = 0;
+	long long do_ctl_hdd = 0;
+	long long do_ctl_vm = 0;
+	char *do_ctl_profile = NULL;
+	char *do_ctl_log = NULL;
+	int do_ctl_interval = 1000;
 
 	/* Record our start time.  */
 	if ((starttime = time(NULL)) == -1) {
@@ -190,12 +209,90 @@ int main(int argc, char **argv)
 		} else if (strcmp(arg, "--hdd-bytes") == 0) {
 			assert_arg("--hdd-bytes");
 			do_hdd_bytes = atoll_b(arg);
+		} else if (strcmp(arg, "--target-cpu") == 0) {
+			do_ctl = 1;
+			assert_arg("--target-cpu");
+			do_ctl_cpu = atof(arg);
+		} else if (strcmp(arg, "--target-hdd") == 0) {
+			do_ctl = 1;
+			assert_arg("--target-hdd");
+			do_ctl_hdd = atoll_b(arg);
+		} else if (strcmp(arg, "--target-vm") == 0) {
+			do_ctl = 1;
+			assert_arg("--target-vm");
+			do_ctl_vm = atoll_b(arg);
+		} else if (strcmp(arg, "--profile") == 0) {
+			do_ctl = 1;
+			if (++i == argc) {
+				err(stderr, "missing argument to option "
+				    "'--profile'\n");
+				exit(1);
+			}
+			do_ctl_profile = argv[i];
+		} else if (strcmp(arg, "--control-interval") == 0) {
+			assert_arg("--control-interval");
+			do_ctl_interval = atoi(arg);
+			if (do_ctl_interval <= 0) {
+				err(stderr, "invalid control interval: %i\n",
+				    do_ctl_interval);
+				exit(1);
+			}
+		} else if (strcmp(arg, "--control-log") == 0) {
+			if (++i == argc) {
+				err(stderr, "missing argument to option "
+				    "'--control-log'\n");
+				exit(1);
+			}
+			do_ctl_log = argv[i];
 		} else {
 			err(stderr, "unrecognized option: %s\n", arg);
 			exit(1);
 		}
 	}
 
+	/* Closed loop control replaces the flat out cpu, hdd and vm hogs and
+	 * treats their fork counts as maximum worker counts.
+	 */
+	if (do_ctl) {
+		long long ctl_cpu = do_cpu ? do_cpu_forks :
+		    sysconf(_SC_NPROCESSORS_ONLN);
+		long long ctl_hdd = do_hdd ? do_hdd_forks : 1;
+		long long ctl_vm = do_vm ? do_vm_forks : 1;
+
+		if (do_ctl_profile) {
+			if (ctl_profile_load(do_ctl_profile))
+				exit(1);
+		} else if (ctl_profile_add(0, do_ctl_cpu, do_ctl_hdd,
+					   do_ctl_vm)) {
+			exit(1);
+		}
+
+		if (ctl_cpu <= 0 || ctl_hdd <= 0 || ctl_vm <= 0) {
+			err(stderr, "controlled worker counts must be "
+			    "positive\n");
+			exit(1);
+		}
+
+		out(stdout, "dispatching load controller\n");
+		fflush(stdout);
+
+		switch (pid = fork()) {
+		case 0:	/* child */
+			if (do_dryrun)
+				exit(0);
+			exit(hogctl(ctl_cpu, ctl_hdd, do_hdd_bytes, ctl_vm,
+				    do_ctl_interval, do_ctl_log));
+		case -1:	/* error */
+			err(stderr, "load controller fork failed\n");
+			exit(1);
+		default:	/* parent */
+			children++;
+			dbg(stdout, "--> load controller forked (%i)\n", pid);
+		}
+
+		do_cpu = do_vm = do_hdd = 0;
+	}
+
 	/* Hog CPU option.  */
 	if (do_cpu) {
 		out(stdout, "dispatching %lli hogcpu forks\n", do_cpu_forks);
@@ -351,10 +448,19 @@ int usage(int status)
 	    " -d, --hdd n           spawn n procs spinning on write()\n"
 	    "     --hdd-noclean     do not unlink file to which random data written\n"
 	    "     --hdd-files f     write to f files (default is 1)\n"
-	    "     --hdd-bytes b     write b bytes (default is 1GB)\n\n"
+	    "     --hdd-bytes b     write b bytes (default is 1GB)\n"
+	    "     --target-cpu p    hold total cpu utilisation at p percent\n"
+	    "     --target-hdd r    hold disk writes at r bytes per second\n"
+	    "     --target-vm b     hold b bytes resident in the vm workers\n"
+	    "     --profile f       read time varying targets from file f\n"
+	    "     --control-interval n  sample and adjust every n ms (default 1000)\n"
+	    "     --control-log f   write per interval targets and load to f\n\n"
 	    "Infinity is denoted with 0.  For -m, -d: n=0 means infinite redo,\n"
 	    "n<0 means redo abs(n) times. Valid suffixes are m,h,d,y for time;\n"
-	    "k,m,g for size.\n\n";
+	    "k,m,g for size.\n\n"
+	    "With --target-* or --profile, -c, -d and -m give the maximum number\n"
+	    "of controlled workers (default is all cpus, 1 and 1).  Profile lines\n"
+	    "are 'time cpu-percent hdd-rate vm-bytes', 0 leaves a class idle.\n\n";
 
 	fprintf(stdout, mesg, global_progname, global_progname);
 
@@ -891,3 +997,617 @@ int hoghdd(long long forks, int clean, long long files, long long bytes)
 
 	return retval;
 }
+
+/* Closed loop controller.
+ *
+ * Instead of spinning flat out, the controlled workers run at a duty cycle
+ * (CPU), a token bucket rate (HDD) or a resident set size (VM) commanded by
+ * the parent through a shared page.  Once per interval the parent samples
+ * /proc/stat, /proc/diskstats and the workers' /proc/<pid>/statm, compares
+ * what was delivered with the target of the current profile step and
+ * integrates the error into the next command.
+ */
+
+/* Length of a CPU worker duty cycle period in microseconds.  */
+#define CTL_CPU_PERIOD 20000
+
+/* Size of a single HDD worker write and how often data is synced.  */
+#define CTL_HDD_CHUNK (256 * 1024)
+#define CTL_HDD_SYNC (16 * CTL_HDD_CHUNK)
+
+/* How often the VM workers re-dirty their whole resident set.  */
+#define CTL_VM_REFRESH 10
+
+/* One step of a load profile, active from start seconds on.  A target of
+ * 0 leaves the class idle; a class that is 0 in every step gets no workers.
+ */
+struct ctl_step {
+	long start;
+	double cpu;		/* percent of all CPUs */
+	long long hdd;		/* bytes/s written */
+	long long vm;		/* resident bytes */
+};
+
+/* Commands from the controller to the workers.  */
+struct ctl_shared {
+	volatile int stop;
+	volatile int cpu_active;
+	volatile int cpu_duty;	/* busy part of the period in ppm */
+	volatile long long hdd_rate;	/* bytes/s for all writers together */
+	volatile long long vm_cmd;	/* resident bytes per vm worker */
+	volatile long long hdd_written;	/* bytes written by all writers */
+};
+
+/* Load profile, a single step when only --target-* options are used.  */
+static struct ctl_step *global_profile;
+static int global_profile_len;
+
+static long long ctl_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void ctl_sleep_until(long long deadline)
+{
+	long long delta = deadline - ctl_now_us();
+
+	if (delta > 0)
+		usleep(delta);
+}
+
+/* Append one step to the profile, steps must be sorted by start time.  */
+int ctl_profile_add(long start, double cpu, long long hdd, long long vm)
+{
+	struct ctl_step *step;
+
+	if (global_profile_len &&
+	    global_profile[global_profile_len - 1].start >= start) {
+		err(stderr, "profile steps must have increasing start times\n");
+		return -1;
+	}
+
+	step = realloc(global_profile,
+		       (global_profile_len + 1) * sizeof(*global_profile));
+	if (step == NULL) {
+		err(stderr, "failed to allocate profile step\n");
+		return -1;
+	}
+	global_profile = step;
+
+	step = &global_profile[global_profile_len++];
+	step->start = start;
+	step->cpu = cpu;
+	step->hdd = hdd;
+	step->vm = vm;
+
+	return 0;
+}
+
+/* Read a profile file.  Each line holds "time cpu% hdd-rate vm-bytes",
+ * using the usual time and size suffixes, and sets the targets from that
+ * time on.  Empty lines and lines starting with '#' are ignored.
+ */
+int ctl_profile_load(const char *path)
+{
+	char line[256], t[64], hdd[64], vm[64];
+	double cpu;
+	int lineno = 0;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		err(stderr, "can't open profile %s: %s\n", path,
+		    strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *p = line;
+
+		lineno++;
+		while (isspace((int)*p))
+			p++;
+		if (*p == '\0' || *p == '#')
+			continue;
+
+		if (sscanf(p, "%63s %lf %63s %63s", t, &cpu, hdd, vm) != 4) {
+			err(stderr, "%s:%i: expected 'time cpu hdd vm'\n",
+			    path, lineno);
+			fclose(f);
+			return -1;
+		}
+
+		if (ctl_profile_add(atoll_s(t), cpu, atoll_b(hdd),
+				    atoll_b(vm))) {
+			fclose(f);
+			return -1;
+		}
+	}
+
+	fclose(f);
+
+	if (global_profile_len == 0) {
+		err(stderr, "profile %s has no steps\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static struct ctl_step *ctl_profile_at(long elapsed)
+{
+	int i;
+
+	for (i = global_profile_len - 1; i > 0; i--)
+		if (global_profile[i].start <= elapsed)
+			break;
+
+	return &global_profile[i];
+}
+
+static int ctl_read_cpu(unsigned long long *busy, unsigned long long *total)
+{
+	unsigned long long v[8];
+	int i, n;
+	FILE *f;
+
+	if ((f = fopen("/proc/stat", "r")) == NULL)
+		return -1;
+
+	memset(v, 0, sizeof(v));
+	n = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+		   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+	fclose(f);
+
+	if (n < 4)
+		return -1;
+
+	*total = 0;
+	for (i = 0; i < 8; i++)
+		*total += v[i];
+	/* idle and iowait */
+	*busy = *total - v[3] - v[4];
+
+	return 0;
+}
+
+/* Sectors written to the block device backing the current directory.  */
+static int ctl_read_disk(dev_t dev, unsigned long long *bytes)
+{
+	unsigned int maj, min;
+	unsigned long long sectors;
+	char line[512];
+	FILE *f;
+
+	if ((f = fopen("/proc/diskstats", "r")) == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%u %u %*s %*u %*u %*u %*u %*u %*u %llu",
+			   &maj, &min, &sectors) != 3)
+			continue;
+		if (maj == major(dev) && min == minor(dev)) {
+			fclose(f);
+			*bytes = sectors * 512;
+			return 0;
+		}
+	}
+
+	fclose(f);
+	return -1;
+}
+
+static long long ctl_read_rss(pid_t pid)
+{
+	char path[64];
+	long long size, resident;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%i/statm", pid);
+	if ((f = fopen(path, "r")) == NULL)
+		return 0;
+
+	if (fscanf(f, "%lli %lli", &size, &resident) != 2)
+		resident = 0;
+	fclose(f);
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void ctl_cpu_worker(struct ctl_shared *shm, int idx)
+{
+	long long start, busy;
+
+	while (!shm->stop) {
+		start = ctl_now_us();
+
+		if (idx >= shm->cpu_active) {
+			ctl_sleep_until(start + CTL_CPU_PERIOD);
+			continue;
+		}
+
+		busy = (long long)CTL_CPU_PERIOD * shm->cpu_duty / 1000000;
+		while (ctl_now_us() - start < busy)
+			sqrt(rand());
+
+		ctl_sleep_until(start + CTL_CPU_PERIOD);
+	}
+}
+
+static void ctl_hdd_worker(struct ctl_shared *shm, int workers,
+			   long long bytes)
+{
+	static char buff[CTL_HDD_CHUNK];
+	char name[] = "./stress.XXXXXX";
+	long long last, now, pos = 0, unsynced = 0;
+	double tokens = 0;
+	int fd, i;
+
+	for (i = 0; i < CTL_HDD_CHUNK - 1; i++)
+		buff[i] = 32 + rand() % 95;
+	buff[i] = '\n';
+
+	if ((fd = mkstemp(name)) < 0) {
+		err(stderr, "mkstemp failed: %s\n", strerror(errno));
+		exit(1);
+	}
+	unlink(name);
+
+	last = ctl_now_us();
+	while (!shm->stop) {
+		double rate = (double)shm->hdd_rate / workers;
+
+		now = ctl_now_us();
+		tokens += rate * (now - last) / 1000000;
+		last = now;
+
+		/* Don't let an idle period turn into a burst.  */
+		if (tokens > 4 * CTL_HDD_CHUNK)
+			tokens = 4 * CTL_HDD_CHUNK;
+
+		if (tokens < CTL_HDD_CHUNK) {
+			if (rate > 0)
+				usleep((CTL_HDD_CHUNK - tokens) / rate *
+				       1000000);
+			else
+				usleep(CTL_CPU_PERIOD);
+			continue;
+		}
+
+		if (bytes && pos + CTL_HDD_CHUNK > bytes)
+			pos = 0;
+
+		if (pwrite(fd, buff, CTL_HDD_CHUNK, pos) != CTL_HDD_CHUNK) {
+			err(stderr, "write failed: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		pos += CTL_HDD_CHUNK;
+		tokens -= CTL_HDD_CHUNK;
+		__sync_fetch_and_add(&shm->hdd_written, CTL_HDD_CHUNK);
+
+		if ((unsynced += CTL_HDD_CHUNK) >= CTL_HDD_SYNC) {
+			fdatasync(fd);
+			unsynced = 0;
+		}
+	}
+
+	close(fd);
+}
+
+static void ctl_vm_worker(struct ctl_shared *shm, long long max)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	long long touched = 0, cmd, k;
+	int round = 0;
+	char *ptr;
+
+	ptr = mmap(NULL, max, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (ptr == MAP_FAILED) {
+		err(stderr, "hogvm mmap of %lli bytes failed\n", max);
+		exit(1);
+	}
+
+	while (!shm->stop) {
+		cmd = shm->vm_cmd;
+		if (cmd > max)
+			cmd = max;
+		cmd -= cmd % page;
+
+		if (cmd < touched) {
+			madvise(ptr + cmd, touched - cmd, MADV_DONTNEED);
+			touched = cmd;
+		}
+
+		/* Periodically fault back whatever was reclaimed.  */
+		k = (++round % CTL_VM_REFRESH) ? touched : 0;
+		for (; k < cmd; k += page)
+			ptr[k] = 'Z';
+		touched = cmd;
+
+		usleep(100000);
+	}
+
+	munmap(ptr, max);
+}
+
+static pid_t ctl_fork(struct ctl_shared *shm, const char *what)
+{
+	pid_t pid;
+
+	/* Or every worker flushes its copy of the buffered output.  */
+	fflush(NULL);
+	pid = fork();
+
+	switch (pid) {
+	case 0:		/* child */
+		/* Don't outlive a controller killed by a signal.  */
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		return 0;
+	case -1:
+		err(stderr, "%s worker fork failed\n", what);
+		shm->stop = 1;
+		return -1;
+	default:
+		dbg(stdout, "--> %s worker forked (%i)\n", what, pid);
+		return pid;
+	}
+}
+
+static double ctl_clamp(double v, double lo, double hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+/* Run the controlled workers until the timeout or the end of the profile.
+ * cpu_max, hdd_max and vm_max are the maximum worker counts per class.
+ */
+int hogctl(long long cpu_max, long long hdd_max, long long hdd_bytes,
+	   long long vm_max, int interval, const char *logpath)
+{
+	int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int do_cpu = 0, do_hdd = 0, do_vm = 0, retval = 0, disk_ok, n;
+	unsigned long long busy0, total0, busy1, total1, disk0, disk1;
+	long long vm_max_bytes = 0, hdd_written0, start, deadline, i;
+	double cpu_cmd = 0, hdd_corr = 0, vm_corr = 0;
+	double cpu_err = 0, hdd_err = 0, vm_err = 0;
+	double cpu_sum = 0, hdd_sum = 0, vm_sum = 0;
+	long samples = 0, end = global_timeout;
+	struct ctl_shared *shm;
+	struct stat st;
+	pid_t *pids, *vm_pids;
+	FILE *log = NULL;
+
+	for (n = 0; n < global_profile_len; n++) {
+		struct ctl_step *step = &global_profile[n];
+
+		do_cpu |= step->cpu > 0;
+		do_hdd |= step->hdd > 0;
+		do_vm |= step->vm > 0;
+		if (step->vm > vm_max_bytes)
+			vm_max_bytes = step->vm;
+	}
+
+	/* Without a timeout the last profile step marks the end of the run.  */
+	if (end == 0 && global_profile_len > 1)
+		end = global_profile[global_profile_len - 1].start;
+
+	if (!do_cpu)
+		cpu_max = 0;
+	if (!do_hdd)
+		hdd_max = 0;
+	if (!do_vm)
+		vm_max = 0;
+
+	/* Leave some room for the controller to overshoot reclaim.  */
+	vm_max_bytes = vm_max ? vm_max_bytes / vm_max * 5 / 4 : 0;
+
+	if (logpath && (log = fopen(logpath, "w")) == NULL) {
+		err(stderr, "can't open control log %s: %s\n", logpath,
+		    strerror(errno));
+		return 1;
+	}
+	if (log)
+		fprintf(log, "time,cpu_target,cpu,hdd_target,hdd,vm_target,vm,"
+			"cpu_workers,cpu_duty\n");
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	pids = malloc((cpu_max + hdd_max + vm_max + 1) * sizeof(*pids));
+	if (shm == MAP_FAILED || pids == NULL) {
+		err(stderr, "failed to allocate controller state\n");
+		return 1;
+	}
+	memset(shm, 0, sizeof(*shm));
+	vm_pids = pids + cpu_max + hdd_max;
+
+	out(stdout, "controlling %lli cpu, %lli hdd and %lli vm workers "
+	    "every %ims\n", cpu_max, hdd_max, vm_max, interval);
+
+	n = 0;
+	for (i = 0; i < cpu_max && !shm->stop; i++) {
+		if ((pids[n] = ctl_fork(shm, "hogcpu")) == 0) {
+			ctl_cpu_worker(shm, i);
+			_exit(0);
+		}
+		n += pids[n] > 0;
+	}
+	for (i = 0; i < hdd_max && !shm->stop; i++) {
+		if ((pids[n] = ctl_fork(shm, "hoghdd")) == 0) {
+			ctl_hdd_worker(shm, hdd_max, hdd_bytes);
+			_exit(0);
+		}
+		n += pids[n] > 0;
+	}
+	for (i = 0; i < vm_max && !shm->stop; i++) {
+		if ((pids[n] = ctl_fork(shm, "hogvm")) == 0) {
+			ctl_vm_worker(shm, vm_max_bytes);
+			_exit(0);
+		}
+		n += pids[n] > 0;
+	}
+
+	if (stat(".", &st) == 0 && ctl_read_disk(st.st_dev, &disk0) == 0) {
+		disk_ok = 1;
+	} else {
+		wrn(stderr, "no diskstats for the current directory, "
+		    "accounting hdd load from the writers\n");
+		disk_ok = 0;
+	}
+	hdd_written0 = shm->hdd_written;
+
+	if (ctl_read_cpu(&busy0, &total0)) {
+		err(stderr, "can't read /proc/stat\n");
+		shm->stop = 1;
+	}
+
+	/* Start from the first step's targets as a feed forward guess.  */
+	if (cpu_max) {
+		cpu_cmd = ctl_clamp(global_profile[0].cpu / 100 * ncpus, 0,
+				    cpu_max);
+		shm->cpu_active = (int)cpu_cmd + (cpu_cmd > (int)cpu_cmd);
+		shm->cpu_duty = shm->cpu_active ?
+		    cpu_cmd / shm->cpu_active * 1000000 : 0;
+	}
+	if (hdd_max)
+		shm->hdd_rate = global_profile[0].hdd;
+	if (vm_max)
+		shm->vm_cmd = global_profile[0].vm / vm_max;
+
+	start = deadline = ctl_now_us();
+	while (!shm->stop) {
+		struct ctl_step *step;
+		double cpu = 0, hdd = 0, vm = 0, dt;
+		long elapsed;
+		long long now;
+
+		deadline += interval * 1000LL;
+		ctl_sleep_until(deadline);
+
+		now = ctl_now_us();
+		elapsed = (now - start) / 1000000;
+		if (end && elapsed >= end)
+			break;
+		step = ctl_profile_at(elapsed);
+		dt = (double)interval / 1000;
+
+		/* Measure what was delivered during the last interval.  */
+		if (do_cpu && ctl_read_cpu(&busy1, &total1) == 0) {
+			if (total1 > total0)
+				cpu = 100.0 * (busy1 - busy0) /
+				    (total1 - total0);
+			busy0 = busy1;
+			total0 = total1;
+		}
+
+		if (do_hdd) {
+			if (disk_ok && ctl_read_disk(st.st_dev, &disk1) == 0) {
+				hdd = (disk1 - disk0) / dt;
+				disk0 = disk1;
+			} else {
+				long long w = shm->hdd_written;
+
+				hdd = (w - hdd_written0) / dt;
+				hdd_written0 = w;
+			}
+		}
+
+		if (do_vm)
+			for (i = 0; i < vm_max; i++)
+				vm += ctl_read_rss(vm_pids[i]);
+
+		/* Integrate the error into the next command.  */
+		if (do_cpu) {
+			cpu_cmd += (step->cpu - cpu) / 100 * ncpus / 2;
+			cpu_cmd = ctl_clamp(cpu_cmd, 0, cpu_max);
+			shm->cpu_active = (int)cpu_cmd + (cpu_cmd > (int)cpu_cmd);
+			shm->cpu_duty = shm->cpu_active ?
+			    cpu_cmd / shm->cpu_active * 1000000 : 0;
+		}
+
+		/* HDD and VM commands are the target plus a correction.  */
+		if (do_hdd) {
+			hdd_corr += (step->hdd - hdd) / 2;
+			hdd_corr = ctl_clamp(hdd_corr, -(double)step->hdd,
+					     3.0 * step->hdd);
+			shm->hdd_rate = step->hdd + hdd_corr;
+		}
+
+		if (do_vm) {
+			vm_corr += (step->vm - vm) / vm_max / 2;
+			vm_corr = ctl_clamp(vm_corr, -(double)step->vm / vm_max,
+					    vm_max_bytes);
+			shm->vm_cmd = ctl_clamp(step->vm / vm_max + vm_corr, 0,
+						vm_max_bytes);
+		}
+
+		/* The first interval only primes the counters.  */
+		if (now - start >= 2 * interval * 1000LL) {
+			samples++;
+			cpu_sum += cpu;
+			hdd_sum += hdd;
+			vm_sum += vm;
+			cpu_err += fabs(step->cpu - cpu);
+			hdd_err += fabs(step->hdd - hdd);
+			vm_err += fabs(step->vm - vm);
+		}
+
+		out(stdout, "%lis cpu %.1f%%/%.1f%% hdd %.1f/%.1f MB/s "
+		    "vm %.1f/%.1f MB\n", elapsed, cpu, step->cpu,
+		    hdd / 1048576, (double)step->hdd / 1048576,
+		    vm / 1048576, (double)step->vm / 1048576);
+
+		if (log) {
+			fprintf(log, "%.3f,%.1f,%.1f,%lli,%.0f,%lli,%.0f,%i,%i\n",
+				(now - start) / 1000000.0, step->cpu, cpu,
+				step->hdd, hdd, step->vm, vm,
+				shm->cpu_active, shm->cpu_duty);
+			fflush(log);
+		}
+	}
+
+	shm->stop = 1;
+	for (i = 0; i < n; i++)
+		kill(pids[i], SIGTERM);
+	while (n) {
+		int status;
+
+		if (wait(&status) < 0) {
+			err(stderr, "detected missing controlled workers\n");
+			++retval;
+			break;
+		}
+		if (WIFEXITED(status) && WEXITSTATUS(status)) {
+			err(stderr, "controlled worker exited %i\n",
+			    WEXITSTATUS(status));
+			++retval;
+		}
+		--n;
+	}
+
+	/* Report the load actually delivered for reproducibility.  */
+	if (samples) {
+		if (do_cpu)
+			out(stdout, "delivered cpu %.1f%% avg, %.1f%% mean "
+			    "abs error\n", cpu_sum / samples,
+			    cpu_err / samples);
+		if (do_hdd)
+			out(stdout, "delivered hdd %.1f MB/s avg, %.1f MB/s "
+			    "mean abs error\n", hdd_sum / samples / 1048576,
+			    hdd_err / samples / 1048576);
+		if (do_vm)
+			out(stdout, "delivered vm %.1f MB avg, %.1f MB mean "
+			    "abs error\n", vm_sum / samples / 1048576,
+			    vm_err / samples / 1048576);
+	}
+
+	if (log)
+		fclose(log);
+	free(pids);
+	munmap(shm, sizeof(*shm));
+
+	return retval;
+}
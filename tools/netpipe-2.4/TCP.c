@@ -11,7 +11,45 @@
 /*     * TCP.c              ---- TCP calls source                            */
 /*     * TCP.h              ---- Include file for TCP calls and data structs */
 /*****************************************************************************/
+#define     _GNU_SOURCE
 #include    "netpipe.h"
+#include    <fcntl.h>
+#include    <poll.h>
+#include    <sys/sendfile.h>
+#include    <sys/uio.h>
+#include    <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY                 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY                0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY       5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED  1
+#endif
+
+/* Reap MSG_ZEROCOPY completions once this many are outstanding */
+#define ZC_BATCH                    32
+
+static const char *modes[] = { "write", "sendfile", "splice", "zerocopy" };
+
+/* Buffer currently copied into the sendfile() source file */
+static char *file_buff;
+static int file_len;
+
+int TCPMode(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+		if (strcmp(name, modes[i]) == 0)
+			return i;
+	return -1;
+}
 
 int Setup(ArgStruct * p)
 {
@@ -157,45 +195,216 @@ void PrepareToReceive(ArgStruct * p)
 	 */
 }
 
-void SendData(ArgStruct * p)
+/*
+   Reap the MSG_ZEROCOPY completion notifications queued on the error queue
+   of stream i, optionally waiting a little for the first one to arrive.
+ */
+static void ReapZeroCopy(ArgStruct * p, int i, int wait)
 {
-	int bytesWritten, bytesLeft;
-	char *q;
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *serr;
+	struct pollfd pfd;
+	unsigned long n;
+
+	if (wait) {
+		pfd.fd = p->prot.streamfd[i];
+		pfd.events = 0;
+		poll(&pfd, 1, 10);
+	}
 
-	bytesLeft = p->bufflen;
-	bytesWritten = 0;
-	q = p->buff;
-	while (bytesLeft > 0 &&
-	       (bytesWritten = write(p->commfd, q, bytesLeft)) > 0) {
-		bytesLeft -= bytesWritten;
-		q += bytesWritten;
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(p->prot.streamfd[i], &msg, MSG_ERRQUEUE) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			printf("NetPIPE: recvmsg(MSG_ERRQUEUE) failed, "
+			       "errno=%d\n", errno);
+			exit(402);
+		}
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (cm->cmsg_level != SOL_IP
+			    || cm->cmsg_type != IP_RECVERR)
+				continue;
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_errno != 0
+			    || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			n = serr->ee_data - serr->ee_info + 1;
+			p->prot.zc_done += n;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				p->prot.zc_copied += n;
+		}
 	}
-	if (bytesWritten == -1) {
-		printf("NetPIPE: write: error encountered, errno=%d\n", errno);
-		exit(401);
+}
+
+/*
+   Move some of the len bytes at buf (pos bytes into the message) out on
+   stream i. Returns the number of bytes moved or -1 with errno set, EAGAIN
+   meaning that the stream can't make progress right now.
+ */
+static int SendSome(ArgStruct * p, int i, char *buf, int len, int pos)
+{
+	int fd = p->prot.streamfd[i];
+	int flags = p->prot.nstreams > 1 ? SPLICE_F_NONBLOCK : 0;
+	unsigned int *inpipe;
+	struct iovec iov;
+	off_t off;
+	int ret;
+
+	switch (p->prot.mode) {
+	case NP_SENDFILE:
+		off = pos;
+		return sendfile(fd, p->prot.filefd, &off, len);
+
+	case NP_SPLICE:
+		/* The pipe holds the start of buf until it is drained */
+		inpipe = &p->prot.inpipe[i];
+		if (*inpipe == 0) {
+			iov.iov_base = buf;
+			iov.iov_len = len;
+			ret = vmsplice(p->prot.pipefd[i][1], &iov, 1, flags);
+			if (ret <= 0)
+				return ret;
+			*inpipe = ret;
+		}
+		ret = splice(p->prot.pipefd[i][0], NULL, fd, NULL, *inpipe,
+			     flags | SPLICE_F_MOVE);
+		if (ret > 0)
+			*inpipe -= ret;
+		return ret;
+
+	case NP_ZEROCOPY:
+		if (p->prot.zc_sent - p->prot.zc_done >= ZC_BATCH)
+			ReapZeroCopy(p, i, 0);
+		ret = send(fd, buf, len, MSG_ZEROCOPY);
+		if (ret >= 0) {
+			p->prot.zc_sent++;
+		} else if (errno == ENOBUFS) {
+			/* Out of option memory until completions are reaped */
+			ReapZeroCopy(p, i, 1);
+			errno = EAGAIN;
+		}
+		return ret;
+
+	default:
+		return write(fd, buf, len);
 	}
 }
 
-void RecvData(ArgStruct * p)
+/* Receive side counterpart of SendSome() */
+static int RecvSome(ArgStruct * p, int i, char *buf, int len)
 {
-	int bytesLeft;
-	int bytesRead;
-	char *q;
+	int fd = p->prot.streamfd[i];
+	int flags = p->prot.nstreams > 1 ? SPLICE_F_NONBLOCK : 0;
+	int ret, n, done;
+
+	if (p->prot.mode != NP_SPLICE)
+		return read(fd, buf, len);
+
+	ret = splice(fd, NULL, p->prot.pipefd[i][1], NULL, len,
+		     flags | SPLICE_F_MOVE);
+	for (done = 0; done < ret; done += n) {
+		n = splice(p->prot.pipefd[i][0], NULL, p->prot.nullfd, NULL,
+			   ret - done, SPLICE_F_MOVE);
+		if (n <= 0) {
+			printf("NetPIPE: splice to /dev/null failed, "
+			       "errno=%d\n", errno);
+			exit(401);
+		}
+	}
+	return ret;
+}
 
-	bytesLeft = p->bufflen;
-	bytesRead = 0;
-	q = p->buff1;
-	while (bytesLeft > 0 && (bytesRead = read(p->commfd, q, bytesLeft)) > 0) {
-		bytesLeft -= bytesRead;
-		q += bytesRead;
+/*
+   Move the whole message, split evenly over the data streams. A single
+   stream is a blocking socket; with more of them the sockets are
+   non-blocking and poll() tells which of them can make progress.
+ */
+static void Transfer(ArgStruct * p, int tx)
+{
+	struct pollfd pfd[MAXSTREAMS];
+	int off[MAXSTREAMS], left[MAXSTREAMS];
+	int n = p->prot.nstreams, slice = p->bufflen / n;
+	char *buf = tx ? p->buff : p->buff1;
+	int i, ret, active;
+
+	for (i = 0; i < n; i++) {
+		off[i] = i * slice;
+		left[i] = i == n - 1 ? p->bufflen - off[i] : slice;
+	}
+
+	for (;;) {
+		active = 0;
+		for (i = 0; i < n; i++) {
+			if (left[i] == 0)
+				continue;
+			if (tx)
+				ret = SendSome(p, i, buf + off[i], left[i],
+					       off[i]);
+			else
+				ret = RecvSome(p, i, buf + off[i], left[i]);
+			if (ret > 0) {
+				off[i] += ret;
+				left[i] -= ret;
+			} else if (ret == 0 && !tx) {
+				printf("NetPIPE: \"end of file\" encountered "
+				       "on reading from socket\n");
+				return;
+			} else if (ret < 0 && errno != EAGAIN) {
+				printf("NetPIPE: %s: error encountered, "
+				       "errno=%d\n", tx ? "write" : "read",
+				       errno);
+				exit(401);
+			}
+			if (left[i] > 0) {
+				pfd[active].fd = p->prot.streamfd[i];
+				pfd[active].events = tx ? POLLOUT : POLLIN;
+				active++;
+			}
+		}
+		if (active == 0)
+			break;
+		if (n > 1 && poll(pfd, active, -1) < 0 && errno != EINTR) {
+			printf("NetPIPE: poll: error encountered, errno=%d\n",
+			       errno);
+			exit(401);
+		}
 	}
-	if (bytesLeft > 0 && bytesRead == 0) {
-		printf
-		    ("NetPIPE: \"end of file\" encountered on reading from socket\n");
-	} else if (bytesRead == -1) {
-		printf("NetPIPE: read: error encountered, errno=%d\n", errno);
-		exit(401);
+}
+
+void SendData(ArgStruct * p)
+{
+	int bytesWritten, bytesLeft;
+
+	/* sendfile() needs the message in its source file */
+	if (p->prot.mode == NP_SENDFILE
+	    && (p->buff != file_buff || p->bufflen != file_len)) {
+		for (bytesLeft = 0; bytesLeft < p->bufflen;
+		     bytesLeft += bytesWritten) {
+			bytesWritten = pwrite(p->prot.filefd,
+					      p->buff + bytesLeft,
+					      p->bufflen - bytesLeft,
+					      bytesLeft);
+			if (bytesWritten <= 0) {
+				printf("NetPIPE: can't write the sendfile "
+				       "source, errno=%d\n", errno);
+				exit(401);
+			}
+		}
+		file_buff = p->buff;
+		file_len = p->bufflen;
 	}
+
+	Transfer(p, 1);
+}
+
+void RecvData(ArgStruct * p)
+{
+	Transfer(p, 0);
 }
 
 void SendTime(ArgStruct * p, double *t)
@@ -271,6 +480,123 @@ void RecvRepeat(ArgStruct * p, int *rpt)
 	*rpt = lrpt;
 }
 
+/* Socket options of the extra data connections, as set on commfd */
+static void StreamOpts(ArgStruct * p, int fd)
+{
+	int one = 1;
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+		printf("NetPIPE: setsockopt: TCP_NODELAY failed! errno=%d\n",
+		       errno);
+		exit(556);
+	}
+	if (p->prot.sndbufsz > 0
+	    && (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &(p->prot.sndbufsz),
+			   sizeof(p->prot.sndbufsz)) < 0
+		|| setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &(p->prot.rcvbufsz),
+			      sizeof(p->prot.rcvbufsz)) < 0)) {
+		printf("NetPIPE: setsockopt: SO_SNDBUF/SO_RCVBUF failed! "
+		       "errno=%d\n", errno);
+		exit(556);
+	}
+}
+
+/*
+   Open the data streams and whatever the transfer mode needs. commfd
+   carries the data when there is only one stream; with more of them it
+   only carries the synchronization and the data goes over nstreams extra
+   non-blocking connections.
+ */
+static void OpenStreams(ArgStruct * p)
+{
+	int i, fd, one = 1;
+	socklen_t clen;
+	FILE *tmp;
+
+	p->prot.streamfd = malloc(p->prot.nstreams * sizeof(int));
+	p->prot.pipefd = malloc(p->prot.nstreams * sizeof(*p->prot.pipefd));
+	p->prot.inpipe = calloc(p->prot.nstreams, sizeof(unsigned int));
+	if (!p->prot.streamfd || !p->prot.pipefd || !p->prot.inpipe) {
+		printf("NetPIPE: can't allocate the streams\n");
+		exit(-4);
+	}
+
+	if (p->prot.nstreams == 1) {
+		p->prot.streamfd[0] = p->commfd;
+	} else {
+		for (i = 0; i < p->prot.nstreams; i++) {
+			if (p->tr) {
+				fd = socket(AF_INET, SOCK_STREAM, 0);
+				if (fd < 0) {
+					printf("NetPIPE: can't open stream "
+					       "socket! errno=%d\n", errno);
+					exit(-4);
+				}
+				StreamOpts(p, fd);
+				if (connect(fd, (struct sockaddr *)&p->prot.sin1,
+					    sizeof(p->prot.sin1)) < 0) {
+					printf("Client: Cannot Connect stream "
+					       "%d! errno=%d\n", i, errno);
+					exit(-10);
+				}
+			} else {
+				clen = sizeof(p->prot.sin2);
+				fd = accept(p->servicefd,
+					    (struct sockaddr *)&p->prot.sin2,
+					    &clen);
+				if (fd < 0) {
+					printf("Server: Accept of stream %d "
+					       "Failed! errno=%d\n", i, errno);
+					exit(-12);
+				}
+				StreamOpts(p, fd);
+			}
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			p->prot.streamfd[i] = fd;
+		}
+	}
+
+	switch (p->prot.mode) {
+	case NP_SENDFILE:
+		if ((tmp = tmpfile()) == NULL) {
+			printf("NetPIPE: can't create the sendfile source! "
+			       "errno=%d\n", errno);
+			exit(-4);
+		}
+		p->prot.filefd = fileno(tmp);
+		break;
+
+	case NP_SPLICE:
+		p->prot.nullfd = open("/dev/null", O_WRONLY);
+		if (p->prot.nullfd < 0) {
+			printf("NetPIPE: can't open /dev/null! errno=%d\n",
+			       errno);
+			exit(-4);
+		}
+		for (i = 0; i < p->prot.nstreams; i++) {
+			if (pipe(p->prot.pipefd[i]) < 0) {
+				printf("NetPIPE: pipe failed! errno=%d\n",
+				       errno);
+				exit(-4);
+			}
+			/* A bigger pipe means fewer splice() calls, if allowed */
+			fcntl(p->prot.pipefd[i][1], F_SETPIPE_SZ, 1 << 20);
+		}
+		break;
+
+	case NP_ZEROCOPY:
+		for (i = 0; i < p->prot.nstreams; i++) {
+			if (setsockopt(p->prot.streamfd[i], SOL_SOCKET,
+				       SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+				printf("NetPIPE: setsockopt: SO_ZEROCOPY "
+				       "failed! errno=%d\n", errno);
+				exit(556);
+			}
+		}
+		break;
+	}
+}
+
 int Establish(ArgStruct * p)
 {
 	socklen_t clen;
@@ -286,7 +612,8 @@ int Establish(ArgStruct * p)
 		}
 	} else {
 		/* SERVER */
-		listen(p->servicefd, 5);
+		/* the client may connect all of its data streams at once */
+		listen(p->servicefd, SOMAXCONN);
 		p->commfd =
 		    accept(p->servicefd, (struct sockaddr *)&(p->prot.sin2),
 			   &clen);
@@ -337,12 +664,30 @@ int Establish(ArgStruct * p)
 			}
 		}
 	}
+
+	OpenStreams(p);
 	return (0);
 }
 
 int CleanUp(ArgStruct * p)
 {
 	char *quit = "QUIT";
+	int i, tries;
+
+	if (p->prot.mode == NP_ZEROCOPY) {
+		/* Collect what is still outstanding, for a second at most */
+		for (tries = 0; tries < 100
+		     && p->prot.zc_done < p->prot.zc_sent; tries++)
+			for (i = 0; i < p->prot.nstreams; i++)
+				ReapZeroCopy(p, i, 1);
+		fprintf(stderr, "NetPIPE: MSG_ZEROCOPY: %lu sends, %lu "
+			"completed, %lu of them copied\n", p->prot.zc_sent,
+			p->prot.zc_done, p->prot.zc_copied);
+	}
+	if (p->prot.nstreams > 1)
+		for (i = 0; i < p->prot.nstreams; i++)
+			close(p->prot.streamfd[i]);
+
 	if (p->tr) {
 		write(p->commfd, quit, 5);
 		read(p->commfd, quit, 5);
@@ -8,6 +8,14 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 
+/* How the data is moved, see TCPMode()                                     */
+#define NP_WRITE            0     /* write() and read()                     */
+#define NP_SENDFILE         1     /* sendfile() from a file, read()         */
+#define NP_SPLICE           2     /* vmsplice()+splice(), splice() to null  */
+#define NP_ZEROCOPY         3     /* send(MSG_ZEROCOPY), read()             */
+
+#define MAXSTREAMS          64
+
 typedef struct protocolstruct ProtocolStruct;
 struct protocolstruct
 {
@@ -17,5 +25,17 @@ struct protocolstruct
     struct hostent          *addr;    /* Address of host                */
     int                     sndbufsz, /* Size of TCP send buffer        */
                             rcvbufsz; /* Size of TCP receive buffer     */
+    int                     mode,     /* One of the NP_* modes above    */
+                            nstreams; /* Number of data connections     */
+    int                     *streamfd;/* Data sockets (commfd if one)   */
+    int                     filefd;   /* sendfile() source              */
+    int                     (*pipefd)[2]; /* splice() pipe per stream   */
+    unsigned int            *inpipe;  /* Bytes left in each pipe        */
+    int                     nullfd;   /* splice() sink                  */
+    unsigned long           zc_sent,  /* MSG_ZEROCOPY sends             */
+                            zc_done,  /*  ... completions reaped        */
+                            zc_copied;/*  ... which were copied anyway  */
 };
 
+int TCPMode(const char *name);
+
@@ -74,8 +74,14 @@ int main(int argc, char *argv[])
 		PrintUsage();
 #endif
 
+#if defined(TCP)
+	args.prot.mode = NP_WRITE;
+	args.prot.nstreams = 1;
+	args.prot.zc_sent = args.prot.zc_done = args.prot.zc_copied = 0;
+#endif
+
 	/* Parse the arguments. See Usage for description */
-	while ((c = getopt(argc, argv, "Pstrh:p:o:A:O:l:u:i:b:a")) != -1) {
+	while ((c = getopt(argc, argv, "Pstrh:p:o:A:O:l:u:i:b:am:n:")) != -1) {
 		switch (c) {
 		case 'o':
 			strcpy(s, optarg);
@@ -149,6 +155,26 @@ int main(int argc, char *argv[])
 			asyncReceive = 1;
 			break;
 
+#ifdef TCP
+		case 'm':
+			args.prot.mode = TCPMode(optarg);
+			if (args.prot.mode < 0) {
+				fprintf(stderr, "Unknown mode %s\n", optarg);
+				exit(-12);
+			}
+			break;
+
+		case 'n':
+			args.prot.nstreams = atoi(optarg);
+			if (args.prot.nstreams < 1
+			    || args.prot.nstreams > MAXSTREAMS) {
+				fprintf(stderr, "Need 1 to %d streams\n",
+					MAXSTREAMS);
+				exit(-12);
+			}
+			break;
+#endif
+
 		default:
 			PrintUsage();
 			exit(-12);
@@ -489,11 +515,12 @@ int main(int argc, char *argv[])
 }
 
 /* Return the current time in seconds, using a double precision number.      */
+/* The clock is monotonic and has nanosecond resolution.                     */
 double When()
 {
-	struct timeval tp;
-	gettimeofday(&tp, NULL);
-	return ((double)tp.tv_sec + (double)tp.tv_usec * 1e-6);
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return ((double)tp.tv_sec + (double)tp.tv_nsec * 1e-9);
 }
 
 void PrintUsage(void)
@@ -507,6 +534,10 @@ void PrintUsage(void)
 #endif
 	printf("i: specify increment step size e.g. <-i 64>\n");
 	printf("l: lower bound start value e.g. <-i 1>\n");
+#if defined(TCP)
+	printf("m: data path: write, sendfile, splice or zerocopy <-m splice>\n");
+	printf("n: number of parallel streams e.g. <-n 4>\n");
+#endif
 	printf("O: specify buffer offset e.g. <-O 127>\n");
 	printf("o: specify output filename <-o fn>\n");
 	printf("P: print on screen\n");
@@ -19,6 +19,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/time.h>       /* struct timeval */
+#include <time.h>           /* clock_gettime(2) */
 #ifdef HAVE_GETRUSAGE
 #include <sys/resource.h>
 #endif
@@ -0,0 +1,56 @@
+#!/bin/sh
+
+#    Copyright (c) Linux Test Project, 2013
+#
+#    This program is free software;  you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation; either version 2 of the License, or
+#    (at your option) any later version.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY;  without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See
+#    the GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program;  if not, write to the Free Software
+#    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#   FILE        : netpipe_veth.sh
+#   DESCRIPTION : runs NPtcp over a veth pair on a single box, the receiver
+#                 in its own network namespace so the traffic can't take
+#                 the loopback shortcut. All arguments are passed to both
+#                 sides, e.g. netpipe_veth.sh -m splice -n 4 -o out -P
+#                 Needs root and iproute2 with netns support.
+
+NS=netpipe$$
+ADDR0=${NETPIPE_ADDR0:-10.211.0.1}
+ADDR1=${NETPIPE_ADDR1:-10.211.0.2}
+PORT=${NETPIPE_PORT:-$((5100 + $$ % 800))}
+
+cleanup()
+{
+	[ -n "$RPID" ] && kill $RPID 2>/dev/null
+	ip link del np$$a 2>/dev/null
+	ip netns del $NS 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+ip netns add $NS || exit 1
+ip link add np$$a type veth peer name np$$b || exit 1
+ip link set np$$b netns $NS
+ip addr add $ADDR0/24 dev np$$a
+ip link set np$$a up
+ip netns exec $NS ip addr add $ADDR1/24 dev np$$b
+ip netns exec $NS ip link set np$$b up
+ip netns exec $NS ip link set lo up
+
+ip netns exec $NS NPtcp -r -p $PORT "$@" &
+RPID=$!
+sleep 1
+
+NPtcp -t -h $ADDR1 -p $PORT "$@"
+RET=$?
+wait $RPID
+RPID=
+exit $RET
@@ -0,0 +1,368 @@
+/* Resource classes of tests and the machine readable progress log. */
+
+/*
+ * Copyright (c) Linux Test Project, 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/time.h>
+
+#include "classes.h"
+
+/*
+ * A test is tagged with a class by a line "<name> <class>" in the file
+ * named by $POUNDER_CLASSES (default ./classes), <name> being the test
+ * name without its type and sequence number.  $POUNDER_CLASS_LIMITS
+ * ("cpu=4,mem=2,io=2") caps how many tests of each class run at once
+ * on the whole box; by default cpu gets one test per online CPU and the
+ * others two.  Untagged tests are not limited.
+ *
+ * The limits are the values of a SysV semaphore set created by the
+ * first runner and handed down to the runners of the subdirectories in
+ * $POUNDER_CLASS_SEMID, so that they are shared by the whole run.
+ */
+#define DEFAULT_LIMITS "mem=2,io=2,net=2"
+#define MAX_TAGS 256
+#define LINE_LEN 256
+
+union semun {
+	int val;
+	struct semid_ds *buf;
+	unsigned short *array;
+};
+
+struct tag_t {
+	char *name;
+	int cls;
+};
+
+static char *class_names[MAX_CLASSES];
+static int class_limits[MAX_CLASSES];
+static int nclasses;
+static struct tag_t tags[MAX_TAGS];
+static int ntags;
+static int semid = -1;
+static int sem_owner;
+static int progress_fd = -1;
+
+static int find_class(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nclasses; i++) {
+		if (strcmp(class_names[i], name) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void parse_limits(const char *limits)
+{
+	char *buf, *tok, *eq;
+
+	buf = strdup(limits);
+	for (tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		eq = strchr(tok, '=');
+		if (eq == NULL || nclasses == MAX_CLASSES) {
+			fprintf(stderr, "Ignoring class limit `%s'.\n", tok);
+			continue;
+		}
+		*eq = 0;
+		if (find_class(tok) >= 0) {
+			continue;
+		}
+		class_names[nclasses] = strdup(tok);
+		class_limits[nclasses] = atoi(eq + 1);
+		nclasses++;
+	}
+	free(buf);
+}
+
+static void read_tags(const char *fname)
+{
+	FILE *fp;
+	char line[LINE_LEN], name[LINE_LEN], cls[LINE_LEN];
+
+	fp = fopen(fname, "r");
+	if (fp == NULL) {
+		return;
+	}
+
+	while (fgets(line, LINE_LEN, fp) != NULL && ntags < MAX_TAGS) {
+		if (line[0] == '#' || sscanf(line, "%s %s", name, cls) != 2) {
+			continue;
+		}
+		tags[ntags].cls = find_class(cls);
+		if (tags[ntags].cls < 0) {
+			fprintf(stderr, "%s: unknown class `%s' for %s.\n",
+				fname, cls, name);
+			continue;
+		}
+		tags[ntags].name = strdup(name);
+		ntags++;
+	}
+	fclose(fp);
+}
+
+static void open_progress(void)
+{
+	char buf[LINE_LEN];
+	char *path;
+
+	path = getenv("POUNDER_PROGRESS");
+	if (path == NULL && getenv("POUNDER_LOGDIR") != NULL) {
+		snprintf(buf, LINE_LEN, "%s/progress", getenv("POUNDER_LOGDIR"));
+		path = buf;
+	}
+	if (path == NULL || *path == 0) {
+		return;
+	}
+
+	progress_fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (progress_fd < 0) {
+		perror(path);
+	}
+}
+
+/**
+ * Read the classes and their limits.  The owner (the leader) creates
+ * the semaphores, everybody else uses the ones in the environment.
+ */
+void init_classes(int owner)
+{
+	union semun arg;
+	char buf[LINE_LEN];
+	char *env;
+	int i;
+
+	open_progress();
+
+	env = getenv("POUNDER_CLASS_LIMITS");
+	if (env == NULL) {
+		snprintf(buf, LINE_LEN, "cpu=%ld,%s",
+			 sysconf(_SC_NPROCESSORS_ONLN), DEFAULT_LIMITS);
+		env = buf;
+	}
+	parse_limits(env);
+
+	env = getenv("POUNDER_CLASSES");
+	read_tags(env != NULL ? env : "classes");
+	if (ntags == 0) {
+		return;
+	}
+
+	env = getenv("POUNDER_CLASS_SEMID");
+	if (env != NULL && !owner) {
+		semid = atoi(env);
+		return;
+	}
+
+	semid = semget(IPC_PRIVATE, nclasses, IPC_CREAT | 0600);
+	if (semid < 0) {
+		perror("semget");
+		return;
+	}
+	sem_owner = 1;
+	for (i = 0; i < nclasses; i++) {
+		arg.val = class_limits[i];
+		semctl(semid, i, SETVAL, arg);
+	}
+	snprintf(buf, LINE_LEN, "%d", semid);
+	setenv("POUNDER_CLASS_SEMID", buf, 1);
+}
+
+/**
+ * Remove the semaphores, if we made them.
+ */
+void cleanup_classes(void)
+{
+	if (sem_owner) {
+		semctl(semid, 0, IPC_RMID);
+		sem_owner = 0;
+	}
+}
+
+/**
+ * Returns the class of a test (path to [TD]NNname), -1 if none.
+ */
+int test_class(const char *fname)
+{
+	const char *name;
+	int i;
+
+	if (semid < 0) {
+		return -1;
+	}
+
+	name = strrchr(fname, '/');
+	name = (name != NULL ? name + 1 : fname);
+	if (strlen(name) > 3) {
+		name += 3;
+	}
+
+	for (i = 0; i < ntags; i++) {
+		if (strcmp(tags[i].name, name) == 0) {
+			return tags[i].cls;
+		}
+	}
+
+	return -1;
+}
+
+const char *class_name(int cls)
+{
+	return (cls < 0 ? "none" : class_names[cls]);
+}
+
+/**
+ * Take a slot of the class.  Returns 1 if the test may start now.
+ */
+int acquire_class(int cls)
+{
+	struct sembuf op = { 0, -1, IPC_NOWAIT | SEM_UNDO };
+
+	if (cls < 0 || semid < 0) {
+		return 1;
+	}
+
+	op.sem_num = cls;
+	while (semop(semid, &op, 1) < 0) {
+		if (errno == EAGAIN) {
+			return 0;
+		} else if (errno != EINTR) {
+			perror("semop");
+			return 1;
+		}
+	}
+
+	return 1;
+}
+
+void release_class(int cls)
+{
+	struct sembuf op = { 0, 1, SEM_UNDO };
+
+	if (cls < 0 || semid < 0) {
+		return;
+	}
+
+	op.sem_num = cls;
+	semop(semid, &op, 1);
+}
+
+/*
+ * Append to the len bytes already in buf, stopping at the end of it.
+ * Returns the new length, which is at most size - 1.
+ */
+static int line_append(char *buf, int size, int len, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(buf + len, size - len, fmt, ap);
+	va_end(ap);
+	if (ret < 0 || ret >= size - len) {
+		return size - 1;
+	}
+	return len + ret;
+}
+
+/**
+ * Append one "key=value ..." line about an event and the state of the
+ * box to the progress log.  The line goes out in a single write, so the
+ * runners of all the directories can share the file.
+ */
+void progress_log(const char *event, const char *test, int cls,
+		  const char *result, int secs, int queued)
+{
+	char line[1024], buf[LINE_LEN];
+	struct timeval tv;
+	FILE *fp;
+	double load = 0;
+	char tasks[32] = "0/0";
+	unsigned long memavail = 0;
+	int len, i, val;
+
+	if (progress_fd < 0) {
+		return;
+	}
+
+	gettimeofday(&tv, NULL);
+	len = line_append(line, sizeof(line), 0,
+			  "time=%ld.%03ld runner=%d event=%s",
+			  (long)tv.tv_sec, (long)tv.tv_usec / 1000, getpid(),
+			  event);
+	if (test != NULL) {
+		len = line_append(line, sizeof(line), len,
+				  " test=%s class=%s", test, class_name(cls));
+	}
+	if (result != NULL) {
+		len = line_append(line, sizeof(line), len,
+				  " result=%s secs=%d", result, secs);
+	}
+
+	if (semid >= 0) {
+		len = line_append(line, sizeof(line), len, " running=");
+		for (i = 0; i < nclasses; i++) {
+			val = semctl(semid, i, GETVAL);
+			len = line_append(line, sizeof(line), len,
+					  "%s%s:%d/%d", i ? "," : "",
+					  class_names[i], class_limits[i] - val,
+					  class_limits[i]);
+		}
+	}
+
+	fp = fopen("/proc/loadavg", "r");
+	if (fp != NULL) {
+		if (fscanf(fp, "%lf %*f %*f %31s", &load, tasks) != 2) {
+			load = 0;
+		}
+		fclose(fp);
+	}
+	fp = fopen("/proc/meminfo", "r");
+	if (fp != NULL) {
+		while (fgets(buf, LINE_LEN, fp) != NULL) {
+			if (sscanf(buf, "MemAvailable: %lu", &memavail) == 1) {
+				break;
+			}
+		}
+		fclose(fp);
+	}
+
+	len = line_append(line, sizeof(line), len,
+			  " queued=%d load1=%.2f tasks=%s memavail_kb=%lu\n",
+			  queued, load, tasks, memavail);
+	/* A truncated line still has to end the record */
+	line[len - 1] = '\n';
+	if (write(progress_fd, line, len) < 0) {
+		perror("progress log");
+		close(progress_fd);
+		progress_fd = -1;
+	}
+}
@@ -0,0 +1,36 @@
+/* Declarations for resource classes and the progress log. */
+
+/*
+ * Copyright (c) Linux Test Project, 2013
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef CLASSES_H_
+#define CLASSES_H_
+
+#define MAX_CLASSES 16
+
+void init_classes(int owner);
+void cleanup_classes(void);
+int test_class(const char *fname);
+const char *class_name(int cls);
+int acquire_class(int cls);
+void release_class(int cls);
+void progress_log(const char *event, const char *test, int cls,
+		  const char *result, int secs, int queued);
+
+#endif
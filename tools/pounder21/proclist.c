@@ -22,35 +22,50 @@
 #include <malloc.h>
 #include "proclist.h"
 
+/*
+ * Items are kept in start order on the list and in a small hash on
+ * the pid, so that reaping a child doesn't mean walking every test.
+ */
 void add_to_proclist(struct proclist_t *list, struct proclist_item_t *item)
 {
-	struct proclist_item_t *curr;
+	struct proclist_item_t **bucket;
 
+	item->next = NULL;
 	if (list->head == NULL) {
-		item->next = NULL;
 		list->head = item;
-		return;
+	} else {
+		list->tail->next = item;
 	}
+	list->tail = item;
 
-	curr = list->head;
-	while (curr->next != NULL) {
-		curr = curr->next;
-	}
-
-	item->next = NULL;
-	curr->next = item;
+	bucket = &list->hash[item->pid % PROCLIST_HASH];
+	item->hnext = *bucket;
+	*bucket = item;
 }
 
 void remove_from_proclist(struct proclist_t *list, struct proclist_item_t *item)
 {
-	struct proclist_item_t *curr, *prev;
+	struct proclist_item_t *curr, *prev, **pp;
 
 	if (list->head == NULL) {
 		return;
 	}
 
+	pp = &list->hash[item->pid % PROCLIST_HASH];
+	while (*pp != NULL && *pp != item) {
+		pp = &(*pp)->hnext;
+	}
+	if (*pp == NULL) {
+		return;
+	}
+	*pp = item->hnext;
+	item->hnext = NULL;
+
 	if (list->head == item) {
 		list->head = item->next;
+		if (list->tail == item) {
+			list->tail = NULL;
+		}
 		item->next = NULL;
 		return;
 	}
@@ -68,5 +83,20 @@ void remove_from_proclist(struct proclist_t *list, struct proclist_item_t *item)
 	}
 
 	prev->next = item->next;
+	if (list->tail == item) {
+		list->tail = prev;
+	}
 	item->next = NULL;
 }
+
+struct proclist_item_t *find_in_proclist(struct proclist_t *list, pid_t pid)
+{
+	struct proclist_item_t *curr;
+
+	curr = list->hash[pid % PROCLIST_HASH];
+	while (curr != NULL && curr->pid != pid) {
+		curr = curr->hnext;
+	}
+
+	return curr;
+}
@@ -23,18 +23,28 @@
 #define PROCLIST_H_
 
 #include <sys/types.h>
+#include <time.h>
+
+#define PROCLIST_HASH 64
 
 struct proclist_item_t {
 	struct proclist_item_t *next;
+	struct proclist_item_t *hnext;
 	pid_t pid;
 	char *name;
+	int cls;		/* resource class, -1 if none */
+	int held;		/* holds a slot of the class */
+	time_t start;
 };
 
 struct proclist_t {
 	struct proclist_item_t *head;
+	struct proclist_item_t *tail;
+	struct proclist_item_t *hash[PROCLIST_HASH];
 };
 
 void add_to_proclist(struct proclist_t *list, struct proclist_item_t *item);
 void remove_from_proclist(struct proclist_t *list, struct proclist_item_t *item);
+struct proclist_item_t *find_in_proclist(struct proclist_t *list, pid_t pid);
 
 #endif
@@ -38,34 +38,56 @@
 #include <sys/stat.h>
 
 #include "proclist.h"
+#include "classes.h"
 #include "debug.h"
 
 // List of subprocesses to wait upon
 struct proclist_t wait_ons = { NULL };
 struct proclist_t daemons = { NULL };
 
+#define TEST_PATH_LEN 512
+#define TEST_FORK_WAIT 100
+
 static int is_leader = 0;
 static char *pidfile = "";
 
+/* An entry of a test directory waiting for its turn */
+struct pending_t {
+	char path[TEST_PATH_LEN];
+	char type;
+	int level;
+	int cls;
+	int started;
+	time_t queued_since;
+};
+
+static sigset_t orig_mask;	// what the children get back
+static int queued = 0;		// entries waiting for a class slot
+static int tick_secs = 0;	// progress log period of the leader
+static int class_timeout = 300;	// seconds a test waits for a slot
+static time_t next_tick = 0;
+
 static inline int is_executable(const char *fname);
 static inline int is_directory(const char *fname);
 static inline int test_filter(const struct dirent *p);
 static inline int test_sort(const struct dirent **a, const struct dirent **b);
 static int wait_for_pids(void);
 static void wait_for_daemons(void);
-static void note_process(pid_t pid, char *name);
-static void note_daemon(pid_t pid, char *name);
+static void wait_event(void);
+static int reap_children(void);
+static void note_process(pid_t pid, char *name, int cls, int held);
+static void note_daemon(pid_t pid, char *name, int cls, int held);
 static void kill_tests(void);
 static void kill_daemons(void);
 static int process_dir(const char *fname);
+static int run_level(struct pending_t *pend, int n, int *result);
 static pid_t spawn_test(char *fname);
-static void note_child(pid_t pid, char *fname, char type);
+static pid_t spawn_dir(char *fname);
+static void note_child(pid_t pid, char *fname, char type, int cls, int held);
 static int child_finished(const char *name, int stat);
+static const char *result_name(int stat);
 static char *progname;
 
-#define TEST_PATH_LEN 512
-#define TEST_FORK_WAIT 100
-
 /**
  * Kill everything upon ^C.
  */
@@ -75,6 +97,7 @@ static void jump_out(int signum)
 	//unlink("pounder_pgrp");
 	kill_tests();
 	kill_daemons();
+	cleanup_classes();
 	if (is_leader) {
 		unlink(pidfile);
 	}
@@ -137,6 +160,7 @@ int main(int argc, char *argv[])
 {
 	int retcode;
 	struct sigaction zig;
+	sigset_t chld;
 	pid_t pid;
 	char *c;
 
@@ -163,6 +187,24 @@ int main(int argc, char *argv[])
 	sigaction(SIGINT, &zig, NULL);
 	sigaction(SIGTERM, &zig, NULL);
 
+	/* children are reaped from the event loop, see wait_event() */
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld, &orig_mask);
+
+	init_classes(is_leader);
+	if (getenv("POUNDER_PROGRESS_INTERVAL") != NULL) {
+		tick_secs = atoi(getenv("POUNDER_PROGRESS_INTERVAL"));
+	} else {
+		tick_secs = 10;
+	}
+	if (getenv("POUNDER_CLASS_TIMEOUT") != NULL) {
+		class_timeout = atoi(getenv("POUNDER_CLASS_TIMEOUT"));
+	}
+	if (is_leader) {
+		progress_log("begin", argv[1], -1, NULL, 0, 0);
+	}
+
 	if (is_directory(argv[1])) {
 		retcode = process_dir(argv[1]);
 	} else {
@@ -178,7 +220,7 @@ int main(int argc, char *argv[])
 				goto out;
 			}
 			// Track the test
-			note_process(pid, argv[1]);
+			note_process(pid, argv[1], -1, 0);
 			if (wait_for_pids() == 0) {
 				retcode = 1;
 			} else {
@@ -195,6 +237,10 @@ int main(int argc, char *argv[])
 out:
 	kill_daemons();
 	wait_for_daemons();
+	if (is_leader) {
+		progress_log("end", argv[1], -1, retcode ? "FAIL" : "PASS", 0, 0);
+	}
+	cleanup_classes();
 	if (is_leader) {
 		if (retcode == 0) {
 			pounder_fprintf(stdout, "%s: %s.\n", argv[1], pass_msg);
@@ -298,119 +344,143 @@ static int child_finished(const char *name, int stat)
 }
 
 /**
- * Wait for some number of PIDs.  If any of them return nonzero, we
- * assume that there was some kind of failure and return 0.  Otherwise,
- * we return 1 to indicate success.
+ * Name of the result in the progress log, as child_finished() reports it.
  */
-static int wait_for_pids(void)
+static const char *result_name(int stat)
 {
-	struct proclist_item_t *curr;
-	int i, stat, res, nprocs;
-	pid_t pid;
-
-	res = 1;
+	if (WIFSIGNALED(stat)) {
+		return "FAIL";
+	} else if (WEXITSTATUS(stat) == 0) {
+		return "PASS";
+	} else if (WEXITSTATUS(stat) == 255) {
+		return "ABORT";
+	}
+	return "FAIL";
+}
 
-	// figure out how many times we have to wait...
-	curr = wait_ons.head;
-	nprocs = 0;
-	while (curr != NULL) {
-		nprocs++;
-		curr = curr->next;
+/**
+ * Sleep until a child exits or a second passes, whichever comes first.
+ * SIGCHLD is blocked, so one that came in before we got here is still
+ * pending and we return at once.  The leader also writes its periodic
+ * line to the progress log from here.
+ */
+static void wait_event(void)
+{
+	struct timespec ts = { 1, 0 };
+	sigset_t chld;
+	time_t now;
+
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	sigtimedwait(&chld, NULL, &ts);
+
+	now = time(NULL);
+	if (is_leader && tick_secs > 0 && now >= next_tick) {
+		progress_log("tick", NULL, -1, NULL, 0, queued);
+		next_tick = now + tick_secs;
 	}
+}
 
-	// now wait for children.
-	for (i = 0; i < nprocs;) {
-		pid = wait(&stat);
+/**
+ * Forget about a list of children that we can't wait for anymore.
+ */
+static void drop_proclist(struct proclist_t *list)
+{
+	struct proclist_item_t *curr;
 
-		if (pid < 0) {
-			perror("wait");
-			return 0;
+	while ((curr = list->head) != NULL) {
+		remove_from_proclist(list, curr);
+		if (curr->held) {
+			release_class(curr->cls);
 		}
+		free(curr->name);
+		free(curr);
+	}
+}
+
+/**
+ * Reap every child that has exited so far, without blocking.  Returns 0
+ * if one of the tests (not daemons) failed, 1 otherwise.
+ */
+static int reap_children(void)
+{
+	struct proclist_item_t *curr;
+	struct proclist_t *list;
+	int stat, res = 1;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &stat, WNOHANG)) > 0) {
 		// go find the child
-		curr = wait_ons.head;
-		while (curr != NULL) {
-			if (curr->pid == pid) {
-				res =
-				    (child_finished(curr->name, stat) ? 0 :
-				     res);
-
-				// one less pid to wait for
-				i++;
-
-				// stop observing
-				remove_from_proclist(&wait_ons, curr);
-				free(curr->name);
-				free(curr);
-				break;
-			}
-			curr = curr->next;
+		if ((curr = find_in_proclist(&wait_ons, pid)) != NULL) {
+			list = &wait_ons;
+			res = (child_finished(curr->name, stat) ? 0 : res);
+		} else if ((curr = find_in_proclist(&daemons, pid)) != NULL) {
+			list = &daemons;
+			child_finished(curr->name, stat);
+		} else {
+			continue;
 		}
 
-		curr = daemons.head;
-		while (curr != NULL) {
-			if (curr->pid == pid) {
-				child_finished(curr->name, stat);
-				remove_from_proclist(&daemons, curr);
-				free(curr->name);
-				free(curr);
-				break;
-			}
-			curr = curr->next;
+		// stop observing
+		if (curr->held) {
+			release_class(curr->cls);
 		}
+		progress_log("finish", curr->name, curr->cls, result_name(stat),
+			     time(NULL) - curr->start, queued);
+		remove_from_proclist(list, curr);
+		free(curr->name);
+		free(curr);
+	}
+
+	if (pid < 0 && errno == ECHILD &&
+	    (wait_ons.head != NULL || daemons.head != NULL)) {
+		perror("wait");
+		drop_proclist(&wait_ons);
+		drop_proclist(&daemons);
+		return 0;
 	}
 
 	return res;
 }
 
 /**
- * Wait for daemons to finish.  This function does NOT wait for wait_ons.
+ * Wait for the tests we started.  If any of them return nonzero, we
+ * assume that there was some kind of failure and return 0.  Otherwise,
+ * we return 1 to indicate success.
  */
-static void wait_for_daemons(void)
+static int wait_for_pids(void)
 {
-	struct proclist_item_t *curr;
-	int i, stat, res, nprocs;
-	pid_t pid;
+	int res = 1;
 
-	res = 1;
-
-	// figure out how many times we have to wait...
-	curr = daemons.head;
-	nprocs = 0;
-	while (curr != NULL) {
-		nprocs++;
-		curr = curr->next;
+	for (;;) {
+		res &= reap_children();
+		if (wait_ons.head == NULL) {
+			break;
+		}
+		wait_event();
 	}
 
-	// now wait for daemons.
-	for (i = 0; i < nprocs;) {
-		pid = wait(&stat);
-
-		if (pid < 0) {
-			perror("wait");
-			if (errno == ECHILD) {
-				return;
-			}
-		}
+	return res;
+}
 
-		curr = daemons.head;
-		while (curr != NULL) {
-			if (curr->pid == pid) {
-				child_finished(curr->name, stat);
-				i++;
-				remove_from_proclist(&daemons, curr);
-				free(curr->name);
-				free(curr);
-				break;
-			}
-			curr = curr->next;
+/**
+ * Wait for daemons to finish.  This function does NOT wait for wait_ons.
+ */
+static void wait_for_daemons(void)
+{
+	for (;;) {
+		reap_children();
+		if (daemons.head == NULL) {
+			break;
 		}
+		wait_event();
 	}
 }
 
 /**
  * Creates a record of processes that we want to watch for.
  */
-static void note_process(pid_t pid, char *name)
+static void note_process(pid_t pid, char *name, int cls, int held)
 {
 	struct proclist_item_t *it;
 
@@ -428,6 +498,9 @@ static void note_process(pid_t pid, char *name)
 		return;
 	}
 	strcpy(it->name, name);
+	it->cls = cls;
+	it->held = held;
+	it->start = time(NULL);
 
 	add_to_proclist(&wait_ons, it);
 }
@@ -435,7 +508,7 @@ static void note_process(pid_t pid, char *name)
 /**
  * Creates a record of daemons that should be killed on exit.
  */
-static void note_daemon(pid_t pid, char *name)
+static void note_daemon(pid_t pid, char *name, int cls, int held)
 {
 	struct proclist_item_t *it;
 
@@ -453,6 +526,9 @@ static void note_daemon(pid_t pid, char *name)
 		return;
 	}
 	strcpy(it->name, name);
+	it->cls = cls;
+	it->held = held;
+	it->start = time(NULL);
 
 	add_to_proclist(&daemons, it);
 }
@@ -473,6 +549,7 @@ static pid_t spawn_test(char *fname)
 		if (setpgrp() < 0) {
 			perror("setpgid");
 		}
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
 
 		pounder_fprintf(stdout, "%s: %s test.\n", fname, start_msg);
 
@@ -580,12 +657,13 @@ static pid_t spawn_test(char *fname)
  * Adds a child process to either the running-test or running-daemon
  * list.
  */
-static void note_child(pid_t pid, char *fname, char type)
+static void note_child(pid_t pid, char *fname, char type, int cls, int held)
 {
+	progress_log("start", fname, cls, NULL, 0, queued);
 	if (type == 'T') {
-		note_process(pid, fname);
+		note_process(pid, fname, cls, held);
 	} else if (type == 'D') {
-		note_daemon(pid, fname);
+		note_daemon(pid, fname, cls, held);
 	} else {
 		pounder_fprintf(stdout,
 				"Don't know what to do with child `%s' of type %c.\n",
@@ -593,13 +671,113 @@ static void note_child(pid_t pid, char *fname, char type)
 	}
 }
 
+/**
+ * Starts a copy of ourself on a subdirectory.
+ */
+static pid_t spawn_dir(char *fname)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		if (setpgrp() < 0) {
+			perror("setpgid");
+		}
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+		// spawn a new copy of ourself.
+		execl(progname, progname, fname, NULL);
+
+		perror(progname);
+		exit(-1);
+	}
+
+	return pid;
+}
+
+/**
+ * Runs one level of a directory: starts every entry of pend[0..n) that
+ * has not been started yet and gets a slot of its class, and goes on
+ * starting them as slots free up until every test has been started and
+ * has finished.  Daemons still waiting for a slot stay queued for the
+ * next levels.  A test waiting longer than $POUNDER_CLASS_TIMEOUT is
+ * started anyway, as the slots may well be held by daemons.
+ */
+static int run_level(struct pending_t *pend, int n, int *result)
+{
+	int i, held, waiting, children_ok = 1;
+	time_t now;
+	pid_t pid;
+
+	for (;;) {
+		/* free the slots of whatever woke us up before acquiring */
+		children_ok &= reap_children();
+		waiting = 0;
+		queued = 0;
+		now = time(NULL);
+		for (i = 0; i < n; i++) {
+			if (pend[i].started) {
+				continue;
+			}
+
+			held = acquire_class(pend[i].cls);
+			if (!held && pend[i].queued_since == 0) {
+				pend[i].queued_since = now;
+				progress_log("queue", pend[i].path,
+					     pend[i].cls, NULL, 0, 0);
+			}
+			if (!held && (pend[i].type == 'D' ||
+				      now - pend[i].queued_since <
+				      class_timeout)) {
+				queued++;
+				if (pend[i].type != 'D') {
+					waiting++;
+				}
+				continue;
+			}
+			if (!held) {
+				pounder_fprintf(stdout, "%s: class %s still "
+						"full after %d seconds, starting "
+						"anyway.\n", pend[i].path,
+						class_name(pend[i].cls),
+						class_timeout);
+			}
+			pend[i].started = 1;
+
+			if (is_directory(pend[i].path)) {
+				pid = spawn_dir(pend[i].path);
+			} else {
+				pid = spawn_test(pend[i].path);
+			}
+
+			if (pid < 0) {
+				perror("fork");
+				*result |= 1;
+				if (held && pend[i].cls >= 0) {
+					release_class(pend[i].cls);
+				}
+				continue;
+			}
+
+			note_child(pid, pend[i].path, pend[i].type,
+				   pend[i].cls, held && pend[i].cls >= 0);
+		}
+
+		if (waiting == 0 && wait_ons.head == NULL) {
+			break;
+		}
+		wait_event();
+	}
+
+	return children_ok;
+}
+
 /**
  * Process a directory--for each entry in a directory, execute files or spawn
  * a new copy of ourself on the new directory.  Process execution is subject to
  * these rules:
  *
  * - Test files that start with the same number '00foo' and '00bar' are allowed
- *   to run simultaneously.
+ *   to run simultaneously, as far as the limits of their classes allow.
  * - Test files are run in order of number and then name.
  *
  * If a the fork fails, bit 1 of the return code is set.  If a
@@ -608,69 +786,58 @@ static void note_child(pid_t pid, char *fname, char type)
 static int process_dir(const char *fname)
 {
 	struct dirent **namelist;
-	int i, result = 0;
-	char buf[TEST_PATH_LEN];
-	int curr_level_num = -1;
-	int test_level_num;
-	pid_t pid;
+	struct pending_t *pend;
+	int i, j, n, result = 0;
 	int children_ok = 1;
 
 	pounder_fprintf(stdout, "%s: Entering directory.\n", fname);
 
-	i = scandir(fname, &namelist, test_filter,
+	n = scandir(fname, &namelist, test_filter,
 		    (int (*)(const void *, const void *))test_sort);
-	if (i < 0) {
+	if (n < 0) {
 		perror(fname);
 		return -1;
 	}
 
-	while (i--) {
-		/* determine level number */
-		test_level_num = ((namelist[i]->d_name[1] - '0') * 10)
-		    + (namelist[i]->d_name[2] - '0');
-
-		if (curr_level_num == -1) {
-			curr_level_num = test_level_num;
-		}
-
-		if (curr_level_num != test_level_num) {
-			children_ok &= wait_for_pids();
-			curr_level_num = test_level_num;
-		}
+	pend = calloc(n + 1, sizeof(*pend));
+	if (pend == NULL) {
+		perror("malloc pending tests");
+		return -1;
+	}
 
-		snprintf(buf, TEST_PATH_LEN, "%s/%s", fname,
-			 namelist[i]->d_name);
-		if (is_directory(buf)) {
-			pid = fork();
-			if (pid == 0) {
-				if (setpgrp() < 0) {
-					perror("setpgid");
-				}
-				// spawn a new copy of ourself.
-				execl(progname, progname, buf, NULL);
+	/* namelist is sorted backwards */
+	for (i = 0; i < n; i++) {
+		struct dirent *d = namelist[n - 1 - i];
+
+		snprintf(pend[i].path, TEST_PATH_LEN, "%s/%s", fname,
+			 d->d_name);
+		pend[i].type = d->d_name[0];
+		pend[i].level = ((d->d_name[1] - '0') * 10)
+		    + (d->d_name[2] - '0');
+		pend[i].cls = (is_directory(pend[i].path) ? -1 :
+			       test_class(pend[i].path));
+		free(d);
+	}
+	free(namelist);
 
-				perror(progname);
-				exit(-1);
-			}
-		} else {
-			pid = spawn_test(buf);
-		}
+	/* one level at a time; pend[0..j) may run during level pend[i] */
+	for (i = 0; i < n; i = j) {
+		for (j = i; j < n && pend[j].level == pend[i].level; j++) ;
+		children_ok &= run_level(pend, j, &result);
+	}
 
-		if (pid < 0) {
-			perror("fork");
-			result |= 1;
-			free(namelist[i]);
-			continue;
+	for (i = 0; i < n; i++) {
+		if (!pend[i].started) {
+			pounder_fprintf(stdout, "%s: not started, class %s "
+					"stayed full.\n", pend[i].path,
+					class_name(pend[i].cls));
+			progress_log("skip", pend[i].path, pend[i].cls, NULL,
+				     0, 0);
 		}
-
-		note_child(pid, buf, namelist[i]->d_name[0]);
-
-		free(namelist[i]);
 	}
-	free(namelist);
+	free(pend);
+	queued = 0;
 
-	/* wait for remaining runners */
-	children_ok &= wait_for_pids();
 	if (children_ok == 0) {
 		result |= 2;
 	}
@@ -26,22 +26,224 @@
 #include <sys/dir.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #ifdef FLASK_LINUX
 #include <fs_secure.h>
 #endif
 
+/* Per-PID cache of open /proc files
+ *
+ * With tens of thousands of tasks, building "/proc/<pid>/stat" & co and
+ * walking them from the root on every refresh costs more than top itself.
+ * So every PID seen keeps an fd on its /proc directory plus its stat,
+ * statm and status files, which are just pread() again on the next
+ * refresh.  A dead task's fds fail with ESRCH, even when its PID got
+ * reused, and the entry is dropped.  Entries not seen by a full scan are
+ * swept in closeproc().
+ *
+ * When a task's stat line is byte for byte the same as last time, it has
+ * not run, so the proc_t of last time is reused and statm and status are
+ * not read at all -- but at least every PCACHE_REFILL scans, since some
+ * status fields (pending signals) change without the task running.
+ *
+ * The cached fds are limited to the RLIMIT_NOFILE, raised to the hard
+ * limit, less some slack; past that, readproc falls back to opening by
+ * path.
+ */
+#define PCACHE_HASH	4096
+#define PCACHE_REFILL	8
+#define PCACHE_SLACK	64
+#define PROC_DENTS_BUF	(256 * 1024)
+
+enum { PC_STAT, PC_STATM, PC_STATUS, PC_NFILES };
+static const char *pcache_names[PC_NFILES] = { "stat", "statm", "status" };
+
+struct pcache {
+	struct pcache *next;
+	pid_t pid;
+	int dirfd;
+	int fd[PC_NFILES];
+	unsigned gen;		/* last scan that saw it */
+	unsigned fill_gen;	/* last scan that read statm/status */
+	unsigned long stat_hash;
+	int stat_len;
+	int last_flags;		/* what last holds, 0 for nothing */
+	proc_t last;
+};
+
+static struct pcache *pcache_tab[PCACHE_HASH];
+static unsigned pcache_gen = 1;	/* 0 marks a new entry */
+static int pcache_fds;
+static int pcache_maxfds = -1;
+
+struct linux_dirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+static void pcache_init(void)
+{
+	struct rlimit rl;
+
+	pcache_maxfds = 0;
+	if (getrlimit(RLIMIT_NOFILE, &rl))
+		return;
+	if (rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		if (rl.rlim_cur > 1 << 20)
+			rl.rlim_cur = 1 << 20;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		getrlimit(RLIMIT_NOFILE, &rl);
+	}
+	if (rl.rlim_cur > PCACHE_SLACK)
+		pcache_maxfds = rl.rlim_cur - PCACHE_SLACK;
+}
+
+static void pcache_drop(struct pcache *c)
+{
+	struct pcache **pp = &pcache_tab[c->pid % PCACHE_HASH];
+	int i;
+
+	while (*pp != c)
+		pp = &(*pp)->next;
+	*pp = c->next;
+	for (i = 0; i < PC_NFILES; i++) {
+		if (c->fd[i] >= 0) {
+			close(c->fd[i]);
+			pcache_fds--;
+		}
+	}
+	close(c->dirfd);
+	pcache_fds--;
+	free(c);
+}
+
+/* find or create the entry of pid, NULL when out of fds */
+static struct pcache *pcache_get(pid_t pid)
+{
+	struct pcache *c;
+	char path[32];
+	int fd, i;
+
+	for (c = pcache_tab[pid % PCACHE_HASH]; c; c = c->next)
+		if (c->pid == pid)
+			return c;
+	if (unlikely(pcache_maxfds < 0))
+		pcache_init();
+	if (pcache_fds >= pcache_maxfds)
+		return NULL;
+	snprintf(path, sizeof path, "/proc/%d", pid);
+	fd = open(path, O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+		return NULL;
+	c = xcalloc(NULL, sizeof *c);
+	c->pid = pid;
+	c->dirfd = fd;
+	for (i = 0; i < PC_NFILES; i++)
+		c->fd[i] = -1;
+	pcache_fds++;
+	c->next = pcache_tab[pid % PCACHE_HASH];
+	pcache_tab[pid % PCACHE_HASH] = c;
+	return c;
+}
+
+/* read a whole /proc/<pid> file into ret, keeping it open if possible */
+static int pcache_read(struct pcache *c, int which, char *ret, int cap)
+{
+	int fd = c->fd[which];
+	int num_read;
+
+	if (fd == -1) {
+		fd = openat(c->dirfd, pcache_names[which], O_RDONLY);
+		if (unlikely(fd == -1))
+			return -1;
+		if (pcache_fds < pcache_maxfds) {
+			c->fd[which] = fd;
+			pcache_fds++;
+		}
+	}
+	num_read = pread(fd, ret, cap - 1, 0);
+	if (unlikely(num_read <= 0))
+		num_read = -1;
+	else
+		ret[num_read] = 0;
+	if (c->fd[which] != fd)
+		close(fd);
+	return num_read;
+}
+
+static void pcache_sweep(void)
+{
+	struct pcache *c, *next;
+	int i;
+
+	for (i = 0; i < PCACHE_HASH; i++) {
+		for (c = pcache_tab[i]; c; c = next) {
+			next = c->next;
+			if (c->gen != pcache_gen)
+				pcache_drop(c);
+		}
+	}
+}
+
+static unsigned long str_hash(const char *s, int len)
+{
+	unsigned long h = 5381;
+
+	while (len--)
+		h = h * 33 + *s++;
+	return h;
+}
+
+/* next numeric entry of /proc, 0 at the end */
+static pid_t next_pid(PROCTAB * PT)
+{
+	struct linux_dirent64 *d;
+	int n;
+
+	for (;;) {
+		if (PT->dents_pos >= PT->dents_len) {
+			n = syscall(SYS_getdents64, PT->procfd, PT->dents,
+				    PROC_DENTS_BUF);
+			if (n <= 0) {
+				PT->done = 1;
+				return 0;
+			}
+			PT->dents_len = n;
+			PT->dents_pos = 0;
+		}
+		d = (struct linux_dirent64 *)(PT->dents + PT->dents_pos);
+		PT->dents_pos += d->d_reclen;
+		if (likely(*d->d_name > '0') && likely(*d->d_name <= '9'))
+			return strtoul(d->d_name, NULL, 10);
+	}
+}
+
 /* initiate a process table scan
  */
 PROCTAB *openproc(int flags, ...)
 {
 	va_list ap;
-	PROCTAB *PT = xmalloc(sizeof(PROCTAB));
+	static char *dents;
+	PROCTAB *PT = xcalloc(NULL, sizeof(PROCTAB));
 
 	if (flags & PROC_PID)
-		PT->procfs = NULL;
-	else if (!(PT->procfs = opendir("/proc")))
+		PT->procfd = -1;
+	else if ((PT->procfd = open("/proc", O_RDONLY | O_DIRECTORY)) == -1) {
+		free(PT);
 		return NULL;
+	} else {
+		/* one buffer is enough, readproc isn't reentrant anyway */
+		if (!dents)
+			dents = xmalloc(PROC_DENTS_BUF);
+		PT->dents = dents;
+	}
+	pcache_gen++;
 	PT->flags = flags;
 	va_start(ap, flags);	/*  Init args list */
 	if (flags & PROC_PID)
@@ -59,8 +261,11 @@ PROCTAB *openproc(int flags, ...)
 void closeproc(PROCTAB * PT)
 {
 	if (PT) {
-		if (PT->procfs)
-			closedir(PT->procfs);
+		if (PT->procfd != -1) {
+			close(PT->procfd);
+			if (PT->done && !(PT->flags & PROC_UNCACHED))
+				pcache_sweep();
+		}
 		free(PT);
 	}
 }
@@ -256,15 +461,20 @@ static int file2str(const char *directory, const char *what, char *ret, int cap)
 	return num_read;
 }
 
-static char **file2strvec(const char *directory, const char *what)
+/* directory is only used when dirfd is -1 */
+static char **file2strvec(int dirfd, const char *directory, const char *what)
 {
 	char buf[2048];		/* read buf bytes at a time */
 	char *p, *rbuf = 0, *endbuf, **q, **ret;
 	int fd, tot = 0, n, c, end_of_file = 0;
 	int align;
 
-	sprintf(buf, "%s/%s", directory, what);
-	fd = open(buf, O_RDONLY, 0);
+	if (dirfd != -1)
+		fd = openat(dirfd, what, O_RDONLY);
+	else {
+		sprintf(buf, "%s/%s", directory, what);
+		fd = open(buf, O_RDONLY, 0);
+	}
 	if (fd == -1)
 		return NULL;
 
@@ -386,13 +596,15 @@ int read_cmdline(char *restrict const dst, unsigned sz, unsigned pid)
  */
 proc_t *readproc(PROCTAB * PT, proc_t * p)
 {
-	static struct direct *ent;	/* dirent handle */
 	static struct stat sb;	/* stat buffer */
 	static char path[32], sbuf[1024];	/* bufs for stat,statm */
 #ifdef FLASK_LINUX
 	security_id_t secsid;
 #endif
+	struct pcache *c;	/* NULL when uncached */
 	pid_t pid;		// saved until we have a proc_t allocated for sure
+	int need, len = 0, retried;
+	unsigned long hash = 0;
 
 	/* loop until a proc matching restrictions is found or no more processes */
 	/* I know this could be a while loop -- this way is easier to indent ;-) */
@@ -405,26 +617,31 @@ next_proc:			/* get next PID for consideration */
 		pid = *(PT->pids)++;
 		if (unlikely(!pid))
 			return NULL;
-		snprintf(path, sizeof path, "/proc/%d", pid);
-	} else {		/* get next numeric /proc ent */
-		for (;;) {
-			ent = readdir(PT->procfs);
-			if (unlikely(unlikely(!ent) || unlikely(!ent->d_name)))
-				return NULL;
-			if (likely
-			    (likely(*ent->d_name > '0')
-			     && likely(*ent->d_name <= '9')))
-				break;
+	} else if (unlikely(!(pid = next_pid(PT))))	/* next numeric /proc ent */
+		return NULL;
+	snprintf(path, sizeof path, "/proc/%d", pid);
+	retried = 0;
+
+retry:
+	c = NULL;
+	if (!(flags & PROC_UNCACHED))
+		c = pcache_get(pid);
+	if (c) {
+		/* always read, it tells a dead or reused PID apart */
+		len = pcache_read(c, PC_STAT, sbuf, sizeof sbuf);
+		if (unlikely(len == -1)) {
+			int stale = c->gen != 0;
+
+			pcache_drop(c);
+			if (stale && !retried++)
+				goto retry;	/* maybe the PID was reused */
+			goto next_proc;
 		}
-		pid = strtoul(ent->d_name, NULL, 10);
-		memcpy(path, "/proc/", 6);
-		strcpy(path + 6, ent->d_name);	// trust /proc to not contain evil top-level entries
-//      snprintf(path, sizeof path, "/proc/%s", ent->d_name);
 	}
 #ifdef FLASK_LINUX
 	if (stat_secure(path, &sb, &secsid) == -1)	/* no such dirent (anymore) */
 #else
-	if (unlikely(stat(path, &sb) == -1))	/* no such dirent (anymore) */
+	if (unlikely(c ? fstat(c->dirfd, &sb) == -1 : stat(path, &sb) == -1))
 #endif
 		goto next_proc;
 
@@ -434,6 +651,19 @@ next_proc:			/* get next PID for consideration */
 	if (!p)
 		p = xcalloc(p, sizeof *p);	/* passed buf or alloced mem */
 
+	need = flags & (PROC_FILLSTAT | PROC_FILLMEM | PROC_FILLSTATUS);
+	if (c) {
+		c->gen = pcache_gen;
+		hash = str_hash(sbuf, len);
+		/* the task did not run: last time's stat, statm, status */
+		if (c->last_flags && (c->last_flags & need) == need &&
+		    c->stat_len == len && c->stat_hash == hash &&
+		    pcache_gen - c->fill_gen < PCACHE_REFILL) {
+			memcpy(p, &c->last, sizeof *p);
+			goto fill_names;
+		}
+	}
+
 	p->euid = sb.st_uid;	/* need a way to get real uid */
 #ifdef FLASK_LINUX
 	p->secsid = secsid;
@@ -441,22 +671,34 @@ next_proc:			/* get next PID for consideration */
 	p->pid = pid;
 
 	if (flags & PROC_FILLSTAT) {	/* read, parse /proc/#/stat */
-		if (unlikely(file2str(path, "stat", sbuf, sizeof sbuf) == -1))
+		if (!c && unlikely(file2str(path, "stat", sbuf, sizeof sbuf) == -1))
 			goto next_proc;	/* error reading /proc/#/stat */
 		stat2proc(sbuf, p);	/* parse /proc/#/stat */
 	}
 
 	if (unlikely(flags & PROC_FILLMEM)) {	/* read, parse /proc/#/statm */
-		if (likely(file2str(path, "statm", sbuf, sizeof sbuf) != -1))
+		if (likely((c ? pcache_read(c, PC_STATM, sbuf, sizeof sbuf) :
+			    file2str(path, "statm", sbuf, sizeof sbuf)) != -1))
 			statm2proc(sbuf, p);	/* ignore statm errors here */
 	}
 	/* statm fields just zero */
 	if (flags & PROC_FILLSTATUS) {	/* read, parse /proc/#/status */
-		if (likely(file2str(path, "status", sbuf, sizeof sbuf) != -1)) {
+		if (likely((c ? pcache_read(c, PC_STATUS, sbuf, sizeof sbuf) :
+			    file2str(path, "status", sbuf, sizeof sbuf)) != -1)) {
 			status2proc(sbuf, p);
 		}
 	}
 
+	if (c) {
+		memcpy(&c->last, p, sizeof *p);
+		c->last.cmdline = c->last.environ = NULL;
+		c->last_flags = need;
+		c->fill_gen = pcache_gen;
+		c->stat_hash = hash;
+		c->stat_len = len;
+	}
+
+fill_names:
 	/* some number->text resolving which is time consuming */
 	if (flags & PROC_FILLUSR) {
 		strncpy(p->euser, user_from_uid(p->euid), sizeof p->euser);
@@ -484,12 +726,12 @@ next_proc:			/* get next PID for consideration */
 	}
 
 	if ((flags & PROC_FILLCOM) || (flags & PROC_FILLARG))	/* read+parse /proc/#/cmdline */
-		p->cmdline = file2strvec(path, "cmdline");
+		p->cmdline = file2strvec(c ? c->dirfd : -1, path, "cmdline");
 	else
 		p->cmdline = NULL;
 
 	if (unlikely(flags & PROC_FILLENV))	/* read+parse /proc/#/environ */
-		p->environ = file2strvec(path, "environ");
+		p->environ = file2strvec(c ? c->dirfd : -1, path, "environ");
 	else
 		p->environ = NULL;
 
@@ -510,7 +752,6 @@ next_proc:			/* get next PID for consideration */
  */
 proc_t *ps_readproc(PROCTAB * PT, proc_t * p)
 {
-	static struct direct *ent;	/* dirent handle */
 	static struct stat sb;	/* stat buffer */
 	static char path[32], sbuf[1024];	/* bufs for stat,statm */
 #ifdef FLASK_LINUX
@@ -525,18 +766,9 @@ next_proc:			/* get next PID for consideration */
 /*printf("PT->flags is 0x%08x\n", PT->flags);*/
 #define flags (PT->flags)
 
-	for (;;) {
-		ent = readdir(PT->procfs);
-		if (unlikely(unlikely(!ent) || unlikely(!ent->d_name)))
-			return NULL;
-		if (likely
-		    (likely(*ent->d_name > '0') && likely(*ent->d_name <= '9')))
-			break;
-	}
-	pid = strtoul(ent->d_name, NULL, 10);
-	memcpy(path, "/proc/", 6);
-	strcpy(path + 6, ent->d_name);	// trust /proc to not contain evil top-level entries
-//  snprintf(path, sizeof path, "/proc/%s", ent->d_name);
+	if (unlikely(!(pid = next_pid(PT))))
+		return NULL;
+	snprintf(path, sizeof path, "/proc/%d", pid);
 
 #ifdef FLASK_LINUX
 	if (stat_secure(path, &sb, &secsid) == -1)	/* no such dirent (anymore) */
@@ -592,12 +824,12 @@ next_proc:			/* get next PID for consideration */
 	}
 
 	if ((flags & PROC_FILLCOM) || (flags & PROC_FILLARG))	/* read+parse /proc/#/cmdline */
-		p->cmdline = file2strvec(path, "cmdline");
+		p->cmdline = file2strvec(-1, path, "cmdline");
 	else
 		p->cmdline = NULL;
 
 	if (flags & PROC_FILLENV)	/* read+parse /proc/#/environ */
-		p->environ = file2strvec(path, "environ");
+		p->environ = file2strvec(-1, path, "environ");
 	else
 		p->environ = NULL;
 
@@ -147,7 +147,11 @@ typedef struct proc_t {
 #include <dirent.h>
 #include <unistd.h>
 typedef struct PROCTAB {
-    DIR*	procfs;
+    int		procfd;	/* /proc, read with getdents64 */
+    char*	dents;	/* the getdents64 buffer ... */
+    int		dents_len;
+    int		dents_pos;	/* ... and the next entry in it */
+    int		done;	/* the whole of /proc was walked */
     int		flags;
     pid_t*	pids;	/* pids of the procs */
     uid_t*	uids;	/* uids of procs */
@@ -214,6 +218,9 @@ extern void freeproc(proc_t* p);
 #define PROC_FILLBUG    0x0fff /* No idea what we need */
 #define PROC_FILLANY    0x0000 /* either stat or status will do */
 
+/* Don't use the per-PID cache of open /proc files (see readproc.c) */
+#define PROC_UNCACHED 0x00100000
+
 /* Obsolete, consider only processes with one of the passed: */
 #define PROC_PID     0x1000  /* process id numbers ( 0   terminated) */
 #define PROC_UID     0x4000  /* user id numbers    ( length needed ) */
@@ -0,0 +1,130 @@
+/*
+ * readproc_bench - cost of one top refresh against the number of tasks
+ *
+ * Forks sleeping children until every task count of the list exists, and
+ * times full openproc()/readproc()/closeproc() scans of /proc with the
+ * fields top shows by default: once with PROC_UNCACHED (open by path on
+ * every refresh), then the first and the average of the following scans
+ * using the per-PID cache of open /proc files.
+ *
+ * usage: readproc_bench [-r refreshes] [tasks,tasks,...]
+ *
+ * May be distributed under the conditions of the
+ * GNU Library General Public License; a copy is in proc/COPYING
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "proc/readproc.h"
+
+#define BENCH_FLAGS (PROC_FILLSTAT | PROC_FILLMEM | PROC_FILLSTATUS | \
+		     PROC_FILLUSR)
+
+static pid_t *kids;
+static int nkids;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* one refresh, returns its duration in seconds and the tasks seen */
+static double refresh(int flags, int *ntasks)
+{
+	static proc_t buf;
+	PROCTAB *PT;
+	double t = now();
+
+	*ntasks = 0;
+	if (!(PT = openproc(flags))) {
+		perror("/proc");
+		exit(1);
+	}
+	while (readproc(PT, &buf))
+		(*ntasks)++;
+	closeproc(PT);
+	return now() - t;
+}
+
+static void spawn(int total)
+{
+	pid_t pid;
+
+	kids = realloc(kids, total * sizeof(*kids));
+	while (nkids < total) {
+		pid = fork();
+		if (pid == -1) {
+			perror("fork");
+			break;
+		}
+		if (pid == 0) {
+			for (;;)
+				pause();
+		}
+		kids[nkids++] = pid;
+	}
+}
+
+static void reap(void)
+{
+	int i;
+
+	for (i = 0; i < nkids; i++)
+		kill(kids[i], SIGKILL);
+	while (wait(NULL) > 0) ;
+}
+
+int main(int argc, char *argv[])
+{
+	char *list = "100,1000,10000";
+	int refreshes = 10;
+	double uncached, cold, warm;
+	char *p;
+	int c, i, n;
+
+	while ((c = getopt(argc, argv, "r:")) != -1) {
+		switch (c) {
+		case 'r':
+			refreshes = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-r refreshes] "
+				"[tasks,tasks,...]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		list = argv[optind];
+	if (refreshes < 1)
+		refreshes = 1;
+
+	printf("%8s %14s %14s %14s %8s\n", "tasks", "uncached ms",
+	       "cached 1st ms", "cached ms", "speedup");
+	for (p = strtok(list, ","); p; p = strtok(NULL, ",")) {
+		spawn(atoi(p));
+
+		uncached = 0;
+		for (i = 0; i < refreshes; i++)
+			uncached += refresh(BENCH_FLAGS | PROC_UNCACHED, &n);
+		uncached /= refreshes;
+		/* opens the files of the tasks new since the last count */
+		cold = refresh(BENCH_FLAGS, &n);
+		warm = 0;
+		for (i = 0; i < refreshes; i++)
+			warm += refresh(BENCH_FLAGS, &n);
+		warm /= refreshes;
+
+		printf("%8d %14.2f %14.2f %14.2f %7.1fx\n", n,
+		       uncached * 1000, cold * 1000, warm * 1000,
+		       uncached / warm);
+	}
+	reap();
+	return 0;
+}